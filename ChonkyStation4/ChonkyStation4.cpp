@@ -1,7 +1,16 @@
 ﻿#include <Common.hpp>
 #include <PlayStation4.hpp>
 #include <Configuration.hpp>
+#include <Profiler.hpp>
 #include <OS/UserManagement.hpp>
+#include <OS/Memory.hpp>
+#include <OS/TimersBenchmark.hpp>
+#include <OS/SceObjBenchmark.hpp>
+#include <OS/Libraries/SceZlib/InflateBenchmark.hpp>
+#include <GCN/Shader/DecoderBenchmark.hpp>
+#include <GCN/DetilerBenchmark.hpp>
+#include <GCN/Backends/Vulkan/FaultBenchmark.hpp>
+#include <GCN/Trace.hpp>
 
 #ifdef _WIN32
 #define NOMINMAX
@@ -13,12 +22,9 @@
 
 int main(int argc, char** argv) {
     // Try to reserve some address space as early as possible
-#ifdef _WIN32
-    void* ret = VirtualAlloc((void*)0x0'8000'0000, 2048_GB, MEM_RESERVE, PAGE_NOACCESS);
-    if (!ret) {
+    if (!PS4::OS::Memory::reserveAddressSpace()) {
         printf("Warning: failed to reserve address space\n");
     }
-#endif
     
     std::string file;
     int uid = 1;
@@ -42,9 +48,65 @@ int main(int argc, char** argv) {
     run_cmd->add_option("--disable-gnmdetiler-texture-size", PS4::Configuration::disable_gnmdetiler_texture_size, "Texture size calculation hack");
     run_cmd->add_option("--disable-sgpr-init-hack", PS4::Configuration::disable_sgpr_init_hack, "Disable SGPR init hack");
     run_cmd->add_option("--clamp-gpu-buffers", PS4::Configuration::clamp_gpu_buffers, "Clamp GPU buffer size to fit in mapped memory");
+    run_cmd->add_option("--async-pipelines", PS4::Configuration::async_pipeline_compilation, "Skip draws while their pipeline is compiling instead of stalling");
+    run_cmd->add_option("--gpu-detile", PS4::Configuration::gpu_detile_tile_modes, "Comma separated list of tile modes to detile on the GPU")->delimiter(',');
+    run_cmd->add_option("--gpu-detile-validate", PS4::Configuration::gpu_detile_validate, "Compare the output of the GPU detiler with the CPU detiler (slow)");
+    run_cmd->add_option("--log-channels", PS4::Configuration::log_channels, "Comma separated list of log channels or groups to print, all if not specified")->delimiter(',');
+    run_cmd->add_option("--log-rate-limit", PS4::Configuration::log_rate_limit, "Max messages per second from each log call site, 0 for no limit");
+    run_cmd->add_option("--profile", PS4::Configuration::profile_capture_path, "Capture a profile of the emulator to a Chrome trace file");
+    run_cmd->add_option("--profile-frames", PS4::Configuration::profile_capture_frames, "Number of frames to profile for, 0 profiles until exit");
+    run_cmd->add_option("--renderer-stats", PS4::Configuration::renderer_stats_interval, "Print the buffer and pipeline cache statistics every this many frames, 0 to disable");
+    run_cmd->add_option("--submit-stats", PS4::Configuration::submit_stats_interval, "Print the cost of GPU submissions every this many frames, 0 to disable");
+    run_cmd->add_option("--record-gcn-trace", PS4::Configuration::gcn_trace_path, "Record the GPU command stream to a trace file");
+    run_cmd->add_option("--mmap-app0", PS4::Configuration::mmap_app0_files, "Read game files through memory mappings instead of read calls");
+    run_cmd->add_option("--audio", PS4::Configuration::audio_sink, "Audio output: sdl, null, or the path of a .wav file to record to");
 
     auto* get_appdata_path_cmd = cli_app.add_subcommand("get_appdata_path", "Print the path to the emulator's app data folder");
 
+    auto* bench_decoder_cmd = cli_app.add_subcommand("bench_decoder", "Measure the shader decoder's throughput on a folder of dumped shaders");
+    std::string bench_decoder_dir;
+    int bench_decoder_iterations = 100;
+    bench_decoder_cmd->add_option("dir", bench_decoder_dir, "Folder containing the .bin shader dumps")->required();
+    bench_decoder_cmd->add_option("-i, --iterations", bench_decoder_iterations, "How many times to decode every shader");
+
+    auto* bench_detiler_cmd = cli_app.add_subcommand("bench_detiler", "Compare the detiler's fast path with the generic path in every tile mode");
+    u32 bench_detiler_width = 1024;
+    u32 bench_detiler_height = 1024;
+    int bench_detiler_iterations = 10;
+    bench_detiler_cmd->add_option("-W, --width", bench_detiler_width, "Width of the texture");
+    bench_detiler_cmd->add_option("-H, --height", bench_detiler_height, "Height of the texture");
+    bench_detiler_cmd->add_option("-i, --iterations", bench_detiler_iterations, "How many times to detile the texture with each path");
+
+    auto* bench_faults_cmd = cli_app.add_subcommand("bench_faults", "Measure the cost of the write faults used to track GPU memory");
+    int bench_faults_pages = 4096;
+    int bench_faults_iterations = 10;
+    bench_faults_cmd->add_option("-n, --pages", bench_faults_pages, "How many pages to track");
+    bench_faults_cmd->add_option("-i, --iterations", bench_faults_iterations, "How many times to protect and write every page");
+
+    auto* bench_timers_cmd = cli_app.add_subcommand("bench_timers", "Measure how accurately the timer service fires timers");
+    int bench_timers_count = 10000;
+    int bench_timers_load_threads = 0;
+    bench_timers_cmd->add_option("-n, --timers", bench_timers_count, "How many timers to arm");
+    bench_timers_cmd->add_option("-l, --load-threads", bench_timers_load_threads, "How many threads to keep busy while the timers are pending");
+
+    auto* bench_handles_cmd = cli_app.add_subcommand("bench_handles", "Measure the cost of allocating, looking up and freeing kernel object handles");
+    int bench_handles_count = 10000;
+    int bench_handles_iterations = 10;
+    int bench_handles_threads = 4;
+    bench_handles_cmd->add_option("-n, --objects", bench_handles_count, "How many handles to allocate at once");
+    bench_handles_cmd->add_option("-i, --iterations", bench_handles_iterations, "How many times to allocate and free every handle");
+    bench_handles_cmd->add_option("-t, --threads", bench_handles_threads, "How many threads to run the lookups on");
+
+    auto* bench_inflate_cmd = cli_app.add_subcommand("bench_inflate", "Measure the zlib inflate service's throughput on 64kb chunks of a file or folder");
+    std::string bench_inflate_path;
+    int bench_inflate_iterations = 10;
+    bench_inflate_cmd->add_option("path", bench_inflate_path, "File or folder to split into chunks")->required();
+    bench_inflate_cmd->add_option("-i, --iterations", bench_inflate_iterations, "How many times to inflate every chunk");
+
+    auto* replay_gcn_trace_cmd = cli_app.add_subcommand("replay_gcn_trace", "Replay a GPU command stream trace and measure how long it takes");
+    std::string replay_gcn_trace_file;
+    replay_gcn_trace_cmd->add_option("trace", replay_gcn_trace_file, "Path to the trace recorded with --record-gcn-trace")->required();
+
     auto* user_cmd      = cli_app.add_subcommand("user", "Manage user accounts");
     auto* user_add_cmd  = user_cmd->add_subcommand("add");
 
@@ -60,6 +122,42 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    if (bench_decoder_cmd->parsed()) {
+        PS4::GCN::Shader::benchmarkDecoder(bench_decoder_dir, bench_decoder_iterations);
+        return 0;
+    }
+
+    if (bench_detiler_cmd->parsed()) {
+        PS4::GCN::benchmarkDetiler(bench_detiler_width, bench_detiler_height, bench_detiler_iterations);
+        return 0;
+    }
+
+    if (bench_faults_cmd->parsed()) {
+        PS4::GCN::Vulkan::Cache::benchmarkFaults(bench_faults_pages, bench_faults_iterations);
+        return 0;
+    }
+
+    if (bench_timers_cmd->parsed()) {
+        PS4::OS::Timers::benchmarkTimers(bench_timers_count, bench_timers_load_threads);
+        return 0;
+    }
+
+    if (bench_handles_cmd->parsed()) {
+        PS4::OS::benchmarkHandles(bench_handles_count, bench_handles_iterations, bench_handles_threads);
+        return 0;
+    }
+
+    if (bench_inflate_cmd->parsed()) {
+        PS4::OS::Libs::SceZlib::benchmarkInflate(bench_inflate_path, bench_inflate_iterations);
+        return 0;
+    }
+
+    if (replay_gcn_trace_cmd->parsed()) {
+        if (!PS4::GCN::Trace::replay(replay_gcn_trace_file))
+            Helpers::panic("Failed to replay %s\n", replay_gcn_trace_file.c_str());
+        return 0;
+    }
+
     if (user_add_cmd->parsed()) {
         if (user_add_username.empty()) {
             Helpers::panic("No username specified\n");  // unreachable (name is required)
@@ -85,6 +183,12 @@ int main(int argc, char** argv) {
     PS4::Configuration::system_ex_dir_path = system_ex_path;
     PS4::Configuration::sysmodules_path = sysmodules_path;
 
+    if (!PS4::Configuration::profile_capture_path.empty()) {
+        Profiler::setThreadName("[Emu] Main");
+        Profiler::startCapture(PS4::Configuration::profile_capture_path);
+        std::atexit(Profiler::stopCapture);
+    }
+
     fs::path file_path = file;
     PS4::loadAndRun(file);
     return 0;
@@ -76,12 +76,16 @@ struct SceKernelTimesec {
 
 namespace Helpers {
 
+// Called before exiting on a fatal error. The logger uses it to print messages that are still queued.
+inline void (*on_fatal_error)() = nullptr;
+
 template <class... Args>
 [[noreturn]] static void panic(const char* fmt, Args&&... args) {
     std::string error;
     error.resize(512_KB);
     std::sprintf(error.data(), fmt, args...);
     //throw std::runtime_error(error);
+    if (on_fatal_error) on_fatal_error();
     std::printf("FATAL: ");
     std::printf(error.c_str());
     std::putc('\n', stdout);
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <Common.hpp>
+#include <map>
+#include <algorithm>
+#include <type_traits>
+
+
+namespace Helpers {
+
+// Maps half-open [start, end) ranges to values.
+// Every range is stored once regardless of its length, so insertion and removal are O(log n).
+// If disjoint is true the caller guarantees ranges never overlap. Ranges are kept in a std::multimap and overlap queries are O(log n + k).
+// Otherwise ranges may overlap, and are kept in a treap ordered by start where every node also stores the largest end in its subtree.
+// Overlap queries skip every subtree that ends before the query, so they are O((k + 1) log n) no matter how long the ranges are.
+template <typename K, typename V, bool disjoint = false>
+class IntervalMap {
+public:
+    struct Range {
+        K start;
+        K end;
+        V value;
+    };
+
+    IntervalMap() = default;
+    IntervalMap(const IntervalMap&) = delete;
+    IntervalMap& operator=(const IntervalMap&) = delete;
+    ~IntervalMap() { clear(); }
+
+    void insert(K start, K end, V value) {
+        if constexpr (disjoint) ranges.emplace(start, Range { start, end, value });
+        else root = insertNode(root, new Node { Range { start, end, value }, end, nextPriority() });
+        count++;
+    }
+
+    // Removes the range starting at start which maps to value. Returns false if it doesn't exist.
+    bool erase(K start, const V& value) {
+        bool erased = false;
+        if constexpr (disjoint) {
+            auto [begin, end] = ranges.equal_range(start);
+            for (auto it = begin; it != end; it++) {
+                if (it->second.value == value) {
+                    ranges.erase(it);
+                    erased = true;
+                    break;
+                }
+            }
+        }
+        else root = eraseNode(root, start, value, erased);
+
+        if (erased) count--;
+        return erased;
+    }
+
+    // Changes the end of the range starting at start which maps to value. Returns false if it doesn't exist.
+    bool resize(K start, const V& value, K new_end) {
+        if constexpr (disjoint) {
+            auto [begin, end] = ranges.equal_range(start);
+            for (auto it = begin; it != end; it++) {
+                if (it->second.value == value) {
+                    it->second.end = new_end;
+                    return true;
+                }
+            }
+            return false;
+        }
+        else return resizeNode(root, start, value, new_end);
+    }
+
+    // Calls func(const Range&) for every range overlapping [start, end), in ascending start order.
+    // func can return false to stop the iteration early.
+    template <typename F>
+    void forEachOverlapping(K start, K end, F&& func) const {
+        auto call = [&](const Range& range) -> bool {
+            if constexpr (std::is_same_v<std::invoke_result_t<F, const Range&>, bool>) return func(range);
+            else {
+                func(range);
+                return true;
+            }
+        };
+
+        if constexpr (disjoint) {
+            // Only the last range starting at or before start can contain it
+            auto it = ranges.upper_bound(start);
+            if (it != ranges.begin() && std::prev(it)->second.end > start)
+                it = std::prev(it);
+
+            for (; it != ranges.end() && it->first < end; it++) {
+                if (it->second.end <= start) continue;
+                if (!call(it->second)) return;
+            }
+        }
+        else visitOverlapping(root, start, end, call);
+    }
+
+    // Returns a pointer to the value of the first range containing key, or nullptr.
+    V* findContaining(K key) {
+        V* res = nullptr;
+        forEachOverlapping(key, key + 1, [&](const Range& range) {
+            res = const_cast<V*>(&range.value);
+            return false;
+        });
+        return res;
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    void clear() {
+        if constexpr (disjoint) ranges.clear();
+        else {
+            freeNode(root);
+            root = nullptr;
+        }
+        count = 0;
+    }
+
+private:
+    struct Node {
+        Range range;
+        K max_end;              // Largest end of the ranges in this subtree
+        u32 priority;
+        Node* left = nullptr;   // Ranges starting before this one, or at the same address and inserted earlier
+        Node* right = nullptr;  // Ranges starting after this one, or at the same address and inserted later
+    };
+
+    std::multimap<K, Range> ranges;     // Only used if disjoint
+    Node* root = nullptr;               // Only used if not disjoint
+    size_t count = 0;
+    u32 rng_state = 0x9e3779b9;
+
+    u32 nextPriority() {
+        // xorshift32, the priorities only have to be well spread for the treap to stay balanced
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+    }
+
+    static void update(Node* node) {
+        node->max_end = node->range.end;
+        if (node->left)  node->max_end = std::max(node->max_end, node->left->max_end);
+        if (node->right) node->max_end = std::max(node->max_end, node->right->max_end);
+    }
+
+    // Splits the tree in the nodes starting at or before key and the ones starting after it
+    static void split(Node* node, K key, Node*& left, Node*& right) {
+        if (!node) {
+            left = right = nullptr;
+            return;
+        }
+
+        if (node->range.start <= key) {
+            split(node->right, key, node->right, right);
+            left = node;
+        }
+        else {
+            split(node->left, key, left, node->left);
+            right = node;
+        }
+        update(node);
+    }
+
+    // Every range in left comes before every range in right
+    static Node* merge(Node* left, Node* right) {
+        if (!left)  return right;
+        if (!right) return left;
+
+        if (left->priority > right->priority) {
+            left->right = merge(left->right, right);
+            update(left);
+            return left;
+        }
+        else {
+            right->left = merge(left, right->left);
+            update(right);
+            return right;
+        }
+    }
+
+    static Node* insertNode(Node* node, Node* new_node) {
+        if (!node) return new_node;
+
+        if (new_node->priority > node->priority) {
+            split(node, new_node->range.start, new_node->left, new_node->right);
+            update(new_node);
+            return new_node;
+        }
+
+        // Ranges with the same start go right, so they stay in insertion order like in a std::multimap
+        if (new_node->range.start < node->range.start)
+            node->left = insertNode(node->left, new_node);
+        else
+            node->right = insertNode(node->right, new_node);
+        update(node);
+        return node;
+    }
+
+    static Node* eraseNode(Node* node, K start, const V& value, bool& erased) {
+        if (!node) return nullptr;
+
+        if (start == node->range.start && node->range.value == value) {
+            Node* res = merge(node->left, node->right);
+            delete node;
+            erased = true;
+            return res;
+        }
+
+        // Ranges with the same start can be on both sides
+        if (start <= node->range.start)
+            node->left = eraseNode(node->left, start, value, erased);
+        if (!erased && start >= node->range.start)
+            node->right = eraseNode(node->right, start, value, erased);
+
+        update(node);
+        return node;
+    }
+
+    static bool resizeNode(Node* node, K start, const V& value, K new_end) {
+        if (!node) return false;
+
+        bool found = false;
+        if (start == node->range.start && node->range.value == value) {
+            node->range.end = new_end;
+            found = true;
+        }
+
+        // Ranges with the same start can be on both sides
+        if (!found && start <= node->range.start)
+            found = resizeNode(node->left, start, value, new_end);
+        if (!found && start >= node->range.start)
+            found = resizeNode(node->right, start, value, new_end);
+
+        if (found) update(node);
+        return found;
+    }
+
+    // In order traversal that skips subtrees ending before start. Returns false if func stopped the iteration.
+    template <typename F>
+    static bool visitOverlapping(const Node* node, K start, K end, F& func) {
+        if (!node || node->max_end <= start) return true;
+
+        if (!visitOverlapping(node->left, start, end, func)) return false;
+        // Everything from here on starts at or after end
+        if (node->range.start >= end) return false;
+        if (node->range.end > start && !func(node->range)) return false;
+        return visitOverlapping(node->right, start, end, func);
+    }
+
+    static void freeNode(Node* node) {
+        if (!node) return;
+        freeNode(node->left);
+        freeNode(node->right);
+        delete node;
+    }
+};
+
+}   // End namespace Helpers
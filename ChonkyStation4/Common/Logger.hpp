@@ -1,7 +1,17 @@
 #pragma once
+
+#include <Common.hpp>
+#include <Configuration.hpp>
 #include <cstdarg>
 #include <fstream>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
@@ -11,7 +21,460 @@
 
 namespace Log {
 
-inline std::mutex logger_mtx;
+// Messages aren't formatted on the thread that logs them.
+// Each thread pushes the format string pointer and a copy of the arguments to its own queue, and a writer thread formats and prints them.
+// Logging never takes a lock shared with other threads, so it doesn't serialize guest threads.
+// Format strings must be string literals, only the pointer is stored. String arguments are copied.
+namespace Async {
+
+static constexpr size_t QUEUE_SIZE = 256_KB;    // Per thread. If a queue is full, the thread waits for the writer to catch up.
+static constexpr size_t MAX_STRING = 4_KB;      // Longer string arguments are truncated
+static constexpr u32 PADDING = 0xffffffff;      // Marks the end of the queue as unused, the next record is at the start
+
+enum class ArgType : u32 {
+    Int,
+    Double,
+    Ptr,
+    String,
+    Unknown
+};
+
+struct RecordHeader {
+    u32 size;               // Size of the record including the header, always a multiple of 8
+    u32 n_args;
+    u64 seq;                // Used to print the messages of all threads in order
+    const char* fmt;
+    const char* prefix;     // nullptr for messages without a prefix
+};
+
+// Followed by 8 bytes of value, or len bytes of string (including the null terminator) aligned up to 8
+struct ArgHeader {
+    ArgType type;
+    u32 len;
+};
+
+// Rate limiting state of a call site, identified by its format string
+struct CallSite {
+    u32 count = 0;
+    u32 suppressed = 0;
+    const char* prefix = nullptr;
+};
+
+struct ThreadQueue {
+    std::unique_ptr<u8[]> data = std::make_unique<u8[]>(QUEUE_SIZE);
+    std::atomic<u64> head = 0;  // Only written by the owning thread
+    std::atomic<u64> tail = 0;  // Only written by the writer thread
+    std::atomic<bool> exited = false;
+    std::string thread_name;
+    std::unordered_map<const char*, CallSite> call_sites;   // Only used by the owning thread
+    u64 window = 0;                                         // Last second in which the owning thread logged
+};
+
+inline std::atomic<u64> next_seq = 0;
+inline std::mutex queues_mtx;
+inline std::vector<std::shared_ptr<ThreadQueue>> queues;
+inline std::mutex drain_mtx;
+inline std::once_flag writer_started;
+inline std::thread writer_thread;
+inline std::atomic<bool> writer_stop = false;
+
+void flush();
+
+inline constexpr u32 align8(size_t size) {
+    return (size + 7) & ~7;
+}
+
+inline const char* argString(const char* str) {
+    return str ? str : "(null)";
+}
+
+template <typename T>
+concept HasValue = requires(const T& t) { t.Value(); };
+
+template <typename T>
+inline constexpr bool isString = std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, const char*>;
+
+template <typename T>
+inline u32 argSize(const T& arg) {
+    if constexpr (isString<T>)
+        return sizeof(ArgHeader) + align8(std::min(std::strlen(argString(arg)), MAX_STRING) + 1);
+    else if constexpr (HasValue<T>)
+        return argSize(arg.Value());
+    else
+        return sizeof(ArgHeader) + sizeof(u64);
+}
+
+template <typename T>
+inline u8* writeArg(u8* out, const T& arg) {
+    using D = std::decay_t<T>;
+    ArgHeader header = { ArgType::Unknown, 0 };
+    u64 value = 0;
+
+    if constexpr (isString<T>) {
+        const char* str = argString(arg);
+        header = { ArgType::String, (u32)std::min(std::strlen(str), MAX_STRING) + 1 };
+        std::memcpy(out, &header, sizeof(header));
+        std::memcpy(out + sizeof(header), str, header.len - 1);
+        out[sizeof(header) + header.len - 1] = '\0';
+        return out + sizeof(header) + align8(header.len);
+    }
+    else if constexpr (HasValue<T>) {
+        return writeArg(out, arg.Value());
+    }
+    else {
+        if constexpr (std::is_floating_point_v<D>) {
+            const double d = arg;
+            header.type = ArgType::Double;
+            std::memcpy(&value, &d, sizeof(double));
+        }
+        else if constexpr (std::is_pointer_v<D> || std::is_null_pointer_v<D>) {
+            header.type = ArgType::Ptr;
+            value = (u64)(uptr)arg;
+        }
+        else if constexpr (std::is_enum_v<D>) {
+            header.type = ArgType::Int;
+            value = (u64)(s64)(std::underlying_type_t<D>)arg;
+        }
+        else if constexpr (std::is_integral_v<D>) {
+            header.type = ArgType::Int;
+            value = std::is_signed_v<D> ? (u64)(s64)arg : (u64)arg;
+        }
+        else if constexpr (std::is_trivially_copyable_v<D> && sizeof(D) <= sizeof(u64)) {
+            // Same as what would have been passed through varargs
+            header.type = ArgType::Int;
+            std::memcpy(&value, &arg, sizeof(D));
+        }
+
+        std::memcpy(out, &header, sizeof(header));
+        std::memcpy(out + sizeof(header), &value, sizeof(value));
+        return out + sizeof(header) + sizeof(value);
+    }
+}
+
+inline ThreadQueue& thisThreadQueue();
+
+// Reserves space for a record in the calling thread's queue. Returns nullptr if the queue is full.
+inline u8* reserve(ThreadQueue& queue, u32 size) {
+    const u64 head = queue.head.load(std::memory_order_relaxed);
+    const u64 tail = queue.tail.load(std::memory_order_acquire);
+    const size_t pos = head % QUEUE_SIZE;
+    const size_t padding = pos + size > QUEUE_SIZE ? QUEUE_SIZE - pos : 0;
+    if (size + padding > QUEUE_SIZE - (head - tail)) return nullptr;
+
+    if (padding) {
+        std::memcpy(&queue.data[pos], &PADDING, sizeof(u32));
+        return &queue.data[0];
+    }
+    return &queue.data[pos];
+}
+
+inline void commit(ThreadQueue& queue, u8* record, u32 size) {
+    const u64 head = queue.head.load(std::memory_order_relaxed);
+    const size_t pos = head % QUEUE_SIZE;
+    const size_t padding = record == &queue.data[pos] ? 0 : QUEUE_SIZE - pos;
+    queue.head.store(head + padding + size, std::memory_order_release);
+}
+
+template <typename... Args>
+inline void pushRecord(ThreadQueue& queue, const char* prefix, const char* fmt, const Args&... args) {
+    const u32 size = sizeof(RecordHeader) + (0 + ... + argSize(args));
+    u8* record;
+    while (!(record = reserve(queue, size)))
+        std::this_thread::yield();
+
+    const RecordHeader header = { size, (u32)sizeof...(Args), next_seq.fetch_add(1, std::memory_order_relaxed), fmt, prefix };
+    std::memcpy(record, &header, sizeof(header));
+    u8* out = record + sizeof(header);
+    ((out = writeArg(out, args)), ...);
+    commit(queue, record, size);
+}
+
+template <typename... Args>
+inline void push(const char* prefix, const char* fmt, const Args&... args) {
+    auto& queue = thisThreadQueue();
+
+    // Per call site rate limiting, to keep a message spammed in a loop from filling the queue
+    if (const u32 limit = PS4::Configuration::log_rate_limit) {
+        const u64 window = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (queue.window != window) {
+            // Report what was dropped in earlier seconds, also for call sites that didn't log again since
+            for (auto& [site_fmt, site] : queue.call_sites) {
+                if (site.suppressed)
+                    pushRecord(queue, site.prefix, "Suppressed %u messages like: %s", site.suppressed, site_fmt);
+                site = {};
+            }
+            queue.window = window;
+        }
+        auto& site = queue.call_sites[fmt];
+        if (++site.count > limit) {
+            site.prefix = prefix;
+            if (!site.suppressed++)
+                pushRecord(queue, prefix, "(more than %u messages per second from this call site, suppressing it until the next second)\n", limit);
+            return;
+        }
+    }
+
+    pushRecord(queue, prefix, fmt, args...);
+}
+
+// Formats a record into out. Every conversion is printed separately with the argument type the format expects.
+inline void format(std::string& out, const RecordHeader& header, const u8* args) {
+    const u8* args_end = (const u8*)&header + header.size;
+    char buf[512];
+    char spec[32];
+
+    auto next_arg = [&](ArgType& type, u64& value, const char*& str) -> bool {
+        if (args >= args_end) return false;
+        ArgHeader arg;
+        std::memcpy(&arg, args, sizeof(arg));
+        args += sizeof(arg);
+        type = arg.type;
+        if (type == ArgType::String) {
+            str = (const char*)args;
+            args += align8(arg.len);
+        }
+        else {
+            std::memcpy(&value, args, sizeof(value));
+            args += sizeof(value);
+        }
+        return true;
+    };
+
+    for (const char* p = header.fmt; *p; p++) {
+        if (*p != '%') {
+            out += *p;
+            continue;
+        }
+
+        const char* spec_start = p++;
+        if (*p == '%') {
+            out += '%';
+            continue;
+        }
+
+        // Flags, width and precision are copied to the spec, '*' is replaced by the value of its argument
+        std::string flags;
+        while (*p && std::strchr("-+ #0123456789.*", *p)) {
+            if (*p == '*') {
+                ArgType type; u64 value = 0; const char* str;
+                next_arg(type, value, str);
+                flags += std::to_string((s32)value);
+            }
+            else flags += *p;
+            p++;
+        }
+
+        bool is_long = false;
+        while (*p && std::strchr("hlLzjtq", *p)) {
+            if (*p != 'h') is_long = true;
+            p++;
+        }
+
+        const char conv = *p;
+        if (!conv) break;
+
+        ArgType type = ArgType::Unknown;
+        u64 value = 0;
+        const char* str = nullptr;
+        if (!next_arg(type, value, str)) {
+            // Missing argument, print the conversion as is
+            out.append(spec_start, p + 1);
+            continue;
+        }
+
+        double d;
+        std::memcpy(&d, &value, sizeof(double));
+        int len = 0;
+        switch (conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c': {
+            if (type == ArgType::Double) value = (u64)(s64)d;
+            if (is_long && conv != 'c') {
+                std::snprintf(spec, sizeof(spec), "%%%sll%c", flags.c_str(), conv);
+                len = std::snprintf(buf, sizeof(buf), spec, (unsigned long long)value);
+            }
+            else {
+                std::snprintf(spec, sizeof(spec), "%%%s%c", flags.c_str(), conv);
+                len = std::snprintf(buf, sizeof(buf), spec, (unsigned int)value);
+            }
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            if (type != ArgType::Double) d = (double)(s64)value;
+            std::snprintf(spec, sizeof(spec), "%%%s%c", flags.c_str(), conv);
+            len = std::snprintf(buf, sizeof(buf), spec, d);
+            break;
+        }
+        case 's': {
+            if (type != ArgType::String) str = type == ArgType::Unknown ? "(?)" : "(not a string)";
+            // Strings can be longer than buf
+            std::snprintf(spec, sizeof(spec), "%%%ss", flags.c_str());
+            if (flags.empty()) out += str;
+            else len = std::snprintf(buf, sizeof(buf), spec, str);
+            break;
+        }
+        case 'p': {
+            std::snprintf(spec, sizeof(spec), "%%%sp", flags.c_str());
+            len = std::snprintf(buf, sizeof(buf), spec, (void*)(uptr)value);
+            break;
+        }
+        case 'n': break;
+        default: out.append(spec_start, p + 1); break;
+        }
+
+        if (len > 0) out.append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+    }
+}
+
+// Prints every message that's currently queued. Returns false if there was nothing to print.
+inline bool drain() {
+    const auto lk = std::unique_lock<std::mutex>(drain_mtx);
+
+    struct Pending {
+        u64 seq;
+        ThreadQueue* queue;
+        const RecordHeader* header;
+    };
+    std::vector<Pending> pending;
+    std::vector<std::pair<std::shared_ptr<ThreadQueue>, u64>> snapshot;
+    {
+        const auto queues_lk = std::unique_lock<std::mutex>(queues_mtx);
+        for (auto& queue : queues)
+            snapshot.push_back({ queue, queue->head.load(std::memory_order_acquire) });
+    }
+
+    std::string out;
+    for (auto& [queue, head] : snapshot) {
+        u64 tail = queue->tail.load(std::memory_order_relaxed);
+        while (tail < head) {
+            const size_t pos = tail % QUEUE_SIZE;
+            u32 size;
+            std::memcpy(&size, &queue->data[pos], sizeof(u32));
+            if (size == PADDING) {
+                tail += QUEUE_SIZE - pos;
+                continue;
+            }
+
+            const auto* header = (const RecordHeader*)&queue->data[pos];
+            pending.push_back({ header->seq, queue.get(), header });
+            tail += size;
+        }
+    }
+
+    std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) { return a.seq < b.seq; });
+    for (auto& msg : pending) {
+        if (msg.header->prefix) {
+            out += msg.header->prefix;
+            if (!msg.queue->thread_name.empty())
+                out += "(" + msg.queue->thread_name + ") ";
+        }
+        format(out, *msg.header, (const u8*)msg.header + sizeof(RecordHeader));
+    }
+
+    // Done with the records, give the space back to the threads
+    for (auto& [queue, head] : snapshot)
+        queue->tail.store(head, std::memory_order_release);
+
+    {
+        // Forget queues of threads that exited once they're empty
+        const auto queues_lk = std::unique_lock<std::mutex>(queues_mtx);
+        std::erase_if(queues, [](const std::shared_ptr<ThreadQueue>& queue) {
+            return queue->exited && queue->tail == queue->head;
+        });
+    }
+
+    if (out.empty()) return false;
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    return true;
+}
+
+// Prints every message that's currently queued
+inline void flush() {
+    drain();
+    std::fflush(stdout);
+}
+
+inline void shutdown() {
+    writer_stop = true;
+    if (writer_thread.joinable())
+        writer_thread.join();
+    flush();
+}
+
+inline void startWriter() {
+    writer_thread = std::thread([]() {
+#ifdef _WIN32
+        SetThreadDescription(GetCurrentThread(), L"[Emu] Log writer");
+#endif
+        while (!writer_stop) {
+            if (!drain())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::atexit(shutdown);
+    Helpers::on_fatal_error = flush;
+}
+
+inline ThreadQueue& thisThreadQueue() {
+    // Marks the queue as exited when the thread exits, the writer frees it once it printed the last messages
+    struct Owner {
+        std::shared_ptr<ThreadQueue> queue;
+        ~Owner() { queue->exited = true; }
+    };
+
+    thread_local Owner owner = []() {
+        std::call_once(writer_started, startWriter);
+
+        auto queue = std::make_shared<ThreadQueue>();
+#ifdef _WIN32
+        PWSTR name;
+        if (SUCCEEDED(GetThreadDescription(GetCurrentThread(), &name))) {
+            const int len = WideCharToMultiByte(CP_UTF8, 0, name, -1, nullptr, 0, nullptr, nullptr);
+            if (len > 1) {
+                queue->thread_name.resize(len - 1);
+                WideCharToMultiByte(CP_UTF8, 0, name, -1, queue->thread_name.data(), len, nullptr, nullptr);
+            }
+            LocalFree(name);
+        }
+#endif
+        const auto lk = std::unique_lock<std::mutex>(queues_mtx);
+        queues.push_back(queue);
+        return Owner{ queue };
+    }();
+    return *owner.queue;
+}
+
+// Returns true if the channel with this prefix was selected with Configuration::log_channels.
+// Channels are selected by name ("Kernel", "SceGnmDriver") or by group ("Lib", "GCN").
+inline bool isChannelSelected(const std::string& prefix) {
+    if (PS4::Configuration::log_channels.empty()) return true;
+
+    auto lower = [](std::string str) {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+        return str;
+    };
+    auto field = [&](size_t idx) {
+        size_t start = 0;
+        for (size_t i = 0; i <= idx; i++) {
+            start = prefix.find('[', start);
+            if (start == std::string::npos) return std::string();
+            start++;
+        }
+        const size_t end = prefix.find(']', start);
+        std::string str = prefix.substr(start, end - start);
+        str.erase(str.find_last_not_of(' ') + 1);
+        return lower(str);
+    };
+
+    const auto group = field(0);
+    const auto name = field(1);
+    for (auto& channel : PS4::Configuration::log_channels) {
+        const auto selected = lower(channel);
+        if (selected == name || selected == group) return true;
+    }
+    return false;
+}
+
+}   // End namespace Async
 
 // Our logger class
 template <bool enabled>
@@ -21,30 +484,32 @@ public:
 
     std::string prefix;
 
-    void log(const char* fmt, ...) {
-        if constexpr (!enabled) return;
+    template <typename... Args>
+    void log(const char* fmt, const Args&... args) {
+        if constexpr (enabled) {
+            if (isSelected())
+                Async::push(prefix.c_str(), fmt, args...);
+        }
+    }
 
-        const std::lock_guard<std::mutex> lock(logger_mtx);
-        std::fputs(prefix.c_str(), stdout);
-#ifdef _WIN32
-        PWSTR thread_name;
-        GetThreadDescription(GetCurrentThread(), &thread_name);
-        std::wprintf(L"(%ls) ", thread_name);
-#endif
-        std::va_list args;
-        va_start(args, fmt);
-        std::vprintf(fmt, args);
-        va_end(args);
+    template <typename... Args>
+    void logNoPrefix(const char* fmt, const Args&... args) {
+        if constexpr (enabled) {
+            if (isSelected())
+                Async::push(nullptr, fmt, args...);
+        }
     }
 
-    void logNoPrefix(const char* fmt, ...) {
-        if constexpr (!enabled) return;
+private:
+    std::atomic<s8> selected = -1;  // -1 if not checked yet
 
-        const std::lock_guard<std::mutex> lock(logger_mtx);
-        std::va_list args;
-        va_start(args, fmt);
-        std::vprintf(fmt, args);
-        va_end(args);
+    bool isSelected() {
+        s8 state = selected.load(std::memory_order_relaxed);
+        if (state < 0) [[unlikely]] {
+            state = Async::isChannelSelected(prefix);
+            selected.store(state, std::memory_order_relaxed);
+        }
+        return state;
     }
 };
 
@@ -100,6 +565,7 @@ static Logger lib_sceComposite      = Logger<true> ("[Lib    ][SceComposite
 static Logger gcn_command_processor = Logger<false>("[GCN    ][Command          ] ");
 static Logger gcn_fetch_shader      = Logger<false>("[GCN    ][Fetch Shader     ] ");
 static Logger gcn_vulkan_renderer   = Logger<false>("[GCN    ][VulkanRenderer   ] ");
+static Logger gcn_trace             = Logger<true> ("[GCN    ][Trace            ] ");
 
 // Other
 static Logger filesystem            = Logger<true> ("[Other  ][Filesystem       ] ");
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Common.hpp>
+#include <atomic>
+#include <array>
+#include <new>
+
+
+namespace Helpers {
+
+// Bounded lock-free multi-producer single-consumer ring buffer.
+// Each slot carries a sequence number telling whether it is free for the producer at that position or ready for the consumer
+// (see Dmitry Vyukov's bounded MPMC queue). Blocking is done with std::atomic wait/notify, which is a futex on Linux
+// and WaitOnAddress on Windows, so neither side takes a lock or makes a syscall unless it actually has to sleep.
+// A producer only blocks if the ring is full, until the consumer frees its slot.
+template <typename T, size_t capacity>
+class MPSCRing {
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "MPSCRing capacity must be a power of 2");
+
+public:
+    MPSCRing() {
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MPSCRing(const MPSCRing&) = delete;
+    MPSCRing& operator=(const MPSCRing&) = delete;
+
+    void push(const T& val) {
+        size_t pos = push_pos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            const size_t seq = slot->seq.load(std::memory_order_acquire);
+            const s64 diff = (s64)seq - (s64)pos;
+            if (diff == 0) {
+                // The slot is free, try to claim it
+                if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                // Full, wait for the consumer to free this slot
+                slot->seq.wait(seq, std::memory_order_acquire);
+                pos = push_pos.load(std::memory_order_relaxed);
+            }
+            else pos = push_pos.load(std::memory_order_relaxed);   // Another producer claimed it
+        }
+
+        slot->val = val;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        slot->seq.notify_all();
+    }
+
+    // Only one thread may pop
+    bool tryPop(T& val) {
+        Slot& slot = slots[pop_pos & mask];
+        if (slot.seq.load(std::memory_order_acquire) != pop_pos + 1) return false;
+
+        consume(slot, val);
+        return true;
+    }
+
+    // Blocks until an element is available. Only one thread may pop.
+    void pop(T& val) {
+        Slot& slot = slots[pop_pos & mask];
+        while (true) {
+            const size_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq == pop_pos + 1) break;
+            slot.seq.wait(seq, std::memory_order_acquire);
+        }
+        consume(slot, val);
+    }
+
+    // Can be called from any thread
+    bool empty() const {
+        return popped.load(std::memory_order_acquire) == push_pos.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr size_t mask = capacity - 1;
+
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq;
+        T val;
+    };
+
+    std::array<Slot, capacity> slots;
+    alignas(64) std::atomic<size_t> push_pos = 0;
+    alignas(64) size_t pop_pos = 0;
+    std::atomic<size_t> popped = 0;     // Mirror of pop_pos for empty()
+
+    void consume(Slot& slot, T& val) {
+        val = slot.val;
+        // Hand the slot back to the producer that will use it on the next lap
+        slot.seq.store(pop_pos + capacity, std::memory_order_release);
+        slot.seq.notify_all();
+        pop_pos++;
+        popped.store(pop_pos, std::memory_order_release);
+    }
+};
+
+}   // End namespace Helpers
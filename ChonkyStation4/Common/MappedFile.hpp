@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Common.hpp>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace Helpers {
+
+// Read-only memory mapping of a whole host file
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const fs::path& path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const fs::path& path) {
+        close();
+
+        std::error_code ec;
+        const auto file_size = fs::file_size(path, ec);
+        if (ec || file_size == 0) return false;
+
+#ifdef _WIN32
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            close();
+            return false;
+        }
+
+        ptr = (u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, file_size);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        void* res = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ptr = res == MAP_FAILED ? nullptr : (u8*)res;
+#endif
+        if (!ptr) {
+            close();
+            return false;
+        }
+
+        mapped_size = file_size;
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (ptr) UnmapViewOfFile(ptr);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (ptr) munmap(ptr, mapped_size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        ptr = nullptr;
+        mapped_size = 0;
+    }
+
+    bool isOpen() const { return ptr != nullptr; }
+    const u8* data() const { return ptr; }
+    size_t size() const { return mapped_size; }
+
+private:
+    u8* ptr = nullptr;
+    size_t mapped_size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+}   // End namespace Helpers
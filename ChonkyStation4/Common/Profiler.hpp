@@ -2,47 +2,219 @@
 
 #include <Common.hpp>
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include <chrono>
+#include <cstring>
 
 
 namespace Profiler {
 
+// Two kinds of data are collected:
+// - Aggregates (add, Scope, Timer): total time and call count per name, printed with printAndReset().
+// - Trace events (Zone, Scope): one event per scope, only while a capture is running (see startCapture).
+//   Captures are written as Chrome trace JSON, which can be opened in chrome://tracing or ui.perfetto.dev.
+// Every thread records into its own buffers, so threads never contend with each other.
+// Names must be string literals (or otherwise outlive the profiler), only the pointer is stored.
+
+using Clock = std::chrono::steady_clock;
+
 struct Entry {
     u64 calls = 0;
     u64 total_us = 0;
 };
 
-inline std::unordered_map<std::string, Entry> entries;
+struct Event {
+    const char* name;
+    u64 start_ns;
+    u64 end_ns;
+};
+
+// Events per thread. When a thread records more than this during a capture, its oldest events are overwritten.
+static constexpr size_t EVENTS_PER_THREAD = 64 * 1024;
+
+struct ThreadData {
+    u32 id;
+    char name[64] = "Unnamed thread";
+
+    // Trace events ring, only written by the owning thread
+    std::unique_ptr<Event[]> events;
+    std::atomic<u64> head = 0;
 
-inline void add(const std::string& name, u64 us) {
-    auto& entry = entries[name];
+    // Aggregates. The lock is only contended while printAndReset() runs.
+    std::mutex entries_mtx;
+    std::unordered_map<const char*, Entry> entries;
+};
+
+inline std::atomic<bool> capturing = false;
+inline Clock::time_point capture_start;
+inline std::string capture_path;
+
+// ThreadData is never freed, so that threads that exited still show up in the capture
+inline std::mutex threads_mtx;
+inline std::vector<ThreadData*> threads;
+
+inline ThreadData& thisThread() {
+    thread_local ThreadData* data = []() {
+        auto* data = new ThreadData();
+        const auto lk = std::unique_lock<std::mutex>(threads_mtx);
+        data->id = threads.size() + 1;
+        threads.push_back(data);
+        return data;
+    }();
+    return *data;
+}
+
+// Name the calling thread in captures
+inline void setThreadName(const std::string& name) {
+    auto& data = thisThread();
+    const auto lk = std::unique_lock<std::mutex>(threads_mtx);
+    std::strncpy(data.name, name.c_str(), sizeof(data.name) - 1);
+}
+
+// Nanoseconds since the start of the capture
+inline u64 captureTime(Clock::time_point time) {
+    return time > capture_start ? std::chrono::duration_cast<std::chrono::nanoseconds>(time - capture_start).count() : 0;
+}
+
+inline void recordEvent(const char* name, u64 start_ns, u64 end_ns) {
+    auto& data = thisThread();
+    if (!data.events) [[unlikely]]
+        data.events = std::make_unique<Event[]>(EVENTS_PER_THREAD);
+
+    const u64 head = data.head.load(std::memory_order_relaxed);
+    data.events[head % EVENTS_PER_THREAD] = { name, start_ns, end_ns };
+    data.head.store(head + 1, std::memory_order_release);
+}
+
+inline void add(const char* name, u64 us) {
+    auto& data = thisThread();
+    const auto lk = std::unique_lock<std::mutex>(data.entries_mtx);
+    auto& entry = data.entries[name];
     entry.calls++;
     entry.total_us += us;
 }
 
 inline void printAndReset() {
+    // Merge the entries of all threads. Different pointers can refer to the same name, so merge by string.
+    std::unordered_map<std::string, Entry> merged;
+    {
+        const auto lk = std::unique_lock<std::mutex>(threads_mtx);
+        for (auto* data : threads) {
+            const auto entries_lk = std::unique_lock<std::mutex>(data->entries_mtx);
+            for (auto& [name, entry] : data->entries) {
+                auto& out = merged[name];
+                out.calls += entry.calls;
+                out.total_us += entry.total_us;
+            }
+            data->entries.clear();
+        }
+    }
+
     printf("------ Profiler ------\n");
-    for (auto& [name, entry] : entries) {
+    for (auto& [name, entry] : merged) {
         printf("%-40s %8llu us (%llu calls, avg %.2f us per call)\n", name.c_str(), entry.total_us, entry.calls, (float)entry.total_us / entry.calls);
     }
-    entries.clear();
 }
 
+// Starts recording trace events. The capture is written to path by stopCapture().
+inline void startCapture(const std::string& path) {
+    const auto lk = std::unique_lock<std::mutex>(threads_mtx);
+    if (capturing) return;
+
+    for (auto* data : threads)
+        data->head = 0;
+    capture_path = path;
+    capture_start = Clock::now();
+    capturing = true;
+}
+
+inline void writeJsonString(FILE* file, const char* str) {
+    std::fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') std::fputc('\\', file);
+        if ((u8)*str < 0x20) continue;
+        std::fputc(*str, file);
+    }
+    std::fputc('"', file);
+}
+
+// Stops the running capture, if any, and writes it as Chrome trace JSON
+inline void stopCapture() {
+    if (!capturing.exchange(false)) return;
+
+    const auto lk = std::unique_lock<std::mutex>(threads_mtx);
+    FILE* file = std::fopen(capture_path.c_str(), "w");
+    if (!file) {
+        printf("Profiler: couldn't open %s\n", capture_path.c_str());
+        return;
+    }
+
+    size_t n_events = 0;
+    std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+    for (auto* data : threads) {
+        std::fprintf(file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", data->id);
+        writeJsonString(file, data->name);
+        std::fputs("}}", file);
+
+        // Events recorded by a thread that was in the middle of a scope when the capture stopped might still land in the ring,
+        // only the newest event can be affected and it's harmless.
+        const u64 head = data->head.load(std::memory_order_acquire);
+        const u64 first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+        for (u64 i = first; i < head; i++) {
+            const Event& ev = data->events[i % EVENTS_PER_THREAD];
+            std::fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":", data->id, ev.start_ns / 1000.0, (ev.end_ns - ev.start_ns) / 1000.0);
+            writeJsonString(file, ev.name);
+            std::fputc('}', file);
+        }
+        n_events += head - first;
+        std::fputs(",\n", file);
+    }
+    // Chrome's parser doesn't allow a trailing comma
+    std::fputs("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"ChonkyStation4\"}}\n]}\n", file);
+    std::fclose(file);
+    printf("Profiler: wrote %zu events to %s\n", n_events, capture_path.c_str());
+}
+
+// Trace event for the lifetime of the object. Costs one relaxed atomic load when no capture is running.
+class Zone {
+public:
+    Zone(const char* name) : name(name) {
+        if (capturing.load(std::memory_order_relaxed)) [[unlikely]]
+            start_ns = captureTime(Clock::now());
+    }
+
+    ~Zone() {
+        if (start_ns != NOT_CAPTURING) [[unlikely]]
+            recordEvent(name, start_ns, captureTime(Clock::now()));
+    }
+
+private:
+    static constexpr u64 NOT_CAPTURING = -1;
+    const char* name;
+    u64 start_ns = NOT_CAPTURING;
+};
+
+// Adds the lifetime of the object to the aggregates, and records a trace event if a capture is running
 class Scope {
 public:
     Scope(const char* name) : name(name) {
-        start = std::chrono::high_resolution_clock::now();
+        start = Clock::now();
     }
 
     ~Scope() {
-        const auto end = std::chrono::high_resolution_clock::now();
+        const auto end = Clock::now();
         const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
         Profiler::add(name, elapsed);
+        if (capturing.load(std::memory_order_relaxed)) [[unlikely]]
+            recordEvent(name, captureTime(start), captureTime(end));
     }
 
 private:
-    std::string name;
-    std::chrono::high_resolution_clock::time_point start;
+    const char* name;
+    Clock::time_point start;
 };
 
 class Timer {
@@ -50,18 +222,18 @@ public:
     Timer(const char* name) : name(name) {}
 
     void start() {
-        start_time = std::chrono::high_resolution_clock::now();
+        start_time = Clock::now();
     }
 
     void stop() {
-        const auto end = std::chrono::high_resolution_clock::now();
+        const auto end = Clock::now();
         const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start_time).count();
         Profiler::add(name, elapsed);
     }
 
 private:
-    std::string name;
-    std::chrono::high_resolution_clock::time_point start_time;
+    const char* name;
+    Clock::time_point start_time;
 };
 
-}   // End namespace Profiler
\ No newline at end of file
+}   // End namespace Profiler
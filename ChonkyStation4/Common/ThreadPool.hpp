@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Common.hpp>
+#include <Profiler.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+
+namespace Helpers {
+
+// Fixed-size pool of host worker threads consuming a FIFO of tasks
+class ThreadPool {
+public:
+    ThreadPool(const std::string& name, size_t n_threads = 0) {
+        if (n_threads == 0)
+            n_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+        for (size_t i = 0; i < n_threads; i++) {
+            workers.emplace_back([this, name, i]() {
+                setThreadName(std::format("[Emu] {} {}", name, i));
+                workerLoop();
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            auto lk = std::unique_lock<std::mutex>(mtx);
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename F>
+    auto submit(F&& func) -> std::future<std::invoke_result_t<F>> {
+        using Ret = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Ret()>>(std::forward<F>(func));
+        auto future = task->get_future();
+        {
+            auto lk = std::unique_lock<std::mutex>(mtx);
+            tasks.emplace_back([task]() { (*task)(); });
+            queued++;
+        }
+        cv.notify_one();
+        return future;
+    }
+
+    // Number of tasks waiting to be picked up by a worker
+    size_t queueDepth() const { return queued; }
+    size_t size() const { return workers.size(); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<size_t> queued = 0;
+    bool stop = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                auto lk = std::unique_lock<std::mutex>(mtx);
+                cv.wait(lk, [this]() { return stop || !tasks.empty(); });
+                if (stop && tasks.empty()) return;
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                queued--;
+            }
+            task();
+        }
+    }
+
+    static void setThreadName(const std::string& name) {
+#ifdef _WIN32
+        std::wstring wname(name.begin(), name.end());
+        SetThreadDescription(GetCurrentThread(), wname.c_str());
+#else
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+        Profiler::setThreadName(name);
+    }
+};
+
+}   // End namespace Helpers
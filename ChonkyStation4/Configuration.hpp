@@ -20,5 +20,17 @@ inline bool skip_waitregmem = false;
 inline bool disable_gnmdetiler_texture_size = false;
 inline bool disable_sgpr_init_hack = false;
 inline bool clamp_gpu_buffers = false;
+inline bool async_pipeline_compilation = false;    // Skip draws whose pipeline is still compiling instead of waiting for it
+inline std::vector<u32> gpu_detile_tile_modes = {};   // Tile modes (T# tiling_index) detiled by a compute shader instead of on the CPU
+inline bool gpu_detile_validate = false;    // Run every GPU detile once more, read it back and compare it with the CPU detiler
+inline std::string profile_capture_path = "";   // Write a Chrome trace of the profiler zones to this file (see Common/Profiler.hpp)
+inline u64 profile_capture_frames = 0;          // Stop the capture after this many frames, 0 captures until the emulator exits
+inline std::vector<std::string> log_channels = {};  // Only print these log channels (see Common/Logger.hpp), all of them if empty
+inline u32 log_rate_limit = 0;   // Max messages per second from each log call site, 0 for no limit
+inline u32 renderer_stats_interval = 0;   // Print the buffer and pipeline cache statistics every this many frames, 0 to disable
+inline u32 submit_stats_interval = 0;   // Print how long GPU submissions take on the guest side every this many frames, 0 to disable
+inline std::string gcn_trace_path = "";   // Record the GPU command stream to this file (see GCN/Trace.hpp)
+inline bool mmap_app0_files = true;   // Read files on /app0 through memory mappings instead of read calls
+inline std::string audio_sink = "sdl";    // Where the audio mixer outputs to: "sdl", "null", or the path of a .wav file to record to
 
 }   // End namespace PS4::Configuration
\ No newline at end of file
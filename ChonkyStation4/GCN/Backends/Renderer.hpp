@@ -121,6 +121,18 @@ union RenderTargetDimensions {
     };
 };
 
+// Groups of the registers the graphics pipeline is built from.
+// A group is marked dirty whenever one of its registers is written, so that draws only have to rebuild the parts of the pipeline key that could have changed.
+namespace RegGroup {
+static constexpr u32 VertexShader   = 1 << 0;   // VS address and user data (the fetch shader address and the V# locations)
+static constexpr u32 PixelShader    = 1 << 1;   // PS address and input locations
+static constexpr u32 Primitive      = 1 << 2;
+static constexpr u32 Blend          = 1 << 3;
+static constexpr u32 DepthStencil   = 1 << 4;
+static constexpr u32 Viewport       = 1 << 5;   // Viewport, clipping and culling
+static constexpr u32 All            = (1 << 6) - 1;
+}   // End namespace RegGroup
+
 enum class IndexType : u32 {
     Uint16,
     Uint32
@@ -143,10 +155,44 @@ public:
     virtual void fillGDS(size_t offset, u8 value, size_t size) = 0;
 
     u32 regs[0xd000];
+    u32 dirty_reg_groups = RegGroup::All;
     IndexType index_type = IndexType::Uint16;
     RenderTargetDimensions color_rt_dim[8];
     RenderTargetDimensions depth_rt_dim;
     
+    // Register writes from the command processor have to go through here to keep dirty_reg_groups up to date
+    void setRegs(u32 reg_offset, const u32* vals, u32 count) {
+        struct RegRange {
+            u32 first;
+            u32 last;
+            u32 groups;
+        };
+        static constexpr RegRange ranges[] = {
+            { Reg::mmSPI_SHADER_PGM_LO_PS,          Reg::mmSPI_SHADER_PGM_HI_PS,        RegGroup::PixelShader },
+            { Reg::mmSPI_PS_INPUT_CNTL_0,           Reg::mmSPI_PS_INPUT_CNTL_31,        RegGroup::PixelShader },
+            { Reg::mmSPI_SHADER_PGM_LO_VS,          Reg::mmSPI_SHADER_PGM_HI_VS,        RegGroup::VertexShader },
+            { Reg::mmSPI_SHADER_USER_DATA_VS_0,     Reg::mmSPI_SHADER_USER_DATA_VS_15,  RegGroup::VertexShader },
+            { Reg::mmDB_RENDER_CONTROL,             Reg::mmDB_RENDER_CONTROL,           RegGroup::DepthStencil },
+            { Reg::mmDB_RENDER_OVERRIDE,            Reg::mmDB_RENDER_OVERRIDE,          RegGroup::DepthStencil },
+            { Reg::mmDB_DEPTH_BOUNDS_MIN,           Reg::mmDB_DEPTH_BOUNDS_MAX,         RegGroup::DepthStencil },
+            { Reg::mmDB_STENCIL_CONTROL,            Reg::mmDB_STENCILREFMASK_BF,        RegGroup::DepthStencil },
+            { Reg::mmPA_CL_VPORT_XSCALE,            Reg::mmPA_CL_VPORT_ZOFFSET,         RegGroup::Viewport },
+            { Reg::mmCB_BLEND0_CONTROL,             Reg::mmCB_BLEND7_CONTROL,           RegGroup::Blend },
+            { Reg::mmDB_DEPTH_CONTROL,              Reg::mmDB_DEPTH_CONTROL,            RegGroup::DepthStencil },
+            { Reg::mmCB_COLOR_CONTROL,              Reg::mmCB_COLOR_CONTROL,            RegGroup::Blend },
+            { Reg::mmPA_CL_CLIP_CNTL,               Reg::mmPA_CL_CLIP_CNTL,             RegGroup::DepthStencil | RegGroup::Viewport },
+            { Reg::mmPA_SU_SC_MODE_CNTL,            Reg::mmPA_CL_VTE_CNTL,              RegGroup::Viewport },
+            { Reg::mmVGT_PRIMITIVE_TYPE__CI__VI,    Reg::mmVGT_PRIMITIVE_TYPE__CI__VI,  RegGroup::Primitive },
+        };
+
+        std::memcpy(&regs[reg_offset], vals, count * sizeof(u32));
+        const u32 last = reg_offset + count - 1;
+        for (const auto& range : ranges) {
+            if (reg_offset <= range.last && last >= range.first)
+                dirty_reg_groups |= range.groups;
+        }
+    }
+
     u8* getVSPtr() {
         return (u8*)(((u64)regs[Reg::mmSPI_SHADER_PGM_LO_VS] << 8) | ((u64)regs[Reg::mmSPI_SHADER_PGM_HI_VS] << 8 << 32));
     }
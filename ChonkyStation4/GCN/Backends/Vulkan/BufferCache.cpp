@@ -1,15 +1,28 @@
 #include "BufferCache.hpp"
 #include <Logger.hpp>
 #include <Profiler.hpp>
+#include <IntervalMap.hpp>
 #include <GCN/Backends/Vulkan/VulkanCommon.hpp>
 #include <GCN/GCN.hpp>
+#include <GCN/Trace.hpp>
 #include <xxhash.h>
 #include <unordered_map>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <bit>
 #ifdef _WIN32
 #define NOMINMAX
 #include <Windows.h>
 #include <intrin.h>
+#else
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
 #endif
 
 
@@ -17,42 +30,45 @@ namespace PS4::GCN::Vulkan::Cache {
 
 MAKE_LOG_FUNCTION(log, gcn_vulkan_renderer);
 
+// Fault statistics, updated from the exception/signal handler
+std::atomic<u64> fault_count = 0;
+std::atomic<u64> fault_ns = 0;
+std::atomic<u64> pages_invalidated = 0;
+
+// Sets the protection of a page-aligned host range. Returns false on failure.
+static bool setPageProtection(void* addr, size_t size, bool writable) {
+#ifdef _WIN32
+    DWORD old_protect;
+    return VirtualProtect(addr, size, writable ? PAGE_READWRITE : PAGE_READONLY, &old_protect);
+#else
+    return mprotect(addr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ) == 0;
+#endif
+}
+
 struct CachedBuffer {
     void* base = nullptr;
     size_t  size = 0;
     u64     page = 0;
     u64     page_end = 0;
     u64     hash = 0;
-    bool    dirty = false;
-    std::vector<bool> dirty_pages;
-    vk::Buffer      staging_buf = nullptr;
+    std::atomic<bool> dirty = false;
+    std::vector<u8> dirty_pages;    // Written with std::atomic_ref from the fault handler
     vk::Buffer      buf = nullptr;
     size_t          offs_in_buf = 0;
     void* mapping = nullptr;
-    VmaAllocation   staging_alloc;
     VmaAllocation   alloc;
     //u64 last_used_frame = 0;
     //u64 last_base_used_frame = 0;
     //std::vector<u64> last_used_page_frame;
 
-    void protect(u64 page_to_protect) {
-#ifdef _WIN32
-        DWORD old_protect;
-        if (!VirtualProtect((void*)((page + page_to_protect) << page_bits), page_size, PAGE_READONLY, &old_protect))
-            Helpers::panic("CachedBuffer::protect: VirtualProtect failed");
-#else
-        Helpers::panic("Unsupported platform\n");
-#endif
+    void protect(u64 page_to_protect, u64 count = 1) {
+        if (!setPageProtection((void*)((page + page_to_protect) << page_bits), count << page_bits, false))
+            Helpers::panic("CachedBuffer::protect: failed to protect page");
     }
 
-    void unprotect(u64 page_to_unprotect) {
-#ifdef _WIN32
-        DWORD old_protect;
-        if (!VirtualProtect((void*)((page + page_to_unprotect) << page_bits), page_size, PAGE_READWRITE, &old_protect))
-            Helpers::panic("CachedBuffer::unprotect: VirtualProtect failed");
-#else
-        Helpers::panic("Unsupported platform\n");
-#endif
+    void unprotect(u64 page_to_unprotect, u64 count = 1) {
+        if (!setPageProtection((void*)((page + page_to_unprotect) << page_bits), count << page_bits, true))
+            Helpers::panic("CachedBuffer::unprotect: failed to unprotect page");
     }
 };
 
@@ -61,88 +77,123 @@ struct TrackedRegion {
     size_t  size = 0;
     u64     page = 0;
     u64     page_end = 0;
-    bool    dirty = false;
+    std::atomic<bool> dirty = false;
     u64     count = 0;
     std::function<void(uptr)> callback;
 
     void protect() {
-#ifdef _WIN32
         const auto aligned_start = Helpers::alignDown<u64>((u64)base, page_size);
         const auto aligned_end = Helpers::alignUp<u64>((u64)base + size, page_size);
 
-        DWORD old_protect;
-        if (!VirtualProtect((void*)aligned_start, aligned_end - aligned_start, PAGE_READONLY, &old_protect))
-            //Helpers::panic("TrackedRegion::protect: VirtualProtect failed");
-            printf("TrackedRegion::protect: VirtualProtect failed at address 0x%llx\n", aligned_start);
-#else
-        Helpers::panic("Unsupported platform\n");
-#endif
+        if (!setPageProtection((void*)aligned_start, aligned_end - aligned_start, false))
+            //Helpers::panic("TrackedRegion::protect: failed to protect region");
+            printf("TrackedRegion::protect: failed to protect region at address 0x%llx\n", aligned_start);
     }
 
     void unprotect() {
-#ifdef _WIN32
         const auto aligned_start = Helpers::alignDown<u64>((u64)base, page_size);
         const auto aligned_end = Helpers::alignUp<u64>((u64)base + size, page_size);
 
-        DWORD old_protect;
-        if (!VirtualProtect((void*)aligned_start, aligned_end - aligned_start, PAGE_READWRITE, &old_protect))
-            Helpers::panic("TrackedRegion::unprotect: VirtualProtect failed");
-#else
-        Helpers::panic("Unsupported platform\n");
-#endif
+        if (!setPageProtection((void*)aligned_start, aligned_end - aligned_start, true))
+            Helpers::panic("TrackedRegion::unprotect: failed to unprotect region");
     }
 };
 
-std::mutex cache_mtx;
-std::unordered_map<u64, CachedBuffer*> cache;
-std::unordered_map<u64, TrackedRegion*> tracked;
+// Page range indices. Each buffer or region is stored once, keyed by its [page, page_end) range.
+// Cached buffers never overlap (overlapping buffers are evicted when a new one is created), tracked regions can.
+// The fault handler only takes cache_mtx in shared mode, so faults on different threads don't serialize.
+std::shared_mutex cache_mtx;
+Helpers::IntervalMap<u64, CachedBuffer*, true> cache;
+Helpers::IntervalMap<u64, TrackedRegion*> tracked;
 std::unordered_map<u64, CachedBuffer*> hash_cache[FRAMES_IN_FLIGHT];
 
-#ifdef _WIN32
-
-static LONG CALLBACK exceptionHandler(EXCEPTION_POINTERS* info) noexcept {
-    const auto* record = info->ExceptionRecord;
-    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION)
-        return EXCEPTION_CONTINUE_SEARCH;
-
-    const bool is_write = record->ExceptionInformation[0] == 1;
-    if (!is_write) return EXCEPTION_CONTINUE_SEARCH;
-
-    void* addr = (void*)record->ExceptionInformation[1];
+// Marks the page containing addr as dirty in every buffer or tracked region covering it.
+// Called from the platform exception/signal handler on write faults. Returns true if the fault was ours.
+static bool handleWriteFault(void* addr) {
+    const auto start = std::chrono::steady_clock::now();
     const u64 page = (uptr)addr >> page_bits;
 
     bool handled = false;
-    TrackedRegion* region = nullptr;
+    // Reused across faults so that they don't allocate. It's moved out while in use, in case a callback faults again.
+    static thread_local std::vector<TrackedRegion*> region_buf;
+    std::vector<TrackedRegion*> regions = std::move(region_buf);
+    regions.clear();
 
     {
-        auto lk = std::unique_lock<std::mutex>(cache_mtx);
+        auto lk = std::shared_lock<std::shared_mutex>(cache_mtx);
 
-        if (cache.contains(page)) {
+        if (auto it = cache.findContaining(page)) {
             handled = true;
 
-            auto& buf = cache[page];
+            auto* buf = *it;
+            std::atomic_ref<u8>(buf->dirty_pages[page - buf->page]).store(true, std::memory_order_relaxed);
             buf->dirty = true;
-            buf->dirty_pages[page - buf->page] = true;
-            cache[page]->unprotect(page - buf->page);
+            buf->unprotect(page - buf->page);
+            pages_invalidated++;
 
             //printf("addr %p base %p size %lld last used (all/base) %d/%d frames ago\n", addr, buf->base, buf->size, GCN::global_flip_counter - buf->last_used_frame, GCN::global_flip_counter - buf->last_base_used_frame);
             //printf("page was bound %d frames ago\n", GCN::global_flip_counter - buf->last_used_page_frame[page - buf->page]);
         }
 
-        if (tracked.contains(page)) {
+        tracked.forEachOverlapping(page, page + 1, [&](const auto& range) {
             handled = true;
-            region = tracked[page];
+            auto* region = range.value;
             region->dirty = true;
-        }
+            pages_invalidated += region->page_end - region->page;
+            regions.push_back(region);
+        });
     }
 
     // Avoid calling the callback function while holding a lock
-    if (region) {
+    for (auto* region : regions) {
         region->callback((uptr)addr);
         region->unprotect();
     }
+    region_buf = std::move(regions);
+
+    if (handled) {
+        const auto end = std::chrono::steady_clock::now();
+        fault_count++;
+        fault_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+    return handled;
+}
+
+#ifdef _WIN32
+
+static LONG CALLBACK exceptionHandler(EXCEPTION_POINTERS* info) noexcept {
+    const auto* record = info->ExceptionRecord;
+    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    const bool is_write = record->ExceptionInformation[0] == 1;
+    if (!is_write) return EXCEPTION_CONTINUE_SEARCH;
+
+    void* addr = (void*)record->ExceptionInformation[1];
+    return handleWriteFault(addr) ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+}
+
+#else
+
+static struct sigaction old_sigsegv_action;
 
-    return handled ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+static void signalHandler(int sig, siginfo_t* info, void* raw_context) {
+    // On x86-64 bit 1 of the page fault error code is set for write accesses
+    const auto* context = (ucontext_t*)raw_context;
+    const bool is_write = context->uc_mcontext.gregs[REG_ERR] & 2;
+    if (is_write && handleWriteFault(info->si_addr)) return;
+
+    // Not one of our pages, forward the fault to whoever was installed before us
+    if (old_sigsegv_action.sa_flags & SA_SIGINFO) {
+        old_sigsegv_action.sa_sigaction(sig, info, raw_context);
+    }
+    else if (old_sigsegv_action.sa_handler != SIG_DFL && old_sigsegv_action.sa_handler != SIG_IGN) {
+        old_sigsegv_action.sa_handler(sig);
+    }
+    else {
+        // Restore the default action, returning will re-execute the faulting instruction and crash properly
+        signal(sig, SIG_DFL);
+    }
 }
 
 #endif
@@ -153,8 +204,66 @@ struct Allocation {
 };
 std::vector<Allocation> allocations_to_clear[FRAMES_IN_FLIGHT];
 
-void init() {
-    // Setup exception handler
+// Staging memory for uploads.
+// Every frame in flight has its own persistently mapped buffer, filled linearly and rewound in clear(), which runs after
+// the frame's fence was waited on, so the GPU is done reading from it. Uploads don't allocate anything in the common case.
+// If a frame needs more than its buffer holds the rest goes to temporary buffers (a ring stall),
+// and the buffer is grown to fit the next time it is rewound.
+// Only the thread recording the command buffer may allocate staging memory.
+struct StagingBuffer {
+    vk::Buffer buf = nullptr;
+    VmaAllocation alloc = nullptr;
+    u8* ptr = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    size_t requested = 0;   // Bytes requested this frame, including the ones that didn't fit
+};
+StagingBuffer staging_bufs[FRAMES_IN_FLIGHT];
+
+static constexpr size_t STAGING_BUFFER_MIN_SIZE = 64_MB;
+static constexpr size_t STAGING_BUFFER_MAX_SIZE = 1_GB;
+static constexpr size_t STAGING_ALIGNMENT = 256;    // Covers storage buffer offsets and buffer to image copies
+
+// Staging statistics, see printStats()
+std::atomic<u64> staging_frames = 0;
+std::atomic<u64> staging_bytes = 0;
+std::atomic<u64> staging_stalls = 0;
+
+static constexpr vk::BufferUsageFlags STAGING_BUFFER_USAGE =   vk::BufferUsageFlagBits::eIndexBuffer   | vk::BufferUsageFlagBits::eVertexBuffer
+                                                             | vk::BufferUsageFlagBits::eTransferSrc   | vk::BufferUsageFlagBits::eTransferDst
+                                                             | vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer;
+
+static void createStagingBuffer(StagingBuffer& staging, size_t size) {
+    if (staging.buf)
+        vmaDestroyBuffer(allocator, staging.buf, staging.alloc);
+
+    const vk::BufferCreateInfo buf_create_info = {
+        .size = size,
+        .usage = STAGING_BUFFER_USAGE,
+        .sharingMode = vk::SharingMode::eExclusive
+    };
+    // Not allocated from vma_pool, the pool uses the linear algorithm and long lived allocations would get in the way
+    VmaAllocationCreateInfo alloc_create_info = {};
+    alloc_create_info.usage = VMA_MEMORY_USAGE_AUTO;
+    alloc_create_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    alloc_create_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkBuffer raw_buf;
+    VmaAllocationInfo info;
+    if (vmaCreateBuffer(allocator, &*buf_create_info, &alloc_create_info, &raw_buf, &staging.alloc, &info) != VK_SUCCESS)
+        Helpers::panic("Cache: could not allocate %lld MB staging buffer\n", size / 1_MB);
+
+    staging.buf = vk::Buffer(raw_buf);
+    staging.ptr = (u8*)info.pMappedData;
+    staging.size = size;
+    staging.offset = 0;
+}
+
+// Installs the write fault handler and sets page_size. Only the first call does anything.
+void initFaultHandler() {
+    static bool installed = false;
+    if (installed) return;
+    installed = true;
+
 #ifdef _WIN32
     if (!AddVectoredExceptionHandler(0, exceptionHandler))
         Helpers::panic("initTextureCache: failed to register exception handler");
@@ -162,57 +271,45 @@ void init() {
     SYSTEM_INFO si;
     GetSystemInfo(&si);
     page_size = si.dwPageSize;
-    page_bits = std::bit_width(page_size - 1);
 #else
-    Helpers::panic("Unsupported platform\n");
+    struct sigaction action = {};
+    action.sa_sigaction = signalHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &old_sigsegv_action))
+        Helpers::panic("initTextureCache: failed to register signal handler");
+
+    page_size = sysconf(_SC_PAGESIZE);
 #endif
+    page_bits = std::bit_width(page_size - 1);
+}
+
+void init() {
+    initFaultHandler();
 
     for (auto& allocations : allocations_to_clear)
-        allocations.reserve(10000);
+        allocations.reserve(1024);
+
+    for (auto& staging : staging_bufs)
+        createStagingBuffer(staging, STAGING_BUFFER_MIN_SIZE);
 }
 
 void updateBuffer(CachedBuffer* buf, bool recreate_vk_buf, u64 starting_page = 0) {
     //Profiler::Scope profiler("updateBuffer");
-    auto& staging_vk_buf    = buf->staging_buf;
     auto& vk_buf            = buf->buf;
-    auto& staging_alloc     = buf->staging_alloc;
     auto& alloc             = buf->alloc;
 
-    // We create a new buffer instead of actually updating the old one,
-    // and then we free all allocations when clear() is called (at the end of every frame), in stream-buffer fashion(?).
-    // This is because buffers can and will be updated mid-frame, so we can't free the old ones right away.
-    // The allocation costs shouldn't be too much due to how VMA is setup - see VulkanRenderer.cpp
+    // The dirty data goes through the staging buffer of this frame and is then copied to the device local buffer.
+    // When the whole buffer has to be recreated, the old one is freed when clear() is called for this frame, since
+    // buffers can and will be updated mid-frame.
 
     auto copy_region = [&](void* base, size_t offset, size_t size, vk::Buffer dest_vk_buf) {
-        const vk::BufferCreateInfo buf_create_info = {
-            .size = size,
-            .usage = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eVertexBuffer
-                     | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst
-                     | vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer
-                     | vk::BufferUsageFlagBits::eIndirectBuffer,
-            .sharingMode = vk::SharingMode::eExclusive
-        };
-        VmaAllocationCreateInfo alloc_create_info = { .pool = vma_pool };
-        alloc_create_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-        alloc_create_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-        VkBuffer raw_buf;
-        VmaAllocationInfo info;
-        vmaCreateBuffer(allocator, &*buf_create_info, &alloc_create_info, &raw_buf, &staging_alloc, &info);
-        staging_vk_buf = vk::Buffer(raw_buf);
-
-        if (info.size < size) {
-            Helpers::panic("Cache::updateBuffer: could not allocate full buffer");
-        }
-
-        // Update the buffer
-        std::memcpy(info.pMappedData, (u8*)base + offset, size);
+        auto [staging_vk_buf, staging_offset, staging_ptr] = getMappedBufferForFrame(size);
+        std::memcpy(staging_ptr, (u8*)base + offset, size);
     
         // Copy staging buffer to device local buffer
         endRendering();
-        cmd_bufs[frame_idx].copyBuffer(staging_vk_buf, dest_vk_buf, vk::BufferCopy { 0, offset, size });
-
-        // Clear staging buffer after this frame
-        allocations_to_clear[frame_idx].push_back({ .buf = staging_vk_buf, .alloc = staging_alloc });
+        cmd_bufs[frame_idx].copyBuffer(staging_vk_buf, dest_vk_buf, vk::BufferCopy { staging_offset, offset, size });
     };
 
     // Recreate and copy the whole device local buffer if needed
@@ -239,9 +336,7 @@ void updateBuffer(CachedBuffer* buf, bool recreate_vk_buf, u64 starting_page = 0
         
         // Copy and protect the whole buffer
         copy_region(buf->base, 0, buf->size, vk_buf);
-        for (int i = 0; i < buf->page_end - buf->page; i++) {
-            buf->protect(i);
-        }
+        buf->protect(0, buf->page_end - buf->page);
     }
     else {
         // Only reupload dirty pages of the buffer
@@ -257,13 +352,12 @@ void updateBuffer(CachedBuffer* buf, bool recreate_vk_buf, u64 starting_page = 0
 
             const size_t page_start = page;
 
-            // Find page end while re-protecting dirty pages
-            while (page < dirty_pages.size() && dirty_pages[page]) {
-                buf->protect(page);
+            // Find page end, then re-protect the dirty pages in one go
+            while (page < dirty_pages.size() && dirty_pages[page])
                 page++;
-            }
 
             const size_t page_end = page;
+            buf->protect(page_start, page_end - page_start);
             const size_t size = (page_end - page_start) << page_bits;
             copy_region(buf->base, page_start << page_bits, size, vk_buf);
         }
@@ -293,19 +387,26 @@ void updateBuffer(CachedBuffer* buf, bool recreate_vk_buf, u64 starting_page = 0
 }
 
 void deleteBuf(CachedBuffer* buf) {
-    for (u64 i = 0; i < buf->page_end - buf->page; i++) {
-        auto it = cache.find(buf->page + i);
-        if (it != cache.end() && it->second == buf) {
-            buf->unprotect(i);
-            cache.erase(it);
-        }
-    }
+    if (cache.erase(buf->page, buf))
+        buf->unprotect(0, buf->page_end - buf->page);
     if (buf->buf)
         allocations_to_clear[frame_idx].push_back({ .buf = buf->buf, .alloc = buf->alloc });
     delete buf;
 }
 
+// Deletes every cached buffer overlapping the page range [page, page_end)
+void evictOverlapping(u64 page, u64 page_end, CachedBuffer* except = nullptr) {
+    std::vector<CachedBuffer*> overlapping;
+    cache.forEachOverlapping(page, page_end, [&](const auto& range) {
+        if (range.value != except)
+            overlapping.push_back(range.value);
+    });
+    for (auto* buf : overlapping)
+        deleteBuf(buf);
+}
+
 std::tuple<vk::Buffer, size_t, bool> getBuffer(void* base, size_t size) {
+    Trace::recordMemory(base, size);
     const uptr   aligned_base   = Helpers::alignDown<uptr>((uptr)base, page_size);
     const uptr   aligned_end    = Helpers::alignUp<uptr>((uptr)base + size, page_size);
     const size_t aligned_size   = aligned_end - aligned_base;
@@ -313,32 +414,26 @@ std::tuple<vk::Buffer, size_t, bool> getBuffer(void* base, size_t size) {
     const u64    page           = aligned_base >> page_bits;
     const u64    page_end       = page + size_in_pages;
     
-    auto lk = std::unique_lock<std::mutex>(cache_mtx);
+    auto lk = std::unique_lock<std::shared_mutex>(cache_mtx);
 
     const bool is_hash = size < page_size / 4;
 
     // Check if we already cached this buffer
     if (!is_hash) {
-        auto it = cache.find(page);
-        if (it != cache.end()) {
+        if (auto it = cache.findContaining(page)) {
             // Check if we need to reupload the buffer
-            auto* buf = it->second;
+            auto* buf = *it;
             const bool size_changed = page_end > buf->page_end;
             const bool was_dirty = buf->dirty || size_changed;
 
             if (buf->dirty || size_changed) {
                 if (size_changed) {
+                    // Update page range index
+                    evictOverlapping(buf->page_end, page_end, buf);
+                    cache.resize(buf->page, buf, page_end);
+
                     buf->page_end = page_end;
                     buf->size = (page_end - buf->page) << page_bits;
-                    
-                    // Update page table
-                    for (int i = 0; i < buf->page_end - buf->page; i++) {
-                        auto it = cache.find(buf->page + i);
-                        if (it != cache.end() && it->second != buf)
-                            deleteBuf(it->second);
-                        cache[buf->page + i] = buf;
-                    }
-                    
                     buf->dirty_pages.resize(buf->page_end - buf->page);
                     //buf->last_used_page_frame.resize(buf->page_end - buf->page);
                 }
@@ -378,16 +473,9 @@ std::tuple<vk::Buffer, size_t, bool> getBuffer(void* base, size_t size) {
         //buf->last_used_frame = GCN::global_flip_counter;
         //buf->last_base_used_frame = GCN::global_flip_counter;
 
-        for (u64 i = 0; i < size_in_pages; i++) {
-            auto it = cache.find(page + i);
-            if (it != cache.end() && it->second != buf)
-                deleteBuf(it->second);
-
-            cache[page + i] = buf;
-            buf->protect(i);
-
-            //buf->last_used_page_frame[i] = GCN::global_flip_counter;
-        }
+        evictOverlapping(page, page_end);
+        cache.insert(page, page_end, buf);
+        //std::fill(buf->last_used_page_frame.begin(), buf->last_used_page_frame.end(), GCN::global_flip_counter);
     }
     else {
         buf->base = base;
@@ -423,13 +511,24 @@ void barrier() {
     );
 }
 
-// This function returns an empty mapped buffer that is cleared at the end of the frame (when clear() is called)
-std::pair<vk::Buffer, void*> getMappedBufferForFrame(size_t size) {
+// This function returns mapped staging memory that is valid until clear() is called for this frame again.
+// Returns the buffer, the offset of the memory in the buffer and the mapped pointer.
+std::tuple<vk::Buffer, size_t, void*> getMappedBufferForFrame(size_t size) {
+    auto& staging = staging_bufs[frame_idx];
+    const size_t offset = Helpers::alignUp<size_t>(staging.offset, STAGING_ALIGNMENT);
+    staging.requested += Helpers::alignUp<size_t>(size, STAGING_ALIGNMENT);
+    staging_bytes += size;
+
+    if (offset + size <= staging.size) {
+        staging.offset = offset + size;
+        return { staging.buf, offset, staging.ptr + offset };
+    }
+
+    // The staging buffer is full, use a temporary buffer until the end of the frame
+    staging_stalls++;
     const vk::BufferCreateInfo buf_create_info = {
         .size = size,
-        .usage =   vk::BufferUsageFlagBits::eIndexBuffer   | vk::BufferUsageFlagBits::eVertexBuffer
-                 | vk::BufferUsageFlagBits::eTransferSrc   | vk::BufferUsageFlagBits::eTransferDst
-                 | vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+        .usage = STAGING_BUFFER_USAGE,
         .sharingMode = vk::SharingMode::eExclusive
     };
     VmaAllocationCreateInfo alloc_create_info = { .pool = vma_pool };
@@ -441,8 +540,12 @@ std::pair<vk::Buffer, void*> getMappedBufferForFrame(size_t size) {
     vmaCreateBuffer(allocator, &*buf_create_info, &alloc_create_info, &raw_buf, &alloc, &info);
     vk::Buffer vk_buf = vk::Buffer(raw_buf);
 
+    if (info.size < size) {
+        Helpers::panic("Cache::getMappedBufferForFrame: could not allocate full buffer");
+    }
+
     allocations_to_clear[frame_idx].push_back({ .buf = vk_buf, .alloc = alloc });
-    return { vk_buf, (void*)info.pMappedData };
+    return { vk_buf, 0, (void*)info.pMappedData };
 }
 
 // This function exists to allow us to track memory pages without necessarily tying them to a Vulkan buffer.
@@ -457,20 +560,19 @@ void track(void* base, size_t size, std::function<void(uptr)> callback) {
     const u64    page = aligned_base >> page_bits;
     const u64    page_end = page + size_in_pages;
 
-    auto lk = std::unique_lock<std::mutex>(cache_mtx);
+    auto lk = std::unique_lock<std::shared_mutex>(cache_mtx);
 
     // Check if we already tracked this region
-    if (tracked.contains(page)) {
+    if (auto it = tracked.findContaining(page)) {
         // Check if we need to re-track due to size changes
-        auto* buf = tracked[page];
+        auto* buf = *it;
         const bool size_changed = page_end > buf->page_end;
 
         if (size_changed) {
+            // Update page range index
+            tracked.resize(buf->page, buf, page_end);
             buf->page_end = page_end;
-            // Update page table
             buf->size = (page_end - buf->page) << page_bits;
-            for (u64 i = 0; i < buf->page_end - buf->page; i++)
-                tracked[buf->page + i] = buf;
         }
 
         buf->protect();
@@ -486,23 +588,22 @@ void track(void* base, size_t size, std::function<void(uptr)> callback) {
     buf->page_end = page_end;
     buf->size = aligned_size;
     buf->callback = callback;
-    for (u64 i = 0; i < size_in_pages; i++)
-        tracked[page + i] = buf;
+    tracked.insert(page, page_end, buf);
     buf->protect();
     buf->count++;
 }
 
 // Unprotects a page
 void unprotect(u64 page) {
-    auto lk = std::unique_lock<std::mutex>(cache_mtx);
-
-    auto buf = tracked.find(page);
-    if (buf != tracked.end()) {
-        buf->second->count--;
-        if (buf->second->count == 0) {
-            buf->second->unprotect();
-            delete buf->second;
-            tracked.erase(buf);
+    auto lk = std::unique_lock<std::shared_mutex>(cache_mtx);
+
+    if (auto it = tracked.findContaining(page)) {
+        auto* buf = *it;
+        buf->count--;
+        if (buf->count == 0) {
+            buf->unprotect();
+            tracked.erase(buf->page, buf);
+            delete buf;
         }
     }
     //else printf("Cache::unprotect: page 0x%llx was not tracked\n", page);
@@ -517,20 +618,19 @@ bool resetDirty(void* base, size_t size) {
     const u64    page = aligned_base >> page_bits;
     const u64    page_end = page + size_in_pages;
 
-    auto lk = std::unique_lock<std::mutex>(cache_mtx);
+    auto lk = std::unique_lock<std::shared_mutex>(cache_mtx);
 
     // Check if we already cached this buffer
-    if (tracked.contains(page)) {
+    if (auto it = tracked.findContaining(page)) {
         // Check if we need to reupload the buffer
-        auto* buf = tracked[page];
+        auto* buf = *it;
         const bool size_changed = page_end > buf->page_end;
 
         if (size_changed) {
+            // Update page range index
+            tracked.resize(buf->page, buf, page_end);
             buf->page_end = page_end;
-            // Update page table
             buf->size = (page_end - buf->page) << page_bits;
-            for (u64 i = 0; i < buf->page_end - buf->page; i++)
-                tracked[buf->page + i] = buf;
         }
 
         buf->dirty = false;
@@ -551,14 +651,14 @@ bool isDirty(void* base, size_t size) {
     const u64    page = aligned_base >> page_bits;
     const u64    page_end = page + size_in_pages;
 
-    auto lk = std::unique_lock<std::mutex>(cache_mtx);
+    auto lk = std::shared_lock<std::shared_mutex>(cache_mtx);
 
-    if (tracked.contains(page)) return tracked[page]->dirty;
+    if (auto it = tracked.findContaining(page)) return (*it)->dirty;
     else Helpers::panic("Cache::isDirty: cache error");
 }
 
 void clear() {
-    auto lk = std::unique_lock<std::mutex>(cache_mtx);
+    auto lk = std::unique_lock<std::shared_mutex>(cache_mtx);
 
     {
         //Profiler::Scope profiler("Buffer cleanup");
@@ -568,6 +668,16 @@ void clear() {
         allocations_to_clear[frame_idx].clear();
     }
 
+    {
+        // Rewind the staging buffer, growing it if it overflowed the last time this frame was recorded
+        auto& staging = staging_bufs[frame_idx];
+        if (staging.requested > staging.size && staging.size < STAGING_BUFFER_MAX_SIZE)
+            createStagingBuffer(staging, std::clamp<size_t>(std::bit_ceil(staging.requested), STAGING_BUFFER_MIN_SIZE, STAGING_BUFFER_MAX_SIZE));
+        staging.offset = 0;
+        staging.requested = 0;
+        staging_frames++;
+    }
+
     {
         //Profiler::Scope profiler("Buffer hash cache cleanup");
         for (auto& [hash, buf] : hash_cache[frame_idx]) {
@@ -578,4 +688,22 @@ void clear() {
     }
 }
 
+// Prints and resets the write fault and staging statistics gathered since the last call
+void printStats() {
+    static auto last_print = std::chrono::steady_clock::now();
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed_s = std::chrono::duration<double>(now - last_print).count();
+    last_print = now;
+
+    const u64 faults = fault_count.exchange(0);
+    const u64 ns = fault_ns.exchange(0);
+    const u64 pages = pages_invalidated.exchange(0);
+    const u64 frames = staging_frames.exchange(0);
+    const u64 streamed = staging_bytes.exchange(0);
+    const u64 stalls = staging_stalls.exchange(0);
+    printf("------ Cache ------\n");
+    printf("%llu write faults (avg %.2f us per fault), %.0f pages invalidated per second\n", faults, faults ? (double)ns / faults / 1000.0 : 0.0, elapsed_s > 0 ? pages / elapsed_s : 0.0);
+    printf("%.2f MB streamed per frame, %llu staging ring stalls in %llu frames\n", frames ? (double)streamed / frames / 1_MB : 0.0, stalls, frames);
+}
+
 }   // End namespace PS4::GCN::Vulkan::Cache
\ No newline at end of file
@@ -12,14 +12,16 @@ namespace PS4::GCN::Vulkan::Cache {
 inline size_t page_size = 0;
 inline u32    page_bits = 0;
 
+void initFaultHandler();
 void init();
 std::tuple<vk::Buffer, size_t, bool> getBuffer(void* base, size_t size);
 void barrier();
-std::pair<vk::Buffer, void*> getMappedBufferForFrame(size_t size);
+std::tuple<vk::Buffer, size_t, void*> getMappedBufferForFrame(size_t size);
 void track(void* base, size_t size, std::function<void(uptr)> callback);
 void unprotect(u64 page);
 bool resetDirty(void* base, size_t size);
 bool isDirty(void* base, size_t size);
 void clear();
+void printStats();
 
 }   // End namespace PS4::GCN::Vulkan::Cache
\ No newline at end of file
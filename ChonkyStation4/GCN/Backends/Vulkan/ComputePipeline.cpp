@@ -60,7 +60,7 @@ ComputePipeline::ComputePipeline(ShaderCache::CachedShader* compute_shader) : co
         .stage = stage_info,
         .layout = *pipeline_layout
     };
-    compute_pipeline = vk::raii::Pipeline(device, nullptr, cpci);
+    compute_pipeline = vk::raii::Pipeline(device, vk_pipeline_cache, cpci);
 }
 
 std::vector<vk::WriteDescriptorSet> ComputePipeline::uploadBuffersAndTextures(PushConstants** push_constants_ptr, TrackedTexture* rt, bool* has_feedback_loop) {
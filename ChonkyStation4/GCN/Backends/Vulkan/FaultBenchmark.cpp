@@ -0,0 +1,54 @@
+#include "FaultBenchmark.hpp"
+#include <GCN/Backends/Vulkan/BufferCache.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+
+namespace PS4::GCN::Vulkan::Cache {
+
+void benchmarkFaults(int n_pages, int iterations) {
+    if (n_pages <= 0 || iterations <= 0) return;
+    initFaultHandler();
+    printf("Write protecting and faulting %d pages of %lld bytes %d times\n", n_pages, page_size, iterations);
+
+    // One page of slack to align the pages, nothing else lives in them
+    auto mem = std::make_unique<u8[]>((size_t)(n_pages + 1) * page_size);
+    u8* pages = (u8*)Helpers::alignUp<uptr>((uptr)mem.get(), page_size);
+
+    // Every page is tracked on its own, so that each of them faults once
+    std::atomic<u64> n_callbacks = 0;
+    for (int i = 0; i < n_pages; i++)
+        track(pages + (size_t)i * page_size, page_size, [&](uptr addr) { n_callbacks++; });
+
+    double protect_s = 0;
+    double fault_s = 0;
+    u64 n_dirty = 0;
+    for (int it = 0; it < iterations; it++) {
+        // The pages are already protected by track() on the first iteration
+        const auto protect_start = std::chrono::steady_clock::now();
+        if (it) {
+            for (int i = 0; i < n_pages; i++)
+                resetDirty(pages + (size_t)i * page_size, page_size);
+        }
+        const auto fault_start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n_pages; i++)
+            *(volatile u8*)(pages + (size_t)i * page_size) = (u8)it;
+        const auto end = std::chrono::steady_clock::now();
+
+        protect_s += std::chrono::duration<double>(fault_start - protect_start).count();
+        fault_s += std::chrono::duration<double>(end - fault_start).count();
+        for (int i = 0; i < n_pages; i++)
+            n_dirty += isDirty(pages + (size_t)i * page_size, page_size);
+    }
+
+    for (int i = 0; i < n_pages; i++)
+        unprotect(((uptr)pages >> page_bits) + i);
+
+    const u64 n_faults = (u64)n_pages * iterations;
+    printf("protect  %.3f ms (%.2f us per page)\n", protect_s * 1000.0, iterations > 1 ? protect_s * 1e6 / ((u64)n_pages * (iterations - 1)) : 0.0);
+    printf("fault    %.3f ms (%.2f us per fault, %.0f pages per second)\n", fault_s * 1000.0, fault_s * 1e6 / n_faults, fault_s > 0 ? n_faults / fault_s : 0.0);
+    printf("%llu/%llu pages marked dirty, %llu/%llu callbacks\n", n_dirty, n_faults, n_callbacks.load(), n_faults);
+}
+
+}   // End namespace PS4::GCN::Vulkan::Cache
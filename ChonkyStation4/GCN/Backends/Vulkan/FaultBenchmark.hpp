@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::GCN::Vulkan::Cache {
+
+// Tracks n_pages pages of host memory, then write protects them and writes one byte to each of them, iterations times.
+// Prints the cost of every write fault and how many pages per second get invalidated, and checks that every page was marked dirty.
+void benchmarkFaults(int n_pages, int iterations);
+
+}   // End namespace PS4::GCN::Vulkan::Cache
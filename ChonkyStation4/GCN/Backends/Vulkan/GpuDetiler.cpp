@@ -0,0 +1,266 @@
+#include "GpuDetiler.hpp"
+#include <Logger.hpp>
+#include <Configuration.hpp>
+#include <GCN/Backends/Vulkan/VulkanCommon.hpp>
+#include <GCN/Backends/Vulkan/BufferCache.hpp>
+#include <GCN/Backends/Vulkan/GLSLCompiler.hpp>
+#include <algorithm>
+#include <array>
+
+
+namespace PS4::GCN::Vulkan::GpuDetiler {
+
+MAKE_LOG_FUNCTION(log, gcn_vulkan_renderer);
+
+static constexpr u32 MICRO_TILE_SIZE = 8;
+static constexpr u32 MICRO_TILE_ELEMS = MICRO_TILE_SIZE * MICRO_TILE_SIZE;
+
+// One workgroup per micro tile.
+// The table starts with the offsets of the 64 elements of a micro tile relative to its first element,
+// followed by the offset of the first element of every micro tile.
+static const std::string detile_shader = R"(
+#version 450
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly  buffer Src   { uint src[]; };
+layout(std430, binding = 1) writeonly buffer Dst   { uint dst[]; };
+layout(std430, binding = 2) readonly  buffer Table { uint table[]; };
+
+layout(push_constant) uniform Params {
+    uint width;
+    uint height;
+    uint depth;
+    uint tiles_x;
+    uint tiles_y;
+    uint words_per_elem;
+};
+
+void main() {
+    const uvec3 id = gl_GlobalInvocationID;
+    if (id.x >= width || id.y >= height || id.z >= depth) return;
+
+    const uint tile = (id.z * tiles_y + id.y / 8) * tiles_x + id.x / 8;
+    const uint src_off = (table[64 + tile] + table[gl_LocalInvocationIndex]) / 4;
+    const uint dst_off = ((id.z * height + id.y) * width + id.x) * words_per_elem;
+    for (uint i = 0; i < words_per_elem; i++)
+        dst[dst_off + i] = src[src_off + i];
+}
+)";
+
+struct PushConstants {
+    u32 width;
+    u32 height;
+    u32 depth;
+    u32 tiles_x;
+    u32 tiles_y;
+    u32 words_per_elem;
+};
+
+bool initialized = false;
+vk::raii::DescriptorSetLayout descriptor_set_layout = nullptr;
+vk::raii::PipelineLayout pipeline_layout = nullptr;
+vk::raii::Pipeline pipeline = nullptr;
+
+static void init() {
+    std::array<vk::DescriptorSetLayoutBinding, 3> layout_bindings;
+    for (u32 i = 0; i < layout_bindings.size(); i++)
+        layout_bindings[i] = vk::DescriptorSetLayoutBinding(i, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr);
+
+    vk::DescriptorSetLayoutCreateInfo layout_info = {
+        .flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+        .bindingCount = (u32)layout_bindings.size(),
+        .pBindings = layout_bindings.data()
+    };
+    descriptor_set_layout = vk::raii::DescriptorSetLayout(device, layout_info);
+
+    vk::PushConstantRange push_constant_range = {
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(PushConstants)
+    };
+    vk::PipelineLayoutCreateInfo pipeline_layout_info = { .setLayoutCount = 1, .pSetLayouts = &*descriptor_set_layout, .pushConstantRangeCount = 1, .pPushConstantRanges = &push_constant_range };
+    pipeline_layout = vk::raii::PipelineLayout(device, pipeline_layout_info);
+
+    vk::raii::ShaderModule shader = createShaderModule(GCN::compileGLSL(detile_shader, EShLangCompute, "detile.comp"));
+    vk::ComputePipelineCreateInfo cpci = {
+        .stage = { .stage = vk::ShaderStageFlagBits::eCompute, .module = *shader, .pName = "main" },
+        .layout = *pipeline_layout
+    };
+    pipeline = vk::raii::Pipeline(device, vk_pipeline_cache, cpci);
+    initialized = true;
+}
+
+bool isEnabledFor(GnmTileMode tile_mode) {
+    return std::find(Configuration::gpu_detile_tile_modes.begin(), Configuration::gpu_detile_tile_modes.end(), (u32)tile_mode) != Configuration::gpu_detile_tile_modes.end();
+}
+
+static void recordDetile(vk::raii::CommandBuffer& cmd, const vk::DescriptorBufferInfo (&buf_infos)[3], const PushConstants& params) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+
+    std::array<vk::WriteDescriptorSet, 3> descriptor_writes;
+    for (u32 i = 0; i < descriptor_writes.size(); i++) {
+        descriptor_writes[i] = vk::WriteDescriptorSet {
+            .dstSet = nullptr,  // Not used for push descriptors
+            .dstBinding = i,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .pBufferInfo = &buf_infos[i]
+        };
+    }
+    cmd.pushDescriptorSetKHR(vk::PipelineBindPoint::eCompute, *pipeline_layout, 0, descriptor_writes);
+    vkCmdPushConstants(*cmd, *pipeline_layout, static_cast<VkShaderStageFlagBits>(vk::ShaderStageFlagBits::eCompute), 0, sizeof(PushConstants), &params);
+    cmd.dispatch(params.tiles_x, params.tiles_y, params.depth);
+}
+
+// Runs the shader in a separate submission into a readback buffer, waits for it and compares the result with the CPU detiler.
+// The source and table buffers are the ones that were just written for the frame, the host writes are visible to the submission.
+static void validate(const void* src, size_t src_size, const GpaTextureInfo& tex_info, const vk::DescriptorBufferInfo (&buf_infos)[3], const PushConstants& params) {
+    const size_t dst_size = buf_infos[1].range;
+    std::vector<u8> expected(dst_size);
+    const GpaError err = gpaTileTextureIndexed(src, src_size, expected.data(), expected.size(), &tex_info, GNM_TM_DISPLAY_LINEAR_GENERAL, 0, 0);
+    if (err != GPA_ERR_OK) {
+        printf("GpuDetiler: CPU detiler failed with error %d, can't validate\n", err);
+        return;
+    }
+
+    const vk::BufferCreateInfo buf_create_info = {
+        .size = dst_size,
+        .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+        .sharingMode = vk::SharingMode::eExclusive
+    };
+    VmaAllocationCreateInfo alloc_create_info = {};
+    alloc_create_info.usage = VMA_MEMORY_USAGE_AUTO;
+    alloc_create_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    VkBuffer raw_buf;
+    VmaAllocation alloc;
+    VmaAllocationInfo alloc_info;
+    if (vmaCreateBuffer(allocator, &*buf_create_info, &alloc_create_info, &raw_buf, &alloc, &alloc_info) != VK_SUCCESS) {
+        printf("GpuDetiler: failed to allocate the readback buffer, can't validate\n");
+        return;
+    }
+
+    vk::DescriptorBufferInfo readback_infos[3] = { buf_infos[0], buf_infos[1], buf_infos[2] };
+    readback_infos[1] = { .buffer = vk::Buffer(raw_buf), .offset = 0, .range = dst_size };
+
+    auto cmd = beginCommands();
+    recordDetile(cmd, readback_infos, params);
+    vk::MemoryBarrier barrier = {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eHostRead
+    };
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, barrier, {}, {});
+    endCommands(cmd);
+    vmaInvalidateAllocation(allocator, alloc, 0, VK_WHOLE_SIZE);
+
+    const u8* result = (const u8*)alloc_info.pMappedData;
+    const u32 elem_size = params.words_per_elem * 4;
+    u64 n_mismatches = 0;
+    for (u32 z = 0; z < params.depth; z++) {
+        for (u32 y = 0; y < params.height; y++) {
+            for (u32 x = 0; x < params.width; x++) {
+                const u64 off = (((u64)z * params.height + y) * params.width + x) * elem_size;
+                if (std::memcmp(&result[off], &expected[off], elem_size) == 0) continue;
+                if (n_mismatches++ == 0)
+                    printf("GpuDetiler: first mismatch at (%d, %d, %d) for tile mode %d\n", x, y, z, tex_info.tm);
+            }
+        }
+    }
+    if (n_mismatches)
+        printf("GpuDetiler: %llu/%llu texels differ for a %dx%dx%d texture with tile mode %d\n", n_mismatches, (u64)params.width * params.height * params.depth, params.width, params.height, params.depth, tex_info.tm);
+    else
+        log("GpuDetiler: %dx%dx%d texture with tile mode %d matches the CPU detiler\n", params.width, params.height, params.depth, tex_info.tm);
+
+    vmaDestroyBuffer(allocator, raw_buf, alloc);
+}
+
+bool detile(const void* src, size_t src_size, const GpaTextureInfo& tex_info, vk::Buffer* out_buf, size_t* out_offset, size_t* out_size) {
+    GpaTextureInfo out_tex_info = tex_info;
+    out_tex_info.tm = GNM_TM_DISPLAY_LINEAR_GENERAL;
+
+    GpaTilingParams src_tp = {};
+    if (gpaTpInit(&src_tp, &tex_info, 0, 0) != GPA_ERR_OK) return false;
+
+    uint64_t src_surf_size = 0;
+    uint64_t src_surf_off = 0;
+    uint64_t dst_surf_size = 0;
+    uint64_t dst_surf_off = 0;
+    if (gpaComputeSurfaceSizeOffset(&src_surf_size, &src_surf_off, &tex_info, 0, 0) != GPA_ERR_OK) return false;
+    if (gpaComputeSurfaceSizeOffset(&dst_surf_size, &dst_surf_off, &out_tex_info, 0, 0) != GPA_ERR_OK) return false;
+    // Offsets in the table are 32 bit, and the texture is copied to the image from the start of the buffer
+    if (src_surf_off + src_surf_size > src_size || src_surf_size > UINT32_MAX || dst_surf_off != 0) return false;
+
+    GpaSurfaceContext ctx = {};
+    if (gpaInitSurfaceContext(&ctx, src_surf_size, &src_tp) != GPA_ERR_OK) return false;
+    // The shader copies whole dwords
+    if (ctx.bitsperelement % 32) return false;
+
+    uint64_t elem_offsets[MICRO_TILE_ELEMS];
+    uint64_t max_elem_offset = 0;
+    if (gpaComputeMicroTileOffsets(elem_offsets, &max_elem_offset, &ctx) != GPA_ERR_OK) return false;
+
+    const u32 elem_size = ctx.bitsperelement / 8;
+    const PushConstants params = {
+        .width = ctx.linearwidth,
+        .height = ctx.linearheight,
+        .depth = ctx.lineardepth,
+        .tiles_x = (ctx.linearwidth + MICRO_TILE_SIZE - 1) / MICRO_TILE_SIZE,
+        .tiles_y = (ctx.linearheight + MICRO_TILE_SIZE - 1) / MICRO_TILE_SIZE,
+        .words_per_elem = elem_size / 4
+    };
+    const size_t dst_size = std::max<size_t>(dst_surf_size, (size_t)params.width * params.height * params.depth * elem_size);
+
+    // Build the table
+    std::vector<u32> table(MICRO_TILE_ELEMS + (size_t)params.tiles_x * params.tiles_y * params.depth);
+    for (u32 i = 0; i < MICRO_TILE_ELEMS; i++)
+        table[i] = (u32)elem_offsets[i];
+
+    u32* tile_offsets = &table[MICRO_TILE_ELEMS];
+    for (u32 z = 0; z < params.depth; z++) {
+        for (u32 ty = 0; ty < params.tiles_y; ty++) {
+            for (u32 tx = 0; tx < params.tiles_x; tx++) {
+                uint64_t offset = 0;
+                if (gpaComputeSurfaceCoord(&offset, nullptr, &ctx, tx * MICRO_TILE_SIZE, ty * MICRO_TILE_SIZE, z, 0) != GPA_ERR_OK) return false;
+                if (offset + max_elem_offset + elem_size > src_surf_size) return false;
+                *tile_offsets++ = (u32)offset;
+            }
+        }
+    }
+
+    if (!initialized) init();
+
+    // Upload the tiled texture and the table as they are
+    const size_t src_buf_size = Helpers::alignUp<size_t>(src_surf_size, 4);
+    const size_t table_size = table.size() * sizeof(u32);
+    auto [src_buf, src_offset, src_ptr] = Cache::getMappedBufferForFrame(src_buf_size);
+    std::memcpy(src_ptr, (const u8*)src + src_surf_off, src_surf_size);
+    auto [table_buf, table_offset, table_ptr] = Cache::getMappedBufferForFrame(table_size);
+    std::memcpy(table_ptr, table.data(), table_size);
+    auto [dst_buf, dst_offset, dst_ptr] = Cache::getMappedBufferForFrame(dst_size);
+
+    // Detile
+    const vk::DescriptorBufferInfo buf_infos[3] = {
+        { .buffer = src_buf,   .offset = src_offset,   .range = src_buf_size },
+        { .buffer = dst_buf,   .offset = dst_offset,   .range = dst_size },
+        { .buffer = table_buf, .offset = table_offset, .range = table_size },
+    };
+    if (Configuration::gpu_detile_validate)
+        validate(src, src_size, tex_info, buf_infos, params);
+
+    auto& cmd = cmd_bufs[frame_idx];
+    recordDetile(cmd, buf_infos, params);
+
+    // Make the detiled texture visible to the copy to the image
+    vk::MemoryBarrier barrier = {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead
+    };
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, barrier, {}, {});
+
+    *out_buf = dst_buf;
+    *out_offset = dst_offset;
+    *out_size = dst_size;
+    return true;
+}
+
+}   // End namespace PS4::GCN::Vulkan::GpuDetiler
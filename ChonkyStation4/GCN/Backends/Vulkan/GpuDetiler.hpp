@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Common.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <GCN/Detiler/gpuaddr.h>
+
+
+namespace PS4::GCN::Vulkan::GpuDetiler {
+
+// Returns true if textures with this tile mode were selected to be detiled on the GPU (see --gpu-detile)
+bool isEnabledFor(GnmTileMode tile_mode);
+
+// Uploads the first mip and slice of a tiled texture as is, and records a compute dispatch that detiles it into a linear buffer,
+// laid out like the output of gpaTileTextureAll with GNM_TM_DISPLAY_LINEAR_GENERAL.
+// The CPU only computes one address per 8x8 micro tile, the per-texel addressing is done by the shader.
+// Returns false without recording anything if the texture can't be detiled on the GPU, in which case the caller has to use the CPU detiler.
+bool detile(const void* src, size_t src_size, const GpaTextureInfo& tex_info, vk::Buffer* out_buf, size_t* out_offset, size_t* out_size);
+
+}   // End namespace PS4::GCN::Vulkan::GpuDetiler
@@ -17,14 +17,14 @@ namespace PS4::GCN::Vulkan {
 
 MAKE_LOG_FUNCTION(log, gcn_vulkan_renderer);
 
-Pipeline::Pipeline(ShaderCache::CachedShader* vert_shader, ShaderCache::CachedShader* pixel_shader, FetchShader fetch_shader, PipelineConfig& cfg) : vert_shader(vert_shader), pixel_shader(pixel_shader), fetch_shader(fetch_shader), cfg(cfg) {
+Pipeline::Pipeline(ShaderCache::CachedShader* vert_shader, ShaderCache::CachedShader* pixel_shader, FetchShader fetch_shader, const std::vector<VSharp>& vsharps, PipelineConfig& cfg) : vert_shader(vert_shader), pixel_shader(pixel_shader), fetch_shader(fetch_shader), cfg(cfg) {
     // Iterate over fetch shader bindings and convert them to vulkan binding/attribute descriptions, and create the vertex buffers
     std::vector<vk::VertexInputBindingDescription> bindings;
     std::vector<vk::VertexInputAttributeDescription> attribs;
     u32 n_binding = 0;
     for (auto& shader_binding : fetch_shader.bindings) {
-        // Get pointer to the V#
-        VSharp* vsharp = shader_binding.vsharp_loc.asPtr();
+        // Get the V# snapshot
+        const VSharp* vsharp = &vsharps[n_binding];
         auto& binding = bindings.emplace_back();
         auto& attrib = attribs.emplace_back();
         binding = { n_binding, (u32)vsharp->stride, !shader_binding.instance_rate ? vk::VertexInputRate::eVertex : vk::VertexInputRate::eInstance };
@@ -402,7 +402,7 @@ Pipeline::Pipeline(ShaderCache::CachedShader* vert_shader, ShaderCache::CachedSh
     rendering_info.stencilAttachmentFormat = vk::Format::eD32SfloatS8Uint;
 
     vk::StructureChain<vk::GraphicsPipelineCreateInfo, vk::PipelineRenderingCreateInfo> pipeline_create_info_chain(gpci, rendering_info);
-    graphics_pipeline = vk::raii::Pipeline(device, nullptr, pipeline_create_info_chain.get());
+    graphics_pipeline = vk::raii::Pipeline(device, vk_pipeline_cache, pipeline_create_info_chain.get());
 }
 
 std::vector<Pipeline::VertexBinding>* Pipeline::gatherVertices() {
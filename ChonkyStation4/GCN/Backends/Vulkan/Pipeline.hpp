@@ -4,6 +4,7 @@
 #include <BitField.hpp>
 #include <vulkan/vulkan_raii.hpp>
 #include <GCN/FetchShader.hpp>
+#include <GCN/VSharp.hpp>
 #include <GCN/Shader/ShaderDecompiler.hpp>
 #include <GCN/Backends/Vulkan/ShaderCache.hpp>
 #include <GCN/Backends/Vulkan/VulkanCommon.hpp>
@@ -221,7 +222,9 @@ struct PipelineConfig {
 
 class Pipeline {
 public:
-    Pipeline(ShaderCache::CachedShader* vert_shader, ShaderCache::CachedShader* pixel_shader, FetchShader fetch_shader, PipelineConfig& cfg);
+    // vsharps holds a copy of the V# of each fetch shader binding, taken when the pipeline was requested.
+    // The pipeline can be built on a worker thread, so it can't read them from the live GPU state.
+    Pipeline(ShaderCache::CachedShader* vert_shader, ShaderCache::CachedShader* pixel_shader, FetchShader fetch_shader, const std::vector<VSharp>& vsharps, PipelineConfig& cfg);
     ShaderCache::CachedShader* vert_shader;
     ShaderCache::CachedShader* pixel_shader;
     vk::raii::ShaderModule tess_control_shader = nullptr;
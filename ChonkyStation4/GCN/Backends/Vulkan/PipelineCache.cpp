@@ -1,11 +1,21 @@
 #include "PipelineCache.hpp"
 #include <Logger.hpp>
+#include <Configuration.hpp>
+#include <ThreadPool.hpp>
+#include <MappedFile.hpp>
 #include <GCN/FetchShader.hpp>
 #include <GCN/VSharp.hpp>
 #include <GCN/RegisterOffsets.hpp>
+#include <GCN/Backends/Renderer.hpp>
 #include <GCN/Backends/Vulkan/ShaderCache.hpp>
 #include <unordered_map>
+#include <unordered_set>
+#include <fstream>
 #include <memory>
+#include <future>
+#include <chrono>
+#include <bit>
+#include <initializer_list>
 #include <xxhash.h>
 
 
@@ -16,170 +26,495 @@ MAKE_LOG_FUNCTION(log, gcn_vulkan_renderer);
 std::unordered_map<u64, Pipeline*> pipelines;
 std::unordered_map<u64, ComputePipeline*> compute_pipelines;
 
-Pipeline& getPipeline(const u8* vert_shader_code, const u8* pixel_shader_code, const u8* fetch_shader_code, const u32* regs) {
-    // Compile shaders
+// Shaders are decompiled on the GCN thread (the decompiler reads the current GPU state),
+// everything else (glslang, shader modules and Vulkan pipeline creation) happens on the worker pool.
+std::unique_ptr<Helpers::ThreadPool> compiler_pool;
+std::unordered_map<u64, std::future<Pipeline*>> pending_pipelines;
+std::unordered_map<u64, std::future<ComputePipeline*>> pending_compute_pipelines;
+
+// Stats
+std::atomic<u64> compiled_count = 0;
+std::atomic<u64> compile_us = 0;
+std::atomic<u64> skipped_draws = 0;
+u64 reused_pipelines = 0;
+u64 prewarmed_count = 0;
+
+// Per-title pipeline database.
+// Every pipeline requested during a run is appended here along with everything needed to build it again without the guest state
+// (the config, the fetch shader bindings and a copy of their V#s). On the next launch they are all rebuilt on the worker pool
+// from the disk shader cache before the title starts drawing.
+// The driver side of the compilation is cached separately in the VkPipelineCache blob.
+// Bump PIPELINE_DB_VERSION when PipelineConfig or the layout below changes.
+
+static constexpr u32 PIPELINE_DB_MAGIC   = 0x42445043;  // "CPDB"
+static constexpr u32 PIPELINE_DB_VERSION = 2;
+
+struct PipelineDbHeader {
+    u32 magic;
+    u32 version;
+};
+
+enum class PipelineDbEntryType : u32 {
+    Graphics,
+    Compute
+};
+
+struct PipelineDbEntry {
+    u64 hash;           // Pipeline hash for graphics pipelines, compute shader hash for compute pipelines
+    u32 size;           // Total size of the entry in bytes, including this header
+    PipelineDbEntryType type;
+    u32 n_bindings;     // Followed by n_bindings FetchShaderVertexBinding and n_bindings VSharp
+    u32 reserved;
+    PipelineConfig cfg;
+};
+
+static_assert(std::is_trivially_copyable_v<PipelineConfig> && std::is_trivially_copyable_v<FetchShaderVertexBinding> && std::is_trivially_copyable_v<VSharp>);
+
+fs::path pipeline_db_path;
+fs::path vk_pipeline_cache_path;
+std::ofstream pipeline_db_out;
+std::unordered_set<u64> recorded_pipelines;
+
+// Set when a pipeline is built, the VkPipelineCache blob is written back to disk by flush()
+std::atomic<bool> vk_pipeline_cache_dirty = false;
+std::atomic<bool> vk_pipeline_cache_flushing = false;
+std::chrono::steady_clock::time_point last_flush;
+static constexpr auto FLUSH_INTERVAL = std::chrono::seconds(10);
+
+template <typename T>
+static std::future<T*> compileAsync(std::function<T*()> build) {
+    return compiler_pool->submit([build]() -> T* {
+        const auto start = std::chrono::steady_clock::now();
+        T* pipeline = build();
+        const auto end = std::chrono::steady_clock::now();
+        compiled_count++;
+        vk_pipeline_cache_dirty = true;
+        compile_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        return pipeline;
+    });
+}
+
+static void loadVkPipelineCache() {
+    Helpers::MappedFile blob;
+    vk::PipelineCacheCreateInfo info = {};
+    // The driver validates the blob header itself and ignores it if it was created by a different driver or device
+    if (blob.open(vk_pipeline_cache_path)) {
+        info.initialDataSize = blob.size();
+        info.pInitialData = blob.data();
+    }
+    vk_pipeline_cache = vk::raii::PipelineCache(device, info);
+}
 
-    auto check_fetch_shader = [&]() -> bool {
-        // The fetch shader jump is always a s_swappc_b64, but it's not always at the second instruction (most of the time it is).
-        // Check the first 0x20 bytes.
-        for (int i = 0; i < 0x20; i += 4) {
-            if (*(u32*)(vert_shader_code + i) == 0xbe802100)
-                return true;
+static void loadPipelineDb() {
+    size_t valid_size = 0;
+    Helpers::MappedFile db;
+    if (db.open(pipeline_db_path) && db.size() >= sizeof(PipelineDbHeader)) {
+        const u8* ptr = db.data();
+        PipelineDbHeader header;
+        std::memcpy(&header, ptr, sizeof(header));
+
+        if (header.magic == PIPELINE_DB_MAGIC && header.version == PIPELINE_DB_VERSION) {
+            size_t offs = sizeof(PipelineDbHeader);
+            while (offs + sizeof(PipelineDbEntry) <= db.size()) {
+                // Entries aren't necessarily aligned in the file, copy them out
+                PipelineDbEntry entry;
+                std::memcpy(&entry, ptr + offs, sizeof(entry));
+                const size_t payload_size = entry.n_bindings * (sizeof(FetchShaderVertexBinding) + sizeof(VSharp));
+                if (entry.size != sizeof(PipelineDbEntry) + payload_size || offs + entry.size > db.size()) break;   // Truncated entry
+
+                if (recorded_pipelines.insert(entry.hash).second) {
+                    if (entry.type == PipelineDbEntryType::Graphics) {
+                        // Both shaders have to be in the disk cache, otherwise the pipeline will be built when the title first uses it
+                        auto* vert_shader  = entry.cfg.has_vs ? ShaderCache::getCachedShader(entry.cfg.vertex_hash, Shader::ShaderStage::Vertex) : nullptr;
+                        auto* pixel_shader = entry.cfg.has_ps ? ShaderCache::getCachedShader(entry.cfg.pixel_hash, Shader::ShaderStage::Fragment) : nullptr;
+                        if (vert_shader && (pixel_shader || !entry.cfg.has_ps)) {
+                            FetchShader fetch_shader = FetchShader(nullptr);
+                            std::vector<VSharp> vsharps(entry.n_bindings);
+                            fetch_shader.bindings.resize(entry.n_bindings);
+                            const u8* bindings_ptr = ptr + offs + sizeof(PipelineDbEntry);
+                            std::memcpy(fetch_shader.bindings.data(), bindings_ptr, entry.n_bindings * sizeof(FetchShaderVertexBinding));
+                            std::memcpy(vsharps.data(), bindings_ptr + entry.n_bindings * sizeof(FetchShaderVertexBinding), entry.n_bindings * sizeof(VSharp));
+
+                            auto cfg = entry.cfg;
+                            pending_pipelines.emplace(entry.hash, compileAsync<Pipeline>([=]() mutable {
+                                return new Pipeline(vert_shader, pixel_shader, fetch_shader, vsharps, cfg);
+                            }));
+                            prewarmed_count++;
+                        }
+                    }
+                    else if (auto* compute_shader = ShaderCache::getCachedShader(entry.hash, Shader::ShaderStage::Compute)) {
+                        pending_compute_pipelines.emplace(entry.hash, compileAsync<ComputePipeline>([=]() {
+                            return new ComputePipeline(compute_shader);
+                        }));
+                        prewarmed_count++;
+                    }
+                }
+                offs += entry.size;
+            }
+            valid_size = offs;
         }
-        return false;
+        else log("Pipeline database %s is outdated, discarding it\n", pipeline_db_path.generic_string().c_str());
+    }
+    db.close();
+
+    // Start over if the database was invalid, and drop any truncated entry at the end of the file
+    if (valid_size == 0) {
+        pipeline_db_out.open(pipeline_db_path, std::ios::binary | std::ios::trunc);
+        const PipelineDbHeader header = { .magic = PIPELINE_DB_MAGIC, .version = PIPELINE_DB_VERSION };
+        pipeline_db_out.write((const char*)&header, sizeof(header));
+        pipeline_db_out.flush();
+    }
+    else {
+        if (valid_size < fs::file_size(pipeline_db_path))
+            fs::resize_file(pipeline_db_path, valid_size);
+        pipeline_db_out.open(pipeline_db_path, std::ios::binary | std::ios::app);
+    }
+}
+
+static void recordPipeline(u64 hash, PipelineDbEntryType type, const PipelineConfig* cfg = nullptr, const FetchShader* fetch_shader = nullptr, const std::vector<VSharp>* vsharps = nullptr) {
+    if (!pipeline_db_out.is_open() || !recorded_pipelines.insert(hash).second) return;
+
+    const u32 n_bindings = fetch_shader ? fetch_shader->bindings.size() : 0;
+    PipelineDbEntry entry = {
+        .hash = hash,
+        .size = (u32)(sizeof(PipelineDbEntry) + n_bindings * (sizeof(FetchShaderVertexBinding) + sizeof(VSharp))),
+        .type = type,
+        .n_bindings = n_bindings,
+        .reserved = 0
     };
+    if (cfg) entry.cfg = *cfg;
 
-    auto fetch_ptr = fetch_shader_code;
-    if (!check_fetch_shader())
-        fetch_ptr = nullptr;
+    pipeline_db_out.write((const char*)&entry, sizeof(entry));
+    if (n_bindings) {
+        pipeline_db_out.write((const char*)fetch_shader->bindings.data(), n_bindings * sizeof(FetchShaderVertexBinding));
+        pipeline_db_out.write((const char*)vsharps->data(), n_bindings * sizeof(VSharp));
+    }
+    pipeline_db_out.flush();
+}
 
-    GCN::FetchShader fetch_shader = FetchShader(fetch_ptr);
+void init() {
+    // Leave a couple of cores for the guest and the GCN thread
+    const size_t n_threads = std::max<s64>(1, (s64)std::thread::hardware_concurrency() - 2);
+    compiler_pool = std::make_unique<Helpers::ThreadPool>("Pipeline Compiler", n_threads);
 
-    PipelineConfig cfg;
-    const bool has_vs = vert_shader_code  != nullptr;
-    const bool has_ps = pixel_shader_code != nullptr;
-    cfg.has_vs = has_vs;
-    cfg.has_ps = has_ps;
+    // Has to happen after ShaderCache::init(), prewarming needs the disk shader cache
+    pipeline_db_path       = ShaderCache::getCacheDir() / "pipelines.bin";
+    vk_pipeline_cache_path = ShaderCache::getCacheDir() / "vk_pipeline_cache.bin";
+    loadVkPipelineCache();
+    loadPipelineDb();
+    last_flush = std::chrono::steady_clock::now();
 
+    log("Prewarming %lld pipelines from %s\n", prewarmed_count, pipeline_db_path.generic_string().c_str());
+}
+
+void flush() {
+    if (!vk_pipeline_cache_dirty || std::chrono::steady_clock::now() - last_flush < FLUSH_INTERVAL) return;
+    if (vk_pipeline_cache_flushing.exchange(true)) return;
+
+    last_flush = std::chrono::steady_clock::now();
+    vk_pipeline_cache_dirty = false;
+    compiler_pool->submit([]() {
+        // Write to a temporary file first, the emulator can be closed at any time
+        const auto data = vk_pipeline_cache.getData();
+        const auto tmp_path = fs::path(vk_pipeline_cache_path).concat(".tmp");
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            out.write((const char*)data.data(), data.size());
+        }
+        std::error_code ec;
+        fs::rename(tmp_path, vk_pipeline_cache_path, ec);
+        vk_pipeline_cache_flushing = false;
+    });
+}
+
+static u64 hashValues(std::initializer_list<u64> values) {
+    return XXH3_64bits(values.begin(), values.size() * sizeof(u64));
+}
+
+static u64 floatBits(float val) {
+    return std::bit_cast<u32>(val);
+}
+
+// Everything the previous draw derived from the registers.
+// Only the groups whose registers were written since then are rebuilt, the pipeline hash is then a hash of the per-group hashes.
+struct DrawState {
+    FetchShader fetch_shader = FetchShader(nullptr);
     ShaderCache::CachedShader* vert_shader  = nullptr;
     ShaderCache::CachedShader* pixel_shader = nullptr;
-    
-    if (!has_vs)
-        Helpers::panic("TODO: no vertex shader");
-
-    if (has_vs) {
-        vert_shader = ShaderCache::getShader(vert_shader_code, Shader::ShaderStage::Vertex, &fetch_shader);
-        cfg.vertex_hash = vert_shader->data.hash;
-    }
-    if (has_ps) {
-        pixel_shader = ShaderCache::getShader(pixel_shader_code, Shader::ShaderStage::Fragment, &fetch_shader);
-        cfg.pixel_hash  = pixel_shader->data.hash;
-    }
-
-    // Hash fetch shader V#s
-    XXH3_state_t* state = XXH3_createState();
-    XXH3_64bits_reset(state);
-    int index = 0;
-    for (auto& binding : fetch_shader.bindings) {
-        auto* vsharp = binding.vsharp_loc.asPtr();
-        const u64 stride = vsharp->stride;
-        const u64 nfmt = vsharp->nfmt;
-        const u64 dfmt = vsharp->dfmt;
-        XXH3_64bits_update(state, &index, sizeof(index));
-        XXH3_64bits_update(state, &stride, sizeof(stride));
-        XXH3_64bits_update(state, &nfmt, sizeof(nfmt));
-        XXH3_64bits_update(state, &dfmt, sizeof(dfmt));
-        index++;
-    }
-    cfg.binding_hash = XXH3_64bits_digest(state);
-
-    XXH3_freeState(state);
+    std::vector<VSharp> vsharps;
+    PipelineConfig cfg;
+
+    struct {
+        u64 shaders;
+        u64 bindings;
+        u64 primitive;
+        u64 blend;
+        u64 depth_stencil;
+        u64 viewport;
+    } hashes = {};
+    u64 pipeline_hash = 0;
+    Pipeline* pipeline = nullptr;
+};
+DrawState last_draw;
+
+// Reads the V#s used by the fetch shader. Returns true if anything that is part of the pipeline changed.
+// V#s are usually in memory rather than in the user data registers, so they have to be checked on every draw.
+// vs_key_changed is set if a field that is part of the vertex shader's key changed (see ShaderCache::getShader).
+static bool updateVSharps(DrawState& state, bool& vs_key_changed) {
+    bool changed = state.vsharps.size() != state.fetch_shader.bindings.size();
+    vs_key_changed = false;
+    state.vsharps.resize(state.fetch_shader.bindings.size());
+    for (int i = 0; i < state.vsharps.size(); i++) {
+        const VSharp* vsharp = state.fetch_shader.bindings[i].vsharp_loc.asPtr();
+        auto& prev = state.vsharps[i];
+        changed |= vsharp->stride != prev.stride || vsharp->nfmt != prev.nfmt || vsharp->dfmt != prev.dfmt;
+        vs_key_changed |= vsharp->nfmt != prev.nfmt || vsharp->dst_sel_x != prev.dst_sel_x || vsharp->dst_sel_y != prev.dst_sel_y
+                       || vsharp->dst_sel_z != prev.dst_sel_z || vsharp->dst_sel_w != prev.dst_sel_w;
+        prev = *vsharp;
+    }
+    return changed;
+}
+
+// Returns the pipeline for the state of the last draw, compiling it if needed
+static Pipeline* lookupPipeline(const DrawState& state) {
+    const u64 pipeline_hash = state.pipeline_hash;
+    if (auto it = pipelines.find(pipeline_hash); it != pipelines.end())
+        return it->second;
+
+    auto pending = pending_pipelines.find(pipeline_hash);
+    if (pending == pending_pipelines.end()) {
+        log("Compiling new pipeline\n");
+        recordPipeline(pipeline_hash, PipelineDbEntryType::Graphics, &state.cfg, &state.fetch_shader, &state.vsharps);
+        auto* vert_shader  = state.vert_shader;
+        auto* pixel_shader = state.pixel_shader;
+        auto fetch_shader  = state.fetch_shader;
+        auto vsharps       = state.vsharps;
+        auto cfg           = state.cfg;
+        pending = pending_pipelines.emplace(pipeline_hash, compileAsync<Pipeline>([=]() mutable {
+            if (vert_shader)  ShaderCache::compile(vert_shader);
+            if (pixel_shader) ShaderCache::compile(pixel_shader);
+            return new Pipeline(vert_shader, pixel_shader, fetch_shader, vsharps, cfg);
+        })).first;
+    }
+
+    // Skip the draw if the pipeline is still compiling and we are allowed to, otherwise wait for it
+    if (Configuration::async_pipeline_compilation && pending->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        skipped_draws++;
+        return nullptr;
+    }
+
+    auto* pipeline = pending->second.get();
+    pending_pipelines.erase(pending);
+    pipelines[pipeline_hash] = pipeline;
+    return pipeline;
+}
+
+Pipeline* getPipeline(const u8* vert_shader_code, const u8* pixel_shader_code, const u8* fetch_shader_code, const u32* regs, u32 dirty_groups) {
+    auto& state = last_draw;
+    auto& cfg = state.cfg;
+    bool changed = dirty_groups != 0;
+
+    // Compile shaders
+    if (dirty_groups & RegGroup::VertexShader) {
+        auto check_fetch_shader = [&]() -> bool {
+            // The fetch shader jump is always a s_swappc_b64, but it's not always at the second instruction (most of the time it is).
+            // Check the first 0x20 bytes.
+            for (int i = 0; i < 0x20; i += 4) {
+                if (*(u32*)(vert_shader_code + i) == 0xbe802100)
+                    return true;
+            }
+            return false;
+        };
+
+        auto fetch_ptr = fetch_shader_code;
+        if (!check_fetch_shader())
+            fetch_ptr = nullptr;
+        state.fetch_shader = FetchShader(fetch_ptr);
+        state.vsharps.clear();
+
+        cfg.has_vs = vert_shader_code != nullptr;
+        if (!cfg.has_vs)
+            Helpers::panic("TODO: no vertex shader");
+
+        state.vert_shader = ShaderCache::getShader(vert_shader_code, Shader::ShaderStage::Vertex, &state.fetch_shader);
+        cfg.vertex_hash = state.vert_shader->data.hash;
+    }
+    if (dirty_groups & RegGroup::PixelShader) {
+        cfg.has_ps = pixel_shader_code != nullptr;
+        state.pixel_shader = cfg.has_ps ? ShaderCache::getShader(pixel_shader_code, Shader::ShaderStage::Fragment, &state.fetch_shader) : nullptr;
+        cfg.pixel_hash = cfg.has_ps ? state.pixel_shader->data.hash : 0;
+    }
+
+    // Hash fetch shader V#s, and keep a copy of them in case we need to build the pipeline.
+    // The shaders are keyed on the V# formats and the T# types too, which are usually in memory.
+    // They have to be looked up again if only those changed.
+    bool vs_key_changed;
+    const bool vsharps_changed = updateVSharps(state, vs_key_changed);
+    vs_key_changed |= !ShaderCache::matchesState(state.vert_shader);
+    const bool ps_key_changed = cfg.has_ps && !ShaderCache::matchesState(state.pixel_shader);
+    if (vs_key_changed && !(dirty_groups & RegGroup::VertexShader)) {
+        state.vert_shader = ShaderCache::getShader(vert_shader_code, Shader::ShaderStage::Vertex, &state.fetch_shader);
+        cfg.vertex_hash = state.vert_shader->data.hash;
+        changed = true;
+    }
+    if (ps_key_changed) {
+        state.pixel_shader = ShaderCache::getShader(pixel_shader_code, Shader::ShaderStage::Fragment, &state.fetch_shader);
+        cfg.pixel_hash = state.pixel_shader->data.hash;
+        changed = true;
+    }
+    if (vs_key_changed || ps_key_changed || (dirty_groups & (RegGroup::VertexShader | RegGroup::PixelShader)))
+        state.hashes.shaders = hashValues({ cfg.has_vs, cfg.has_ps, cfg.vertex_hash, cfg.pixel_hash });
+
+    if (vsharps_changed || (dirty_groups & RegGroup::VertexShader)) {
+        XXH3_state_t* xxh_state = XXH3_createState();
+        XXH3_64bits_reset(xxh_state);
+        int index = 0;
+        for (auto& vsharp : state.vsharps) {
+            const u64 stride = vsharp.stride;
+            const u64 nfmt = vsharp.nfmt;
+            const u64 dfmt = vsharp.dfmt;
+            XXH3_64bits_update(xxh_state, &index, sizeof(index));
+            XXH3_64bits_update(xxh_state, &stride, sizeof(stride));
+            XXH3_64bits_update(xxh_state, &nfmt, sizeof(nfmt));
+            XXH3_64bits_update(xxh_state, &dfmt, sizeof(dfmt));
+            index++;
+        }
+        cfg.binding_hash = XXH3_64bits_digest(xxh_state);
+        XXH3_freeState(xxh_state);
+
+        state.hashes.bindings = cfg.binding_hash;
+        changed = true;
+    }
 
     // Primitive info
-    cfg.prim_type = regs[Reg::mmVGT_PRIMITIVE_TYPE__CI__VI];
+    if (dirty_groups & RegGroup::Primitive) {
+        cfg.prim_type = regs[Reg::mmVGT_PRIMITIVE_TYPE__CI__VI];
+        state.hashes.primitive = cfg.prim_type;
+    }
 
     // Color blending info
-    for (int i = 0; i < 8; i++) {
-        cfg.blend_control[i].raw = regs[Reg::mmCB_BLEND0_CONTROL + i];
-    }
-
-    // Color
-    cfg.degamma_enable = (regs[Reg::mmCB_COLOR_CONTROL] >> 3) & 1;
-
-    // Depth control
-    cfg.depth_control.raw   = regs[Reg::mmDB_DEPTH_CONTROL];
-    cfg.depth_clear_enable  = regs[Reg::mmDB_RENDER_CONTROL] & 1;
-    cfg.max_depth_bounds    = reinterpret_cast<const float&>(regs[Reg::mmDB_DEPTH_BOUNDS_MAX]);
-    cfg.min_depth_bounds    = reinterpret_cast<const float&>(regs[Reg::mmDB_DEPTH_BOUNDS_MIN]);
-
-    // Stencil control
-    cfg.stencil_control.raw         = regs[Reg::mmDB_STENCIL_CONTROL];
-    cfg.stencil_refmask_front.raw   = regs[Reg::mmDB_STENCILREFMASK];
-    cfg.stencil_refmask_back.raw    = regs[Reg::mmDB_STENCILREFMASK_BF];
-
-    // Depth clamp
-    cfg.enable_depth_clamp = ((regs[Reg::mmDB_RENDER_OVERRIDE] >> 16) & 1) != 1;   // DISABLE_VIEWPORT_CLAMP
-    
-    const bool zclip_near_disable = (regs[Reg::mmPA_CL_CLIP_CNTL] >> 26) & 1;
-    const bool zclip_far_disable  = (regs[Reg::mmPA_CL_CLIP_CNTL] >> 27) & 1;
-    cfg.enable_depth_clip = !zclip_near_disable && !zclip_far_disable;
-
-    // Viewport
-    cfg.viewport_control.raw = regs[Reg::mmPA_CL_VTE_CNTL];
-    cfg.x_offset = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_XOFFSET]);
-    cfg.x_scale  = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_XSCALE]);
-    cfg.y_offset = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_YOFFSET]);
-    cfg.y_scale  = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_YSCALE]);
-    cfg.z_offset = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_ZOFFSET]);
-    cfg.z_scale  = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_ZSCALE]);
-
-    // Culling & other
-    cfg.culling_poly_control.raw = regs[Reg::mmPA_SU_SC_MODE_CNTL];
-
-    // Clip space
-    cfg.dx_clip_space_enable = (regs[Reg::mmPA_CL_CLIP_CNTL] >> 19) & 1;
+    if (dirty_groups & RegGroup::Blend) {
+        for (int i = 0; i < 8; i++) {
+            cfg.blend_control[i].raw = regs[Reg::mmCB_BLEND0_CONTROL + i];
+        }
+        cfg.degamma_enable = (regs[Reg::mmCB_COLOR_CONTROL] >> 3) & 1;
+
+        state.hashes.blend = XXH3_64bits(&cfg.blend_control, sizeof(BlendControl) * 8) ^ cfg.degamma_enable;
+    }
+
+    if (dirty_groups & RegGroup::DepthStencil) {
+        // Depth control
+        cfg.depth_control.raw   = regs[Reg::mmDB_DEPTH_CONTROL];
+        cfg.depth_clear_enable  = regs[Reg::mmDB_RENDER_CONTROL] & 1;
+        cfg.max_depth_bounds    = reinterpret_cast<const float&>(regs[Reg::mmDB_DEPTH_BOUNDS_MAX]);
+        cfg.min_depth_bounds    = reinterpret_cast<const float&>(regs[Reg::mmDB_DEPTH_BOUNDS_MIN]);
+
+        // Stencil control
+        cfg.stencil_control.raw         = regs[Reg::mmDB_STENCIL_CONTROL];
+        cfg.stencil_refmask_front.raw   = regs[Reg::mmDB_STENCILREFMASK];
+        cfg.stencil_refmask_back.raw    = regs[Reg::mmDB_STENCILREFMASK_BF];
+
+        // Depth clamp
+        cfg.enable_depth_clamp = ((regs[Reg::mmDB_RENDER_OVERRIDE] >> 16) & 1) != 1;   // DISABLE_VIEWPORT_CLAMP
+
+        const bool zclip_near_disable = (regs[Reg::mmPA_CL_CLIP_CNTL] >> 26) & 1;
+        const bool zclip_far_disable  = (regs[Reg::mmPA_CL_CLIP_CNTL] >> 27) & 1;
+        cfg.enable_depth_clip = !zclip_near_disable && !zclip_far_disable;
+
+        // Only hash what is actually used
+        const bool depth_enable   = cfg.depth_control.depth_enable;
+        const bool bounds_enable  = cfg.depth_control.depth_bounds_enable;
+        const bool stencil_enable = cfg.depth_control.stencil_enable;
+        state.hashes.depth_stencil = hashValues({
+            cfg.depth_control.raw,
+            cfg.depth_clear_enable,
+            bounds_enable  ? floatBits(cfg.max_depth_bounds) : 0,
+            bounds_enable  ? floatBits(cfg.min_depth_bounds) : 0,
+            depth_enable && cfg.enable_depth_clamp,
+            depth_enable && cfg.enable_depth_clip,
+            stencil_enable ? cfg.stencil_control.raw : 0,
+            stencil_enable ? cfg.stencil_refmask_front.raw : 0,
+            stencil_enable ? cfg.stencil_refmask_back.raw : 0
+        });
+    }
+
+    if (dirty_groups & RegGroup::Viewport) {
+        // Viewport
+        cfg.viewport_control.raw = regs[Reg::mmPA_CL_VTE_CNTL];
+        cfg.x_offset = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_XOFFSET]);
+        cfg.x_scale  = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_XSCALE]);
+        cfg.y_offset = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_YOFFSET]);
+        cfg.y_scale  = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_YSCALE]);
+        cfg.z_offset = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_ZOFFSET]);
+        cfg.z_scale  = reinterpret_cast<const float&>(regs[Reg::mmPA_CL_VPORT_ZSCALE]);
+
+        // Culling & other
+        cfg.culling_poly_control.raw = regs[Reg::mmPA_SU_SC_MODE_CNTL];
+
+        // Clip space
+        cfg.dx_clip_space_enable = (regs[Reg::mmPA_CL_CLIP_CNTL] >> 19) & 1;
+
+        const auto& vp = cfg.viewport_control;
+        state.hashes.viewport = hashValues({
+            vp.raw,
+            vp.x_offset_enable ? floatBits(cfg.x_offset) : 0,
+            vp.x_scale_enable  ? floatBits(cfg.x_scale)  : 0,
+            vp.y_offset_enable ? floatBits(cfg.y_offset) : 0,
+            vp.y_scale_enable  ? floatBits(cfg.y_scale)  : 0,
+            vp.z_offset_enable ? floatBits(cfg.z_offset) : 0,
+            vp.z_scale_enable  ? floatBits(cfg.z_scale)  : 0,
+            cfg.culling_poly_control.raw,
+            cfg.dx_clip_space_enable
+        });
+    }
+
+    // Nothing changed since the last draw, and its pipeline was ready
+    if (!changed && state.pipeline) {
+        reused_pipelines++;
+        return state.pipeline;
+    }
 
     // Calculate final pipeline hash
-    state = XXH3_createState();
-    XXH3_64bits_reset(state);
-
-    XXH3_64bits_update(state, &cfg.has_vs, sizeof(cfg.has_vs));
-    XXH3_64bits_update(state, &cfg.has_ps, sizeof(cfg.has_ps));
-    if (cfg.has_vs) XXH3_64bits_update(state, &cfg.vertex_hash, sizeof(cfg.vertex_hash));
-    if (cfg.has_ps) XXH3_64bits_update(state, &cfg.pixel_hash, sizeof(cfg.pixel_hash));
-    XXH3_64bits_update(state, &cfg.prim_type, sizeof(cfg.prim_type));
-    XXH3_64bits_update(state, &cfg.blend_control, sizeof(BlendControl) * 8);
-    XXH3_64bits_update(state, &cfg.degamma_enable, sizeof(cfg.degamma_enable));
-    XXH3_64bits_update(state, &cfg.depth_control, sizeof(cfg.depth_control));
-    XXH3_64bits_update(state, &cfg.depth_clear_enable, sizeof(cfg.depth_clear_enable));
-    if (cfg.depth_control.depth_bounds_enable) {
-        XXH3_64bits_update(state, &cfg.max_depth_bounds, sizeof(cfg.max_depth_bounds));
-        XXH3_64bits_update(state, &cfg.min_depth_bounds, sizeof(cfg.min_depth_bounds));
-    }
-    if (cfg.depth_control.depth_enable)   XXH3_64bits_update(state, &cfg.enable_depth_clamp, sizeof(cfg.enable_depth_clamp));
-    if (cfg.depth_control.depth_enable)   XXH3_64bits_update(state, &cfg.enable_depth_clamp, sizeof(cfg.enable_depth_clip));
-    if (cfg.depth_control.stencil_enable) {
-        XXH3_64bits_update(state, &cfg.stencil_control, sizeof(cfg.stencil_control));
-        XXH3_64bits_update(state, &cfg.stencil_refmask_front, sizeof(cfg.stencil_refmask_front));
-        XXH3_64bits_update(state, &cfg.stencil_refmask_back,  sizeof(cfg.stencil_refmask_back));
-    }
-    XXH3_64bits_update(state, &cfg.viewport_control, sizeof(cfg.viewport_control));
-    if (cfg.viewport_control.x_offset_enable) XXH3_64bits_update(state, &cfg.x_offset, sizeof(cfg.x_offset));
-    if (cfg.viewport_control.x_scale_enable)  XXH3_64bits_update(state, &cfg.x_scale, sizeof(cfg.x_scale));
-    if (cfg.viewport_control.y_offset_enable) XXH3_64bits_update(state, &cfg.y_offset, sizeof(cfg.y_offset));
-    if (cfg.viewport_control.y_scale_enable)  XXH3_64bits_update(state, &cfg.y_scale, sizeof(cfg.y_scale));
-    if (cfg.viewport_control.z_offset_enable) XXH3_64bits_update(state, &cfg.z_offset, sizeof(cfg.z_offset));
-    if (cfg.viewport_control.z_scale_enable)  XXH3_64bits_update(state, &cfg.z_scale,  sizeof(cfg.z_scale));
-
-    XXH3_64bits_update(state, &cfg.culling_poly_control, sizeof(cfg.culling_poly_control));
-    XXH3_64bits_update(state, &cfg.dx_clip_space_enable, sizeof(cfg.dx_clip_space_enable));
-    XXH3_64bits_update(state, &cfg.binding_hash, sizeof(cfg.binding_hash));
-
-    const u64 pipeline_hash = XXH3_64bits_digest(state);
-    XXH3_freeState(state);
-    
-    if (pipelines.contains(pipeline_hash))
-        return *pipelines[pipeline_hash];
-
-    log("Compiling new pipeline\n");
-    auto* pipeline = new Pipeline(vert_shader, pixel_shader, fetch_shader, cfg);
-    pipelines[pipeline_hash] = pipeline;
-    return *pipeline;
+    if (changed)
+        state.pipeline_hash = XXH3_64bits(&state.hashes, sizeof(state.hashes));
+    state.pipeline = lookupPipeline(state);
+    return state.pipeline;
 }
 
 ComputePipeline& getComputePipeline(const ComputeJob& job) {
     const u8* compute_shader_code = (const u8*)job.addr;
 
-    // Compile shader (or get the cached one)
+    // Decompile shader (or get the cached one)
     ShaderCache::CachedShader* compute_shader = ShaderCache::getShader(compute_shader_code, Shader::ShaderStage::Compute, nullptr, const_cast<ComputeJob*>(&job));
+    const u64 hash = compute_shader->data.hash;
+
+    if (auto it = compute_pipelines.find(hash); it != compute_pipelines.end())
+        return *it->second;
+
+    // Dispatches are never skipped, we always wait for compute pipelines
+    auto pending = pending_compute_pipelines.find(hash);
+    if (pending == pending_compute_pipelines.end()) {
+        log("Compiling new compute pipeline\n");
+        recordPipeline(hash, PipelineDbEntryType::Compute);
+        pending = pending_compute_pipelines.emplace(hash, compileAsync<ComputePipeline>([=]() {
+            ShaderCache::compile(compute_shader);
+            return new ComputePipeline(compute_shader);
+        })).first;
+    }
 
-    if (compute_pipelines.contains(compute_shader->data.hash))
-        return *compute_pipelines[compute_shader->data.hash];
-
-    log("Compiling new compute pipeline\n");
-    auto* pipeline = new ComputePipeline(compute_shader);
-    compute_pipelines[compute_shader->data.hash] = pipeline;
+    auto* pipeline = pending->second.get();
+    pending_compute_pipelines.erase(pending);
+    compute_pipelines[hash] = pipeline;
     return *pipeline;
 }
 
+void printStats() {
+    const u64 compiled = compiled_count.exchange(0);
+    const u64 us = compile_us.exchange(0);
+    printf("------ Pipeline cache ------\n");
+    printf("%llu pipelines compiled (avg %.2f ms per pipeline), %llu queued, %llu pending, %llu draws skipped\n", compiled, compiled ? (double)us / compiled / 1000.0 : 0.0,
+        compiler_pool ? compiler_pool->queueDepth() : 0, pending_pipelines.size() + pending_compute_pipelines.size(), skipped_draws.exchange(0));
+    printf("%llu draws reused the previous pipeline without rebuilding its key\n", std::exchange(reused_pipelines, 0));
+}
+
 }   // End namespace PS4::GCN::Vulkan::PipelineCache
\ No newline at end of file
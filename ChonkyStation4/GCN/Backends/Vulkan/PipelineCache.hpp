@@ -10,7 +10,14 @@
 
 namespace PS4::GCN::Vulkan::PipelineCache {
 
-Pipeline& getPipeline(const u8* vert_shader_code, const u8* pixel_shader_code, const u8* fetch_shader_code, const u32* regs);
+// Has to be called after ShaderCache::init(). Starts prebuilding the pipelines recorded in previous runs.
+void init();
+// Periodically writes the VkPipelineCache blob to disk, called at the end of each frame
+void flush();
+// Returns nullptr if the pipeline is still being compiled and Configuration::async_pipeline_compilation is enabled.
+// dirty_groups are the RegGroups written since the previous call, only those are read again from regs.
+Pipeline* getPipeline(const u8* vert_shader_code, const u8* pixel_shader_code, const u8* fetch_shader_code, const u32* regs, u32 dirty_groups);
 ComputePipeline& getComputePipeline(const ComputeJob& job);
+void printStats();
 
 }   // End namespace PS4::GCN::Vulkan::PipelineCache
\ No newline at end of file
@@ -1,17 +1,260 @@
 #include "ShaderCache.hpp"
 #include <Logger.hpp>
+#include <MappedFile.hpp>
+#include <Loaders/App.hpp>
 #include <GCN/FetchShader.hpp>
+#include <GCN/VSharp.hpp>
+#include <GCN/TSharp.hpp>
+#include <GCN/GCN.hpp>
+#include <GCN/Trace.hpp>
 #include <GCN/Backends/Vulkan/VulkanCommon.hpp>
 #include <GCN/Backends/Vulkan/GLSLCompiler.hpp>
 #include <xxhash.h>
 #include <unordered_map>
+#include <SDL.h>    // For SDL_GetPrefPath
 
 
+extern App g_app;
+
 namespace PS4::GCN::Vulkan::ShaderCache {
 
 MAKE_LOG_FUNCTION(log, gcn_vulkan_renderer);
 
 std::unordered_map<u64, CachedShader*> shaders;
+std::unordered_map<u64, CachedShader*> variants;    // Base hash -> any shader decompiled from it, used to find the T#s it reads
+
+// On-disk shader cache.
+// The file is a header followed by a list of entries appended as new shaders get compiled.
+// Each entry stores the SPIR-V and the binding metadata of a shader, so we can skip both the decompiler and glslang.
+// The whole file is mapped at startup and entries are only parsed when a shader is first requested.
+// Bump DISK_CACHE_VERSION when the layout below changes, and Shader::DECOMPILER_VERSION when the decompiler output changes.
+
+static constexpr u32 DISK_CACHE_MAGIC   = 0x43535343;   // "CSSC"
+static constexpr u32 DISK_CACHE_VERSION = 3;
+
+struct DiskCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 decompiler_version;
+    u32 reserved;
+};
+
+struct DiskCacheEntry {
+    u64 hash;           // See getShader() for what goes into it
+    u64 base_hash;      // The hash without the T# types, to find the T#s of a shader before decompiling it
+    u32 size;           // Total size of the entry in bytes, including this header
+    u32 stage;
+    u32 n_buffers;
+    u32 n_vtx_outputs;
+    u32 spirv_size;     // In words
+    u32 has_gds;
+};
+
+struct DiskCacheBuffer {
+    s32 binding;
+    u32 is_image_store;
+    u32 is_instr_typed;
+    u32 instr_dfmt;
+    u32 instr_nfmt;
+    u32 sgpr;
+    u32 offs;
+    u32 is_ptr;
+    u32 ptr_is_from_buf;
+    s32 buf_idx;        // Index of the bindless buffer in the shader's buffer list, or -1
+    s32 buf_offs;
+    u32 type;
+    u32 stage;
+};
+
+fs::path cache_dir;
+fs::path disk_cache_path;
+Helpers::MappedFile disk_cache_file;
+std::unordered_map<u64, const DiskCacheEntry*> disk_cache;
+std::unordered_map<u64, const DiskCacheEntry*> disk_variants;
+std::ofstream disk_cache_out;
+std::mutex disk_cache_out_mtx;
+
+void init() {
+    const auto title = g_app.title_id.empty() ? g_app.name : g_app.title_id;
+    cache_dir = fs::path(SDL_GetPrefPath("ChonkyStation", "ChonkyStation4")) / "shader_cache" / title;
+    fs::create_directories(cache_dir);
+    disk_cache_path = cache_dir / "shaders.bin";
+
+    // Map the existing cache and index its entries
+    size_t valid_size = 0;
+    if (disk_cache_file.open(disk_cache_path) && disk_cache_file.size() >= sizeof(DiskCacheHeader)) {
+        const u8* ptr = disk_cache_file.data();
+        const size_t size = disk_cache_file.size();
+        const auto* header = (const DiskCacheHeader*)ptr;
+
+        if (header->magic == DISK_CACHE_MAGIC && header->version == DISK_CACHE_VERSION && header->decompiler_version == Shader::DECOMPILER_VERSION) {
+            size_t offs = sizeof(DiskCacheHeader);
+            while (offs + sizeof(DiskCacheEntry) <= size) {
+                const auto* entry = (const DiskCacheEntry*)(ptr + offs);
+                if (entry->size < sizeof(DiskCacheEntry) || offs + entry->size > size) break;   // Truncated entry
+                disk_cache[entry->hash] = entry;
+                disk_variants[entry->base_hash] = entry;
+                offs += entry->size;
+            }
+            valid_size = offs;
+        }
+        else log("Shader cache %s is outdated, discarding it\n", disk_cache_path.generic_string().c_str());
+    }
+
+    // Start over if the cache was invalid, and drop any truncated entry at the end of the file
+    if (valid_size == 0) {
+        disk_cache_file.close();
+        disk_cache.clear();
+        disk_variants.clear();
+        disk_cache_out.open(disk_cache_path, std::ios::binary | std::ios::trunc);
+        const DiskCacheHeader header = { .magic = DISK_CACHE_MAGIC, .version = DISK_CACHE_VERSION, .decompiler_version = Shader::DECOMPILER_VERSION, .reserved = 0 };
+        disk_cache_out.write((const char*)&header, sizeof(header));
+        disk_cache_out.flush();
+    }
+    else {
+        if (valid_size < disk_cache_file.size()) {
+            disk_cache_file.close();
+            disk_cache.clear();
+            disk_variants.clear();
+            fs::resize_file(disk_cache_path, valid_size);
+            return init();
+        }
+        disk_cache_out.open(disk_cache_path, std::ios::binary | std::ios::app);
+    }
+
+    log("Loaded %lld shaders from %s\n", disk_cache.size(), disk_cache_path.generic_string().c_str());
+}
+
+const fs::path& getCacheDir() {
+    return cache_dir;
+}
+
+static CachedShader* loadFromDisk(const DiskCacheEntry* entry) {
+    CachedShader* cached_shader = new CachedShader();
+    cached_shader->stage = (Shader::ShaderStage)entry->stage;
+    auto& data = cached_shader->data;
+    data.hash = entry->hash;
+    cached_shader->base_hash = entry->base_hash;
+    data.has_gds = entry->has_gds;
+
+    const auto* bufs = (const DiskCacheBuffer*)(entry + 1);
+    for (u32 i = 0; i < entry->n_buffers; i++)
+        data.buffers.emplace_back();    // Create them all first, bindless descriptors point to other buffers in the list
+
+    for (u32 i = 0; i < entry->n_buffers; i++) {
+        const auto& in = bufs[i];
+        auto& buf = data.buffers[i];
+        buf.binding = in.binding;
+        buf.is_image_store = in.is_image_store;
+        buf.is_instr_typed = in.is_instr_typed;
+        buf.instr_dfmt = in.instr_dfmt;
+        buf.instr_nfmt = in.instr_nfmt;
+        buf.desc_info.sgpr = in.sgpr;
+        buf.desc_info.offs = in.offs;
+        buf.desc_info.is_ptr = in.is_ptr;
+        buf.desc_info.ptr_is_from_buf = in.ptr_is_from_buf;
+        buf.desc_info.buf = in.buf_idx >= 0 ? &data.buffers[in.buf_idx] : nullptr;
+        buf.desc_info.buf_offs = in.buf_offs;
+        buf.desc_info.type = (Shader::DescriptorType)in.type;
+        buf.desc_info.stage = (Shader::ShaderStage)in.stage;
+    }
+
+    const auto* vtx_outputs = (const s32*)(bufs + entry->n_buffers);
+    data.vtx_outputs.assign(vtx_outputs, vtx_outputs + entry->n_vtx_outputs);
+
+    // Creating the module from SPIR-V is cheap, do it right away
+    const auto* spirv = (const u32*)(vtx_outputs + entry->n_vtx_outputs);
+    std::call_once(cached_shader->compile_flag, [&]() {
+        cached_shader->vk_shader = createShaderModule({ spirv, entry->spirv_size });
+    });
+    return cached_shader;
+}
+
+static void storeToDisk(const CachedShader* cached_shader, Shader::ShaderStage stage, const std::vector<u32>& spirv) {
+    auto lk = std::unique_lock<std::mutex>(disk_cache_out_mtx);
+    if (!disk_cache_out.is_open()) return;
+
+    const auto& data = cached_shader->data;
+    auto buf_idx = [&](const Shader::Buffer* buf) -> s32 {
+        for (s32 i = 0; i < data.buffers.size(); i++) {
+            if (&data.buffers[i] == buf) return i;
+        }
+        return -1;
+    };
+
+    std::vector<DiskCacheBuffer> bufs;
+    bufs.reserve(data.buffers.size());
+    for (auto& buf : data.buffers) {
+        bufs.push_back({
+            .binding = buf.binding,
+            .is_image_store = buf.is_image_store,
+            .is_instr_typed = buf.is_instr_typed,
+            .instr_dfmt = buf.instr_dfmt,
+            .instr_nfmt = buf.instr_nfmt,
+            .sgpr = buf.desc_info.sgpr,
+            .offs = buf.desc_info.offs,
+            .is_ptr = buf.desc_info.is_ptr,
+            .ptr_is_from_buf = buf.desc_info.ptr_is_from_buf,
+            .buf_idx = buf_idx(buf.desc_info.buf),
+            .buf_offs = buf.desc_info.buf_offs,
+            .type = (u32)buf.desc_info.type,
+            .stage = (u32)buf.desc_info.stage
+        });
+    }
+
+    // Keep entries 8-byte aligned in the file, so they can be read in place from the mapping
+    const size_t unpadded_size = sizeof(DiskCacheEntry) + bufs.size() * sizeof(DiskCacheBuffer) + data.vtx_outputs.size() * sizeof(s32) + spirv.size() * sizeof(u32);
+    const size_t entry_size = Helpers::alignUp<size_t>(unpadded_size, alignof(DiskCacheEntry));
+    const DiskCacheEntry entry = {
+        .hash = data.hash,
+        .base_hash = cached_shader->base_hash,
+        .size = (u32)entry_size,
+        .stage = (u32)stage,
+        .n_buffers = (u32)bufs.size(),
+        .n_vtx_outputs = (u32)data.vtx_outputs.size(),
+        .spirv_size = (u32)spirv.size(),
+        .has_gds = data.has_gds
+    };
+
+    disk_cache_out.write((const char*)&entry, sizeof(entry));
+    disk_cache_out.write((const char*)bufs.data(), bufs.size() * sizeof(DiskCacheBuffer));
+    disk_cache_out.write((const char*)data.vtx_outputs.data(), data.vtx_outputs.size() * sizeof(s32));
+    disk_cache_out.write((const char*)spirv.data(), spirv.size() * sizeof(u32));
+    const u64 padding = 0;
+    disk_cache_out.write((const char*)&padding, entry_size - unpadded_size);
+    disk_cache_out.flush();
+}
+
+CachedShader* getCachedShader(u64 hash, Shader::ShaderStage stage) {
+    if (auto it = shaders.find(hash); it != shaders.end())
+        return it->second;
+
+    if (auto it = disk_cache.find(hash); it != disk_cache.end() && it->second->stage == (u32)stage) {
+        log("Loading shader %016llx from disk cache\n", hash);
+        CachedShader* cached_shader = loadFromDisk(it->second);
+        shaders[hash] = cached_shader;
+        return cached_shader;
+    }
+    return nullptr;
+}
+
+// The decompiler declares images as 2D or 3D depending on the type of the T# bound when the shader is decompiled.
+// Where the T#s are is only known after decompiling, so they're found through the buffers of a shader with the same base hash.
+static u64 variantHash(u64 base_hash, Shader::ShaderData& data) {
+    // Checked on every draw, so this avoids allocating a hash state
+    u64 hash = base_hash;
+    for (auto& buf : data.buffers) {
+        if (buf.desc_info.type != Shader::DescriptorType::Tsharp) continue;
+        const TSharp* tsharp = buf.desc_info.asPtr<TSharp>();
+        const u8 is_3d = tsharp && tsharp->type == 10;
+        hash = XXH3_64bits_withSeed(&is_3d, sizeof(is_3d), hash);
+    }
+    return hash;
+}
+
+bool matchesState(CachedShader* shader) {
+    return variantHash(shader->base_hash, shader->data) == shader->data.hash;
+}
 
 CachedShader* getShader(const u8* code, Shader::ShaderStage stage, FetchShader* fetch_shader, ComputeJob* compute_job) {
     // Find shader header
@@ -24,45 +267,94 @@ CachedShader* getShader(const u8* code, Shader::ShaderStage stage, FetchShader*
     u64 hash;
     ptr += 4;
     std::memcpy(&hash, ptr, sizeof(u64));
+    Trace::recordMemory(code, (const u8*)(ptr + 2) - code);
+
+    // The decompiled code also depends on state outside of the shader binary, which goes into the key of both caches:
+    // - Vertex shaders load their inputs as laid out by the fetch shader, with the type and swizzle of each V#
+    // - Pixel shaders read their inputs at the locations selected by SPI_PS_INPUT_CNTL
+    // - Compute shaders declare the workgroup size of the dispatch
+    // - All stages declare images with the dimensionality of their T#s (see variantHash())
+    XXH3_state_t* state = XXH3_createState();
+    XXH3_64bits_reset(state);
+    XXH3_64bits_update(state, &hash, sizeof(hash));
+
+    switch (stage) {
+    case Shader::ShaderStage::Vertex: {
+        for (auto& binding : fetch_shader->bindings) {
+            const VSharp* vsharp = binding.vsharp_loc.asPtr();
+            const u32 layout[] = {
+                binding.idx, binding.dest_vgpr, binding.n_elements,
+                vsharp->nfmt, vsharp->dst_sel_x, vsharp->dst_sel_y, vsharp->dst_sel_z, vsharp->dst_sel_w
+            };
+            XXH3_64bits_update(state, layout, sizeof(layout));
+        }
+        break;
+    }
 
-    // Hash compute job info if this is a compute shader
-    if (stage == Shader::ShaderStage::Compute) {
-        XXH3_state_t* state = XXH3_createState();
-        XXH3_64bits_reset(state);
+    case Shader::ShaderStage::Fragment: {
+        u32 locations[32];
+        for (u32 i = 0; i < 32; i++)
+            locations[i] = GCN::renderer->regs[Reg::mmSPI_PS_INPUT_CNTL_0 + i] & 0x1f;
+        XXH3_64bits_update(state, locations, sizeof(locations));
+        break;
+    }
 
-        XXH3_64bits_update(state, &hash, sizeof(hash));
+    case Shader::ShaderStage::Compute: {
         XXH3_64bits_update(state, &compute_job->n_threads_x, sizeof(compute_job->n_threads_x));
         XXH3_64bits_update(state, &compute_job->n_threads_y, sizeof(compute_job->n_threads_y));
         XXH3_64bits_update(state, &compute_job->n_threads_z, sizeof(compute_job->n_threads_z));
-
-        hash = XXH3_64bits_digest(state);
-        XXH3_freeState(state);
+        break;
     }
 
-    // Check if this shader was cached, otherwise compile and cache it
-    if (shaders.contains(hash)) {
-        return shaders[hash];
+    default: break;
     }
 
-    auto shader_stage = [](Shader::ShaderStage stage) -> EShLanguage {
-        switch (stage) {
-        case Shader::ShaderStage::Vertex:       return EShLangVertex;
-        case Shader::ShaderStage::Fragment:     return EShLangFragment;
-        case Shader::ShaderStage::Compute:      return EShLangCompute;
-        default: Helpers::panic("shader_stage: unreachable");
-        }
-    };
+    const u64 base_hash = XXH3_64bits_digest(state);
+    XXH3_freeState(state);
+
+    // Check if this shader was cached or compiled in a previous run, otherwise decompile and cache it
+    CachedShader* variant = nullptr;
+    if (auto it = variants.find(base_hash); it != variants.end())
+        variant = it->second;
+    else if (auto it = disk_variants.find(base_hash); it != disk_variants.end())
+        variant = getCachedShader(it->second->hash, stage);
+
+    if (variant) {
+        variants.try_emplace(base_hash, variant);
+        if (auto* cached_shader = getCachedShader(variantHash(base_hash, variant->data), stage))
+            return cached_shader;
+    }
 
-    // Compile it
-    log("Compiling new shader %016llx\n", hash);
+    // Decompile it. The GLSL is compiled later by compile()
     CachedShader* cached_shader = new CachedShader();
-    cached_shader->data.hash = hash;
+    cached_shader->base_hash = base_hash;
+    cached_shader->stage = stage;
     Shader::decompileShader((u32*)code, stage, cached_shader->data, fetch_shader, compute_job);
-    cached_shader->vk_shader = createShaderModule(GCN::compileGLSL(cached_shader->data.source, shader_stage(stage), std::format("{:x}.glsl", hash)));
+    cached_shader->data.hash = variantHash(base_hash, cached_shader->data);
+    log("Decompiled new shader %016llx\n", cached_shader->data.hash);
 
     // Cache it
-    shaders[hash] = cached_shader;
+    shaders[cached_shader->data.hash] = cached_shader;
+    variants.try_emplace(base_hash, cached_shader);
     return cached_shader;
 }
 
-}   // End namespace PS4::GCN::Vulkan::ShaderCache
\ No newline at end of file
+void compile(CachedShader* shader) {
+    std::call_once(shader->compile_flag, [shader]() {
+        auto shader_stage = [](Shader::ShaderStage stage) -> EShLanguage {
+            switch (stage) {
+            case Shader::ShaderStage::Vertex:       return EShLangVertex;
+            case Shader::ShaderStage::Fragment:     return EShLangFragment;
+            case Shader::ShaderStage::Compute:      return EShLangCompute;
+            default: Helpers::panic("shader_stage: unreachable");
+            }
+        };
+
+        log("Compiling new shader %016llx\n", shader->data.hash);
+        const auto spirv = GCN::compileGLSL(shader->data.source, shader_stage(shader->stage), std::format("{:x}.glsl", shader->data.hash));
+        shader->vk_shader = createShaderModule(spirv);
+        storeToDisk(shader, shader->stage, spirv);
+    });
+}
+
+}   // End namespace PS4::GCN::Vulkan::ShaderCache
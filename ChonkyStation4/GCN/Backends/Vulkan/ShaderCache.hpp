@@ -5,18 +5,32 @@
 #include <GCN/Shader/ShaderDecompiler.hpp>
 #include <GCN/ComputeJob.hpp>
 #include <vulkan/vulkan_raii.hpp>
+#include <mutex>
 
 
 namespace PS4::GCN::Vulkan::ShaderCache {
 
 struct CachedShader {
-    vk::raii::ShaderModule vk_shader = nullptr;
+    vk::raii::ShaderModule vk_shader = nullptr;     // Only valid after compile()
     Shader::ShaderData data;
+    Shader::ShaderStage stage;
+    u64 base_hash = 0;  // data.hash without the T# types, see getShader()
+    std::once_flag compile_flag;
     u32 compute_thread_size_x = 0;
     u32 compute_thread_size_y = 0;
     u32 compute_thread_size_z = 0;
 };
 
+void init();
+// Per-title directory holding the on-disk caches
+const fs::path& getCacheDir();
+// Returns the shader with the given hash if it was already decompiled or is in the disk cache, nullptr otherwise
+CachedShader* getCachedShader(u64 hash, Shader::ShaderStage stage);
+// Returns the decompiled shader. Has to be called from the GCN thread, as decompilation reads the current GPU state.
 CachedShader* getShader(const u8* code, Shader::ShaderStage stage, FetchShader* fetch_shader, ComputeJob* compute_job = nullptr);
+// Returns false if the T#s bound now have a different type than the ones the shader was decompiled for, in which case it has to be looked up again
+bool matchesState(CachedShader* shader);
+// Compiles the shader module if it wasn't already. Thread safe, can be called from the pipeline compiler workers.
+void compile(CachedShader* shader);
 
 }   // End namespace PS4::GCN::Vulkan::ShaderCache
\ No newline at end of file
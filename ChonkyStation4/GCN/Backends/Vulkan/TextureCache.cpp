@@ -4,14 +4,18 @@
 #include <Configuration.hpp>
 #include <Profiler.hpp>
 #include <GCN/GCN.hpp>
+#include <GCN/Trace.hpp>
 #include <GCN/Backends/Vulkan/VulkanCommon.hpp>
 #include <GCN/Backends/Vulkan/BufferCache.hpp>
+#include <GCN/Backends/Vulkan/GpuDetiler.hpp>
 #include <GCN/Detiler/gpuaddr.h>
 #include <GCN/Detiler/gnm/texture.h>
+#include <ThreadPool.hpp>
 #include <xxhash.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <mutex>
+#include <future>
 #ifdef _WIN32
 #include <Windows.h>
 #endif
@@ -30,6 +34,44 @@ std::mutex cache_mtx;
 std::unordered_map<void*, std::vector<TrackedTexture*>> tracked_textures;
 std::vector<TrackedTexture*> currently_tracking;
 
+std::unique_ptr<Helpers::ThreadPool> detiler_pool;
+// Textures smaller than this are detiled on the calling thread, handing them to the pool would cost more than it saves.
+// Bigger surfaces are split in bands of roughly this size.
+static constexpr size_t detile_band_size = 256_KB;
+
+// Detiles all the slices and mips of a texture straight into dst (usually mapped staging memory).
+// Slices, mips and bands of large surfaces are spread over the detiler pool, this returns once all of them are done.
+static GpaError detileTexture(const void* src, size_t src_size, void* dst, size_t dst_size, const GpaTextureInfo& tex_info) {
+    if (src_size < detile_band_size)
+        return gpaTileTextureAll(src, src_size, dst, dst_size, &tex_info, GNM_TM_DISPLAY_LINEAR_GENERAL);
+
+    if (!detiler_pool)
+        detiler_pool = std::make_unique<Helpers::ThreadPool>("Detiler");
+
+    std::vector<std::future<GpaError>> jobs;
+    for (u32 slice = 0; slice < tex_info.numslices; slice++) {
+        for (u32 mip = 0; mip < tex_info.nummips; mip++) {
+            uint64_t surf_size = 0;
+            uint64_t surf_off = 0;
+            gpaComputeSurfaceSizeOffset(&surf_size, &surf_off, &tex_info, mip, slice);
+
+            const u32 n_parts = std::clamp<u64>(surf_size / detile_band_size, 1, detiler_pool->size());
+            for (u32 part = 0; part < n_parts; part++) {
+                jobs.push_back(detiler_pool->submit([=, &tex_info]() {
+                    return gpaTileTextureIndexedPart(src, src_size, dst, dst_size, &tex_info, GNM_TM_DISPLAY_LINEAR_GENERAL, mip, slice, part, n_parts);
+                }));
+            }
+        }
+    }
+
+    GpaError err = GPA_ERR_OK;
+    for (auto& job : jobs) {
+        const GpaError job_err = job.get();
+        if (err == GPA_ERR_OK) err = job_err;
+    }
+    return err;
+}
+
 void TrackedTexture::transition(vk::ImageLayout new_layout) {
     if (curr_layout == new_layout) return;
     transitionImageLayout(image, vk_fmt, curr_layout, new_layout);
@@ -89,6 +131,7 @@ void getVulkanImageInfoForTSharp(TSharp* tsharp, TrackedTexture** out_info, bool
     const u64    page_end = page + size_in_pages;
 
     auto reupload_tex = [&](TrackedTexture* tex) {
+        Profiler::Zone zone("Texture upload");
         auto& img = tex->image;
 
         //tex->invalidate_cnt++;
@@ -101,11 +144,9 @@ void getVulkanImageInfoForTSharp(TSharp* tsharp, TrackedTexture** out_info, bool
         endRendering();
         tex->transition(vk::ImageLayout::eTransferDstOptimal);
 
-        // Detile the texture
-        void* img_ptr = ptr;
-        //auto detiled_buf = std::make_unique<u8[]>(img_size);
-        std::unique_ptr<u8[]> detiled_buf;
-
+        // Detile the texture straight into the staging buffer
+        vk::Buffer buf;
+        size_t buf_offset = 0;
         if (tex->tsharp.tiling_index != GNM_TM_DISPLAY_LINEAR_GENERAL && tex->tsharp.tiling_index != GNM_TM_DISPLAY_LINEAR_ALIGNED) {
             //Profiler::add("Detiled textures", 1);
             //Profiler::Scope profiler("Detiler time");
@@ -140,25 +181,30 @@ void getVulkanImageInfoForTSharp(TSharp* tsharp, TrackedTexture** out_info, bool
                 out_size = img_size;
             }
 
-            detiled_buf = std::make_unique<u8[]>(out_size);
-
-            GpaError err = gpaTileTextureAll(ptr, in_size, detiled_buf.get(), out_size, &tex_info, GNM_TM_DISPLAY_LINEAR_GENERAL);
-            //if (err != 0) Helpers::panic("gpaTileTextureAll failed with error %d\n", err);
-            img_ptr = detiled_buf.get();
+            Trace::recordMemory(ptr, in_size);
+            if (!GpuDetiler::isEnabledFor((GnmTileMode)tex->tsharp.tiling_index) || !GpuDetiler::detile(ptr, in_size, tex_info, &buf, &buf_offset, &out_size)) {
+                void* buf_ptr;
+                std::tie(buf, buf_offset, buf_ptr) = Cache::getMappedBufferForFrame(out_size);
+                GpaError err = detileTexture(ptr, in_size, buf_ptr, out_size, tex_info);
+                //if (err != 0) Helpers::panic("gpaTileTextureAll failed with error %d\n", err);
+            }
             pitch = width;
             img_size = out_size;
         }
-
-        // Upload to a buffer
-        auto [buf, buf_ptr] = Cache::getMappedBufferForFrame(img_size);
-        std::memcpy(buf_ptr, img_ptr, img_size);
+        else {
+            // Upload to a buffer
+            void* buf_ptr;
+            std::tie(buf, buf_offset, buf_ptr) = Cache::getMappedBufferForFrame(img_size);
+            Trace::recordMemory(ptr, img_size);
+            std::memcpy(buf_ptr, ptr, img_size);
+        }
 
         // Copy buffer to image
         const auto buffer_row_length = pitch >= width ? pitch : 0;
         if (pitch < width)
             printf("pitch < width\n");
         vk::BufferImageCopy region = {
-            .bufferOffset = 0,
+            .bufferOffset = buf_offset,
             .bufferRowLength = buffer_row_length,
             .bufferImageHeight = height,
             .imageSubresource = {
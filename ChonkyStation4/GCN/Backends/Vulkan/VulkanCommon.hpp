@@ -4,6 +4,7 @@
 #include <vulkan/vulkan_raii.hpp>
 #include <GCN/DataFormats.hpp>
 #include "vk_mem_alloc.h"
+#include <span>
 
 
 namespace PS4::GCN::Vulkan {
@@ -18,6 +19,7 @@ inline vk::raii::PhysicalDevice             physical_device = nullptr;
 inline vk::raii::Device                     device = nullptr;
 inline vk::raii::Queue                      queue = nullptr;
 inline vk::raii::CommandPool                cmd_pool = nullptr;
+inline vk::raii::PipelineCache              vk_pipeline_cache = nullptr;
 inline std::vector<vk::raii::CommandBuffer> cmd_bufs;
 inline bool                                 is_recording_render_block = false;
 inline vk::SurfaceFormatKHR                 swapchain_surface_format;
@@ -36,6 +38,6 @@ void endRendering();
 void transitionImageLayout(const vk::Image& image, const vk::Format fmt, vk::ImageLayout old_layout, vk::ImageLayout new_layout, vk::raii::CommandBuffer* cmd_buf = nullptr);
 u32 findMemoryType(u32 typeFilter, vk::MemoryPropertyFlags properties);
 std::pair<vk::Format, size_t> getBufFormatAndSize(u32 dfmt, u32 nfmt);
-vk::raii::ShaderModule createShaderModule(const std::vector<u32>& code);
+vk::raii::ShaderModule createShaderModule(std::span<const u32> code);
 
 }   // End namespace PS4::GCN::Vulkan
\ No newline at end of file
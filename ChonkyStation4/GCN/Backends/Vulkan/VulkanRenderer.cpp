@@ -8,6 +8,7 @@
 #include <Loaders/App.hpp>
 #include <GCN/Backends/Vulkan/VulkanCommon.hpp>
 #include <GCN/Backends/Vulkan/PipelineCache.hpp>
+#include <GCN/Backends/Vulkan/ShaderCache.hpp>
 #include <GCN/Backends/Vulkan/BufferCache.hpp>
 #include <GCN/Backends/Vulkan/TextureCache.hpp>
 #include <GCN/Backends/Vulkan/RenderTarget.hpp>
@@ -519,6 +520,10 @@ void VulkanRenderer::init() {
     // Initialize the buffer cache
     Cache::init();
 
+    // Load the on-disk shader cache, start the pipeline compiler threads and prebuild the pipelines recorded in previous runs
+    ShaderCache::init();
+    PipelineCache::init();
+
     for (auto& pipelines : curr_frame_pipelines)
         pipelines.reserve(4096);
 
@@ -686,6 +691,7 @@ vk::Extent2D VulkanRenderer::setupRenderingAttachments(Pipeline* pipeline, bool&
 }
 
 void VulkanRenderer::draw(const u64 cnt, const void* idx_buf_ptr, u32 idx_offs) {
+    Profiler::Zone zone("Draw");
     const auto* vs_ptr = getVSPtr();
     const auto* ps_ptr = getPSPtr();
     log("Vertex Shader address : %p\n", vs_ptr);
@@ -707,8 +713,11 @@ void VulkanRenderer::draw(const u64 cnt, const void* idx_buf_ptr, u32 idx_offs)
     //if (!fetch_shader_ptr)
     //    return;
 
-    // Get pipeline
-    auto& pipeline = Vulkan::PipelineCache::getPipeline(vs_ptr, ps_ptr, fetch_shader_ptr, regs);
+    // Get pipeline, skip the draw if it's still being compiled
+    auto* pipeline_ptr = Vulkan::PipelineCache::getPipeline(vs_ptr, ps_ptr, fetch_shader_ptr, regs, std::exchange(dirty_reg_groups, 0));
+    if (!pipeline_ptr)
+        return;
+    auto& pipeline = *pipeline_ptr;
     curr_frame_pipelines[frame_idx].push_back(&pipeline);
     
     if (disable_stencil)
@@ -815,6 +824,7 @@ void VulkanRenderer::draw(const u64 cnt, const void* idx_buf_ptr, u32 idx_offs)
 }
 
 void VulkanRenderer::drawIndirect(const u64 cnt, const bool is_indexed, void* draw_args, void* idx_buf_ptr, s32 idx_buf_max_size) {
+    Profiler::Zone zone("Draw indirect");
     const auto* vs_ptr = getVSPtr();
     const auto* ps_ptr = getPSPtr();
     log("Vertex Shader address : %p\n", vs_ptr);
@@ -832,8 +842,11 @@ void VulkanRenderer::drawIndirect(const u64 cnt, const bool is_indexed, void* dr
     //if (!fetch_shader_ptr)
     //    return;
 
-    // Get pipeline
-    auto& pipeline = Vulkan::PipelineCache::getPipeline(vs_ptr, ps_ptr, fetch_shader_ptr, regs);
+    // Get pipeline, skip the draw if it's still being compiled
+    auto* pipeline_ptr = Vulkan::PipelineCache::getPipeline(vs_ptr, ps_ptr, fetch_shader_ptr, regs, std::exchange(dirty_reg_groups, 0));
+    if (!pipeline_ptr)
+        return;
+    auto& pipeline = *pipeline_ptr;
     curr_frame_pipelines[frame_idx].push_back(&pipeline);
 
     if (disable_stencil)
@@ -933,18 +946,21 @@ void VulkanRenderer::drawIndirect(const u64 cnt, const bool is_indexed, void* dr
 }
 
 void VulkanRenderer::dispatch(ComputeJob job) {
+    Profiler::Zone zone("Dispatch");
     log("Compute shader address: %p\n", job.addr);
     endRendering();
     
     // Get pipeline
     auto& pipeline = Vulkan::PipelineCache::getComputePipeline(job);
     curr_frame_compute_pipelines[frame_idx].push_back(&pipeline);
-    cmd_bufs[frame_idx].bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline.getVkPipeline());
 
     // Upload buffers and get descriptor writes, as well as the push constants
     ComputePipeline::PushConstants* push_constants;
     auto descriptor_writes = pipeline.uploadBuffersAndTextures(&push_constants, color_attachments[0].tex, &has_feedback_loop);
 
+    // Bound after the uploads, uploading a texture can record a dispatch of the GPU detiler which binds its own pipeline
+    cmd_bufs[frame_idx].bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline.getVkPipeline());
+
     if (descriptor_writes.size())
         cmd_bufs[frame_idx].pushDescriptorSetKHR(vk::PipelineBindPoint::eCompute, *pipeline.getVkPipelineLayout(), 0, descriptor_writes);
 
@@ -976,8 +992,10 @@ void VulkanRenderer::dispatch(ComputeJob job) {
 static bool fullscreen = false;
 static bool force_recreate_swapchain = false;
 static int texture_free_counter = 0;
+static u32 stats_frame_counter = 0;
 static constexpr int FREE_TEXTURES_EVERY_N_FRAMES = 500;
 void VulkanRenderer::flip(OS::Libs::SceVideoOut::SceVideoOutBuffer* buf) {
+    Profiler::Zone zone("Flip");
     endRendering();
     
     std::memset(last_color_rt, 0, sizeof(ColorTarget) * 8);
@@ -1089,6 +1107,8 @@ void VulkanRenderer::flip(OS::Libs::SceVideoOut::SceVideoOutBuffer* buf) {
         switch (e.type) {
         case SDL_QUIT: {
             //exit(0);
+            Profiler::stopCapture();
+            Log::Async::flush();
             std::_Exit(0);
             break;
         }
@@ -1174,7 +1194,13 @@ void VulkanRenderer::flip(OS::Libs::SceVideoOut::SceVideoOutBuffer* buf) {
         texture_free_counter = 0;
     }
 
+    PipelineCache::flush();
+
     //Profiler::printAndReset();
+    if (Configuration::renderer_stats_interval && ++stats_frame_counter % Configuration::renderer_stats_interval == 0) {
+        Cache::printStats();
+        PipelineCache::printStats();
+    }
 }
 
 void VulkanRenderer::fillGDS(size_t offset, u8 value, size_t size) {
@@ -3,11 +3,19 @@
 #include <Configuration.hpp>
 #include <GCN/PM4.hpp>
 #include <GCN/ComputeJob.hpp>
+#include <GCN/Trace.hpp>
 #include <OS/Libraries/SceVideoOut/SceVideoOut.hpp>
 #include <BitField.hpp>
+#include <MPSCRing.hpp>
+#include <Profiler.hpp>
 #include <co.hpp>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
 
 
 namespace PS4::GCN {
@@ -103,79 +111,131 @@ union ReleaseMem3 {
     u32 data_lo;
 };
 
+// Memory waits sleep until something notifies a write (see notifyMemoryWrite), or until this much time has passed.
+// The timeout only matters for memory written by the guest CPU.
+static constexpr auto MEMORY_WAIT_FALLBACK = std::chrono::microseconds(200);
+
 // Constant engine
+// The counters are only ever incremented by their own engine, the other one waits on them with atomic wait/notify.
 std::atomic<u32> ce_count = 0;
 std::atomic<u32> de_count = 0;
-std::thread ce_thread;
 u8 constant_ram[48_KB];
 
-void initCommandProcessor() {
-    std::memset(constant_ram, 0, 48_KB);
-}
+// The constant engine runs on its own persistent thread. CCBs are queued in submission order by the draw engine.
+struct CcbJob {
+    u32* ccb = nullptr;
+    size_t ccb_size = 0;
+};
 
-void processCcb(u32* ccb, size_t ccb_size) {
-    if (ce_thread.joinable()) ce_thread.join();
-
-    ce_thread = std::thread([=]() {
-        for (u32* ptr = ccb; (u8*)ptr < (u8*)ccb + ccb_size; ) {
-            PM4Header* pkt = (PM4Header*)ptr;
-            u32* args = ptr;
-            args++;
-
-            if (pkt->type == 0) {
-                ptr++;
-                continue;
-                Helpers::panic("CCB PM4 type 0 packet\n");
-            }
-            else if (pkt->type == 1) {
-                Helpers::panic("CCB PM4 type 1 packet\n");
-            }
-            else if (pkt->type == 2) {
-                Helpers::panic("CCB PM4 type 1 packet\n");
-            }
+Helpers::MPSCRing<CcbJob, 256> ce_queue;
+std::thread ce_thread;
 
-            switch ((PM4ItOpcode)(u32)pkt->opcode) {
-            case PM4ItOpcode::Nop:  break;
+// Stats
+std::atomic<u64> ccb_count = 0;
+std::atomic<u64> ccb_submit_ns = 0;
+std::atomic<u64> ccb_exec_ns = 0;
 
-            case PM4ItOpcode::WriteConstRam: {
-                const u32 offs = *args++;
-                std::memcpy(&constant_ram[offs], args, pkt->count * sizeof(u32));
-                break;
-            }
+static void executeCcb(u32* ccb, size_t ccb_size) {
+    for (u32* ptr = ccb; (u8*)ptr < (u8*)ccb + ccb_size; ) {
+        PM4Header* pkt = (PM4Header*)ptr;
+        u32* args = ptr;
+        args++;
 
-            case PM4ItOpcode::DumpConstRam: {
-                const u32 offs = *args++;
-                const u32 n_dw = *args++;
-                const u32 addr_lo = *args++;
-                const u32 addr_hi = *args++;
-                void* addr = (void*)(addr_lo | ((u64)addr_hi << 32));
-                std::memcpy(addr, &constant_ram[offs], n_dw * sizeof(u32));
-                break;
-            }
+        if (pkt->type == 0) {
+            ptr++;
+            continue;
+            Helpers::panic("CCB PM4 type 0 packet\n");
+        }
+        else if (pkt->type == 1) {
+            Helpers::panic("CCB PM4 type 1 packet\n");
+        }
+        else if (pkt->type == 2) {
+            Helpers::panic("CCB PM4 type 1 packet\n");
+        }
 
-            case PM4ItOpcode::IncrementCeCounter: {
-                ce_count++;
-                break;
-            }
+        switch ((PM4ItOpcode)(u32)pkt->opcode) {
+        case PM4ItOpcode::Nop:  break;
 
-            case PM4ItOpcode::WaitOnDeCounterDiff: {
-                const u32 diff = *args++;
-                while (de_count - ce_count >= diff) {
-                    std::this_thread::sleep_for(std::chrono::microseconds(1000));
-                    std::this_thread::yield();
-                }
-                break;
-            }
+        case PM4ItOpcode::WriteConstRam: {
+            const u32 offs = *args++;
+            std::memcpy(&constant_ram[offs], args, pkt->count * sizeof(u32));
+            break;
+        }
 
-            default: {
-                log("Unimplemented ccb opcode 0x%x count %d\n", (u32)pkt->opcode, (u32)pkt->count);
-                break;
-            }
+        case PM4ItOpcode::DumpConstRam: {
+            const u32 offs = *args++;
+            const u32 n_dw = *args++;
+            const u32 addr_lo = *args++;
+            const u32 addr_hi = *args++;
+            void* addr = (void*)(addr_lo | ((u64)addr_hi << 32));
+            std::memcpy(addr, &constant_ram[offs], n_dw * sizeof(u32));
+            break;
+        }
+
+        case PM4ItOpcode::IncrementCeCounter: {
+            ce_count++;
+            ce_count.notify_all();
+            break;
+        }
+
+        case PM4ItOpcode::WaitOnDeCounterDiff: {
+            const u32 diff = *args++;
+            while (true) {
+                const u32 de = de_count;
+                if (de - ce_count < diff) break;
+                de_count.wait(de);
             }
+            break;
+        }
 
-            ptr += pkt->count + 2;
+        default: {
+            log("Unimplemented ccb opcode 0x%x count %d\n", (u32)pkt->opcode, (u32)pkt->count);
+            break;
+        }
         }
-    });
+
+        ptr += pkt->count + 2;
+    }
+}
+
+static void ceThread() {
+#ifdef _WIN32
+    SetThreadDescription(GetCurrentThread(), L"[Emu] GCN Constant Engine");
+#endif
+    Profiler::setThreadName("[Emu] GCN Constant Engine");
+
+    CcbJob job;
+    while (true) {
+        ce_queue.pop(job);
+
+        Profiler::Zone zone("Execute CCB");
+        const auto start = std::chrono::steady_clock::now();
+        executeCcb(job.ccb, job.ccb_size);
+        const auto end = std::chrono::steady_clock::now();
+        ccb_exec_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+}
+
+void initCommandProcessor() {
+    std::memset(constant_ram, 0, 48_KB);
+    ce_thread = std::thread(ceThread);
+    ce_thread.detach();
+}
+
+void processCcb(u32* ccb, size_t ccb_size) {
+    const auto start = std::chrono::steady_clock::now();
+    ce_queue.push({ ccb, ccb_size });
+    const auto end = std::chrono::steady_clock::now();
+    ccb_count++;
+    ccb_submit_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void printCeStats() {
+    const u64 count = ccb_count.exchange(0);
+    const u64 submit_ns = ccb_submit_ns.exchange(0);
+    const u64 exec_ns = ccb_exec_ns.exchange(0);
+    printf("------ Constant engine ------\n");
+    printf("%llu CCBs (avg %.1f ns to submit, %.1f us to execute)\n", count, count ? (double)submit_ns / count : 0.0, count ? (double)exec_ns / count / 1000.0 : 0.0);
 }
 
 void* index_base = nullptr;
@@ -305,6 +365,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             }
 
             std::memcpy((void*)addr, args, (pkt->count - 2) * sizeof(u32));
+            GCN::notifyMemoryWrite();
             break;
         }
 
@@ -319,17 +380,24 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             case Select::SignalSemaphore: {
                 log("Signalling semaphore\n");
                 switch (d2.signal_type) {
-                case SignalType::Increment: (*ptr)++;   break;
-                case SignalType::Write:     *ptr = 1;   break;
+                case SignalType::Increment: (*sem_ptr)++;   break;
+                case SignalType::Write:     *sem_ptr = 1;   break;
 
                 default: Helpers::panic("invalid MemSemaphore signal type %d\n", d2.signal_type.Value());
                 }
+                GCN::notifyMemoryWrite();
                 break;
             }
 
             case Select::WaitSemaphore: {
                 log("Waiting on semaphore\n");
-                while (*ptr == 0) std::this_thread::sleep_for(std::chrono::microseconds(10));
+                // Whoever signals the semaphore isn't part of a trace
+                if (Trace::replaying) break;
+                while (true) {
+                    const u32 epoch = GCN::memoryWriteEpoch();
+                    if (*(volatile u64*)sem_ptr != 0) break;
+                    GCN::waitForMemoryWrite(epoch, MEMORY_WAIT_FALLBACK);
+                }
                 break;
             }
 
@@ -354,7 +422,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             log("WaitRegMem: ref=%d\n", reference);
 
             auto check = [&]() -> bool {
-                u32 val = (d1.mem_space == MemSpace::Memory) ? *ptr : renderer->regs[d2.reg];
+                u32 val = (d1.mem_space == MemSpace::Memory) ? *(volatile u32*)ptr : renderer->regs[d2.reg];
                 val &= mask;
 
                 switch (d1.function) {
@@ -369,16 +437,19 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
                 }
             };
 
-            if (!Configuration::skip_waitregmem) {
-                while (!check()) {
+            if (!Configuration::skip_waitregmem && !Trace::replaying) {
+                while (true) {
+                    u32 epoch = GCN::memoryWriteEpoch();
+                    if (check()) break;
+
                     if (!is_compute)
                         GCN::processAsyncCompute();
                     else
                         co::active().get_parent().switch_to();
 
-
-                    // TODO: Use poll_interval
-                    std::this_thread::sleep_for(std::chrono::microseconds(1000));
+                    // Only sleep if nothing was written while the other queues ran
+                    if (GCN::memoryWriteEpoch() != epoch) continue;
+                    GCN::waitForMemoryWrite(epoch, MEMORY_WAIT_FALLBACK);
                 }
             }
             break;
@@ -390,6 +461,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             const IndirectBuffer2 d2 = { .raw = *args++ };
             const u32* ptr = (u32*)(addr_lo | ((u64)d1.addr_hi << 32));
             log("IndirectBuffer: ptr=%p, size=0x%llx\n", ptr, d2.size.Value());
+            Trace::recordMemory(ptr, d2.size * sizeof(u32));
             processCommands((u32*)ptr, d2.size * sizeof(u32), nullptr, 0, compute_queue, true);
             break;
         }
@@ -446,6 +518,9 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             default: Helpers::panic("EventWriteEop: unhandled data_sel %d\n", data_sel);
             }
 
+            if (data_sel != 0)
+                GCN::notifyMemoryWrite();
+
             if (int_sel != 0) {   // 0 = None
                 GCN::eop_ev_source.trigger(EOP_EVENT_ID);
             }
@@ -464,6 +539,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             case 2: std::memcpy(dst_ptr, &data, sizeof(u32));   break;
             default: Helpers::panic("EventWriteEos: unhandled cmd %d\n", cmd);
             }
+            GCN::notifyMemoryWrite();
             break;
         }
 
@@ -485,6 +561,8 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             }
 
             log("ReleaseMem: write to %p\n", dst_ptr);
+            if (d2.data_sel != 0)
+                GCN::notifyMemoryWrite();
 
             if (d2.int_sel != 0)
                 log("TODO: ReleaseMem interrupt\n");
@@ -537,6 +615,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
                     if (dst && src)
                         std::memcpy(dst, src, size);
                 }
+                GCN::notifyMemoryWrite();
             }
             break;
         }
@@ -545,7 +624,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             const u32 reg_offset = 0x2000 + (*args++ & 0xffff);    // 0x2000 is the offset for ConfigReg
             log("Set context register 0x%x\n", reg_offset);
             if (reg_offset < 0xd000)
-                std::memcpy(&renderer->regs[reg_offset], args, pkt->count * sizeof(u32));
+                renderer->setRegs(reg_offset, args, pkt->count);
             else printf("Bad config register offset 0x%x\n", reg_offset);
             break;
         }
@@ -554,7 +633,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             const u32 reg_offset = 0xa000 + (*args++ & 0xffff);    // 0xa000 is the offset for ContextReg
             log("Set context register 0x%x\n", reg_offset);
             if (reg_offset < 0xd000)
-                std::memcpy(&renderer->regs[reg_offset], args, pkt->count * sizeof(u32));
+                renderer->setRegs(reg_offset, args, pkt->count);
             else printf("Bad context register offset 0x%x\n", reg_offset);
 
             // This hack is ported from shadPS4.
@@ -626,7 +705,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             const u32 reg_offset = 0x2c00 + (*args++ & 0xffff);    // 0x2c00 is the offset for ShReg
             log("Set shader register 0x%x\n", reg_offset);
             if (reg_offset < 0xd000)
-                std::memcpy(&renderer->regs[reg_offset], args, pkt->count * sizeof(u32));
+                renderer->setRegs(reg_offset, args, pkt->count);
             else printf("Bad shader register offset 0x%x\n", reg_offset);
             break;
         }
@@ -635,7 +714,7 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
             const u32 reg_offset = 0xc000 + (*args++ & 0xffff);    // 0xc000 is the offset for UconfigReg
             log("Set Uconfig register 0x%x\n", reg_offset);
             if (reg_offset < 0xd000)
-                std::memcpy(&renderer->regs[reg_offset], args, pkt->count * sizeof(u32));
+                renderer->setRegs(reg_offset, args, pkt->count);
             else printf("Bad shader register offset 0x%x\n", reg_offset);
             break;
         }
@@ -688,13 +767,15 @@ void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::L
 
         case PM4ItOpcode::IncrementDeCounter: {
             de_count++;
+            de_count.notify_all();
             break;
         }
 
         case PM4ItOpcode::WaitOnCeCounter: {
-            while (ce_count <= de_count) {
-                std::this_thread::sleep_for(std::chrono::microseconds(1000));
-                std::this_thread::yield();
+            while (true) {
+                const u32 ce = ce_count;
+                if (ce > de_count) break;
+                ce_count.wait(ce);
             }
             break;
         }
@@ -9,5 +9,6 @@ namespace PS4::GCN {
 
 void initCommandProcessor();
 void processCommands(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size, OS::Libs::SceGnmDriver::ComputeQueue* compute_queue, bool is_indirect = false);
+void printCeStats();
 
 }   // End namespace PS4::GCN
\ No newline at end of file
@@ -36,6 +36,12 @@ GpaError gpaComputeSurfaceCoord(
     uint64_t* outoffset, uint64_t* outbitoffset, const GpaSurfaceContext* ctx,
     uint32_t x, uint32_t y, uint32_t z, uint32_t fragindex
 );
+// Computes the offset of every element of a 8x8 micro tile relative to the
+// first element of the micro tile. Only supported for thin surfaces with one
+// fragment per pixel, where these offsets are the same for every micro tile.
+GpaError gpaComputeMicroTileOffsets(
+    uint64_t* outoffsets, uint64_t* outmaxoffset, const GpaSurfaceContext* ctx
+);
 GpaError gpaComputeSurfaceSizeOffset(
     uint64_t* outsize, uint64_t* outoffset, const GpaTextureInfo* tex,
     uint32_t miplevel, uint32_t arrayslice
@@ -90,11 +96,27 @@ GpaError gpaTileSurfaceRegion(
     const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
     const GpaSurfaceRegion* region
 );
+// Same as gpaTileSurfaceRegion, but always computes the address of every
+// element instead of using the per micro tile fast path. Only meant to check
+// and benchmark the fast path against.
+GpaError gpaTileSurfaceRegionGeneric(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
+    const GpaSurfaceRegion* region
+);
 GpaError gpaTileTextureIndexed(
     const void* inbuf, size_t inlen, void* outbuf, size_t outlen,
     const GpaTextureInfo* texinfo, GnmTileMode newtiling, uint32_t mip,
     uint32_t slice
 );
+// Same as gpaTileTextureIndexed, but only converts one of numparts horizontal
+// bands of the surface. Different parts of the same surface can be converted
+// concurrently.
+GpaError gpaTileTextureIndexedPart(
+    const void* inbuf, size_t inlen, void* outbuf, size_t outlen,
+    const GpaTextureInfo* texinfo, GnmTileMode newtiling, uint32_t mip,
+    uint32_t slice, uint32_t part, uint32_t numparts
+);
 GpaError gpaTileTextureAll(
     const void* inbuf, size_t inlen, void* outbuf, size_t outlen,
     const GpaTextureInfo* texinfo, GnmTileMode newtiling
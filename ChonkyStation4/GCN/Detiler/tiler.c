@@ -115,11 +115,15 @@ static GpaError initregioninfo(
 	return GPA_ERR_OK;
 }
 
-GpaError gpaTileSurface(
+// Converts one of numparts horizontal bands of the surface. Bands are made of
+// whole micro tile rows, so different bands never write to the same bytes.
+static GpaError tilesurfacepart(
     void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
-    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp
+    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
+    uint32_t part, uint32_t numparts
 ) {
-	if (!outbuf || !outlen || !inbuf || !inlen || !srctp || !dst_tp) {
+	if (!outbuf || !outlen || !inbuf || !inlen || !srctp || !dst_tp ||
+	    !numparts || part >= numparts) {
 		return GPA_ERR_INVALID_ARGS;
 	}
 
@@ -131,11 +135,35 @@ GpaError gpaTileSurface(
 		return err;
 	}
 
+	if (numparts > 1) {
+		const uint32_t tilerows =
+		    (region.bottom + MicroTileHeight - 1) / MicroTileHeight;
+		const uint32_t rowsperpart =
+		    (tilerows + numparts - 1) / numparts * MicroTileHeight;
+		const uint32_t top = part * rowsperpart;
+		if (top >= region.bottom) {
+			// more parts than micro tile rows, nothing left for
+			// this one
+			return GPA_ERR_OK;
+		}
+		region.top = top;
+		region.bottom = umin(top + rowsperpart, region.bottom);
+	}
+
 	return gpaTileSurfaceRegion(
 	    outbuf, outlen, inbuf, inlen, srctp, dst_tp, &region
 	);
 }
 
+GpaError gpaTileSurface(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp
+) {
+	return tilesurfacepart(
+	    outbuf, outlen, inbuf, inlen, srctp, dst_tp, 0, 1
+	);
+}
+
 static inline bool regionhastexels(const GpaSurfaceRegion* region) {
 	const uint32_t width = region->right - region->left;
 	const uint32_t height = region->bottom - region->top;
@@ -143,50 +171,245 @@ static inline bool regionhastexels(const GpaSurfaceRegion* region) {
 	return width > 0 && height > 0 && depth > 0;
 }
 
-GpaError gpaTileSurfaceRegion(
-    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
-    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
-    const GpaSurfaceRegion* region
+// Fast path for thin, single fragment surfaces.
+// Within a micro tile the pipe and bank are the same for every element and the
+// tile is never split, so the offset of an element relative to the first
+// element of its micro tile doesn't depend on where the micro tile is.
+// These offsets are computed once per surface, and the full address is only
+// computed once per micro tile instead of once per element.
+static bool canusefastpath(const GpaSurfaceContext* ctx) {
+	if (ctx->numfragsperpixel != 1) {
+		return false;
+	}
+	switch (ctx->bitsperelement) {
+	case 8:
+	case 16:
+	case 32:
+	case 64:
+	case 128:
+		break;
+	default:
+		return false;
+	}
+
+	const GnmArrayMode arraymode = gpaGetArrayMode(ctx->tilemode);
+	return gpaIsLinear(arraymode) ||
+	       gpaGetMicroTileThickness(arraymode) == 1;
+}
+
+GpaError gpaComputeMicroTileOffsets(
+    uint64_t* outoffsets, uint64_t* outmaxoffset, const GpaSurfaceContext* ctx
 ) {
-	if (!outbuf || !outlen || !inbuf || !inlen || !srctp || !dst_tp ||
-	    !region) {
+	if (!outoffsets || !outmaxoffset || !ctx) {
 		return GPA_ERR_INVALID_ARGS;
 	}
-
-	if (!regionhastexels(region)) {
-		// nothing to convert
-		return GPA_ERR_OK;
+	if (!canusefastpath(ctx)) {
+		return GPA_ERR_UNSUPPORTED;
 	}
 
-	GpaSurfaceContext src_ctx = {0};
-	GpaError err = gpaInitSurfaceContext(&src_ctx, inlen, srctp);
+	uint64_t base = 0;
+	GpaError err = gpaComputeSurfaceCoord(&base, NULL, ctx, 0, 0, 0, 0);
 	if (err != GPA_ERR_OK) {
 		return err;
 	}
 
-	GpaSurfaceContext dstctx = {0};
-	err = gpaInitSurfaceContext(&dstctx, outlen, dst_tp);
+	uint64_t maxoffset = 0;
+	for (uint32_t y = 0; y < MicroTileHeight; y += 1) {
+		for (uint32_t x = 0; x < MicroTileWidth; x += 1) {
+			uint64_t off = 0;
+			err = gpaComputeSurfaceCoord(&off, NULL, ctx, x, y, 0, 0);
+			if (err != GPA_ERR_OK) {
+				return err;
+			}
+			if (off < base) {
+				return GPA_ERR_INTERNAL_ERROR;
+			}
+			off -= base;
+			outoffsets[y * MicroTileWidth + x] = off;
+			maxoffset = off > maxoffset ? off : maxoffset;
+		}
+	}
+
+	*outmaxoffset = maxoffset;
+	return GPA_ERR_OK;
+}
+
+typedef struct {
+	uint8_t* dst;
+	const uint8_t* src;
+	const uint64_t* dstoffsets;
+	const uint64_t* srcoffsets;
+	uint32_t x0, x1;  // element range within the micro tile
+	uint32_t y0, y1;
+} TileCopy;
+
+// The element size is a constant in each copy function, so the memcpy
+// becomes a single (SSE for 128 bit elements) load and store
+#define DEFINE_TILE_COPY(bytes)                                             \
+	static void copytile##bytes(const TileCopy* tc) {                   \
+		for (uint32_t y = tc->y0; y < tc->y1; y += 1) {             \
+			const uint32_t row = y * MicroTileWidth;            \
+			for (uint32_t x = tc->x0; x < tc->x1; x += 1) {     \
+				memcpy(                                     \
+				    tc->dst + tc->dstoffsets[row + x],      \
+				    tc->src + tc->srcoffsets[row + x], bytes \
+				);                                          \
+			}                                                   \
+		}                                                           \
+	}
+
+DEFINE_TILE_COPY(1)
+DEFINE_TILE_COPY(2)
+DEFINE_TILE_COPY(4)
+DEFINE_TILE_COPY(8)
+DEFINE_TILE_COPY(16)
+
+#undef DEFINE_TILE_COPY
+
+typedef void (*TileCopyFunc)(const TileCopy* tc);
+
+static TileCopyFunc gettilecopyfunc(uint32_t elembytesize) {
+	switch (elembytesize) {
+	case 1:
+		return copytile1;
+	case 2:
+		return copytile2;
+	case 4:
+		return copytile4;
+	case 8:
+		return copytile8;
+	case 16:
+		return copytile16;
+	default:
+		return NULL;
+	}
+}
+
+// Same as copytile but checks every element against the buffer sizes, for
+// micro tiles whose full footprint doesn't fit in one of the buffers (the edges
+// of linear surfaces)
+static GpaError copytilechecked(
+    const TileCopy* tc, uint32_t elembytesize, uint64_t inlen, uint64_t outlen
+) {
+	for (uint32_t y = tc->y0; y < tc->y1; y += 1) {
+		const uint32_t row = y * MicroTileWidth;
+		for (uint32_t x = tc->x0; x < tc->x1; x += 1) {
+			const uint8_t* src = tc->src + tc->srcoffsets[row + x];
+			uint8_t* dst = tc->dst + tc->dstoffsets[row + x];
+			if (tc->srcoffsets[row + x] + elembytesize > inlen ||
+			    tc->dstoffsets[row + x] + elembytesize > outlen) {
+				return GPA_ERR_OVERFLOW;
+			}
+			memcpy(dst, src, elembytesize);
+		}
+	}
+	return GPA_ERR_OK;
+}
+
+static GpaError tilesurfaceregionfast(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaSurfaceContext* src_ctx, const GpaSurfaceContext* dstctx,
+    const GpaSurfaceRegion* region
+) {
+	const uint32_t elembytesize = src_ctx->bitsperelement / 8;
+	const TileCopyFunc copytile = gettilecopyfunc(elembytesize);
+	if (!copytile) {
+		return GPA_ERR_UNSUPPORTED;
+	}
+
+	uint64_t srcoffsets[MicroTilePixels];
+	uint64_t dstoffsets[MicroTilePixels];
+	uint64_t srcmaxoffset = 0;
+	uint64_t dstmaxoffset = 0;
+	GpaError err =
+	    gpaComputeMicroTileOffsets(srcoffsets, &srcmaxoffset, src_ctx);
+	if (err != GPA_ERR_OK) {
+		return err;
+	}
+	err = gpaComputeMicroTileOffsets(dstoffsets, &dstmaxoffset, dstctx);
 	if (err != GPA_ERR_OK) {
 		return err;
 	}
 
-	if (src_ctx.bitsperelement != dstctx.bitsperelement ||
-	    src_ctx.numfragsperpixel != dstctx.numfragsperpixel) {
-		return GPA_ERR_UNSUPPORTED;
+	const uint32_t tx0 = region->left / MicroTileWidth;
+	const uint32_t tx1 =
+	    (region->right + MicroTileWidth - 1) / MicroTileWidth;
+	const uint32_t ty0 = region->top / MicroTileHeight;
+	const uint32_t ty1 =
+	    (region->bottom + MicroTileHeight - 1) / MicroTileHeight;
+
+	for (uint32_t z = region->front; z < region->back; z += 1) {
+		for (uint32_t ty = ty0; ty < ty1; ty += 1) {
+			const uint32_t y = ty * MicroTileHeight;
+			for (uint32_t tx = tx0; tx < tx1; tx += 1) {
+				const uint32_t x = tx * MicroTileWidth;
+
+				uint64_t srcbase = 0;
+				err = gpaComputeSurfaceCoord(
+				    &srcbase, NULL, src_ctx, x, y, z, 0
+				);
+				if (err != GPA_ERR_OK) {
+					return err;
+				}
+				uint64_t dstbase = 0;
+				err = gpaComputeSurfaceCoord(
+				    &dstbase, NULL, dstctx, x, y, z, 0
+				);
+				if (err != GPA_ERR_OK) {
+					return err;
+				}
+
+				// Clip the micro tile against the region
+				const TileCopy tc = {
+				    .dst = (uint8_t*)outbuf + dstbase,
+				    .src = (const uint8_t*)inbuf + srcbase,
+				    .dstoffsets = dstoffsets,
+				    .srcoffsets = srcoffsets,
+				    .x0 = x < region->left ? region->left - x : 0,
+				    .x1 = umin(region->right - x, MicroTileWidth),
+				    .y0 = y < region->top ? region->top - y : 0,
+				    .y1 = umin(region->bottom - y, MicroTileHeight),
+				};
+
+				if (srcbase + srcmaxoffset + elembytesize <= inlen &&
+				    dstbase + dstmaxoffset + elembytesize <= outlen) {
+					copytile(&tc);
+				} else {
+					if (srcbase > inlen || dstbase > outlen) {
+						return GPA_ERR_OVERFLOW;
+					}
+					err = copytilechecked(
+					    &tc, elembytesize, inlen - srcbase,
+					    outlen - dstbase
+					);
+					if (err != GPA_ERR_OK) {
+						return err;
+					}
+				}
+			}
+		}
 	}
 
-	const uint32_t elembytesize = src_ctx.bitsperelement / 8;
+	return GPA_ERR_OK;
+}
+
+static GpaError tilesurfaceregiongeneric(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaSurfaceContext* src_ctx, const GpaSurfaceContext* dstctx,
+    const GpaSurfaceRegion* region
+) {
+	const uint32_t elembytesize = src_ctx->bitsperelement / 8;
 	const uint32_t lz = region->back;
 	const uint32_t ly = region->bottom;
 	const uint32_t lx = region->right;
-	const uint32_t lf = src_ctx.numfragsperpixel;
+	const uint32_t lf = src_ctx->numfragsperpixel;
 	for (uint32_t z = region->front; z < lz; z += 1) {
 		for (uint32_t y = region->top; y < ly; y += 1) {
 			for (uint32_t x = region->left; x < lx; x += 1) {
 				for (uint32_t f = 0; f < lf; f += 1) {
 					uint64_t srcoff = 0;
 					GpaError gerr = gpaComputeSurfaceCoord(
-					    &srcoff, NULL, &src_ctx, x, y, z, f
+					    &srcoff, NULL, src_ctx, x, y, z, f
 					);
 					if (gerr != GPA_ERR_OK) {
 						return gerr;
@@ -194,7 +417,7 @@ GpaError gpaTileSurfaceRegion(
 
 					uint64_t dstoff = 0;
 					gerr = gpaComputeSurfaceCoord(
-					    &dstoff, NULL, &dstctx, x, y, z, f
+					    &dstoff, NULL, dstctx, x, y, z, f
 					);
 					if (gerr != GPA_ERR_OK) {
 						return gerr;
@@ -219,10 +442,79 @@ GpaError gpaTileSurfaceRegion(
 	return GPA_ERR_OK;
 }
 
-GpaError gpaTileTextureIndexed(
+static GpaError tilesurfaceregion(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
+    const GpaSurfaceRegion* region, bool allowfastpath
+) {
+	if (!outbuf || !outlen || !inbuf || !inlen || !srctp || !dst_tp ||
+	    !region) {
+		return GPA_ERR_INVALID_ARGS;
+	}
+
+	if (!regionhastexels(region)) {
+		// nothing to convert
+		return GPA_ERR_OK;
+	}
+
+	GpaSurfaceContext src_ctx = {0};
+	GpaError err = gpaInitSurfaceContext(&src_ctx, inlen, srctp);
+	if (err != GPA_ERR_OK) {
+		return err;
+	}
+
+	GpaSurfaceContext dstctx = {0};
+	err = gpaInitSurfaceContext(&dstctx, outlen, dst_tp);
+	if (err != GPA_ERR_OK) {
+		return err;
+	}
+
+	if (src_ctx.bitsperelement != dstctx.bitsperelement ||
+	    src_ctx.numfragsperpixel != dstctx.numfragsperpixel) {
+		return GPA_ERR_UNSUPPORTED;
+	}
+
+	if (allowfastpath && canusefastpath(&src_ctx) &&
+	    canusefastpath(&dstctx)) {
+		err = tilesurfaceregionfast(
+		    outbuf, outlen, inbuf, inlen, &src_ctx, &dstctx, region
+		);
+		// Surfaces whose first micro tile doesn't fit in the padded
+		// size (tiny linear mips) take the generic path
+		if (err != GPA_ERR_INVALID_ARGS) {
+			return err;
+		}
+	}
+
+	return tilesurfaceregiongeneric(
+	    outbuf, outlen, inbuf, inlen, &src_ctx, &dstctx, region
+	);
+}
+
+GpaError gpaTileSurfaceRegion(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
+    const GpaSurfaceRegion* region
+) {
+	return tilesurfaceregion(
+	    outbuf, outlen, inbuf, inlen, srctp, dst_tp, region, true
+	);
+}
+
+GpaError gpaTileSurfaceRegionGeneric(
+    void* outbuf, size_t outlen, const void* inbuf, size_t inlen,
+    const GpaTilingParams* srctp, const GpaTilingParams* dst_tp,
+    const GpaSurfaceRegion* region
+) {
+	return tilesurfaceregion(
+	    outbuf, outlen, inbuf, inlen, srctp, dst_tp, region, false
+	);
+}
+
+GpaError gpaTileTextureIndexedPart(
     const void* inbuf, size_t inlen, void* outbuf, size_t outlen,
     const GpaTextureInfo* texinfo, GnmTileMode newtiling, uint32_t mip,
-    uint32_t slice
+    uint32_t slice, uint32_t part, uint32_t numparts
 ) {
 	if (!inbuf || !inlen || !outbuf || !outlen || !texinfo) {
 		return GPA_ERR_INVALID_ARGS;
@@ -268,9 +560,10 @@ GpaError gpaTileTextureIndexed(
 		return GPA_ERR_OVERFLOW;
 	}
 
-	res = gpaTileSurface(
+	res = tilesurfacepart(
 	    (uint8_t*)outbuf + dstsurfoff, dstsurflen,
-	    (const uint8_t*)inbuf + srcsurfoff, srcsurflen, &srctp, &dst_tp
+	    (const uint8_t*)inbuf + srcsurfoff, srcsurflen, &srctp, &dst_tp,
+	    part, numparts
 	);
 	if (res != GPA_ERR_OK) {
 		return res;
@@ -279,6 +572,16 @@ GpaError gpaTileTextureIndexed(
 	return GPA_ERR_OK;
 }
 
+GpaError gpaTileTextureIndexed(
+    const void* inbuf, size_t inlen, void* outbuf, size_t outlen,
+    const GpaTextureInfo* texinfo, GnmTileMode newtiling, uint32_t mip,
+    uint32_t slice
+) {
+	return gpaTileTextureIndexedPart(
+	    inbuf, inlen, outbuf, outlen, texinfo, newtiling, mip, slice, 0, 1
+	);
+}
+
 GpaError gpaTileTextureAll(
     const void* inbuf, size_t inlen, void* outbuf, size_t outlen,
     const GpaTextureInfo* texinfo, GnmTileMode newtiling
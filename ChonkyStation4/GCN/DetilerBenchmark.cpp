@@ -0,0 +1,105 @@
+#include "DetilerBenchmark.hpp"
+#include <GCN/Detiler/gpuaddr.h>
+#include <GCN/Detiler/gnm/dataformat.h>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+namespace PS4::GCN {
+
+template <typename F>
+static double measure(int iterations, F&& detile) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (detile() != GPA_ERR_OK) return -1.0;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+void benchmarkDetiler(u32 width, u32 height, int iterations) {
+    if (!width || !height || iterations <= 0) return;
+
+    // One format per element size, every size has its own fast path copy function
+    struct Format {
+        const char* name;
+        GnmDataFormat fmt;
+        u32 bytes_per_element;
+    };
+    const Format formats[] = {
+        { "R8",             GNM_FMT_R8_UNORM,               1 },
+        { "R16",            GNM_FMT_R16_UNORM,              2 },
+        { "RGBA8",          GNM_FMT_R8G8B8A8_UNORM,         4 },
+        { "RGBA16",         GNM_FMT_R16G16B16A16_UNORM,     8 },
+        { "RGBA32F",        GNM_FMT_R32G32B32A32_FLOAT,     16 },
+    };
+
+    printf("Detiling a %dx%d texture %d times per path\n", width, height, iterations);
+    printf("%-8s %-10s %-6s %14s %14s %8s\n", "format", "tile mode", "fast", "fast GB/s", "generic GB/s", "match");
+
+    std::mt19937 rng(1234);
+    for (const auto& format : formats) {
+        // Thick tile modes are skipped, the fast path only handles thin surfaces.
+        // The values between the last thick mode and GNM_TM_DISPLAY_LINEAR_GENERAL aren't valid tile modes.
+        for (u32 tm = GNM_TM_DEPTH_2D_THIN_64; tm <= GNM_TM_DISPLAY_LINEAR_GENERAL; tm++) {
+            if (tm > GNM_TM_THIN_3D_THIN_PRT && tm != GNM_TM_DISPLAY_LINEAR_GENERAL) continue;
+
+            GpaTextureInfo tex_info = {
+                .type = GNM_TEXTURE_2D,
+                .fmt = format.fmt,
+                .width = width,
+                .height = height,
+                .pitch = width,
+                .depth = 1,
+                .numfrags = 1,
+                .nummips = 1,
+                .numslices = 1,
+                .tm = (GnmTileMode)tm,
+                .mingpumode = GNM_GPU_BASE,
+                .pow2pad = false
+            };
+            GpaTextureInfo out_tex_info = tex_info;
+            out_tex_info.tm = GNM_TM_DISPLAY_LINEAR_GENERAL;
+
+            // Tile modes that don't apply to this kind of texture are skipped
+            GpaTilingParams src_tp = {};
+            GpaTilingParams dst_tp = {};
+            if (gpaTpInit(&src_tp, &tex_info, 0, 0) != GPA_ERR_OK) continue;
+            if (gpaTpInit(&dst_tp, &out_tex_info, 0, 0) != GPA_ERR_OK) continue;
+            uint64_t src_size = 0, src_offset = 0, dst_size = 0, dst_offset = 0;
+            if (gpaComputeSurfaceSizeOffset(&src_size, &src_offset, &tex_info, 0, 0) != GPA_ERR_OK) continue;
+            if (gpaComputeSurfaceSizeOffset(&dst_size, &dst_offset, &out_tex_info, 0, 0) != GPA_ERR_OK) continue;
+
+            GpaSurfaceContext ctx = {};
+            uint64_t micro_tile_offsets[64];
+            uint64_t max_offset = 0;
+            const bool has_fast_path = gpaInitSurfaceContext(&ctx, src_size, &src_tp) == GPA_ERR_OK
+                                    && gpaComputeMicroTileOffsets(micro_tile_offsets, &max_offset, &ctx) == GPA_ERR_OK;
+
+            std::vector<u8> src(src_size);
+            for (auto& b : src) b = rng();
+            std::vector<u8> fast_out(dst_size);
+            std::vector<u8> generic_out(dst_size);
+            const GpaSurfaceRegion region = { .left = 0, .top = 0, .front = 0, .right = src_tp.linearwidth, .bottom = src_tp.linearheight, .back = src_tp.lineardepth };
+
+            const double fast_secs = measure(iterations, [&]() {
+                return gpaTileSurfaceRegion(fast_out.data(), fast_out.size(), src.data(), src.size(), &src_tp, &dst_tp, &region);
+            });
+            const double generic_secs = measure(iterations, [&]() {
+                return gpaTileSurfaceRegionGeneric(generic_out.data(), generic_out.size(), src.data(), src.size(), &src_tp, &dst_tp, &region);
+            });
+            if (fast_secs < 0 || generic_secs < 0) {
+                printf("%-8s 0x%-8x failed to detile\n", format.name, tm);
+                continue;
+            }
+
+            const double bytes = (double)width * height * format.bytes_per_element * iterations;
+            const bool match = std::memcmp(fast_out.data(), generic_out.data(), dst_size) == 0;
+            printf("%-8s 0x%-8x %-6s %14.2f %14.2f %8s\n", format.name, tm, has_fast_path ? "yes" : "no", bytes / fast_secs / 1e9, bytes / generic_secs / 1e9, match ? "yes" : "NO");
+        }
+    }
+}
+
+}   // End namespace PS4::GCN
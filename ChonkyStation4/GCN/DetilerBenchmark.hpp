@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::GCN {
+
+// Detiles a width x height texture of random data in one format per element size and every thin tile mode, both through the per micro tile fast path and
+// the per element generic path, checks that they produce the same output and prints the throughput of each.
+void benchmarkDetiler(u32 width, u32 height, int iterations);
+
+}   // End namespace PS4::GCN
@@ -1,6 +1,7 @@
 #include "FetchShader.hpp"
 #include <Logger.hpp>
 #include <GCN/GCN.hpp>
+#include <GCN/Trace.hpp>
 #include <GCN/Shader/Decoder.hpp>
 #include <GCN/VSharp.hpp>
 #include <unordered_map>
@@ -14,6 +15,7 @@ VSharp* VSharpLocation::asPtr() {
     VSharp* vsharp;
     std::memcpy(&vsharp, &renderer->regs[Reg::mmSPI_SHADER_USER_DATA_VS_0 + sgpr], sizeof(VSharp*));
     vsharp = (VSharp*)((u32*)vsharp + offs);  // The immediate is an offset in dwords
+    Trace::recordMemory(vsharp, sizeof(VSharp));
     return vsharp;
 }
 
@@ -84,6 +86,8 @@ FetchShader::FetchShader(const u8* data) {
             break;
         }
     }
+
+    Trace::recordMemory(data, (const u8*)code_slice.position() - data);
 }
 
 }   // End namespace PS4::GCN
\ No newline at end of file
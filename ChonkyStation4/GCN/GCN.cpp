@@ -1,12 +1,15 @@
 #include "GCN.hpp"
 #include <Configuration.hpp>
 #include <GCN/CommandProcessor.hpp>
+#include <GCN/Trace.hpp>
 #include <OS/Libraries/SceVideoOut/SceVideoOut.hpp>
 #include <OS/Libraries/SceGnmDriver/SceGnmDriver.hpp>
-#include <mutex>
-#include <semaphore>
-#include <deque>
+#include <MPSCRing.hpp>
+#include <Profiler.hpp>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
@@ -16,25 +19,27 @@
 
 namespace PS4::GCN {
 
-std::deque<RendererCommand> commands;
-std::deque<RendererCommand> asc_commands;
-std::counting_semaphore<256> sem { 0 };
-std::mutex mtx;
-std::mutex asc_mtx;
+// Submissions can come from any guest thread, and are only consumed by the GCN thread.
+// If a ring fills up the submitting thread waits for the GCN thread to catch up.
+// Compute submissions also push a SubmitCompute command to wake up the GCN thread, so that asc_commands is drained
+// even if the guest doesn't submit graphics work.
+Helpers::MPSCRing<RendererCommand, 4096> commands;
+Helpers::MPSCRing<RendererCommand, 1024> asc_commands;
 int prev_flip_idx = -1;
 co::thread* asc_co;
 bool asc_co_done = true;
 
-void gcnThread() {
-#ifdef _WIN32
-    SetThreadDescription(GetCurrentThread(), L"[Emu] GCN Thread");
-#endif
+// How long submissions take on the guest side, measured if Configuration::submit_stats_interval is set (see printSubmitStats)
+std::atomic<u64> submit_count = 0;
+std::atomic<u64> submit_ns = 0;
 
-    using clock = std::chrono::steady_clock;
-    const double target_fps = 60.0; // Stubbed for now
-    const clock::duration frame_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / target_fps));
-    auto frame_time = clock::now();
+// Memory write notifications. Writers only take the lock if someone is actually waiting.
+std::atomic<u32> mem_write_epoch = 0;
+std::atomic<u32> mem_waiters = 0;
+std::mutex mem_wait_mtx;
+std::condition_variable mem_wait_cv;
 
+void init() {
     // Initialize renderer
     initVulkan();
 
@@ -43,29 +48,45 @@ void gcnThread() {
     
     GCN::initCommandProcessor();
     initialized = true;
+}
+
+void gcnThread() {
+#ifdef _WIN32
+    SetThreadDescription(GetCurrentThread(), L"[Emu] GCN Thread");
+#endif
+    Profiler::setThreadName("[Emu] GCN Thread");
+
+    using clock = std::chrono::steady_clock;
+    const double target_fps = 60.0; // Stubbed for now
+    const clock::duration frame_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / target_fps));
+    auto frame_time = clock::now();
+
+    init();
+    if (!Configuration::gcn_trace_path.empty())
+        Trace::startRecording(Configuration::gcn_trace_path);
 
     RendererCommand cmd;
     while (true) {
-        // Wait until we have work to do.
-        sem.acquire();
-
-        {
-            // Acquire command queue lock
-            std::scoped_lock lk(mtx);
-            // Fetch command from the queue
-            cmd = commands.front();
-            commands.pop_front();
-        }
+        // Wait until we have work to do
+        commands.pop(cmd);
 
         // Process the command
         switch (cmd.type) {
         case CommandType::SubmitGraphics: {
             processAsyncCompute();
 
+            Profiler::Zone zone("Submit graphics");
+            Trace::recordSubmitGraphics(cmd.dcb, cmd.dcb_size, cmd.ccb, cmd.ccb_size);
             GCN::processCommands(cmd.dcb, cmd.dcb_size, cmd.ccb, cmd.ccb_size, nullptr);
             break;
         }
 
+        case CommandType::SubmitCompute: {
+            // Run queued compute submissions until they're all done or one of them is waiting for something
+            while (processAsyncCompute() && asc_co_done);
+            break;
+        }
+
         case CommandType::Flip: {
             auto port = PS4::OS::find<OS::Libs::SceVideoOut::SceVideoOutPort>(cmd.video_out_handle);
             if (!port) {
@@ -81,16 +102,25 @@ void gcnThread() {
             u64* buf_label;
             OS::Libs::SceVideoOut::sceVideoOutGetBufferLabelAddress(cmd.video_out_handle, (void**)&buf_label);
             buf_label[cmd.buf_idx] = 1;
+            notifyMemoryWrite();
+            Trace::recordFlip(cmd.buf_idx, OS::Libs::SceVideoOut::bufs[cmd.buf_idx]);
             renderer->flip(&OS::Libs::SceVideoOut::bufs[cmd.buf_idx]);
             global_flip_counter++;
+            if (Configuration::submit_stats_interval && global_flip_counter % Configuration::submit_stats_interval == 0)
+                printSubmitStats();
+
+            if (Configuration::profile_capture_frames && global_flip_counter == Configuration::profile_capture_frames)
+                Profiler::stopCapture();
 
             if (Configuration::is_vsh)
                 OS::Libs::SceVideoOut::bufs[cmd.buf_idx].base = OS::Libs::SceVideoOut::sce_composite_color_target_addr;
 
             // Signal SceVideoOut port event queues
             port->signalFlip(cmd.flip_arg);
-            if (prev_flip_idx >= 0)
+            if (prev_flip_idx >= 0) {
                 buf_label[prev_flip_idx] = 0;
+                notifyMemoryWrite();
+            }
             prev_flip_idx = cmd.buf_idx;
 
             // Frame limiter
@@ -110,25 +140,21 @@ void gcnThread() {
 bool processAsyncCompute() {
     if (asc_co_done) {
         RendererCommand cmd;
-        {
-            // Acquire command queue lock
-            std::scoped_lock lk(asc_mtx);
-
-            if (asc_commands.empty())
-                return false;
-
-            // Fetch command from the queue
-            cmd = asc_commands.front();
-            asc_commands.pop_front();
-        }
+        if (!asc_commands.tryPop(cmd))
+            return false;
 
         asc_co_done = false;
+        Trace::recordSubmitCompute(cmd.dcb, cmd.dcb_size, cmd.queue);
 
         if (!asc_co)
             asc_co = new co::thread();
 
         asc_co->reset([=]() {
-            GCN::processCommands(cmd.dcb, cmd.dcb_size, nullptr, 0, cmd.queue);
+            {
+                // The coroutine never returns, so the zone has to end before it switches back for the last time
+                Profiler::Zone zone("Submit compute");
+                GCN::processCommands(cmd.dcb, cmd.dcb_size, nullptr, 0, cmd.queue);
+            }
             asc_co_done = true;
             co::active().get_parent().switch_to();
         });
@@ -138,15 +164,20 @@ bool processAsyncCompute() {
     return true;
 }
 
-void submitRendererCommand(RendererCommand cmd) {
-    {
-        // Acquire command queue lock
-        std::scoped_lock lk(mtx);
-        // Push command
-        commands.push_back(cmd);
+template <typename Ring>
+static void pushCommand(Ring& ring, const RendererCommand& cmd) {
+    if (Configuration::submit_stats_interval) {
+        const auto start = std::chrono::steady_clock::now();
+        ring.push(cmd);
+        const auto end = std::chrono::steady_clock::now();
+        submit_count++;
+        submit_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
     }
-    // Increment semaphore
-    sem.release();
+    else ring.push(cmd);
+}
+
+void submitRendererCommand(RendererCommand cmd) {
+    pushCommand(commands, cmd);
 }
 
 void submitGraphics(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size) {
@@ -154,12 +185,10 @@ void submitGraphics(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size) {
 }
 
 void submitCompute(u32* cb, size_t cb_size, OS::Libs::SceGnmDriver::ComputeQueue* queue) {
-    {
-        // Acquire command queue lock
-        std::scoped_lock lk(asc_mtx);
-        // Push command
-        asc_commands.push_back({ CommandType::SubmitCompute, cb, cb_size, .queue = queue });
-    }
+    pushCommand(asc_commands, { CommandType::SubmitCompute, cb, cb_size, .queue = queue });
+    commands.push({ CommandType::SubmitCompute });   // Only a wake up, not counted as a submission
+    // A graphics WaitRegMem might be waiting for this queue to run
+    notifyMemoryWrite();
 }
 
 void submitFlip(u32 video_out_handle, u32 buf_idx, u64 flip_arg) {
@@ -167,13 +196,36 @@ void submitFlip(u32 video_out_handle, u32 buf_idx, u64 flip_arg) {
 }
 
 bool isCommandProcessorIdle() {
-    size_t size;
+    return commands.empty();
+}
+
+void printSubmitStats() {
+    const u64 count = submit_count.exchange(0);
+    const u64 ns = submit_ns.exchange(0);
+    printf("------ GCN submissions ------\n");
+    printf("%llu submissions (avg %.1f ns per submission)\n", count, count ? (double)ns / count : 0.0);
+    printCeStats();
+}
+
+void notifyMemoryWrite() {
+    mem_write_epoch++;
+    if (mem_waiters) {
+        std::scoped_lock lk(mem_wait_mtx);
+        mem_wait_cv.notify_all();
+    }
+}
+
+u32 memoryWriteEpoch() {
+    return mem_write_epoch;
+}
+
+void waitForMemoryWrite(u32 epoch, std::chrono::microseconds timeout) {
+    mem_waiters++;
     {
-        // Acquire command queue lock
-        std::scoped_lock lk(mtx);
-        size = commands.size();
+        auto lk = std::unique_lock<std::mutex>(mem_wait_mtx);
+        mem_wait_cv.wait_for(lk, timeout, [epoch]() { return mem_write_epoch != epoch; });
     }
-    return size == 0;
+    mem_waiters--;
 }
 
 }   // End namespace PS4::GCN
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <GCN/Backends/Renderer.hpp>
 #include <GCN/Backends/Vulkan/VulkanRenderer.hpp>
 #include <atomic>
+#include <chrono>
 
 
 namespace PS4::OS::Libs::SceGnmDriver {
@@ -49,12 +50,24 @@ inline std::unique_ptr<Renderer> renderer;
 // Event sources
 inline OS::Libs::Kernel::EventSource eop_ev_source;
 
+// Initializes the renderer and the command processor on the calling thread
+void init();
 void gcnThread();
 bool processAsyncCompute();
 void submitGraphics(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size);
 void submitCompute(u32* cb, size_t cb_size, OS::Libs::SceGnmDriver::ComputeQueue* queue);
 void submitFlip(u32 video_out_handle, u32 buf_idx, u64 flip_arg);
 bool isCommandProcessorIdle();
+void printSubmitStats();
+
+// Wakes up GPU waits (WaitRegMem, MemSemaphore) after a write to memory they might be polling.
+// Waiters re-check their condition when woken, so extra notifications are harmless.
+void notifyMemoryWrite();
+// Returns the current memory write epoch, to be passed to waitForMemoryWrite()
+u32 memoryWriteEpoch();
+// Sleeps until notifyMemoryWrite() is called after epoch was sampled, or until timeout elapses.
+// The timeout is a fallback for memory written directly by the guest CPU, which we can't observe.
+void waitForMemoryWrite(u32 epoch, std::chrono::microseconds timeout);
 
 inline void initVulkan() {
     renderer = std::make_unique<Vulkan::VulkanRenderer>();
@@ -2,6 +2,7 @@
 
 #include "Decoder.hpp"
 #include <algorithm>
+#include <limits>
 
 
 namespace PS4::GCN::Shader {
@@ -13,7 +14,7 @@ T extract(T value, u32 lst, u32 fst) {
 }
 } // namespace bit
 
-InstEncoding GetInstructionEncoding(u32 token) {
+static InstEncoding ComputeInstructionEncoding(u32 token) {
     auto encoding = static_cast<InstEncoding>(token & (u32)EncodingMask::MASK_9bit);
     switch (encoding) {
     case InstEncoding::SOP1:
@@ -79,10 +80,24 @@ InstEncoding GetInstructionEncoding(u32 token) {
         break;
     }
 
-    Helpers::panic("Unreachable\n");
     return InstEncoding::ILLEGAL;
 }
 
+// All encoding masks only cover the top 9 bits of the first dword, so the encoding can be looked up with them directly
+static const std::array<InstEncoding, 512> encoding_table = []() {
+    std::array<InstEncoding, 512> table;
+    for (u32 i = 0; i < table.size(); i++)
+        table[i] = ComputeInstructionEncoding(i << 23);
+    return table;
+}();
+
+InstEncoding GetInstructionEncoding(u32 token) {
+    const InstEncoding encoding = encoding_table[token >> 23];
+    if (encoding == InstEncoding::ILLEGAL)
+        Helpers::panic("Unreachable\n");
+    return encoding;
+}
+
 bool HasAdditionalLiteral(InstEncoding encoding, Opcode opcode) {
     switch (encoding) {
     case InstEncoding::SOPK: {
@@ -140,6 +155,31 @@ GcnInst GcnDecodeContext::decodeInstruction(GcnCodeSlice& code) {
     return m_instruction;
 }
 
+void GcnProgram::reset(const u32* code) {
+    m_code = code;
+    m_instructions.clear();
+    m_index.clear();
+}
+
+void GcnProgram::decodeFrom(u32 pc) {
+    u32 idx = pc / sizeof(u32);
+    GcnCodeSlice code_slice = GcnCodeSlice(m_code + idx, m_code + std::numeric_limits<u32>::max());
+
+    while (true) {
+        if (idx >= m_index.size())
+            m_index.resize(std::max<size_t>(m_index.size() * 2, idx + 64), NOT_DECODED);
+        if (m_index[idx] != NOT_DECODED)
+            break;
+
+        m_index[idx] = m_instructions.size();
+        const GcnInst& instr = m_instructions.emplace_back(m_decoder.decodeInstruction(code_slice));
+        if (instr.opcode == Opcode::S_ENDPGM)
+            break;
+
+        idx += instr.length / sizeof(u32);
+    }
+}
+
 uint32_t GcnDecodeContext::getEncodingLength(InstEncoding encoding) {
     uint32_t instLength = 0;
 
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <GCN/Shader/Instruction.hpp>
+#include <vector>
 
 
 namespace PS4::GCN::Shader {
@@ -48,6 +49,10 @@ public:
         return m_ptr == m_end;
     }
 
+    const u32* position() const {
+        return m_ptr;
+    }
+
 private:
     const u32* m_ptr{};
     const u32* m_end{};
@@ -94,4 +99,32 @@ private:
     GcnInst m_instruction;
 };
 
+// The decoded instructions of a shader, so that passes that walk the code more than once only decode it once.
+// Instructions are decoded linearly on first access, up to an S_ENDPGM or to code that was already decoded.
+// PCs are byte offsets from the start of the shader, like in the decompiler.
+class GcnProgram {
+public:
+    void reset(const u32* code);
+
+    // The returned reference is only valid until the next call to at(), as decoding more code can grow the instruction buffer
+    const GcnInst& at(u32 pc) {
+        const u32 idx = pc / sizeof(u32);
+        if (idx >= m_index.size() || m_index[idx] == NOT_DECODED) [[unlikely]]
+            decodeFrom(pc);
+        return m_instructions[m_index[idx]];
+    }
+
+    size_t size() const { return m_instructions.size(); }
+
+private:
+    static constexpr u32 NOT_DECODED = 0xFFFFFFFF;
+
+    const u32* m_code = nullptr;
+    GcnDecodeContext m_decoder;
+    std::vector<GcnInst> m_instructions;
+    std::vector<u32> m_index;   // Dword offset -> index in m_instructions
+
+    void decodeFrom(u32 pc);
+};
+
 } // End namespace PS4::GCN::Shader
@@ -0,0 +1,87 @@
+#include "DecoderBenchmark.hpp"
+#include <GCN/Shader/Decoder.hpp>
+#include <chrono>
+#include <fstream>
+#include <vector>
+
+
+namespace PS4::GCN::Shader {
+
+// Appended to every shader, so that truncated dumps can't make the decoder run off the end of the buffer
+static constexpr u32 S_ENDPGM_TOKEN = 0xBF810000;
+static constexpr size_t PADDING_DWORDS = 16;
+
+static std::vector<std::vector<u32>> loadShaders(const fs::path& dir) {
+    std::vector<std::vector<u32>> shaders;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".bin") continue;
+
+        std::ifstream file(entry.path(), std::ios::binary);
+        const size_t size = entry.file_size();
+        auto& code = shaders.emplace_back(Helpers::alignUp<size_t>(size, 4) / 4 + PADDING_DWORDS, S_ENDPGM_TOKEN);
+        file.read((char*)code.data(), size);
+    }
+    return shaders;
+}
+
+template <typename F>
+static void measure(const char* name, int iterations, F&& decode) {
+    u64 n_instrs = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        n_instrs += decode();
+    const auto end = std::chrono::steady_clock::now();
+
+    const double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-16s %llu instructions in %.3f ms (%.2f M instructions/s)\n", name, n_instrs, secs * 1000.0, secs > 0 ? n_instrs / secs / 1e6 : 0.0);
+}
+
+void benchmarkDecoder(const fs::path& dir, int iterations) {
+    const auto shaders = loadShaders(dir);
+    if (shaders.empty()) {
+        printf("No .bin shaders found in %s\n", dir.generic_string().c_str());
+        return;
+    }
+    printf("Decoding %zu shaders %d times\n", shaders.size(), iterations);
+
+    measure("GcnDecodeContext", iterations, [&]() {
+        u64 n = 0;
+        GcnDecodeContext decoder;
+        for (const auto& code : shaders) {
+            GcnCodeSlice code_slice = GcnCodeSlice(code.data(), code.data() + code.size());
+            while (!code_slice.atEnd()) {
+                n++;
+                if (decoder.decodeInstruction(code_slice).opcode == Opcode::S_ENDPGM) break;
+            }
+        }
+        return n;
+    });
+
+    GcnProgram program;
+    measure("GcnProgram", iterations, [&]() {
+        u64 n = 0;
+        for (const auto& code : shaders) {
+            program.reset(code.data());
+            program.at(0);
+            n += program.size();
+        }
+        return n;
+    });
+
+    // What later passes over an already decoded shader cost
+    std::vector<GcnProgram> programs(shaders.size());
+    for (size_t i = 0; i < shaders.size(); i++)
+        programs[i].reset(shaders[i].data());
+    measure("GcnProgram walk", iterations, [&]() {
+        u64 n = 0;
+        for (auto& program : programs) {
+            for (u32 pc = 0; ; pc += program.at(pc).length) {
+                n++;
+                if (program.at(pc).opcode == Opcode::S_ENDPGM) break;
+            }
+        }
+        return n;
+    });
+}
+
+}   // End namespace PS4::GCN::Shader
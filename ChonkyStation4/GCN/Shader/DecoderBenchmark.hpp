@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::GCN::Shader {
+
+// Decodes every .bin shader dump in dir (see the commented out dump code in decompileShader) and prints the decoder's throughput.
+// Each shader is decoded both one instruction at a time and through GcnProgram.
+void benchmarkDecoder(const fs::path& dir, int iterations);
+
+}   // End namespace PS4::GCN::Shader
@@ -6,6 +6,7 @@
 #include <GCN/TSharp.hpp>
 #include <GCN/DataFormats.hpp>
 #include <GCN/GCN.hpp>
+#include <GCN/Trace.hpp>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
@@ -450,11 +451,13 @@ T* DescriptorLocation::asPtr() {
         if (ptr_is_from_buf) {
             VSharp* vsharp = buf->desc_info.asPtr<VSharp>();
             desc = (T*)((u32*)vsharp->base + buf_offs);
+            Trace::recordMemory(desc, sizeof(T));
             return desc;
         }
 
         std::memcpy(&desc, &GCN::renderer->regs[base + sgpr], sizeof(T*));
         desc = (T*)((u32*)desc + offs);  // The immediate is an offset in dwords
+        Trace::recordMemory(desc, sizeof(T));
         return desc;
     }
     else {
@@ -498,7 +501,10 @@ std::unordered_map<u32, DescriptorLocation> backup_descs;  // The u32 should cor
 // Map a buffer load instruction address to buffer ptr
 std::unordered_map<int, Buffer*> buffer_map;
 
-void trackAndCreateBuffers(ShaderStage stage, ShaderData& out_data, Shader::GcnDecodeContext& decoder, Shader::GcnCodeSlice& code_slice) {
+// The shader being decompiled, shared by all the passes below
+Shader::GcnProgram program;
+
+void trackAndCreateBuffers(ShaderStage stage, ShaderData& out_data) {
     // Parse shader to figure out descriptor locations.
     // This is done similarly to the fetch shader, but there are other cases we need to handle.
 
@@ -521,8 +527,8 @@ void trackAndCreateBuffers(ShaderStage stage, ShaderData& out_data, Shader::GcnD
 
     u32 pc = 0;
     bool done = false;
-    while (!code_slice.atEnd() && !done) {
-        const auto instr = decoder.decodeInstruction(code_slice);
+    while (!done) {
+        const auto instr = program.at(pc);
 
         bool is_img_store = false;
         switch (instr.opcode) {
@@ -798,12 +804,9 @@ void discoverBasicBlockEntries(u32* data, u32 pc) {
     if (!block_entries.insert(pc).second)
         return;
 
-    Shader::GcnDecodeContext decoder;
-    Shader::GcnCodeSlice code_slice = Shader::GcnCodeSlice((u32*)((u8*)data + pc), data + std::numeric_limits<u32>::max());
-
     bool done = false;
-    while (!code_slice.atEnd() && !done) {
-        const auto instr = decoder.decodeInstruction(code_slice);
+    while (!done) {
+        const auto instr = program.at(pc);
 
         switch (instr.opcode) {
         case Shader::Opcode::S_ENDPGM: {
@@ -827,9 +830,6 @@ void discoverBasicBlockEntries(u32* data, u32 pc) {
 }
 
 void decompileBasicBlock(u32* data, u32 start_pc, ShaderStage stage, BasicBlock& block) {
-    Shader::GcnDecodeContext decoder;
-    Shader::GcnCodeSlice code_slice = Shader::GcnCodeSlice((u32*)((u8*)data + start_pc), data + std::numeric_limits<u32>::max());
-
     auto s_buffer_load_dword_offset = [&](const PS4::GCN::Shader::GcnInst& instr) -> std::string {
         if (instr.control.smrd.imm)
             return std::format("{}", instr.control.smrd.offset);
@@ -847,7 +847,7 @@ void decompileBasicBlock(u32* data, u32 start_pc, ShaderStage stage, BasicBlock&
 
     u32 pc = start_pc;
     bool done = false;
-    while (!code_slice.atEnd() && !done) {
+    while (!done) {
         // If the current PC is the start of another block, stop.
         if (block_entries.contains(pc) && pc != block.pc) {
             block.fallthrough = getOrCreateBlock(data, pc, stage);
@@ -855,7 +855,7 @@ void decompileBasicBlock(u32* data, u32 start_pc, ShaderStage stage, BasicBlock&
             continue;
         }
 
-        const auto instr = decoder.decodeInstruction(code_slice);
+        const auto instr = program.at(pc);
 
         code += std::format("/* {:08x} */ ", pc);
 
@@ -2703,8 +2703,7 @@ void decompileShader(u32* data, ShaderStage stage, ShaderData& out_data, FetchSh
     //  out.close();
     //}
 
-    Shader::GcnDecodeContext decoder;
-    Shader::GcnCodeSlice code_slice = Shader::GcnCodeSlice((u32*)data, data + std::numeric_limits<u32>::max());
+    program.reset(data);
 
     shader.clear();
     shader.reserve(256_KB);  // Avoid reallocations
@@ -2811,7 +2810,7 @@ bool v_cmp_class_f32(float x, uint mask) {
         shader += std::format("layout(local_size_x = {}, local_size_y = {}, local_size_z = {}) in;\n\n", compute_job->n_threads_x, compute_job->n_threads_y, compute_job->n_threads_z);
     }
 
-    trackAndCreateBuffers(stage, out_data, decoder, code_slice);
+    trackAndCreateBuffers(stage, out_data);
 
     std::string main;
     main.reserve(32_KB); // Avoid reallocations
@@ -13,6 +13,9 @@ class FetchShader;
 
 namespace PS4::GCN::Shader {
 
+// Bump this whenever the decompiler output changes, to invalidate shaders cached on disk
+static constexpr u32 DECOMPILER_VERSION = 1;
+
 enum class ShaderStage {
     Vertex,
     Fragment,
@@ -0,0 +1,401 @@
+#include "Trace.hpp"
+#include <Logger.hpp>
+#include <Configuration.hpp>
+#include <MappedFile.hpp>
+#include <GCN/GCN.hpp>
+#include <GCN/CommandProcessor.hpp>
+#include <GCN/PM4.hpp>
+#include <OS/Memory.hpp>
+#include <OS/Libraries/SceGnmDriver/SceGnmDriver.hpp>
+#include <OS/Libraries/SceVideoOut/SceVideoOut.hpp>
+#include <xxhash.h>
+#include <unordered_map>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace PS4::GCN::Trace {
+
+MAKE_LOG_FUNCTION(log, gcn_trace);
+
+// Trace file layout: a TraceHeader followed by records, each one a RecordHeader followed by its payload.
+// The memory read while processing a submission is recorded after the submission itself, the replayer restores it before processing it.
+// Bump TRACE_VERSION when the layout below changes.
+
+static constexpr u32 TRACE_MAGIC   = 0x544E4347;    // "GCNT"
+static constexpr u32 TRACE_VERSION = 1;
+
+using OS::Memory::GUEST_MEMORY_START;
+using OS::Memory::GUEST_MEMORY_END;
+
+struct TraceHeader {
+    u32 magic;
+    u32 version;
+};
+
+enum class RecordType : u32 {
+    Memory,         // Followed by MemoryRecord and the contents of the range
+    SubmitGraphics,
+    SubmitCompute,
+    Flip
+};
+
+struct RecordHeader {
+    RecordType type;
+    u32 reserved;
+    u64 size;       // Size of the payload
+};
+
+struct MemoryRecord {
+    u64 addr;
+};
+
+struct SubmitGraphicsRecord {
+    u64 dcb;
+    u64 dcb_size;
+    u64 ccb;
+    u64 ccb_size;
+};
+
+struct SubmitComputeRecord {
+    u64 cb;
+    u64 cb_size;
+    u64 ring_base_addr;
+    u64 read_ptr_addr;
+    u32 ring_size_dw;
+    u32 reserved;
+};
+
+struct FlipRecord {
+    u32 buf_idx;
+    u32 reserved;
+    OS::Libs::SceVideoOut::SceVideoOutBuffer buf;
+};
+
+// Recording
+std::mutex trace_mtx;
+std::ofstream trace_out;
+std::unordered_map<uptr, std::pair<size_t, u64>> recorded_ranges;  // Address -> size and hash of the last recorded contents
+u64 recorded_bytes = 0;
+
+static void writeRecord(RecordType type, const void* payload, size_t payload_size, const void* data = nullptr, size_t data_size = 0) {
+    const RecordHeader header = { .type = type, .reserved = 0, .size = payload_size + data_size };
+    trace_out.write((const char*)&header, sizeof(header));
+    trace_out.write((const char*)payload, payload_size);
+    if (data_size)
+        trace_out.write((const char*)data, data_size);
+    recorded_bytes += sizeof(header) + header.size;
+}
+
+void startRecording(const fs::path& path) {
+    auto lk = std::unique_lock<std::mutex>(trace_mtx);
+    trace_out.open(path, std::ios::binary | std::ios::trunc);
+    if (!trace_out.is_open()) {
+        log("Couldn't open %s, not recording\n", path.generic_string().c_str());
+        return;
+    }
+
+    const TraceHeader header = { .magic = TRACE_MAGIC, .version = TRACE_VERSION };
+    trace_out.write((const char*)&header, sizeof(header));
+    recording = true;
+    log("Recording GPU commands to %s\n", path.generic_string().c_str());
+}
+
+void recordSubmitGraphics(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size) {
+    if (!recording) return;
+
+    {
+        auto lk = std::unique_lock<std::mutex>(trace_mtx);
+        const SubmitGraphicsRecord record = { .dcb = (u64)dcb, .dcb_size = dcb_size, .ccb = (u64)ccb, .ccb_size = ccb_size };
+        writeRecord(RecordType::SubmitGraphics, &record, sizeof(record));
+    }
+    recordMemory(dcb, dcb_size);
+    if (ccb) recordMemory(ccb, ccb_size);
+}
+
+void recordSubmitCompute(u32* cb, size_t cb_size, const OS::Libs::SceGnmDriver::ComputeQueue* queue) {
+    if (!recording) return;
+
+    {
+        auto lk = std::unique_lock<std::mutex>(trace_mtx);
+        const SubmitComputeRecord record = {
+            .cb = (u64)cb,
+            .cb_size = cb_size,
+            .ring_base_addr = (u64)queue->ring_base_addr,
+            .read_ptr_addr = (u64)queue->read_ptr_addr,
+            .ring_size_dw = queue->ring_size_dw,
+            .reserved = 0
+        };
+        writeRecord(RecordType::SubmitCompute, &record, sizeof(record));
+    }
+    recordMemory(cb, cb_size);
+}
+
+void recordFlip(u32 buf_idx, const OS::Libs::SceVideoOut::SceVideoOutBuffer& buf) {
+    if (!recording) return;
+
+    auto lk = std::unique_lock<std::mutex>(trace_mtx);
+    const FlipRecord record = { .buf_idx = buf_idx, .reserved = 0, .buf = buf };
+    writeRecord(RecordType::Flip, &record, sizeof(record));
+    // Keep the trace usable if the emulator is closed
+    trace_out.flush();
+}
+
+void recordMemoryImpl(const void* ptr, size_t size) {
+    if (!ptr || !size) return;
+    if ((uptr)ptr < GUEST_MEMORY_START || (uptr)ptr + size > GUEST_MEMORY_END) return;
+
+    const u64 hash = XXH3_64bits(ptr, size);
+    auto lk = std::unique_lock<std::mutex>(trace_mtx);
+    auto [it, inserted] = recorded_ranges.try_emplace((uptr)ptr, size, hash);
+    if (!inserted) {
+        if (it->second.first == size && it->second.second == hash) return;
+        it->second = { size, hash };
+    }
+
+    const MemoryRecord record = { .addr = (u64)ptr };
+    writeRecord(RecordType::Memory, &record, sizeof(record), ptr, size);
+}
+
+// Replay
+
+static size_t host_page_size = 0;
+
+// Maps a zeroed page of guest memory that was never recorded. Returns false if addr can't be a guest page, or is already mapped.
+static bool mapGuestPage(uptr addr) {
+    if (addr < GUEST_MEMORY_START || addr >= GUEST_MEMORY_END) return false;
+
+    const uptr page = addr & ~(uptr)(host_page_size - 1);
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION mbi;
+    if (!VirtualQuery((void*)page, &mbi, sizeof(mbi)) || mbi.State == MEM_COMMIT) return false;
+    const DWORD type = mbi.State == MEM_RESERVE ? MEM_COMMIT : MEM_RESERVE | MEM_COMMIT;
+    return VirtualAlloc((void*)page, host_page_size, type, PAGE_READWRITE) != nullptr;
+#else
+    void* res = mmap((void*)page, host_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (res != MAP_FAILED) return true;
+    // The page is inside the guest address space reservation, which is mapped without access. Nothing else is mapped there while replaying.
+    return errno == EEXIST && mprotect((void*)page, host_page_size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+#ifdef _WIN32
+
+static LONG CALLBACK replayExceptionHandler(EXCEPTION_POINTERS* info) noexcept {
+    const auto* record = info->ExceptionRecord;
+    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    return mapGuestPage((uptr)record->ExceptionInformation[1]) ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+}
+
+#else
+
+static struct sigaction old_sigsegv_action;
+
+static void replaySignalHandler(int sig, siginfo_t* info, void* raw_context) {
+    if (mapGuestPage((uptr)info->si_addr)) return;
+
+    if (old_sigsegv_action.sa_flags & SA_SIGINFO) {
+        old_sigsegv_action.sa_sigaction(sig, info, raw_context);
+    }
+    else if (old_sigsegv_action.sa_handler != SIG_DFL && old_sigsegv_action.sa_handler != SIG_IGN) {
+        old_sigsegv_action.sa_handler(sig);
+    }
+    else {
+        signal(sig, SIG_DFL);
+    }
+}
+
+#endif
+
+// Has to be installed before the renderer, which installs its own handler for the buffer cache
+static void installFaultHandler() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    host_page_size = si.dwPageSize;
+
+    if (!AddVectoredExceptionHandler(0, replayExceptionHandler))
+        Helpers::panic("Trace::replay: failed to register exception handler");
+#else
+    host_page_size = sysconf(_SC_PAGESIZE);
+
+    struct sigaction action = {};
+    action.sa_sigaction = replaySignalHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &old_sigsegv_action))
+        Helpers::panic("Trace::replay: failed to register signal handler");
+#endif
+}
+
+// Counts the PM4 packets of a command buffer the same way the command processor walks it.
+// Indirect buffers are counted as one packet, their contents aren't visited.
+static u64 countPackets(const u32* cb, size_t cb_size) {
+    u64 n = 0;
+    for (const u32* ptr = cb; (const u8*)ptr < (const u8*)cb + cb_size; n++) {
+        const PM4Header pkt = { .raw = *ptr };
+        ptr += pkt.type == 3 ? pkt.count + 2 : 1;
+    }
+    return n;
+}
+
+struct Record {
+    RecordType type;
+    const u8* payload;
+    u64 size;
+};
+
+bool replay(const fs::path& path) {
+    Helpers::MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(TraceHeader)) return false;
+
+    TraceHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        log("%s is not a trace or was recorded by a different version\n", path.generic_string().c_str());
+        return false;
+    }
+
+    // Index the records, a trace can end with a truncated one if the emulator was closed while recording
+    std::vector<Record> records;
+    size_t offs = sizeof(TraceHeader);
+    while (offs + sizeof(RecordHeader) <= file.size()) {
+        RecordHeader record_header;
+        std::memcpy(&record_header, file.data() + offs, sizeof(record_header));
+        offs += sizeof(RecordHeader);
+        if (offs + record_header.size > file.size()) break;
+
+        records.push_back({ record_header.type, file.data() + offs, record_header.size });
+        offs += record_header.size;
+    }
+
+    replaying = true;
+    installFaultHandler();
+    GCN::init();
+
+    u64 restored_bytes = 0;
+    auto restore_memory = [&](const Record& record) {
+        MemoryRecord mem;
+        std::memcpy(&mem, record.payload, sizeof(mem));
+        const size_t size = record.size - sizeof(mem);
+        std::memcpy((void*)mem.addr, record.payload + sizeof(mem), size);
+        restored_bytes += size;
+    };
+
+    u64 n_submits = 0;
+    u64 n_frames = 0;
+    u64 n_packets = 0;
+    u64 cb_bytes = 0;
+    double submit_ms = 0.0;
+    double total_ms = 0.0;
+    double frame_ms = 0.0;
+    double min_frame_ms = std::numeric_limits<double>::max();
+    double max_frame_ms = 0.0;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const auto& record = records[i];
+        if (record.type == RecordType::Memory) {
+            restore_memory(record);
+            continue;
+        }
+
+        // Restore the memory read while processing this submission, it's not part of the measurement
+        while (i + 1 < records.size() && records[i + 1].type == RecordType::Memory)
+            restore_memory(records[++i]);
+
+        // Counting the packets isn't part of the measurement either
+        if (record.type == RecordType::SubmitGraphics) {
+            SubmitGraphicsRecord submit;
+            std::memcpy(&submit, record.payload, sizeof(submit));
+            n_packets += countPackets((u32*)submit.dcb, submit.dcb_size) + (submit.ccb ? countPackets((u32*)submit.ccb, submit.ccb_size) : 0);
+            cb_bytes += submit.dcb_size + (submit.ccb ? submit.ccb_size : 0);
+        }
+        else if (record.type == RecordType::SubmitCompute) {
+            SubmitComputeRecord submit;
+            std::memcpy(&submit, record.payload, sizeof(submit));
+            n_packets += countPackets((u32*)submit.cb, submit.cb_size);
+            cb_bytes += submit.cb_size;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        switch (record.type) {
+        case RecordType::SubmitGraphics: {
+            SubmitGraphicsRecord submit;
+            std::memcpy(&submit, record.payload, sizeof(submit));
+            GCN::processCommands((u32*)submit.dcb, submit.dcb_size, (u32*)submit.ccb, submit.ccb_size, nullptr);
+            n_submits++;
+            break;
+        }
+
+        // Compute submissions are processed right away instead of being interleaved with the graphics queue
+        case RecordType::SubmitCompute: {
+            SubmitComputeRecord submit;
+            std::memcpy(&submit, record.payload, sizeof(submit));
+            OS::Libs::SceGnmDriver::ComputeQueue queue = {
+                .is_mapped = true,
+                .ring_base_addr = (void*)submit.ring_base_addr,
+                .ring_size_dw = submit.ring_size_dw,
+                .read_ptr_addr = (u32*)submit.read_ptr_addr
+            };
+            GCN::processCommands((u32*)submit.cb, submit.cb_size, nullptr, 0, &queue);
+            n_submits++;
+            break;
+        }
+
+        case RecordType::Flip: {
+            FlipRecord flip;
+            std::memcpy(&flip, record.payload, sizeof(flip));
+            OS::Libs::SceVideoOut::bufs[flip.buf_idx] = flip.buf;
+            renderer->flip(&OS::Libs::SceVideoOut::bufs[flip.buf_idx]);
+            global_flip_counter++;
+            break;
+        }
+
+        default: Helpers::panic("Trace::replay: invalid record type %d\n", (u32)record.type);
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        total_ms += ms;
+        frame_ms += ms;
+        if (record.type != RecordType::Flip)
+            submit_ms += ms;
+        if (record.type == RecordType::Flip) {
+            min_frame_ms = std::min(min_frame_ms, frame_ms);
+            max_frame_ms = std::max(max_frame_ms, frame_ms);
+            frame_ms = 0.0;
+            n_frames++;
+        }
+    }
+
+    printf("------ Trace replay ------\n");
+    printf("%llu submissions, %llu frames, %.2f MB of guest memory restored\n", n_submits, n_frames, restored_bytes / 1024.0 / 1024.0);
+    printf("%.2f ms total", total_ms);
+    if (n_frames)
+        printf(", avg %.3f ms per frame (min %.3f ms, max %.3f ms)", total_ms / n_frames, min_frame_ms, max_frame_ms);
+    printf("\n");
+    // Flips are left out of the packet throughput, they mostly measure presentation
+    printf("%llu PM4 packets (%.2f MB of DCB/CCB) processed in %.2f ms", n_packets, cb_bytes / 1024.0 / 1024.0, submit_ms);
+    if (submit_ms > 0)
+        printf(", %.2f M packets/s, %.1f ns per packet", n_packets / submit_ms / 1000.0, submit_ms * 1e6 / std::max<u64>(n_packets, 1));
+    printf("\n");
+    return true;
+}
+
+}   // End namespace PS4::GCN::Trace
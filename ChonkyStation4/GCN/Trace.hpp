@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::OS::Libs::SceGnmDriver {
+
+struct ComputeQueue;
+
+}   // End namespace PS4::OS::Libs::SceGnmDriver
+
+namespace PS4::OS::Libs::SceVideoOut {
+
+struct SceVideoOutBuffer;
+
+}   // End namespace PS4::OS::Libs::SceVideoOut
+
+namespace PS4::GCN::Trace {
+
+// GPU command stream traces.
+// While recording, every submission processed by the GCN thread is written to the trace along with the guest memory the GPU path reads
+// while processing it (command buffers, shaders, descriptors, vertex/index buffers, textures...).
+// A trace can then be replayed without the guest (see replay()), to measure the CPU cost of the whole GPU path in a reproducible way.
+
+inline bool recording = false;
+inline bool replaying = false;
+
+void startRecording(const fs::path& path);
+void recordSubmitGraphics(u32* dcb, size_t dcb_size, u32* ccb, size_t ccb_size);
+void recordSubmitCompute(u32* cb, size_t cb_size, const OS::Libs::SceGnmDriver::ComputeQueue* queue);
+void recordFlip(u32 buf_idx, const OS::Libs::SceVideoOut::SceVideoOutBuffer& buf);
+void recordMemoryImpl(const void* ptr, size_t size);
+
+// Records the current contents of a range of guest memory read by the GPU.
+// Ranges that didn't change since they were last recorded aren't written again.
+inline void recordMemory(const void* ptr, size_t size) {
+    if (recording) [[unlikely]]
+        recordMemoryImpl(ptr, size);
+}
+
+// Replays a trace on the current thread and prints how long it took, per frame and per PM4 packet. Returns false if the trace couldn't be opened.
+// Guest memory is restored at the addresses it was recorded at. Pages that weren't recorded are mapped on first access and read as zero.
+bool replay(const fs::path& path);
+
+}   // End namespace PS4::GCN::Trace
@@ -99,14 +99,15 @@ void App::run() {
 
     // Initialize system VideoOut port (used by VSH)
     // It looks like VSH expects this port to have handle 2.
-    // We can change it because the first 0x100 handles are reserved (see SceObj.cpp) so handle 2 will never be allocated.
+    // 16bit handles below HandleTable::FIRST_HANDLE16 are never allocated, so the port can be moved there (see OS/SceObj.hpp).
     if (PS4::Configuration::is_vsh) {
         using namespace PS4::OS::Libs::Kernel;
         using namespace PS4::OS::Libs::SceVideoOut;
 
         auto handle = sceVideoOutOpen(0, 0, 0, nullptr);
         auto* port = PS4::OS::find<SceVideoOutPort>(handle);
-        port->handle = 2;
+        if (!PS4::OS::moveToReservedHandle(port, 2))
+            Helpers::panic("App::run: could not move the system VideoOut port to handle 2\n");
 
         constexpr u32 sce_composite_color_width = 1280;
         constexpr u32 sce_composite_color_height = 720;
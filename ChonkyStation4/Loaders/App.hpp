@@ -3,6 +3,7 @@
 #include <Common.hpp>
 #include <Logger.hpp>
 #include <Loaders/Module.hpp>
+#include <Loaders/Linker/ExportIndex.hpp>
 #include <xbyak/xbyak.h>
 
 #include <memory>
@@ -19,6 +20,7 @@ public:
     std::deque<std::shared_ptr<Module>> modules;
     std::deque<std::string> unresolved_symbols;
     std::vector<std::unique_ptr<Xbyak::CodeGenerator>> unresolved_symbol_handlers;
+    PS4::Loader::Linker::ExportIndex export_index;
 
     void run();
     std::tuple<u8*, size_t, size_t> getTLSImage(u32 modid);
@@ -2,6 +2,7 @@
 #include <Logger.hpp>
 #include <Loaders/Module.hpp>
 #include <OS/Thread.hpp>
+#include <OS/Memory.hpp>
 #include <Zydis/Zydis.h>
 #include <xbyak/xbyak.h>
 
@@ -30,26 +31,12 @@ u8* allocatePatchCode(void* addr, size_t size) {
         return diff <= 0x80000000;
     };
 
-#ifdef _WIN32
-    // TODO: Add a timeout or something
-    while (!patch_code_ptr || !is_addr_ok(patch_code_ptr)) {
-        MEMORY_BASIC_INFORMATION mbi;
-        VirtualQuery((void*)addr, &mbi, sizeof(mbi));
-        if (mbi.State == MEM_RESERVE && mbi.RegionSize >= size) {
-            patch_code_ptr = (u8*)VirtualAlloc(addr, size, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-        }
-        else patch_code_ptr = nullptr;
-
-        if (patch_code_ptr && !is_addr_ok(patch_code_ptr)) {
-            VirtualFree(patch_code_ptr, size, MEM_DECOMMIT);
-            patch_code_ptr = nullptr;
-        }
-
-        addr = (u8*)((u64)mbi.BaseAddress + mbi.RegionSize);
-    }
-#else
-    Helpers::panic("Unsupported platform\n");
-#endif
+    // Search forwards from the instruction, the first free area is the closest one
+    namespace Memory = PS4::OS::Memory;
+    constexpr s32 prot = Memory::SCE_KERNEL_PROT_CPU_READ | Memory::SCE_KERNEL_PROT_CPU_WRITE | Memory::SCE_KERNEL_PROT_CPU_EXEC;
+    patch_code_ptr = (u8*)Memory::map((uptr)addr, size, 0, Memory::VmaType::Code, prot, false, false, "patch code");
+    if (!patch_code_ptr || !is_addr_ok(patch_code_ptr))
+        Helpers::panic("allocatePatchCode: could not allocate patch code within 2GB of %p\n", addr);
 
     return patch_code_ptr;
 }
@@ -1,5 +1,6 @@
 #include "ELFLoader.hpp"
 #include "CodePatcher.hpp"
+#include <OS/Memory.hpp>
 #include <fstream>
 
 #ifdef _WIN32
@@ -92,21 +93,11 @@ std::shared_ptr<Module> ELFLoader::load(const fs::path& path, bool is_partial_ll
     log("* Total size of ELF: %d bytes (%f KB)\n", total_size, total_size / 1024.0f);
 
     // Allocate memory
-#ifdef _WIN32
-    while (true) {
-        MEMORY_BASIC_INFORMATION mbi;
-        VirtualQuery(last_load_addr, &mbi, sizeof(mbi));
-        if (mbi.State == MEM_RESERVE && mbi.RegionSize > total_size) {
-            module->base_address = VirtualAlloc(mbi.BaseAddress, total_size, MEM_COMMIT, PAGE_READWRITE);
-            last_load_addr = (void*)((u64)module->base_address + total_size);
-            break;
-        }
-        last_load_addr = (void*)((u64)mbi.BaseAddress + mbi.RegionSize);
-    }
-    Helpers::debugAssert(module->base_address, "ELFLoader: VirtualAlloc failed");
-#else
-    Helpers::panic("Unsupported platform\n");
-#endif
+    namespace Memory = PS4::OS::Memory;
+    constexpr s32 prot = Memory::SCE_KERNEL_PROT_CPU_READ | Memory::SCE_KERNEL_PROT_CPU_WRITE | Memory::SCE_KERNEL_PROT_CPU_EXEC | Memory::SCE_KERNEL_PROT_GPU_READ;
+    module->base_address = Memory::map((uptr)last_load_addr, total_size, 0, Memory::VmaType::Code, prot, false, false, module->filename.c_str());
+    Helpers::debugAssert(module->base_address, "ELFLoader: failed to allocate memory for the module");
+    last_load_addr = (void*)((u64)module->base_address + total_size);
 
     log("* Base address of ELF: 0x%016llx\n", (u64)module->base_address);
     log("* Mapped area: %p - %p (%p - %p)\n", module->base_address, (u64)module->base_address + total_size, 0, total_size);
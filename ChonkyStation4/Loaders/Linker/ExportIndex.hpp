@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Common.hpp>
+#include <Loaders/Symbol.hpp>
+#include <unordered_map>
+#include <string_view>
+
+
+namespace PS4::Loader::Linker {
+
+// Index of the symbols exported by all the modules of an app, so imports can be resolved with a single lookup.
+// Library and module names are interned, a key is the NID plus two integers.
+// If more than one module exports the same symbol the first one added wins, so modules have to be added in load order.
+class ExportIndex {
+public:
+    void add(Symbol* sym) {
+        exports.try_emplace(Key { sym->nid, intern(sym->lib), intern(sym->module) }, sym);
+    }
+
+    Symbol* find(std::string_view nid, const std::string& lib, const std::string& module) const {
+        auto lib_id = ids.find(lib);
+        auto mod_id = ids.find(module);
+        if (lib_id == ids.end() || mod_id == ids.end()) return nullptr;
+
+        auto it = exports.find(Key { nid, lib_id->second, mod_id->second });
+        return it != exports.end() ? it->second : nullptr;
+    }
+
+    size_t size() const { return exports.size(); }
+
+private:
+    struct Key {
+        std::string_view nid;   // Points to the nid of the exported Symbol, which never moves
+        u32 lib;
+        u32 module;
+
+        bool operator==(const Key& other) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string_view>{}(key.nid) ^ ((((u64)key.lib << 32) | key.module) * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    std::unordered_map<std::string, u32> ids;
+    std::unordered_map<Key, Symbol*, KeyHash> exports;
+
+    u32 intern(const std::string& str) {
+        return ids.try_emplace(str, (u32)ids.size()).first->second;
+    }
+};
+
+}   // End namespace PS4::Loader::Linker
@@ -5,6 +5,10 @@
 #include <OS/HLE.hpp>
 
 #include <memory>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <string_view>
 #ifdef _MSC_VER
 #include <intrin.h>
 #define RETURN_ADDRESS() _ReturnAddress()
@@ -64,90 +68,131 @@ App loadAndLink(const fs::path& path) {
     return app;
 }
 
-void doRelocations(App& app) {
-    // Iterate over the relocation tables of all loaded modules
-    auto relocate = [](App& app, Module& module, Elf64_Rela* reloc_table, size_t reloc_table_size) {
-        for (Elf64_Rela* rela = reloc_table; (u8*)rela < (u8*)reloc_table + reloc_table_size; rela++) {
-            const auto type = ELF64_R_TYPE(rela->r_info);
-            const auto base = module.base_address;
-            //log("Relocation type: %x\n", type);
-            //log("Relocation offs: 0x%llx\n", rela->r_offset);
-            //log("Relocation addend: 0x%llx\n", rela->r_addend);
-
-            switch (type) {
-            case R_X86_64_RELATIVE: {
-                *(u64*)((u8*)base + rela->r_offset) = (u64)base + rela->r_addend;
-                break;
-            }
-
-            case R_X86_64_GLOB_DAT:
-            case R_X86_64_JUMP_SLOT:
-            case R_X86_64_64: {
-                auto addend = rela->r_addend;
-                if (type != R_X86_64_64) addend = 0;
-                auto* sym = &module.sym_table[ELF64_R_SYM(rela->r_info)];
-                auto bind = ELF_ST_BIND(sym->st_info);
-                const std::string sym_name = module.dyn_str_table + sym->st_name;
-
-                // Is this a local symbol?
-                if (bind == STB_LOCAL) {
-                    *(u64*)((u8*)base + rela->r_offset) = (u64)base + sym->st_value + addend;
-                    break;
-                }
-
-                auto tokens = Helpers::split(sym_name, "#");
-                void* ptr = nullptr;
-                if (tokens.size() == 3) {
-                    // Find library and module
-                    auto* lib = module.findLibrary(tokens[1]);
-                    auto* mod = module.findModule(tokens[2]);
-                    Helpers::debugAssert(lib, "Linker: could not find library for symbol %s\n", sym_name.c_str());
-                    Helpers::debugAssert(mod, "Linker: could not find module for symbol %s\n", sym_name.c_str());
-
-                    // Iterate over the list of exported symbols in the app to try to find it
-                    for (auto& m : app.modules) {
-                        Symbol* exported_sym = m->findSymbolExport(tokens[0], lib->name, mod->name);
-                        if (exported_sym) {
-                            log("* Resolved symbol %s as %s (%s) (ptr=%p)\n", sym_name.c_str(), exported_sym->name.c_str(), exported_sym->lib.c_str(), exported_sym->ptr);
-                            ptr = exported_sym->ptr;
-                            break;
-                        }
-                    }
-
-                    // If we couldn't resolve the symbol, make it point to the unresolved symbol handler. Unless it's an object
-                    if (!ptr) {
-                        log("* Could not resolve symbol %s (%s)\n", sym_name.c_str(), lib->name.c_str());
-                        if (ELF_ST_TYPE(sym->st_info) != STT_OBJECT)
-                            ptr = generateTrampolineForUnresolvedSymbol(app, sym_name, lib->name.c_str(), mod->name.c_str());
-                        else ptr = nullptr;
-                    }
-                } else {
-                    // Symbol is not a nid
-                    log("* Could not resolve non-nid symbol %s\n", sym_name.c_str());
-                    break;
-                }
-                
-
-                *(u64*)((u8*)base + rela->r_offset) = (u64)ptr + addend;
-                break;
-            }
-
-            case R_X86_64_DTPMOD64: {
-                *(u64*)((u8*)base + rela->r_offset) = module.tls_modid;
-                break;
-            }
-
-            default: {
-                Helpers::panic("Unhandled relocation type 0x%x\n", type);
-            }
-            }
+// Resolves the symbol of a GLOB_DAT, JUMP_SLOT or 64 relocation and patches it.
+// Returns false if the symbol couldn't be resolved, in which case it points to a trampoline that reports the unresolved call.
+static bool relocateSymbol(App& app, Module& module, Elf64_Rela* rela, bool first_pass, std::mutex& app_mtx) {
+    const auto type = ELF64_R_TYPE(rela->r_info);
+    const auto base = module.base_address;
+    auto addend = rela->r_addend;
+    if (type != R_X86_64_64) addend = 0;
+    auto* sym = &module.sym_table[ELF64_R_SYM(rela->r_info)];
+    auto bind = ELF_ST_BIND(sym->st_info);
+    const std::string_view sym_name = module.dyn_str_table + sym->st_name;
+
+    // Is this a local symbol?
+    if (bind == STB_LOCAL) {
+        *(u64*)((u8*)base + rela->r_offset) = (u64)base + sym->st_value + addend;
+        return true;
+    }
+
+    // NID symbols are in the form nid#lib#module
+    const size_t lib_pos = sym_name.find('#');
+    const size_t mod_pos = lib_pos == std::string_view::npos ? lib_pos : sym_name.find('#', lib_pos + 1);
+    if (mod_pos == std::string_view::npos || sym_name.find('#', mod_pos + 1) != std::string_view::npos) {
+        // Symbol is not a nid
+        if (first_pass) log("* Could not resolve non-nid symbol %.*s\n", (int)sym_name.size(), sym_name.data());
+        return true;
+    }
+    const auto nid = sym_name.substr(0, lib_pos);
+
+    // Find library and module
+    auto* lib = module.findLibrary(sym_name.substr(lib_pos + 1, mod_pos - lib_pos - 1));
+    auto* mod = module.findModule(sym_name.substr(mod_pos + 1));
+    Helpers::debugAssert(lib, "Linker: could not find library for symbol %.*s\n", (int)sym_name.size(), sym_name.data());
+    Helpers::debugAssert(mod, "Linker: could not find module for symbol %.*s\n", (int)sym_name.size(), sym_name.data());
+
+    void* ptr = nullptr;
+    if (Symbol* exported_sym = app.export_index.find(nid, lib->name, mod->name)) {
+        log("* Resolved symbol %.*s as %s (%s) (ptr=%p)\n", (int)sym_name.size(), sym_name.data(), exported_sym->name.c_str(), exported_sym->lib.c_str(), exported_sym->ptr);
+        ptr = exported_sym->ptr;
+    }
+    else {
+        // Retries don't touch the trampoline created in the first pass
+        if (!first_pass) return false;
+
+        // If we couldn't resolve the symbol, make it point to the unresolved symbol handler. Unless it's an object
+        log("* Could not resolve symbol %.*s (%s)\n", (int)sym_name.size(), sym_name.data(), lib->name.c_str());
+        if (ELF_ST_TYPE(sym->st_info) != STT_OBJECT) {
+            auto lk = std::unique_lock<std::mutex>(app_mtx);
+            ptr = generateTrampolineForUnresolvedSymbol(app, std::string(sym_name), lib->name.c_str(), mod->name.c_str());
+        }
+    }
+
+    *(u64*)((u8*)base + rela->r_offset) = (u64)ptr + addend;
+    return ptr != nullptr;
+}
+
+static void relocateModule(App& app, Module& module, Elf64_Rela* reloc_table, size_t reloc_table_size, std::mutex& app_mtx) {
+    const auto base = module.base_address;
+    for (Elf64_Rela* rela = reloc_table; (u8*)rela < (u8*)reloc_table + reloc_table_size; rela++) {
+        const auto type = ELF64_R_TYPE(rela->r_info);
+        //log("Relocation type: %x\n", type);
+        //log("Relocation offs: 0x%llx\n", rela->r_offset);
+        //log("Relocation addend: 0x%llx\n", rela->r_addend);
+
+        switch (type) {
+        case R_X86_64_RELATIVE: {
+            *(u64*)((u8*)base + rela->r_offset) = (u64)base + rela->r_addend;
+            break;
+        }
+
+        case R_X86_64_GLOB_DAT:
+        case R_X86_64_JUMP_SLOT:
+        case R_X86_64_64: {
+            if (!relocateSymbol(app, module, rela, true, app_mtx))
+                module.unresolved_relocs.push_back(rela);
+            break;
+        }
+
+        case R_X86_64_DTPMOD64: {
+            *(u64*)((u8*)base + rela->r_offset) = module.tls_modid;
+            break;
         }
-    };
 
+        default: {
+            Helpers::panic("Unhandled relocation type 0x%x\n", type);
+        }
+        }
+    }
+}
+
+void doRelocations(App& app) {
+    const auto start = std::chrono::steady_clock::now();
+
+    // Index the exports of newly loaded modules. This has to be done in load order, the first module exporting a symbol wins.
     for (auto& module : app.modules) {
-        relocate(app, *module, module->reloc_table,     module->reloc_table_size);
-        relocate(app, *module, module->jmp_reloc_table, module->jmp_reloc_table_size);
+        for (; module->n_indexed_exports < module->exported_symbols.size(); module->n_indexed_exports++)
+            app.export_index.add(&module->exported_symbols[module->n_indexed_exports]);
     }
+
+    // Relocate new modules in parallel. The export index is read-only from here on.
+    std::mutex app_mtx;
+    std::vector<std::future<void>> jobs;
+    size_t n_relocated = 0;
+    for (auto& module : app.modules) {
+        if (module->relocated) continue;
+        module->relocated = true;
+        n_relocated++;
+
+        jobs.push_back(std::async(std::launch::async, [&app, &app_mtx, module = module.get()]() {
+            relocateModule(app, *module, module->reloc_table,     module->reloc_table_size,     app_mtx);
+            relocateModule(app, *module, module->jmp_reloc_table, module->jmp_reloc_table_size, app_mtx);
+        }));
+    }
+    for (auto& job : jobs)
+        job.get();
+
+    // Symbols that weren't exported by any module might be exported by the one we just loaded
+    size_t n_unresolved = 0;
+    for (auto& module : app.modules) {
+        std::erase_if(module->unresolved_relocs, [&](Elf64_Rela* rela) {
+            return relocateSymbol(app, *module, rela, false, app_mtx);
+        });
+        n_unresolved += module->unresolved_relocs.size();
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+    log("Relocated %lld modules in %.2f ms (%lld exported symbols, %lld unresolved relocations)\n", n_relocated, std::chrono::duration<double, std::milli>(end - start).count(), app.export_index.size(), n_unresolved);
 }
 
 std::shared_ptr<Module> loadAndLinkLib(App& app, const fs::path& path, bool is_partial_lle_module, std::shared_ptr<Module> hle_module) {
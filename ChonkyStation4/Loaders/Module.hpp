@@ -7,6 +7,7 @@
 #include <xbyak/xbyak.h>
 #include <deque>
 #include <memory>
+#include <string_view>
 
 
 namespace PS4::Loader {
@@ -131,7 +132,7 @@ public:
     void* eh_frame_addr = nullptr;
     size_t eh_frame_size = 0;
 
-    ModuleInfo* findModule(const std::string& id) {
+    ModuleInfo* findModule(std::string_view id) {
         for (auto& module : required_modules) {
             if (module.id == id)
                 return &module;
@@ -143,7 +144,7 @@ public:
         return nullptr;
     }
 
-    LibraryInfo* findLibrary(const std::string& id) {
+    LibraryInfo* findLibrary(std::string_view id) {
         for (auto& lib : required_libs) {
             if (lib.id == id)
                 return &lib;
@@ -232,4 +233,9 @@ public:
     size_t reloc_table_size = 0;
     ELFIO::Elf64_Rela* jmp_reloc_table = nullptr;
     size_t jmp_reloc_table_size = 0;
+
+    // Linker state
+    size_t n_indexed_exports = 0;   // Number of exported_symbols already added to the app's export index
+    bool relocated = false;
+    std::vector<ELFIO::Elf64_Rela*> unresolved_relocs;  // Retried every time a new module is linked
 };
\ No newline at end of file
@@ -4,6 +4,16 @@
 #include <Logger.hpp>
 #include <ErrorCodes.hpp>
 #include <OS/SceObj.hpp>
+#include <Configuration.hpp>
+#include <MappedFile.hpp>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 
 namespace PS4::FS {
@@ -14,6 +24,71 @@ std::unordered_map<Device, fs::path> mounted_devices;
 std::unordered_map<u64, std::unique_ptr<File>> open_files;
 std::unordered_map<u64, Directory> open_dirs;
 
+// Host file backend.
+// On Windows files are opened for overlapped I/O, so that positional reads and writes to the same file from different threads
+// don't get serialized by the kernel like they are on synchronous handles.
+
+static constexpr u64 MAX_IO_CHUNK = 1_GB;   // ReadFile/WriteFile take 32bit sizes
+
+static s64 hostOpen(const fs::path& path, u32 flags) {
+    const u32 access_mode = flags & 3;
+#ifdef _WIN32
+    DWORD access = GENERIC_READ;
+    if      (access_mode == SCE_KERNEL_O_WRONLY)    access = GENERIC_WRITE;
+    else if (access_mode == SCE_KERNEL_O_RDWR)      access |= GENERIC_WRITE;
+    HANDLE handle = CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+    return handle == INVALID_HANDLE_VALUE ? -1 : (s64)handle;
+#else
+    int mode = O_RDONLY;
+    if      (access_mode == SCE_KERNEL_O_WRONLY)    mode = O_WRONLY;
+    else if (access_mode == SCE_KERNEL_O_RDWR)      mode = O_RDWR;
+    return ::open(path.c_str(), mode | O_CLOEXEC);
+#endif
+}
+
+static void hostClose(s64 host_file) {
+#ifdef _WIN32
+    CloseHandle((HANDLE)host_file);
+#else
+    ::close(host_file);
+#endif
+}
+
+// Returns the number of bytes transferred, which is less than size at the end of the file or on error
+template <bool is_write>
+static u64 hostTransfer(s64 host_file, u8* buf, u64 size, u64 offset) {
+    u64 done = 0;
+    while (done < size) {
+        const u64 chunk = std::min(size - done, MAX_IO_CHUNK);
+#ifdef _WIN32
+        // Every thread waits on its own event, the file handle itself can't be waited on when several operations are in flight
+        thread_local HANDLE event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(offset + done);
+        ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+        ov.hEvent = event;
+
+        DWORD n = 0;
+        const BOOL ok = is_write ? WriteFile((HANDLE)host_file, buf + done, (DWORD)chunk, nullptr, &ov)
+                                 : ReadFile((HANDLE)host_file, buf + done, (DWORD)chunk, nullptr, &ov);
+        if (!ok && GetLastError() != ERROR_IO_PENDING) break;
+        if (!GetOverlappedResult((HANDLE)host_file, &ov, &n, TRUE)) break;  // Fails with ERROR_HANDLE_EOF at the end of the file
+#else
+        const ssize_t n = is_write ? ::pwrite(host_file, buf + done, chunk, offset + done)
+                                   : ::pread(host_file, buf + done, chunk, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+#endif
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+File::~File() {
+    if (host_file != -1) hostClose(host_file);
+}
+
 void mount(Device device, fs::path path) {
     mounted_devices[device] = path;
     log("Mounted device %s at %s\n", deviceToString(device).c_str(), path.generic_string().c_str());
@@ -36,11 +111,7 @@ static int fileno = 1;
 
 u64 open(fs::path path, u32& err, u32 flags) {
     const fs::path host_path = guestPathToHost(path);
-    std::string mode = "";
-    if      ((flags & 3) == SCE_KERNEL_O_RDONLY) mode = "rb";
-    else if ((flags & 3) == SCE_KERNEL_O_WRONLY) mode = "wb";
-    else if ((flags & 3) == SCE_KERNEL_O_RDWR)   mode = "rb+";
-    Helpers::debugAssert(!mode.empty(), "Filesystem: invalid open mode flags 0x%x\n", flags);
+    Helpers::debugAssert((flags & 3) <= SCE_KERNEL_O_RDWR, "Filesystem: invalid open mode flags 0x%x\n", flags);
     
     
     const bool append = flags & SCE_KERNEL_O_APPEND;
@@ -92,11 +163,17 @@ u64 open(fs::path path, u32& err, u32 flags) {
     file_desc->is_dir       = is_dir;
     file_desc->flags        = flags;
 
-    FILE* file = nullptr;
     if (!is_dir) {
-        file = std::fopen(host_path.generic_string().c_str(), mode.c_str());
-        if (!file) {
-            Helpers::panic("Failed to open file %s with mode %s\n", host_path.generic_string().c_str(), mode.c_str());
+        file_desc->host_file = hostOpen(host_path, flags);
+        if (file_desc->host_file == -1) {
+            Helpers::panic("Failed to open file %s with flags 0x%x\n", host_path.generic_string().c_str(), flags);
+        }
+
+        // Game files don't change while the game runs, reading them from a mapping skips a syscall per read
+        if (Configuration::mmap_app0_files && getDeviceFromPath(path) == Device::APP0 && (flags & 3) == SCE_KERNEL_O_RDONLY) {
+            file_desc->mapping = std::make_unique<Helpers::MappedFile>();
+            if (!file_desc->mapping->open(host_path))
+                file_desc->mapping.reset(); // i.e. empty files
         }
     }
     else {
@@ -128,7 +205,6 @@ u64 open(fs::path path, u32& err, u32 flags) {
         }
     }
 
-    file_desc->file = file;
     log("Opened file %s with id %d\n", host_path.generic_string().c_str(), new_file_id);
     return new_file_id;
 }
@@ -147,12 +223,8 @@ u64 opendir(fs::path path) {
 }
 
 void close(u64 file_id) {
-    auto& file = getFileFromID(file_id);
-
-    if (!file.is_dir) {
-        std::fclose(file.file);
-    }
-    open_files.erase(file_id);
+    getFileFromID(file_id);     // Panics if the file doesn't exist
+    open_files.erase(file_id);  // The host file is closed by the File destructor
 }
 
 void closedir(u64 file_id) {
@@ -168,7 +240,9 @@ u64 read(u64 file_id, u8* buf, u64 size) {
         Helpers::panic("FS::read: file is dir\n");
     }
 
-    return std::fread(buf, sizeof(u8), size, file.file);
+    const u64 n = pread(file_id, buf, size, file.pos);
+    file.pos += n;
+    return n;
 }
 
 u64 write(u64 file_id, u8* buf, u64 size) {
@@ -179,29 +253,50 @@ u64 write(u64 file_id, u8* buf, u64 size) {
         Helpers::panic("FS::write: file is dir\n");
     }
 
-    return std::fwrite(buf, sizeof(u8), size, file.file);
+    const u64 n = pwrite(file_id, buf, size, file.pos);
+    file.pos += n;
+    return n;
+}
+
+u64 pread(u64 file_id, u8* buf, u64 size, u64 offset) {
+    auto& file = getFileFromID(file_id);
+    if (file.is_dir) {
+        Helpers::panic("FS::pread: file is dir\n");
+    }
+
+    if (file.mapping) {
+        if (offset >= file.mapping->size()) return 0;
+        const u64 n = std::min<u64>(size, file.mapping->size() - offset);
+        std::memcpy(buf, file.mapping->data() + offset, n);
+        return n;
+    }
+    return hostTransfer<false>(file.host_file, buf, size, offset);
+}
+
+u64 pwrite(u64 file_id, const u8* buf, u64 size, u64 offset) {
+    auto& file = getFileFromID(file_id);
+    if (file.is_dir) {
+        Helpers::panic("FS::pwrite: file is dir\n");
+    }
+
+    return hostTransfer<true>(file.host_file, (u8*)buf, size, offset);
 }
 
 u64 seek(u64 file_id, s64 offs, u32 mode) {
-    Helpers::debugAssert(mode <= 3, "Filesystem: invalid seek mode");
+    Helpers::debugAssert(mode <= SEEK_END, "Filesystem: invalid seek mode %d\n", mode);
 
-    FILE* file = getFileFromID(file_id).file;
-#ifdef _WIN32
-    _fseeki64(file, offs, mode);
-    return _ftelli64(file);
-#else
-    std::fseek(file, offs, mode);
-    return std::ftell(file);
-#endif
+    auto& file = getFileFromID(file_id);
+    s64 base = 0;
+    if      (mode == SEEK_CUR) base = file.pos;
+    else if (mode == SEEK_END) base = getFileSize(file_id);
+
+    if (base + offs < 0) return -1;
+    file.pos = base + offs;
+    return file.pos;
 }
 
 u64 tell(u64 file_id) {
-    FILE* file = getFileFromID(file_id).file;
-#ifdef _WIN32
-    return _ftelli64(file);
-#else
-    return std::ftell(file);
-#endif
+    return getFileFromID(file_id).pos;
 }
 
 // Returns false if path already exists
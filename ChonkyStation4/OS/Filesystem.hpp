@@ -5,6 +5,12 @@
 #include <Common.hpp>
 #include <unordered_map>
 #include <mutex>
+#include <memory>
+
+
+namespace Helpers {
+class MappedFile;
+}
 
 namespace PS4::FS {
 
@@ -50,8 +56,14 @@ struct SceKernelDirent {
     char d_name[SCE_KERNEL_MAXNAMLEN + 1];
 };
 
+// Files are accessed through native host handles with positional reads and writes, which don't need a lock.
+// Only read/write/seek, which use the seek position, and directory reads must be done with the file lock held.
 struct File {
-    FILE* file;
+    ~File();
+
+    s64 host_file = -1;     // File descriptor, or HANDLE on Windows
+    std::unique_ptr<Helpers::MappedFile> mapping;   // Read-only files on /app0 are read from a mapping of the whole file
+    u64 pos = 0;            // Seek position
     fs::path path;
     fs::path guest_path;
     bool is_dir;
@@ -75,6 +87,10 @@ void close(u64 file_id);
 void closedir(u64 file_id);
 u64 read(u64 file_id, u8* buf, u64 size);
 u64 write(u64 file_id, u8* buf, u64 size);
+// Read and write at offset without using or moving the seek position. Don't need the file lock.
+u64 pread(u64 file_id, u8* buf, u64 size, u64 offset);
+u64 pwrite(u64 file_id, const u8* buf, u64 size, u64 offset);
+// Returns the new seek position, or -1 if it would be negative
 u64 seek(u64 file_id, s64 offs, u32 mode);
 u64 tell(u64 file_id);
 bool mkdir(fs::path path);
@@ -1,8 +1,12 @@
 #include "Equeue.hpp"
 #include <Logger.hpp>
+#include <ErrorCodes.hpp>
 #include <OS/SceObj.hpp>
+#include <OS/Libraries/Kernel/Kernel.hpp>
 #include <thread>
 #include <unordered_map>
+#include <algorithm>
+#include <limits>
 #ifdef _MSC_VER
 #include <intrin.h>
 #define RETURN_ADDRESS() _ReturnAddress()
@@ -15,65 +19,285 @@ namespace PS4::OS::Libs::Kernel {
 
 MAKE_LOG_FUNCTION(log, lib_kernel_equeue);
 
-// TODO: level triggered events
+Equeue::~Equeue() {
+    Removed removed;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        for (auto& [key, kn] : knotes) {
+            if (kn->source) removed.sources.push_back(kn->source);
+            if (kn->timer) removed.timers.push_back(std::move(kn->timer));
+        }
+    }
+    release(removed);
+}
+
+void Equeue::pushReady(Knote* kn) {
+    kn->ready = true;
+    kn->prev = ready_tail;
+    kn->next = nullptr;
+    if (ready_tail) ready_tail->next = kn;
+    else ready_head = kn;
+    ready_tail = kn;
+    n_ready++;
+}
+
+void Equeue::removeReady(Knote* kn) {
+    if (kn->prev) kn->prev->next = kn->next;
+    else ready_head = kn->next;
+    if (kn->next) kn->next->prev = kn->prev;
+    else ready_tail = kn->prev;
+    kn->ready = false;
+    kn->prev = nullptr;
+    kn->next = nullptr;
+    n_ready--;
+}
+
+void Equeue::activate(Knote* kn) {
+    kn->triggered = true;
+    if (kn->enabled && !kn->ready)
+        pushReady(kn);
+}
+
+void Equeue::eraseKnote(Knote* kn, Removed& removed) {
+    if (kn->ready) removeReady(kn);
+    if (kn->source) removed.sources.push_back(kn->source);
+    if (kn->timer) removed.timers.push_back(std::move(kn->timer));
+    knotes.erase({ kn->ev.ident, kn->ev.filter });
+}
+
+// Must be called without holding mtx: event sources lock their own mutex before the queue's, and timer callbacks lock the queue
+void Equeue::release(Removed& removed) {
+    for (auto* source : removed.sources)
+        source->removeFromEventQueue(this);
+    for (auto& timer : removed.timers)
+        Timers::cancel(*timer);
+}
+
+void Equeue::registerEvent(SceKernelEvent ev, EventSource* source) {
+    auto lk = std::unique_lock<std::mutex>(mtx);
+    registerEventLocked(ev, source);
+}
 
-void Equeue::trigger(u64 ident, u16 filter, u64 data) {
-    bool has_triggered_event = false;
-    for (auto& ev : events) {
-        if (ev.second.ident == ident && ev.second.filter == filter) {
-            ev.first = true;    // Event arrived
-            has_triggered_event = true;
-            ev.second.data = data;
+Equeue::Knote* Equeue::registerEventLocked(SceKernelEvent ev, EventSource* source) {
+    const bool enabled = !(ev.flags & SCE_KERNEL_EV_DISABLE);
+    ev.flags &= ~(SCE_KERNEL_EV_ADD | SCE_KERNEL_EV_DELETE | SCE_KERNEL_EV_ENABLE | SCE_KERNEL_EV_DISABLE | SCE_KERNEL_EV_RECEIPT);
+
+    auto& kn = knotes[{ ev.ident, ev.filter }];
+    if (kn) {
+        // Already registered, only update the event's parameters
+        kn->ev.flags = ev.flags;
+        kn->ev.udata = ev.udata;
+        if (!enabled && kn->ready) removeReady(kn.get());
+        kn->enabled = enabled;
+        return kn.get();
+    }
+
+    kn = std::make_unique<Knote>();
+    kn->ev = ev;
+    kn->ev.fflags = 0;
+    kn->ev.data = 0;
+    kn->source = source;
+    kn->enabled = enabled;
+    return kn.get();
+}
+
+bool Equeue::deleteEvent(u64 ident, u16 filter) {
+    Removed removed;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        auto it = knotes.find({ ident, filter });
+        if (it == knotes.end()) return false;
+        eraseKnote(it->second.get(), removed);
+    }
+    release(removed);
+    return true;
+}
+
+bool Equeue::enableEvent(u64 ident, u16 filter, bool enable) {
+    bool wake = false;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        auto it = knotes.find({ ident, filter });
+        if (it == knotes.end()) return false;
+
+        Knote* kn = it->second.get();
+        kn->enabled = enable;
+        if (enable && kn->triggered && !kn->ready) {
+            pushReady(kn);
+            wake = n_waiters;
+        }
+        else if (!enable && kn->ready) {
+            removeReady(kn);
         }
     }
 
-    // Notify equeue condition variable
-    std::unique_lock lk(cv_m);
-    cv.notify_one();
+    if (wake) cv.notify_all();
+    return true;
 }
 
-std::pair<bool, std::vector<SceKernelEvent>> Equeue::wait(bool has_timeout, u32 timeout) {
-    auto poll_events = [&]() -> std::vector<SceKernelEvent> {
-        std::vector<SceKernelEvent> evs;
-        for (auto& ev : events) {
-            // Check if the event arrived and add it to the list of arrived events
-            if (ev.first) {
-                ev.first = false;   // Reset arrived state
-                evs.push_back(ev.second);
-            }
+bool Equeue::trigger(u64 ident, u16 filter, u64 data) {
+    bool wake = false;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        auto it = knotes.find({ ident, filter });
+        if (it == knotes.end()) return false;
+
+        Knote* kn = it->second.get();
+        kn->ev.data = data;
+        activate(kn);
+        wake = n_waiters && kn->ready;
+    }
+
+    if (wake) cv.notify_all();
+    return true;
+}
+
+bool Equeue::triggerUserEvent(u64 ident, u32 fflags, void* udata, bool set_udata) {
+    bool wake = false;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        auto it = knotes.find({ ident, (u16)SCE_KERNEL_EVFILT_USER });
+        if (it == knotes.end()) return false;
+
+        Knote* kn = it->second.get();
+        const u32 new_fflags = fflags & SCE_KERNEL_NOTE_FFLAGSMASK;
+        switch (fflags & SCE_KERNEL_NOTE_FFCTRLMASK) {
+        case SCE_KERNEL_NOTE_FFAND:     kn->ev.fflags &= new_fflags;    break;
+        case SCE_KERNEL_NOTE_FFOR:      kn->ev.fflags |= new_fflags;    break;
+        case SCE_KERNEL_NOTE_FFCOPY:    kn->ev.fflags = new_fflags;     break;
         }
-        return evs;
-    };
+        if (set_udata) kn->ev.udata = udata;
 
-    std::vector<SceKernelEvent> evs;
+        if (fflags & SCE_KERNEL_NOTE_TRIGGER) {
+            activate(kn);
+            wake = n_waiters && kn->ready;
+        }
+    }
 
-    // Poll events once to see if there already were arrived events
-    evs = poll_events();
-    if (!evs.empty()) return { false, evs };    // false means we did not timeout
+    if (wake) cv.notify_all();
+    return true;
+}
 
-    // If we have a timeout, and the timeout is 0, only poll once.
-    // (This polls the events already present at the time of the wait and returns)
-    if (has_timeout && timeout == 0) {
-        return { evs.empty(), evs };
+void Equeue::addTimer(u64 ident, u16 filter, u16 flags, void* udata, Timers::Clock::duration delay, Timers::Clock::duration period) {
+    std::unique_ptr<Timers::Timer> old_timer;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+
+        // Timers report the number of expirations since they were last returned, so they're always EV_CLEAR
+        Knote* kn = registerEventLocked({
+            .ident = ident,
+            .filter = filter,
+            .flags = (u16)(flags | SCE_KERNEL_EV_CLEAR),
+            .fflags = 0,
+            .data = 0,
+            .udata = udata,
+        }, nullptr);
+
+        // Adding a timer again restarts it
+        if (kn->ready) removeReady(kn);
+        kn->triggered = false;
+        kn->ev.data = 0;
+        old_timer = std::move(kn->timer);
+        kn->timer = std::make_unique<Timers::Timer>();
+        kn->timer->callback = [this, ident, filter]() { fireTimer(ident, filter); };
+        Timers::arm(*kn->timer, Timers::Clock::now() + delay, period);
     }
 
-    // Waiting for events is implemented via a condition variable
-    if (!has_timeout) {
-        // Wait for events without timeout 
-        std::unique_lock lk(cv_m);
-        cv.wait(lk);
+    if (old_timer) Timers::cancel(*old_timer);
+}
+
+void Equeue::fireTimer(u64 ident, u16 filter) {
+    bool wake = false;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        auto it = knotes.find({ ident, filter });
+        if (it == knotes.end()) return;
+
+        Knote* kn = it->second.get();
+        kn->ev.data++;
+        activate(kn);
+        wake = n_waiters && kn->ready;
     }
-    else {
-        // Wait for events with timeout 
-        std::unique_lock lk(cv_m);
-        auto res = cv.wait_for(lk, std::chrono::microseconds(timeout));
-        // Did we timeout?
-        if (res == std::cv_status::timeout) return { true, {} };
+
+    if (wake) cv.notify_all();
+}
+
+s32 Equeue::wait(SceKernelEvent* evs, s32 n_evs, bool has_timeout, u32 timeout) {
+    Removed removed;
+    s32 n = 0;
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        if (closed) return -1;
+
+        // If we have a timeout, and the timeout is 0, only poll once.
+        // (This returns the events already triggered at the time of the wait)
+        if (!ready_head && !(has_timeout && timeout == 0)) {
+            n_waiters++;
+            auto has_events = [&]() { return ready_head != nullptr || closed; };
+            if (!has_timeout) {
+                cv.wait(lk, has_events);
+            }
+            else {
+                // The timeout is handled by the timer service, which is more precise than cv.wait_for on some hosts
+                bool timed_out = false;
+                Timers::Timer timer;
+                timer.callback = [&]() {
+                    {
+                        auto timer_lk = std::unique_lock<std::mutex>(mtx);
+                        timed_out = true;
+                    }
+                    cv.notify_all();
+                };
+                Timers::arm(timer, Timers::Clock::now() + std::chrono::microseconds(timeout));
+                cv.wait(lk, [&]() { return has_events() || timed_out; });
+
+                lk.unlock();
+                Timers::cancel(timer);
+                lk.lock();
+            }
+            n_waiters--;
+
+            if (closed) {
+                // The thread deleting the queue waits for every waiter to leave
+                cv.notify_all();
+                return -1;
+            }
+        }
+
+        // Level triggered events are moved to the back of the ready list after being returned.
+        // Only visit the events that were ready when we started so that they aren't returned twice.
+        size_t to_visit = n_ready;
+        while (n < n_evs && to_visit--) {
+            Knote* kn = ready_head;
+            removeReady(kn);
+            evs[n++] = kn->ev;
+
+            if (kn->ev.flags & SCE_KERNEL_EV_ONESHOT) {
+                eraseKnote(kn, removed);
+                continue;
+            }
+            if (kn->ev.flags & SCE_KERNEL_EV_CLEAR) {
+                kn->triggered = false;
+                kn->ev.data = 0;
+                kn->ev.fflags = 0;
+            }
+            if (kn->ev.flags & SCE_KERNEL_EV_DISPATCH)
+                kn->enabled = false;
+
+            if (kn->triggered && kn->enabled)
+                pushReady(kn);
+        }
     }
 
-    // Return events
-    evs = poll_events();
-    return { false, evs };
+    release(removed);
+    return n;
+}
+
+void Equeue::close() {
+    auto lk = std::unique_lock<std::mutex>(mtx);
+    closed = true;
+    cv.notify_all();
+    cv.wait(lk, [&]() { return n_waiters == 0; });
 }
 
 void EventSource::init(u64 ident, u16 filter) {
@@ -84,18 +308,28 @@ void EventSource::init(u64 ident, u16 filter) {
 }
 
 void EventSource::addToEventQueue(Equeue* eq, void* udata) {
+    auto lk = std::unique_lock<std::mutex>(mtx);
+    
+    // Events triggered by the system are edge triggered
     eq->registerEvent({
         .ident = ident,
         .filter = filter,
-        .flags = 0,     // TODO
-        .fflags = 0,    // TODO
+        .flags = SCE_KERNEL_EV_ADD | SCE_KERNEL_EV_CLEAR,
+        .fflags = 0,
         .data = 0,      
         .udata = udata,
-    });
-    eqs.push_back(eq);
+    }, this);
+    if (std::find(eqs.begin(), eqs.end(), eq) == eqs.end())
+        eqs.push_back(eq);
+}
+
+void EventSource::removeFromEventQueue(Equeue* eq) {
+    auto lk = std::unique_lock<std::mutex>(mtx);
+    std::erase(eqs, eq);
 }
 
 void EventSource::trigger(u64 data) {
+    auto lk = std::unique_lock<std::mutex>(mtx);
     for (auto& eq : eqs) {
         eq->trigger(ident, filter, data);
     }
@@ -109,44 +343,41 @@ s32 PS4_FUNC sceKernelCreateEqueue(SceKernelEqueue* eq, const char* name) {
     return SCE_OK;
 }
 
+s32 PS4_FUNC sceKernelDeleteEqueue(SceKernelEqueue eq) {
+    log("sceKernelDeleteEqueue(eq=%p)\n", eq);
+
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    eq->close();
+    delete eq;
+    return SCE_OK;
+}
+
 s32 PS4_FUNC sceKernelWaitEqueue(SceKernelEqueue eq, SceKernelEvent* ev, s32 n_evs, s32* n_out, u32* timeout) {
     log("sceKernelWaitEqueue(eq=*%p, ev=*%p, n_evs=%d, n_out=*%p, timeout=*%p)\n", eq, ev, n_evs, n_out, timeout);
 
-    if (eq->name == "ScePsmSetModeEvent") {
-        *n_out = 1;
-        return SCE_OK;
-    }
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (n_evs < 1) return SCE_KERNEL_ERROR_EINVAL;
 
-    // TODO
-    if (eq->has_hr_timer_event) {
-        eq->has_hr_timer_event = false;
+    if (eq->name == "ScePsmSetModeEvent") {
         *n_out = 1;
         return SCE_OK;
     }
 
-    auto [timed_out, events] = eq->wait(timeout != nullptr, timeout ? *timeout : 0);
-    if (timed_out) return SCE_KERNEL_ERROR_ETIMEDOUT;
-
-    // Return events
-    int written_evs = 0;
-    for (int i = 0; i < events.size(); i++) {
-        if (i >= n_evs) break;
-
-        ev[i] = events[i];
-        written_evs++;
-    }
+    const s32 n = eq->wait(ev, n_evs, timeout != nullptr, timeout ? *timeout : 0);
+    if (n < 0) return SCE_KERNEL_ERROR_EBADF;
+    if (!n) return SCE_KERNEL_ERROR_ETIMEDOUT;
 
-    *n_out = written_evs;
+    *n_out = n;
     return SCE_OK;
 }
 
-s32 PS4_FUNC sceKernelAddUserEvent(SceKernelEqueue eq, s32 id) {
-    log("sceKernelAddUserEvent(eq=%p, id=%d)\n", eq, id);
+static s32 addUserEvent(SceKernelEqueue eq, s32 id, u16 flags) {
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
 
     eq->registerEvent({
         .ident = (u64)id,
-        .filter = 0,
-        .flags = 0,     
+        .filter = (u16)SCE_KERNEL_EVFILT_USER,
+        .flags = flags,
         .fflags = 0,    
         .data = 0,
         .udata = 0,
@@ -154,11 +385,73 @@ s32 PS4_FUNC sceKernelAddUserEvent(SceKernelEqueue eq, s32 id) {
     return SCE_OK;
 }
 
+s32 PS4_FUNC sceKernelAddUserEvent(SceKernelEqueue eq, s32 id) {
+    log("sceKernelAddUserEvent(eq=%p, id=%d)\n", eq, id);
+    return addUserEvent(eq, id, SCE_KERNEL_EV_ADD);
+}
+
+s32 PS4_FUNC sceKernelAddUserEventEdge(SceKernelEqueue eq, s32 id) {
+    log("sceKernelAddUserEventEdge(eq=%p, id=%d)\n", eq, id);
+    return addUserEvent(eq, id, SCE_KERNEL_EV_ADD | SCE_KERNEL_EV_CLEAR);
+}
+
+s32 PS4_FUNC sceKernelTriggerUserEvent(SceKernelEqueue eq, s32 id, void* udata) {
+    log("sceKernelTriggerUserEvent(eq=%p, id=%d, udata=%p)\n", eq, id, udata);
+
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (!eq->triggerUserEvent(id, SCE_KERNEL_NOTE_TRIGGER, udata, true))
+        return SCE_KERNEL_ERROR_ENOENT;
+    return SCE_OK;
+}
+
+s32 PS4_FUNC sceKernelDeleteUserEvent(SceKernelEqueue eq, s32 id) {
+    log("sceKernelDeleteUserEvent(eq=%p, id=%d)\n", eq, id);
+
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (!eq->deleteEvent(id, (u16)SCE_KERNEL_EVFILT_USER))
+        return SCE_KERNEL_ERROR_ENOENT;
+    return SCE_OK;
+}
+
 s32 PS4_FUNC sceKernelAddHRTimerEvent(SceKernelEqueue eq, s32 id, SceKernelTimespec* timespec, void* udata) {
     log("sceKernelAddHRTimerEvent(eq=%p, id=%d, timespec=*%p, udata=%p)\n", eq, id, timespec, udata);
     
-    // TODO
-    eq->has_hr_timer_event = true;
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (!timespec || timespec->tv_sec < 0 || timespec->tv_nsec < 0 || timespec->tv_nsec >= 1'000'000'000)
+        return SCE_KERNEL_ERROR_EINVAL;
+
+    const auto delay = std::chrono::seconds(timespec->tv_sec) + std::chrono::nanoseconds(timespec->tv_nsec);
+    eq->addTimer(id, (u16)SCE_KERNEL_EVFILT_HRTIMER, SCE_KERNEL_EV_ONESHOT, udata, delay, {});
+    return SCE_OK;
+}
+
+s32 PS4_FUNC sceKernelDeleteHRTimerEvent(SceKernelEqueue eq, s32 id) {
+    log("sceKernelDeleteHRTimerEvent(eq=%p, id=%d)\n", eq, id);
+
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (!eq->deleteEvent(id, (u16)SCE_KERNEL_EVFILT_HRTIMER))
+        return SCE_KERNEL_ERROR_ENOENT;
+    return SCE_OK;
+}
+
+s32 PS4_FUNC sceKernelAddTimerEvent(SceKernelEqueue eq, s32 id, u32 usec, void* udata) {
+    log("sceKernelAddTimerEvent(eq=%p, id=%d, usec=%d, udata=%p)\n", eq, id, usec, udata);
+
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (!usec) return SCE_KERNEL_ERROR_EINVAL;
+
+    // Periodic
+    const auto period = std::chrono::microseconds(usec);
+    eq->addTimer(id, (u16)SCE_KERNEL_EVFILT_TIMER, 0, udata, period, period);
+    return SCE_OK;
+}
+
+s32 PS4_FUNC sceKernelDeleteTimerEvent(SceKernelEqueue eq, s32 id) {
+    log("sceKernelDeleteTimerEvent(eq=%p, id=%d)\n", eq, id);
+
+    if (!eq) return SCE_KERNEL_ERROR_EBADF;
+    if (!eq->deleteEvent(id, (u16)SCE_KERNEL_EVFILT_TIMER))
+        return SCE_KERNEL_ERROR_ENOENT;
     return SCE_OK;
 }
 
@@ -167,6 +460,21 @@ s32 PS4_FUNC sceKernelGetEventFilter(SceKernelEvent* ev) {
     return (s32)(s16)ev->filter;
 }
 
+u64 PS4_FUNC sceKernelGetEventId(SceKernelEvent* ev) {
+    log("sceKernelGetEventId(ev=%p)\n", ev);
+    return ev->ident;
+}
+
+u64 PS4_FUNC sceKernelGetEventData(SceKernelEvent* ev) {
+    log("sceKernelGetEventData(ev=%p)\n", ev);
+    return ev->data;
+}
+
+void* PS4_FUNC sceKernelGetEventUserData(SceKernelEvent* ev) {
+    log("sceKernelGetEventUserData(ev=%p)\n", ev);
+    return ev->udata;
+}
+
 // Posix queues
 std::unordered_map<u64, SceKernelEqueue> posix_eqs;
 std::mutex posix_eq_mtx;
@@ -191,9 +499,71 @@ s32 PS4_FUNC kernel_kqueue() {
 s32 PS4_FUNC kernel_kevent(s32 handle, SceKernelEvent* changelist, u64 n_changes, SceKernelEvent* eventlist, u64 n_events, SceKernelTimespec* timeout) {
     log("kernel_kevent(handle=%d, changelist=*%p, n_changes=%lld, eventlist=*%p, n_events=%lld, timeout=*%p)\n", handle, changelist, n_changes, eventlist, n_events, timeout);
 
-    // TODO: Important
-    printf("TODO: kevent\n");
-    return SCE_OK;
+    SceKernelEqueue eq = nullptr;
+    {
+        const std::unique_lock<std::mutex> lk(posix_eq_mtx);
+        if (posix_eqs.contains(handle)) eq = posix_eqs[handle];
+    }
+    if (!eq) {
+        *Kernel::kernel_error() = POSIX_EBADF;
+        return -1;
+    }
+
+    // Apply changes
+    s32 n_out = 0;
+    for (int i = 0; i < n_changes; i++) {
+        const SceKernelEvent& change = changelist[i];
+        bool ok = true;
+        if (change.flags & SCE_KERNEL_EV_DELETE) {
+            ok = eq->deleteEvent(change.ident, change.filter);
+        }
+        else {
+            if (change.flags & SCE_KERNEL_EV_ADD) {
+                if ((s16)change.filter == SCE_KERNEL_EVFILT_TIMER) {
+                    // data is the period in milliseconds
+                    const auto period = std::chrono::milliseconds(change.data);
+                    eq->addTimer(change.ident, change.filter, change.flags, change.udata, period, (change.flags & SCE_KERNEL_EV_ONESHOT) ? Timers::Clock::duration() : period);
+                }
+                else {
+                    eq->registerEvent(change);
+                    if ((s16)change.filter != SCE_KERNEL_EVFILT_USER)
+                        log("kevent: filter %d is registered but nothing triggers it\n", (s16)change.filter);
+                }
+            }
+            if (change.flags & (SCE_KERNEL_EV_ENABLE | SCE_KERNEL_EV_DISABLE))
+                ok = eq->enableEvent(change.ident, change.filter, change.flags & SCE_KERNEL_EV_ENABLE);
+            if (ok && (s16)change.filter == SCE_KERNEL_EVFILT_USER)
+                ok = eq->triggerUserEvent(change.ident, change.fflags, nullptr, false);
+        }
+
+        // Errors are returned in the event list if there's space for them
+        if (!ok || (change.flags & SCE_KERNEL_EV_RECEIPT)) {
+            if (n_out < n_events) {
+                eventlist[n_out] = change;
+                eventlist[n_out].flags = SCE_KERNEL_EV_ERROR;
+                eventlist[n_out].data = ok ? 0 : POSIX_ENOENT;
+                n_out++;
+            }
+            else if (!ok) {
+                *Kernel::kernel_error() = POSIX_ENOENT;
+                return -1;
+            }
+        }
+    }
+    if (n_out || !n_events) return n_out;
+
+    // Wait for events
+    u32 timeout_us = 0;
+    if (timeout) {
+        const u64 us = timeout->tv_sec * 1000000ull + timeout->tv_nsec / 1000;
+        timeout_us = std::min<u64>(us, std::numeric_limits<u32>::max());
+    }
+    const s32 n = eq->wait(eventlist, std::min<u64>(n_events, INT32_MAX), timeout != nullptr, timeout_us);
+    if (n < 0) {
+        *Kernel::kernel_error() = POSIX_EBADF;
+        return -1;
+    }
+    return n;
 }
 
 };  // End namespace PS4::OS::Libs::Kernel
\ No newline at end of file
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <Common.hpp>
-#include <deque>
+#include <OS/Timers.hpp>
+#include <unordered_map>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 
 
@@ -10,6 +12,32 @@ namespace PS4::OS::Libs::Kernel {
 
 static constexpr s32 SCE_KERNEL_ERROR_ETIMEDOUT = 0x8002003c;
 
+// Filters
+static constexpr s16 SCE_KERNEL_EVFILT_TIMER            = -7;
+static constexpr s16 SCE_KERNEL_EVFILT_USER             = -11;
+static constexpr s16 SCE_KERNEL_EVFILT_VIDEO_OUT        = -13;
+static constexpr s16 SCE_KERNEL_EVFILT_GRAPHICS_CORE    = -14;
+static constexpr s16 SCE_KERNEL_EVFILT_HRTIMER          = -15;
+
+// Flags
+static constexpr u16 SCE_KERNEL_EV_ADD      = 0x0001;
+static constexpr u16 SCE_KERNEL_EV_DELETE   = 0x0002;
+static constexpr u16 SCE_KERNEL_EV_ENABLE   = 0x0004;
+static constexpr u16 SCE_KERNEL_EV_DISABLE  = 0x0008;
+static constexpr u16 SCE_KERNEL_EV_ONESHOT  = 0x0010;   // Delete the event after it's returned
+static constexpr u16 SCE_KERNEL_EV_CLEAR    = 0x0020;   // Reset the event after it's returned (edge triggered)
+static constexpr u16 SCE_KERNEL_EV_RECEIPT  = 0x0040;
+static constexpr u16 SCE_KERNEL_EV_DISPATCH = 0x0080;   // Disable the event after it's returned
+static constexpr u16 SCE_KERNEL_EV_ERROR    = 0x4000;
+
+// EVFILT_USER fflags
+static constexpr u32 SCE_KERNEL_NOTE_FFAND          = 0x40000000;
+static constexpr u32 SCE_KERNEL_NOTE_FFOR           = 0x80000000;
+static constexpr u32 SCE_KERNEL_NOTE_FFCOPY         = 0xc0000000;
+static constexpr u32 SCE_KERNEL_NOTE_FFCTRLMASK     = 0xc0000000;
+static constexpr u32 SCE_KERNEL_NOTE_FFLAGSMASK     = 0x00ffffff;
+static constexpr u32 SCE_KERNEL_NOTE_TRIGGER        = 0x01000000;
+
 struct SceKernelEvent {
 	u64 ident;
 	u16 filter;
@@ -19,42 +47,114 @@ struct SceKernelEvent {
     void* udata;
 };
 
+struct EventSource;
+
+// Event queue, behaves like a FreeBSD kqueue.
+// Registered events are indexed by (ident, filter), so triggering one doesn't look at the other events of the queue.
+// Triggered events are linked in a ready list, waiting returns events from the ready list only.
+// Level triggered events stay in the ready list after being returned, EV_CLEAR events are reset and EV_ONESHOT events are deleted.
 struct Equeue {
+    ~Equeue();
+
+    struct Knote {
+        SceKernelEvent ev;
+        EventSource* source = nullptr;  // Event source that triggers this event, if any
+        std::unique_ptr<Timers::Timer> timer;   // For timer events
+        bool triggered = false;
+        bool enabled = true;
+
+        // Ready list links
+        bool ready = false;
+        Knote* prev = nullptr;
+        Knote* next = nullptr;
+    };
+
+    struct KnoteKey {
+        u64 ident;
+        u16 filter;
+
+        bool operator==(const KnoteKey& other) const { return ident == other.ident && filter == other.filter; }
+    };
+
+    struct KnoteKeyHash {
+        size_t operator()(const KnoteKey& key) const { return std::hash<u64>()(key.ident ^ ((u64)key.filter << 48)); }
+    };
+
     std::string name;
-    std::vector<std::pair<bool, SceKernelEvent>> events;    // bool = event arrived or not
+    std::unordered_map<KnoteKey, std::unique_ptr<Knote>, KnoteKeyHash> knotes;
+    Knote* ready_head = nullptr;
+    Knote* ready_tail = nullptr;
+    size_t n_ready = 0;
+    s32 n_waiters = 0;
+    bool closed = false;
     std::condition_variable cv;
-    std::mutex cv_m;
-    bool has_hr_timer_event = false;
+    std::mutex mtx;
+
+    // Registers an event, or updates its flags, fflags and udata if it was already registered
+    void registerEvent(SceKernelEvent ev, EventSource* source = nullptr);
+    bool deleteEvent(u64 ident, u16 filter);
+    bool enableEvent(u64 ident, u16 filter, bool enable);
+    // Returns false if the event isn't registered
+    bool trigger(u64 ident, u16 filter, u64 data);
+    bool triggerUserEvent(u64 ident, u32 fflags, void* udata, bool set_udata);
+    // Registers a timer event that triggers after delay, and then every period if period isn't zero. data counts the expirations.
+    void addTimer(u64 ident, u16 filter, u16 flags, void* udata, Timers::Clock::duration delay, Timers::Clock::duration period);
+    // Writes up to n_evs triggered events to evs and returns how many were written.
+    // Blocks until at least one event triggers, or until timeout microseconds passed if has_timeout is true (then it can return 0).
+    // Returns -1 if the queue is closed, or was closed while waiting.
+    s32 wait(SceKernelEvent* evs, s32 n_evs, bool has_timeout, u32 timeout);
+    // Wakes up every waiter, making them return -1, and blocks until they're gone. Must be called before deleting the queue.
+    void close();
 
-    
-    void registerEvent(SceKernelEvent ev) {
-        // TODO: Verify ev.ident is unique
-        events.push_back({ false, ev });
-    }
+private:
+    // What deleted events leave behind that can only be cleaned up without holding mtx
+    struct Removed {
+        std::vector<EventSource*> sources;
+        std::vector<std::unique_ptr<Timers::Timer>> timers;
+    };
 
-    void trigger(u64 ident, u16 filter, u64 data);
-    std::pair<bool, std::vector<SceKernelEvent>> wait(bool has_timeout, u32 timeout); // bool = whether or not we timed out
+    Knote* registerEventLocked(SceKernelEvent ev, EventSource* source);
+    void pushReady(Knote* kn);
+    void removeReady(Knote* kn);
+    void activate(Knote* kn);
+    void fireTimer(u64 ident, u16 filter);
+    void eraseKnote(Knote* kn, Removed& removed);
+    void release(Removed& removed);
 };
 
+// Something that triggers events, i.e. a video out port or the GPU.
+// Triggering an event source triggers the event in every queue it was added to.
 struct EventSource {
     bool initialized = false;
     u64 ident;
     u16 filter;
     std::vector<Equeue*> eqs;
+    std::mutex mtx;
 
     void init(u64 ident, u16 filter);
     void addToEventQueue(Equeue* eq, void* udata);
+    void removeFromEventQueue(Equeue* eq);
     void trigger(u64 data);
 };
 
 using SceKernelEqueue = Equeue*;
 
 s32 PS4_FUNC sceKernelCreateEqueue(SceKernelEqueue* eq, const char* name);
+s32 PS4_FUNC sceKernelDeleteEqueue(SceKernelEqueue eq);
 s32 PS4_FUNC sceKernelWaitEqueue(SceKernelEqueue eq, SceKernelEvent* ev, s32 n_evs, s32* n_out, u32* timeout);
 s32 PS4_FUNC sceKernelAddUserEvent(SceKernelEqueue eq, s32 id);
+s32 PS4_FUNC sceKernelAddUserEventEdge(SceKernelEqueue eq, s32 id);
+s32 PS4_FUNC sceKernelTriggerUserEvent(SceKernelEqueue eq, s32 id, void* udata);
+s32 PS4_FUNC sceKernelDeleteUserEvent(SceKernelEqueue eq, s32 id);
 s32 PS4_FUNC sceKernelAddHRTimerEvent(SceKernelEqueue eq, s32 id, SceKernelTimespec* timespec, void* udata);
+s32 PS4_FUNC sceKernelDeleteHRTimerEvent(SceKernelEqueue eq, s32 id);
+s32 PS4_FUNC sceKernelAddTimerEvent(SceKernelEqueue eq, s32 id, u32 usec, void* udata);
+s32 PS4_FUNC sceKernelDeleteTimerEvent(SceKernelEqueue eq, s32 id);
 s32 PS4_FUNC sceKernelGetEventFilter(SceKernelEvent* ev);
+u64 PS4_FUNC sceKernelGetEventId(SceKernelEvent* ev);
+u64 PS4_FUNC sceKernelGetEventData(SceKernelEvent* ev);
+void* PS4_FUNC sceKernelGetEventUserData(SceKernelEvent* ev);
 s32 PS4_FUNC kernel_kqueue();
 s32 PS4_FUNC kernel_kevent(s32 handle, SceKernelEvent* changelist, u64 n_changes, SceKernelEvent* eventlist, u64 n_events, SceKernelTimespec* timeout);
 
-};  // End namespace PS4::OS::Libs::Kernel
\ No newline at end of file
+};  // End namespace PS4::OS::Libs::Kernel
@@ -85,7 +85,12 @@ s64 PS4_FUNC kernel_lseek(s32 fd, s64 offset, s32 whence) {
     }
 
     auto lock = FS::getFileLock(fd);
-    return FS::seek(fd, offset, whence);
+    const s64 pos = FS::seek(fd, offset, whence);
+    if (pos < 0) {
+        *Kernel::kernel_error() = POSIX_EINVAL;
+        return -1;
+    }
+    return pos;
 }
 
 s64 PS4_FUNC sceKernelLseek(s32 fd, s64 offset, s32 whence) {
@@ -108,16 +113,14 @@ s64 PS4_FUNC sceKernelRead(s32 fd, u8* buf, u64 size) {
 
 s64 PS4_FUNC kernel_pread(s32 fd, u8* buf, u64 size, s64 offset) {
     log("pread(fd=%d, buf=%p, size=%lld, offset=%lld)\n", fd, buf, size, offset);
-    auto lock = FS::getFileLock(fd);
 
-    // Save old seek position
-    const auto old_pos = FS::tell(fd);
-    // Seek to offset and read
-    FS::seek(fd, offset, SEEK_SET);
-    const auto ret = FS::read(fd, buf, size);
-    // Restore old seek position
-    FS::seek(fd, old_pos, SEEK_SET);
-    return ret;
+    if (offset < 0) {
+        *Kernel::kernel_error() = POSIX_EINVAL;
+        return -1;
+    }
+
+    // Doesn't use the seek position, so concurrent reads of the same file don't need the file lock
+    return FS::pread(fd, buf, size, offset);
 }
 
 s64 PS4_FUNC kernel_readv(s32 fd, SceKernelIovec* iov, int iovcnt) {
@@ -169,16 +172,13 @@ s64 PS4_FUNC kernel_write(s32 fd, u8* buf, u64 size) {
 
 s64 PS4_FUNC kernel_pwrite(s32 fd, u8* buf, u64 size, s64 offset) {
     log("pwrite(fd=%d, buf=%p, size=%lld, offset=%lld)\n", fd, buf, size, offset);
-    auto lock = FS::getFileLock(fd);
 
-    // Save old seek position
-    const auto old_pos = FS::tell(fd);
-    // Seek to offset and write
-    FS::seek(fd, offset, SEEK_SET);
-    const auto ret = FS::write(fd, buf, size);
-    // Restore old seek position
-    FS::seek(fd, old_pos, SEEK_SET);
-    return ret;
+    if (offset < 0) {
+        *Kernel::kernel_error() = POSIX_EINVAL;
+        return -1;
+    }
+
+    return FS::pwrite(fd, buf, size, offset);
 }
 
 s64 PS4_FUNC sceKernelPwrite(s32 fd, u8* buf, u64 size, s64 offset) {
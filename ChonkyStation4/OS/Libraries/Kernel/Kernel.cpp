@@ -15,6 +15,8 @@
 #include <OS/Libraries/Kernel/Semaphore.hpp>
 #include <OS/Libraries/Kernel/Filesystem.hpp>
 #include <OS/Filesystem.hpp>
+#include <OS/Memory.hpp>
+#include <OS/Timers.hpp>
 #include <OS/SceObj.hpp>
 #include <chrono>
 #include <thread>
@@ -283,14 +285,21 @@ void init(Module& module) {
     module.addSymbolExport("fzyMKs9kim0", "sceKernelWaitEqueue", "libkernel", "libkernel", (void*)&sceKernelWaitEqueue);
     module.addSymbolExport("4R6-OvI2cEA", "sceKernelAddUserEvent", "libkernel", "libkernel", (void*)&sceKernelAddUserEvent);
     module.addSymbolExport("R74tt43xP6k", "sceKernelAddHRTimerEvent", "libkernel", "libkernel", (void*)&sceKernelAddHRTimerEvent);
-    module.addSymbolStub("J+LF6LwObXU", "sceKernelDeleteHRTimerEvent", "libkernel", "libkernel");
-    module.addSymbolStub("WDszmSbWuDk", "sceKernelAddUserEventEdge", "libkernel", "libkernel");
+    module.addSymbolExport("J+LF6LwObXU", "sceKernelDeleteHRTimerEvent", "libkernel", "libkernel", (void*)&sceKernelDeleteHRTimerEvent);
+    module.addSymbolExport("57ZK+ODEXWY", "sceKernelAddTimerEvent", "libkernel", "libkernel", (void*)&sceKernelAddTimerEvent);
+    module.addSymbolExport("YWQFUyXIVdU", "sceKernelDeleteTimerEvent", "libkernel", "libkernel", (void*)&sceKernelDeleteTimerEvent);
+    module.addSymbolExport("WDszmSbWuDk", "sceKernelAddUserEventEdge", "libkernel", "libkernel", (void*)&sceKernelAddUserEventEdge);
+    module.addSymbolExport("F6e0kwo4cnk", "sceKernelTriggerUserEvent", "libkernel", "libkernel", (void*)&sceKernelTriggerUserEvent);
+    module.addSymbolExport("LJDwdSNTnDg", "sceKernelDeleteUserEvent", "libkernel", "libkernel", (void*)&sceKernelDeleteUserEvent);
     module.addSymbolExport("23CPPI1tyBY", "sceKernelGetEventFilter", "libkernel", "libkernel", (void*)&sceKernelGetEventFilter);
+    module.addSymbolExport("mJ7aghmgvfc", "sceKernelGetEventId", "libkernel", "libkernel", (void*)&sceKernelGetEventId);
+    module.addSymbolExport("kwGyyjohI50", "sceKernelGetEventData", "libkernel", "libkernel", (void*)&sceKernelGetEventData);
+    module.addSymbolExport("vz+pg2zdopI", "sceKernelGetEventUserData", "libkernel", "libkernel", (void*)&sceKernelGetEventUserData);
     module.addSymbolExport("nh2IFMgKTv8", "kqueue", "libkernel", "libkernel", (void*)&kernel_kqueue);
     module.addSymbolExport("nh2IFMgKTv8", "kqueue", "libScePosix", "libkernel", (void*)&kernel_kqueue);
     module.addSymbolExport("RW-GEfpnsqg", "kevent", "libkernel", "libkernel", (void*)&kernel_kevent);
     module.addSymbolExport("RW-GEfpnsqg", "kevent", "libScePosix", "libkernel", (void*)&kernel_kevent);
-    module.addSymbolStub("jpFjmgAC5AE", "sceKernelDeleteEqueue", "libkernel", "libkernel");
+    module.addSymbolExport("jpFjmgAC5AE", "sceKernelDeleteEqueue", "libkernel", "libkernel", (void*)&sceKernelDeleteEqueue);
     
     module.addSymbolExport("BpFoboUJoZU", "sceKernelCreateEventFlag", "libkernel", "libkernel", (void*)&sceKernelCreateEventFlag);
     module.addSymbolExport("1vDaenmJtyA", "sceKernelOpenEventFlag", "libkernel", "libkernel", (void*)&sceKernelOpenEventFlag);
@@ -406,7 +415,7 @@ void init(Module& module) {
     module.addSymbolStub("XAzZo12sbN8", "scePthreadMutexSetprioceiling", "libkernel", "libkernel");
     module.addSymbolStub("tZY4+SZNFhA", "msync", "libkernel", "libkernel");
     module.addSymbolStub("crb5j7mkk1c", "_is_signal_return", "libkernel", "libkernel"); // TODO: Important
-    module.addSymbolStub("vSMAm3cxYTY", "sceKernelMprotect", "libkernel", "libkernel"); // TODO: Probably important
+    module.addSymbolExport("vSMAm3cxYTY", "sceKernelMprotect", "libkernel", "libkernel", (void*)&sceKernelMprotect);
     module.addSymbolStub("aPcyptbOiZs", "sigprocmask", "libkernel", "libkernel");
     module.addSymbolStub("6xVpy0Fdq+I", "_sigprocmask", "libkernel", "libkernel");
     module.addSymbolStub("jh+8XiK4LeE", "sceKernelIsAddressSanitizerEnabled", "libkernel", "libkernel", false);
@@ -426,7 +435,7 @@ void init(Module& module) {
     module.addSymbolStub("pB-yGZ2nQ9o", "_sceKernelSetThreadAtexitCount", "libkernel", "libkernel");  // void
     module.addSymbolStub("WhCc1w3EhSI", "_sceKernelSetThreadAtexitReport", "libkernel", "libkernel");  // void
     module.addSymbolStub("Tz4RNUCBbGI", "_sceKernelRtldThreadAtexitIncrement", "libkernel", "libkernel");
-    module.addSymbolStub("DGMG3JshrZU", "sceKernelSetVirtualRangeName", "libkernel", "libkernel");
+    module.addSymbolExport("DGMG3JshrZU", "sceKernelSetVirtualRangeName", "libkernel", "libkernel", (void*)&sceKernelSetVirtualRangeName);
     module.addSymbolStub("PfccT7qURYE", "ioctl", "libkernel", "libkernel");
     module.addSymbolStub("fFxGkxF2bVo", "setsockopt", "libkernel", "libkernel");
     module.addSymbolStub("fFxGkxF2bVo", "setsockopt", "libScePosix", "libkernel");
@@ -513,101 +522,6 @@ void init(Module& module) {
 
 static thread_local s32 posix_errno = 0;
 
-#ifdef _WIN32
-std::mutex allocator_mtx;
-
-static constexpr uptr SYSTEM_MAPPING_AREA = 0x0010'0000'0000;
-void* allocate(uptr reservation_start, uptr reservation_end, size_t size, size_t alignment) {
-    auto lk = std::unique_lock<std::mutex>(allocator_mtx);
-    
-    if (reservation_start >= reservation_end) return nullptr;
-    if (!alignment || (alignment & (alignment - 1)) != 0) return nullptr;
-    if (size == 0) return nullptr;
-
-    SYSTEM_INFO si;
-    GetSystemInfo(&si);
-    const size_t page_size = si.dwPageSize;
-    alignment = alignment < page_size ? page_size : alignment;
-    size = (size + page_size - 1) & ~(page_size - 1);
-
-    uptr cur_addr = reservation_start;
-    // Align up
-    cur_addr = (cur_addr + alignment - 1) & ~(alignment - 1);
-
-    while (true) {
-        MEMORY_BASIC_INFORMATION mbi;
-        if (!VirtualQuery((void*)cur_addr, &mbi, sizeof(mbi)))
-            Helpers::panic("allocate: VirtualQuery failed\n");
-
-        if (mbi.State == MEM_RESERVE) {
-            uptr region_end = (uptr)mbi.BaseAddress + mbi.RegionSize;
-            if (cur_addr + size <= region_end) {
-                // Try to commit memory
-                void* ret = VirtualAlloc((void*)cur_addr, size, MEM_COMMIT, PAGE_READWRITE);
-                if (ret) {
-                    if ((u64)ret & (alignment - 1)) Helpers::panic("allocate: alignment error\n");
-
-                    std::memset(ret, 0xcd, size);
-                    return ret;
-                }
-            }
-
-            // Free area wasn't big enough to allocate or VirtualAlloc failed
-        }
-        cur_addr = (uptr)mbi.BaseAddress + mbi.RegionSize;
-        // Align up
-        cur_addr = (cur_addr + alignment - 1) & ~(alignment - 1);
-        
-        if (cur_addr > reservation_end) Helpers::panic("allocate: out of memory\n");
-    }
-
-    
-    return nullptr;
-}
-
-// Same as allocate, without committing physical memory.
-void* findNextFree(uptr reservation_start, uptr reservation_end, size_t size, size_t alignment) {
-    auto lk = std::unique_lock<std::mutex>(allocator_mtx);
-
-    if (reservation_start >= reservation_end) return nullptr;
-    if (!alignment || (alignment & (alignment - 1)) != 0) return nullptr;
-    if (size == 0) return nullptr;
-
-    SYSTEM_INFO si;
-    GetSystemInfo(&si);
-    const size_t page_size = si.dwPageSize;
-    alignment = alignment < page_size ? page_size : alignment;
-    size = (size + page_size - 1) & ~(page_size - 1);
-
-    uptr cur_addr = reservation_start;
-    // Align up
-    cur_addr = (cur_addr + alignment - 1) & ~(alignment - 1);
-
-    while (true) {
-        MEMORY_BASIC_INFORMATION mbi;
-        if (!VirtualQuery((void*)cur_addr, &mbi, sizeof(mbi)))
-            Helpers::panic("allocate: VirtualQuery failed\n");
-
-        if (mbi.State == MEM_RESERVE) {
-            uptr region_end = (uptr)mbi.BaseAddress + mbi.RegionSize;
-            if (cur_addr + size <= region_end) {
-                return (void*)cur_addr;
-            }
-
-            // Free area wasn't big enough
-        }
-        cur_addr = (uptr)mbi.BaseAddress + mbi.RegionSize;
-        // Align up
-        cur_addr = (cur_addr + alignment - 1) & ~(alignment - 1);
-
-        if (cur_addr > reservation_end) Helpers::panic("allocate: out of memory\n");
-    }
-
-
-    return nullptr;
-}
-#endif
-
 s32* PS4_FUNC kernel_error() {
     return &posix_errno;
 }
@@ -627,7 +541,7 @@ s32 PS4_FUNC kernel_nanosleep(SceKernelTimespec* rqtp, SceKernelTimespec* rmtp)
 
     const auto sec = std::chrono::seconds(rqtp->tv_sec);
     const auto nsec = std::chrono::nanoseconds(rqtp->tv_nsec);
-    std::this_thread::sleep_for(sec + nsec);
+    Timers::sleepFor(sec + nsec);
     if (rmtp) {
         rmtp->tv_sec = 0;
         rmtp->tv_nsec = 0;
@@ -636,17 +550,17 @@ s32 PS4_FUNC kernel_nanosleep(SceKernelTimespec* rqtp, SceKernelTimespec* rmtp)
 }
 
 s32 PS4_FUNC sceKernelNanosleep(const SceKernelTimespec* rqtp, SceKernelTimespec* rmtp) {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(rqtp->tv_nsec) + std::chrono::seconds(rqtp->tv_sec));
+    Timers::sleepFor(std::chrono::nanoseconds(rqtp->tv_nsec) + std::chrono::seconds(rqtp->tv_sec));
     return SCE_OK;
 }
 
 s32 PS4_FUNC sceKernelUsleep(u32 us) {
-    std::this_thread::sleep_for(std::chrono::microseconds(us));
+    Timers::sleepFor(std::chrono::microseconds(us));
     return SCE_OK;
 }
 
 s32 PS4_FUNC sceKernelSleep(u32 s) {
-    std::this_thread::sleep_for(std::chrono::seconds(s));
+    Timers::sleepFor(std::chrono::seconds(s));
     return SCE_OK;
 }
 
@@ -1120,39 +1034,37 @@ s32 PS4_FUNC ipmimgr_call(s64 cmd, s64 unk2, u32* res, u8* args, size_t arg_size
     return SCE_OK;
 }
 
-// TODO: Properly implement the virtual memory map
-
-std::unordered_map<void*, u64> virt_dmem_map;
-std::unordered_map<u64, void*> dmem_virt_map;
-std::unordered_map<u64, size_t> dmem_size_map;
-
-u64 next_dmem_addr = 0x100;
 s32 PS4_FUNC sceKernelAllocateMainDirectMemory(size_t size, size_t align, s32 mem_type, void** out_addr) {
     log("sceKernelAllocateMainDirectMemory(size=0x%016llx, align=0x%016llx, mem_type=%d, out_addr=*%p)\n", size, align, mem_type, out_addr);
-    
-    // TODO: For now we allocate memory directly in the map function
-    //       Eventually I will need to handle the physical memory map properly...
-    *out_addr = (void*)next_dmem_addr++;
-    return SCE_OK;
+    return sceKernelAllocateDirectMemory(nullptr, (void*)Memory::DIRECT_MEMORY_SIZE, size, align, mem_type, out_addr);
 }
 
 s32 PS4_FUNC sceKernelAllocateDirectMemory(void* search_start, void* search_end, size_t size, size_t align, s32 mem_type, void** out_addr) {
     log("sceKernelAllocateDirectMemory(search_start=%p, search_end=%p, size=0x%016llx, align=0x%016llx, mem_type=%d, out_addr=*%p)\n", search_start, search_end, size, align, mem_type, out_addr);
 
-    // TODO: For now we allocate memory directly in the map function
-    //       Eventually I will need to handle the physical memory map properly...
-    *out_addr = (void*)next_dmem_addr++;
+    if (!out_addr || !size || (size & (Memory::GUEST_PAGE_SIZE - 1)) || (align & (align - 1)))
+        return SCE_KERNEL_ERROR_EINVAL;
+
+    u64 offset;
+    if (!Memory::allocateDirect((u64)search_start, (u64)search_end, size, align, mem_type, offset))
+        return SCE_KERNEL_ERROR_EAGAIN;
+
+    *out_addr = (void*)offset;
+    log("Allocated direct memory at 0x%llx\n", offset);
     return SCE_OK;
 }
 
 s32 PS4_FUNC sceKernelMapDirectMemory(void** addr, size_t len, s32 prot, s32 flags, void* dmem_start, size_t align) {
     log("sceKernelMapDirectMemory(addr=*%p, len=0x%llx, prot=%d, flags=%d, dmem_start=0x%016llx, align=0x%016llx)\n", addr, len, prot, flags, dmem_start, align);
+    return sceKernelMapNamedDirectMemory(addr, len, prot, flags, dmem_start, align, "");
+}
+
+s32 PS4_FUNC sceKernelMapNamedDirectMemory(void** addr, size_t len, s32 prot, s32 flags, void* dmem_start, size_t align, const char* name) {
+    log("sceKernelMapNamedDirectMemory(addr=*%p, len=0x%llx, prot=%d, flags=%d, dmem_start=0x%016llx, align=0x%016llx, name=\"%s\")\n", addr, len, prot, flags, dmem_start, align, name);
 
     void* in_addr = *addr;
     log("in_addr=%p\n", in_addr);
 
-    align = align ? align : 16_KB;
-
     // Address is out of bounds. FIFA 14 does this, and expects it to work?
     // This game doesn't request a fixed mapping so we can just treat it as in_addr == 0
     if (in_addr > (void*)0xff'ffff'ffff) {
@@ -1161,57 +1073,23 @@ s32 PS4_FUNC sceKernelMapDirectMemory(void** addr, size_t len, s32 prot, s32 fla
         in_addr = nullptr;
     }
 
-    // TODO: prot, flags, verify align is a valid value (multiple of 16kb)
-#ifdef _WIN32
-    if (!in_addr) {
-        *addr = allocate(0x8000'0000, 0x8000'0000 + 2000_GB, len, align);
-    }
-    else if ((u64)in_addr >= 0x8000'0000)
-        *addr = allocate((u64)in_addr, 0x8000'0000 + 2000_GB, len, align);
-    else
-        // TODO
-        *addr = allocate(0x8000'0000, 0x8000'0000 + 2000_GB, len, align);
-#else
-    Helpers::panic("Unsupported platform\n");
-#endif
-
+    // TODO: Direct memory mapped more than once isn't shared between the mappings
+    const bool fixed = flags & Memory::SCE_KERNEL_MAP_FIXED;
+    *addr = Memory::map((uptr)in_addr, len, align, Memory::VmaType::Direct, prot, fixed, flags & Memory::SCE_KERNEL_MAP_NO_OVERWRITE, name, (u64)dmem_start);
     if (!*addr) {
-        Helpers::panic("sceKernelMapDirectMemory: failed to allocate\n");
-    }
-
-    if ((flags & 0x10) && *addr != in_addr) {
-        if (virt_dmem_map.contains(in_addr)) {
-            printf("dmem %p was mapped at in_addr with size %d. mapping requested size %d\n", virt_dmem_map[in_addr], dmem_size_map[virt_dmem_map[in_addr]], len);
+        if (fixed) {
+            Memory::Vma vma;
+            if (Memory::query((uptr)in_addr, false, vma))
+                printf("Memory was mapped from %p to %p with type %d\n", vma.start, vma.end, vma.type);
+            Helpers::panic("sceKernelMapDirectMemory: could not allocate at in_addr with fixed flag (requested %p)\n", in_addr);
         }
-#ifdef _WIN32
-        MEMORY_BASIC_INFORMATION mbi;
-        VirtualQuery(in_addr, &mbi, sizeof(mbi));
-
-        printf("Memory was reserved from % p to % p with state 0x%x\n", mbi.BaseAddress, (uptr)mbi.BaseAddress + mbi.RegionSize, mbi.State);
-#endif
-        Helpers::panic("sceKernelMapDirectMemory: could not allocate at in_addr with fixed flag (got addr %p, requested %p)\n", *addr, in_addr);
-        //printf("sceKernelMapDirectMemory: could not allocate at in_addr with fixed flag (got addr %p, requested %p)\n", *addr, in_addr);
-        sceKernelMunmap(*addr, len);
-        *addr = nullptr;
-        return SCE_KERNEL_ERROR_ENOMEM;
+        Helpers::panic("sceKernelMapDirectMemory: failed to allocate\n");
     }
 
-    virt_dmem_map[*addr] = (u64)dmem_start;
-    dmem_virt_map[(u64)dmem_start] = *addr;
-    dmem_size_map[(u64)dmem_start] = len;
-
-    // Clear allocated memory
-    std::memset(*addr, 0, len);
-
-    log("Allocated at %p (dmem handle=0x%llx)\n", *addr, dmem_start);
+    log("Allocated at %p (dmem offset=0x%llx)\n", *addr, dmem_start);
     return SCE_OK;
 }
 
-s32 PS4_FUNC sceKernelMapNamedDirectMemory(void** addr, size_t len, s32 prot, s32 flags, void* dmem_start, size_t align, const char* name) {
-    log("sceKernelMapNamedDirectMemory(addr=*%p, len=0x%llx, prot=%d, flags=%d, dmem_start=0x%016llx, align=0x%016llx, name=\"%s\")\n", addr, len, prot, flags, dmem_start, align, name);
-    return sceKernelMapDirectMemory(addr, len, prot, flags, dmem_start, align);
-}
-
 s32 PS4_FUNC sceKernelMapFlexibleMemory(void** addr, size_t len, s32 prot, s32 flags) {
     log("sceKernelMapFlexibleMemory(addr=*%p, len=0x%llx, prot=%d, flags=%d)\n", addr, len, prot, flags);
     return sceKernelMapNamedFlexibleMemory(addr, len, prot, flags, "unnamed");
@@ -1221,20 +1099,12 @@ s32 PS4_FUNC sceKernelMapNamedFlexibleMemory(void** addr, size_t len, s32 prot,
     log("sceKernelMapNamedFlexibleMemory(addr=*%p, len=0x%llx, prot=%d, flags=%d, name=\"%s\")\n", addr, len, prot, flags, name);
 
     void* in_addr = *addr;
-    if (in_addr) {
-        Helpers::panic("TODO: sceKernelMapNamedFlexibleMemory with non-zero input addr\n");
+    *addr = Memory::map((uptr)in_addr, len, 0, Memory::VmaType::Flexible, prot, flags & Memory::SCE_KERNEL_MAP_FIXED, flags & Memory::SCE_KERNEL_MAP_NO_OVERWRITE, name);
+    if (!*addr) {
+        log("Could not allocate (in_addr=%p)\n", in_addr);
+        return SCE_KERNEL_ERROR_ENOMEM;
     }
 
-    // TODO: prot, flags
-#ifdef _WIN32
-    *addr = allocate(0x8000'0000, 0x8000'0000 + 2000_GB, len, 16_KB);
-#else
-    Helpers::panic("Unsupported platform\n");
-#endif
-
-    // Clear allocated memory
-    std::memset(*addr, 0, len);
-
     log("Allocated at %p\n", *addr);
     return SCE_OK;
 }
@@ -1244,79 +1114,34 @@ s32 PS4_FUNC sceKernelMapNamedSystemFlexibleMemory(void** addr, size_t len, s32
     return sceKernelMapNamedFlexibleMemory(addr, len, prot, flags, name);
 }
 
-struct ReservedArea {
-    uptr start = 0;
-    size_t size = 0;
-};
-std::vector<ReservedArea> reserved_areas;
-
 s32 PS4_FUNC sceKernelReserveVirtualRange(void** addr, size_t len, s32 flags, size_t align) {
     log("sceKernelReserveVirtualRange(addr=*%p, len=0x%llx, flags=%d, align=0x%016llx)\n", addr, len, flags, align);
     log("in_addr=%p\n", *addr);
 
-    // Quick hack: if MAP_FIXED is specified and MAP_NO_OVERWRITE isn't, just reserve the input address directly
-    if ((flags & 0x10) && !(flags & 0x80)) {
-        if (!*addr) {
-            Helpers::panic("sceKernelReserveVirtualRange: MAP_FIXED was specified but *addr is null\n");
-        }
-
-        // Leave *addr unchanged
-        
-        reserved_areas.push_back({ .start = (uptr)*addr, .size = len });
-        log("out_addr=%p [skipped]\n", *addr);
-        return SCE_OK;
-    }
-
-    // Search forwards from in_addr
     void* in_addr = *addr;
-    void* original_addr = in_addr;
-    void* out_addr = nullptr;
-    while (true) {
-        // If the address we got was already reserved continue searching
-        if ((u64)in_addr >= 0x8000'0000)
-            out_addr = findNextFree((u64)in_addr, 0x8000'0000 + 2000_GB, len, align);
-        else
-            // TODO                   
-            out_addr = findNextFree(SYSTEM_MAPPING_AREA, SYSTEM_MAPPING_AREA + 2000_GB, len, align);
-    
-        bool overlap = false;
-        for (auto& area : reserved_areas) {
-            if (   Helpers::inRangeSized<uptr>((uptr)out_addr, area.start, area.size)
-                || Helpers::inRangeSized<uptr>((uptr)area.start, (uptr)out_addr, len)
-               ) {
-                overlap = true;
-                break;
-            }
-        }
-
-        if (overlap) {
-            in_addr = (void*)((uptr)out_addr + len);
-            continue;
-        }
-
-        break;
+    const bool fixed = flags & Memory::SCE_KERNEL_MAP_FIXED;
+    if (fixed && !in_addr) {
+        Helpers::panic("sceKernelReserveVirtualRange: MAP_FIXED was specified but *addr is null\n");
     }
 
-    // Check for fixed mapping and error only if the NO_OVERWRITE flag is specified
-    if ((flags & 0x10) && out_addr != original_addr) {
-        if (flags & 0x80) {     // SCE_KERNEL_MAP_NO_OVERWRITE
-#ifdef _WIN32
-            MEMORY_BASIC_INFORMATION mbi;
-            VirtualQuery(in_addr, &mbi, sizeof(mbi));
-
-            log("Could not reserve area at %p. Memory was reserved from %p to %p with state 0x%x\n", in_addr, mbi.BaseAddress, (uptr)mbi.BaseAddress + mbi.RegionSize, mbi.State);
-#endif
-            Helpers::panic("sceKernelReserveVirtualRange: could not allocate memory at fixed mapping (in_addr=%p, out_addr=%p)\n", in_addr, out_addr);
-        }
-        else {
-            // Just use the input address since we can overwrite it
-            out_addr = original_addr;
+    // TODO
+    uptr search_start = (uptr)in_addr;
+    if (!fixed && search_start < Memory::GUEST_MEMORY_START)
+        search_start = Memory::SYSTEM_MAPPING_AREA;
+
+    // Fixed reservations over existing mappings leave the mappings in place
+    void* out_addr = Memory::map(search_start, len, align, Memory::VmaType::Reserved, 0, fixed, flags & Memory::SCE_KERNEL_MAP_NO_OVERWRITE, nullptr);
+    if (!out_addr) {
+        if (fixed) {
+            Memory::Vma vma;
+            if (Memory::query((uptr)in_addr, false, vma))
+                log("Could not reserve area at %p. Memory was mapped from %p to %p with type %d\n", in_addr, vma.start, vma.end, vma.type);
+            Helpers::panic("sceKernelReserveVirtualRange: could not allocate memory at fixed mapping (in_addr=%p)\n", in_addr);
         }
+        return SCE_KERNEL_ERROR_ENOMEM;
     }
 
     *addr = out_addr;
-    reserved_areas.push_back({ .start = (uptr)out_addr, .size = len });
-
     log("out_addr=%p\n", out_addr);
     return SCE_OK;
 }
@@ -1324,49 +1149,23 @@ s32 PS4_FUNC sceKernelReserveVirtualRange(void** addr, size_t len, s32 flags, si
 s32 PS4_FUNC sceKernelReleaseDirectMemory(void* addr, size_t len) {
     log("sceKernelReleaseDirectMemory(addr=%p, len=0x%llx)\n", addr, len);
 
-    // TODO: Implement properly
-    //auto to_free = len;
-    //while (to_free) {
-    //    if (dmem_virt_map.contains((u64)addr)) {
-    //        log("releasing memory\n");
-    //        void* virt_addr = dmem_virt_map[(u64)addr];
-    //        const auto size = std::min(dmem_size_map[(u64)addr], to_free);
-    //        sceKernelMunmap(virt_addr, size);
-    //        virt_dmem_map.erase(virt_addr);
-    //        dmem_virt_map.erase((u64)addr);
-    //        dmem_size_map.erase((u64)addr);
-    //        addr = (void*)((u64)addr + 1);
-    //        to_free -= size;
-    //    }
-    //    else break;
-    //}
-    if (dmem_virt_map.contains((u64)addr)) {
-        log("releasing memory\n");
-        void* virt_addr = dmem_virt_map[(u64)addr];
-        sceKernelMunmap(virt_addr, len);
-        virt_dmem_map.erase(virt_addr);
-        dmem_virt_map.erase((u64)addr);
-    }
+    Memory::releaseDirect((u64)addr, len);
     return SCE_OK;
 }
 
 s32 PS4_FUNC sceKernelCheckedReleaseDirectMemory(void* addr, size_t len) {
     log("sceKernelCheckedReleaseDirectMemory(addr=%p, len=0x%llx)\n", addr, len);
 
-    // TODO: Check if an unallocated area is included
-    return sceKernelReleaseDirectMemory(addr, len);
+    if (!Memory::releaseDirect((u64)addr, len, true))
+        return SCE_KERNEL_ERROR_ENOENT;
+    return SCE_OK;
 }
 
 s32 PS4_FUNC sceKernelMunmap(void* addr, size_t len) {
     log("sceKernelMunmap(addr=%p, len=0x%llx)\n", addr, len);
 
-#ifdef _WIN32
-    auto lk = std::unique_lock<std::mutex>(allocator_mtx);
-    VirtualFree(addr, len, MEM_DECOMMIT);
-#else
-    Helpers::panic("Unsupported platform\n");
-#endif
-
+    if ((uptr)addr & (Memory::GUEST_PAGE_SIZE - 1)) return SCE_KERNEL_ERROR_EINVAL;
+    Memory::unmap((uptr)addr, len);
     return SCE_OK;
 }
 
@@ -1381,59 +1180,67 @@ s32 PS4_FUNC kernel_munmap(void* addr, size_t len) {
 size_t PS4_FUNC sceKernelGetDirectMemorySize() {
     log("sceKernelGetDirectMemorySize()\n");
     //return 5_GB;    // Stub for now, we need to get the flexible memory size from the SELF
-    return 5_GB - 512_MB;   // total size - flexible mem size
+    return Memory::DIRECT_MEMORY_SIZE;
 }
 
 s32 PS4_FUNC sceKernelVirtualQuery(const void* addr, s32 flags, SceKernelVirtualQueryInfo* info, size_t info_size) {
     log("sceKernelVirtualQuery(addr=%p, flags=0x%x, info=*%p, info_size=%d)\n", addr, flags, info, info_size);
 
-    // TODO: This is a very bad stub. I need to properly implement the memory map.
-#ifdef _WIN32
-    MEMORY_BASIC_INFORMATION mbi;
-    VirtualQuery(addr, &mbi, sizeof(mbi));
+    Memory::Vma vma;
+    if (!Memory::query((uptr)addr, flags & 1, vma))     // 1 = SCE_KERNEL_VQ_FIND_NEXT
+        return SCE_KERNEL_ERROR_EACCES;
+
+    const bool is_dmem = vma.type == Memory::VmaType::Direct;
+    std::memset(info, 0, sizeof(SceKernelVirtualQueryInfo));
+    info->start             = (void*)vma.start;
+    info->end               = (void*)vma.end;
+    info->offset            = is_dmem ? vma.dmem_offset : 0;
+    info->protection        = vma.prot;
+    info->is_flexible_mem   = vma.type == Memory::VmaType::Flexible;
+    info->is_direct_mem     = is_dmem;
+    info->is_stack          = 0;
+    info->is_pooled_mem     = 0;
+    info->is_committed      = vma.type != Memory::VmaType::Reserved;
+    std::memcpy(info->name, vma.name, sizeof(info->name));
+
+    Memory::DmemBlock block;
+    if (is_dmem && Memory::queryDirect(vma.dmem_offset, block))
+        info->memory_type = block.mem_type;
 
-    info->start             = mbi.BaseAddress;
-    info->end               = (void*)((uptr)mbi.BaseAddress + mbi.RegionSize);
-#else
-    Helpers::panic("Unsupported platform\n");
-#endif
+    return SCE_OK;
+}
+
+s32 PS4_FUNC sceKernelQueryMemoryProtection(void* addr, void** start, void** end, s32* prot) {
+    log("sceKernelQueryMemoryProtection(addr=%p, start=*%p, end=*%p, prot=*%p)\n", addr, start, end, prot);
     
-    if (flags & 1) {
-        printf("sceKernelVirtualQuery: unhandled flag find_next\n");
-        //return SCE_KERNEL_ERROR_EACCES;
+    Memory::Vma vma;
+    if (!Memory::query((uptr)addr, false, vma) || vma.type == Memory::VmaType::Reserved) {
+        // Memory that wasn't mapped by the guest (i.e. host allocations)
+        if (start || end) return SCE_KERNEL_ERROR_EACCES;
+        if (prot) *prot = 0x2 | 0x4 | 0x30;   // CPU RWX + GPU RW
+        return SCE_OK;
     }
 
-    bool is_dmem = false;
-    if (virt_dmem_map.contains(info->start)) {
-        is_dmem = true;
-    }
+    if (start) *start = (void*)vma.start;
+    if (end) *end = (void*)(vma.end - 1);
+    if (prot) *prot = vma.prot;
+    return SCE_OK;
+}
 
-    info->protection = 0;
-    info->is_flexible_mem = !is_dmem;
-    info->is_direct_mem = is_dmem;
-    info->is_stack = 0;
-    info->is_pooled_mem = 0;
-    info->is_committed = 1;
-    if (is_dmem) {
-        info->offset = virt_dmem_map[info->start];
-    }
-    else {
-        info->offset = 0;
-    }
-    info->name[0] = '\0';
+s32 PS4_FUNC sceKernelMprotect(const void* addr, size_t len, s32 prot) {
+    log("sceKernelMprotect(addr=%p, len=0x%llx, prot=0x%x)\n", addr, len, prot);
 
+    if (!Memory::protect((uptr)addr, len, prot))
+        return SCE_KERNEL_ERROR_EACCES;
     return SCE_OK;
 }
 
-s32 PS4_FUNC sceKernelQueryMemoryProtection(void* addr, void** start, void** end, s32* prot) {
-    log("sceKernelQueryMemoryProtection(addr=%p, start=*%p, end=*%p, prot=*%p)\n", addr, start, end, prot);
-    
-    if (start || end) {
-        Helpers::panic("TODO: sceKernelQueryMemoryProtection with start/end");
-    }
+s32 PS4_FUNC sceKernelSetVirtualRangeName(const void* addr, size_t len, const char* name) {
+    log("sceKernelSetVirtualRangeName(addr=%p, len=0x%llx, name=\"%s\")\n", addr, len, name);
 
-    // TODO: Stubbed
-    *prot = 0x2 | 0x4 | 0x30;   // CPU RWX + GPU RW
+    if (!name) return SCE_KERNEL_ERROR_EFAULT;
+    if (!Memory::setName((uptr)addr, len, name))
+        return SCE_KERNEL_ERROR_ENOENT;
     return SCE_OK;
 }
 
@@ -1447,22 +1254,14 @@ void* PS4_FUNC kernel_mmap(void* addr, size_t len, s32 prot, s32 flags, s32 fd,
         fd = -1;
 
     if (fd == -1) {
-#ifdef _WIN32
-        out_addr = allocate(0x8000'0000, 0x8000'0000 + 2000_GB, Helpers::alignUp<size_t>(len, 16_KB), 16_KB);
-#else
-        Helpers::panic("Unsupported platform\n");
-#endif
-
-        // Clear allocated memory
-        std::memset(out_addr, 0, len);
+        out_addr = Memory::map((uptr)addr, len, 0, Memory::VmaType::Flexible, prot, flags & Memory::SCE_KERNEL_MAP_FIXED, false, "anon");
+        if (!out_addr) Helpers::panic("kernel_mmap: out of memory\n");
     }
     else {
-#ifdef _WIN32
         auto& file = FS::getFileFromID(fd);
         if (len == 0) len = FS::getFileSize(fd);
-        
-        HANDLE file_handle = (HANDLE)_get_osfhandle(_fileno(file.file));
-        if (file_handle == INVALID_HANDLE_VALUE) Helpers::panic("kernel_mmap: could not retrieve native file handle for fd %d\n", fd);
+#ifdef _WIN32
+        HANDLE file_handle = (HANDLE)file.host_file;
 
         HANDLE mapping = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
         if (!mapping) Helpers::panic("kernel_mmap: CreateFileMappingW failed for fd %d\n", fd);
@@ -1470,7 +1269,9 @@ void* PS4_FUNC kernel_mmap(void* addr, size_t len, s32 prot, s32 flags, s32 fd,
         out_addr = MapViewOfFile(mapping, FILE_MAP_READ, offs >> 32, offs & 0xffffffff, len);
         if (!out_addr) Helpers::panic("kernel_mmap: MapViewOfFile failed for fd %d\n", fd);
 #else
-        Helpers::panic("Unsupported platform\n");
+        // The file's pages are mapped straight into the guest range, copy-on-write
+        out_addr = Memory::mapFile((uptr)addr, len, prot, flags & Memory::SCE_KERNEL_MAP_FIXED, file.host_file, offs, FS::getFileSize(fd), "file");
+        if (!out_addr) Helpers::panic("kernel_mmap: could not map fd %d (offs=0x%llx, len=0x%llx)\n", fd, offs, len);
 #endif
     }
 
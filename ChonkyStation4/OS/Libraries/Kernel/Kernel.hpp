@@ -229,6 +229,8 @@ s32 PS4_FUNC kernel_munmap(void* addr, size_t len);
 size_t PS4_FUNC sceKernelGetDirectMemorySize();
 s32 PS4_FUNC sceKernelVirtualQuery(const void* addr, s32 flags, SceKernelVirtualQueryInfo* info, size_t info_size);
 s32 PS4_FUNC sceKernelQueryMemoryProtection(void* addr, void** start, void** end, s32* prot);
+s32 PS4_FUNC sceKernelMprotect(const void* addr, size_t len, s32 prot);
+s32 PS4_FUNC sceKernelSetVirtualRangeName(const void* addr, size_t len, const char* name);
 void* PS4_FUNC kernel_mmap(void* addr, size_t len, s32 prot, s32 flags, s32 fd, s64 offs);
 s32 PS4_FUNC sceKernelMmap(void* addr, size_t len, s32 prot, s32 flags, s32 fd, s64 offs, void** res);
 
@@ -0,0 +1,269 @@
+#include "AudioMixer.hpp"
+#include <Configuration.hpp>
+#include <Profiler.hpp>
+#include <OS/Timers.hpp>
+#include <SDL.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+
+namespace PS4::OS::Libs::SceAudioOut {
+
+MixerPort::MixerPort(SampleFormat format, u32 n_channels, u32 len)
+    : format(format), n_channels(n_channels), len(len), frame_size(n_channels * (format == SampleFormat::F32 ? sizeof(float) : sizeof(s16))),
+      capacity(len * 2), ring((size_t)len * 2 * frame_size) {}
+
+void MixerPort::push(const void* data) {
+    const u64 write = write_pos.load(std::memory_order_relaxed);
+    u64 read = read_pos.load(std::memory_order_acquire);
+    while (write + len - read > capacity) {
+        read_pos.wait(read, std::memory_order_acquire);
+        read = read_pos.load(std::memory_order_acquire);
+    }
+
+    // The buffer can wrap around the end of the ring
+    const u32 start = write % capacity;
+    const u32 first = std::min(len, capacity - start);
+    std::memcpy(&ring[(size_t)start * frame_size], data, (size_t)first * frame_size);
+    std::memcpy(ring.data(), (const u8*)data + (size_t)first * frame_size, (size_t)(len - first) * frame_size);
+    write_pos.store(write + len, std::memory_order_release);
+}
+
+void MixerPort::drain() {
+    const u64 write = write_pos.load(std::memory_order_relaxed);
+    u64 read = read_pos.load(std::memory_order_acquire);
+    while (read != write) {
+        read_pos.wait(read, std::memory_order_acquire);
+        read = read_pos.load(std::memory_order_acquire);
+    }
+}
+
+template <typename T>
+static inline float toFloat(T sample) {
+    if constexpr (std::is_same_v<T, s16>) return sample * (1.0f / 32768.0f);
+    else return sample;
+}
+
+// The conversion loops are kept branchless and contiguous so that the compiler vectorizes them
+template <typename T, u32 N_CHANNELS>
+static void mixFrames(float* out, const T* in, u32 n_frames) {
+    static_assert(MIX_CHANNELS == 2);
+    for (u32 i = 0; i < n_frames; i++) {
+        const T* frame = &in[i * N_CHANNELS];
+        if constexpr (N_CHANNELS == 1) {
+            const float s = toFloat(frame[0]);
+            out[i * 2 + 0] += s;
+            out[i * 2 + 1] += s;
+        }
+        else if constexpr (N_CHANNELS == 2) {
+            out[i * 2 + 0] += toFloat(frame[0]);
+            out[i * 2 + 1] += toFloat(frame[1]);
+        }
+        else {
+            // 7.1 is L, R, C, LFE followed by two pairs of left/right surround channels.
+            // Downmixed with the usual -3dB for the center and surround channels, the LFE is dropped.
+            constexpr float k = 0.70710678f;
+            const float c = toFloat(frame[2]) * k;
+            out[i * 2 + 0] += toFloat(frame[0]) + c + (toFloat(frame[4]) + toFloat(frame[6])) * k;
+            out[i * 2 + 1] += toFloat(frame[1]) + c + (toFloat(frame[5]) + toFloat(frame[7])) * k;
+        }
+    }
+}
+
+template <typename T>
+static void mixFrames(float* out, const T* in, u32 n_frames, u32 n_channels) {
+    switch (n_channels) {
+    case 1: mixFrames<T, 1>(out, in, n_frames); break;
+    case 2: mixFrames<T, 2>(out, in, n_frames); break;
+    case 8: mixFrames<T, 8>(out, in, n_frames); break;
+    default: Helpers::panic("mixFrames: unsupported channel count %d\n", n_channels);
+    }
+}
+
+void MixerPort::mixInto(float* out, u32 n_frames) {
+    const u64 read = read_pos.load(std::memory_order_relaxed);
+    const u64 write = write_pos.load(std::memory_order_acquire);
+    u32 remaining = std::min<u64>(n_frames, write - read);
+    if (!remaining) return;     // Underrun, the port is silent for this period
+
+    u64 pos = read;
+    while (remaining) {
+        const u32 start = pos % capacity;
+        const u32 count = std::min(remaining, capacity - start);
+        const u8* in = &ring[(size_t)start * frame_size];
+        if (format == SampleFormat::F32)
+            mixFrames(out, (const float*)in, count, n_channels);
+        else
+            mixFrames(out, (const s16*)in, count, n_channels);
+
+        out += count * MIX_CHANNELS;
+        pos += count;
+        remaining -= count;
+    }
+
+    read_pos.store(pos, std::memory_order_release);
+    read_pos.notify_all();
+}
+
+class NullSink : public AudioSink {
+public:
+    void write(const float* frames, u32 n_frames) override {}
+};
+
+class WavSink : public AudioSink {
+public:
+    WavSink(const fs::path& path) : file(path, std::ios::binary) {
+        if (!file.is_open())
+            Helpers::panic("Failed to open %s to record audio\n", path.generic_string().c_str());
+        writeHeader();
+    }
+
+    void write(const float* frames, u32 n_frames) override {
+        file.write((const char*)frames, n_frames * MIX_CHANNELS * sizeof(float));
+        data_size += n_frames * MIX_CHANNELS * sizeof(float);
+        // The mix thread never exits, so the header is kept up to date for the file to be valid whenever the emulator is closed
+        file.seekp(0);
+        writeHeader();
+        file.seekp(0, std::ios::end);
+        file.flush();
+    }
+
+private:
+    std::ofstream file;
+    u32 data_size = 0;
+
+    void writeHeader() {
+        const auto write32 = [&](u32 val) { file.write((const char*)&val, 4); };
+        const auto write16 = [&](u16 val) { file.write((const char*)&val, 2); };
+        file.write("RIFF", 4);
+        write32(36 + data_size);
+        file.write("WAVEfmt ", 8);
+        write32(16);
+        write16(3);     // IEEE float
+        write16(MIX_CHANNELS);
+        write32(MIX_FREQ);
+        write32(MIX_FREQ * MIX_CHANNELS * sizeof(float));
+        write16(MIX_CHANNELS * sizeof(float));
+        write16(32);
+        file.write("data", 4);
+        write32(data_size);
+    }
+};
+
+class SdlSink : public AudioSink {
+public:
+    SdlSink() {
+        SDL_AudioSpec desired, obtained;
+        SDL_zero(desired);
+        desired.freq = MIX_FREQ;
+        desired.format = AUDIO_F32;
+        desired.channels = MIX_CHANNELS;
+        desired.samples = MIX_PERIOD;
+        desired.callback = NULL;
+
+        // SDL converts to the device's format if it's different
+        dev = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
+        if (!dev) {
+            Helpers::panic("Failed to open SDL audio device for playback\n");
+        }
+        SDL_PauseAudioDevice(dev, 0);
+    }
+
+    void write(const float* frames, u32 n_frames) override {
+        SDL_QueueAudio(dev, frames, n_frames * MIX_CHANNELS * sizeof(float));
+    }
+
+    u32 queuedFrames() override {
+        return SDL_GetQueuedAudioSize(dev) / (MIX_CHANNELS * sizeof(float));
+    }
+
+private:
+    SDL_AudioDeviceID dev;
+};
+
+std::unique_ptr<AudioSink> createSink() {
+    const auto& sink = Configuration::audio_sink;
+    if (sink == "sdl")  return std::make_unique<SdlSink>();
+    if (sink == "null") return std::make_unique<NullSink>();
+    return std::make_unique<WavSink>(sink);
+}
+
+// The mix thread runs until the process exits, so the objects it waits on are never destroyed
+std::mutex& ports_mtx = *new std::mutex();
+std::condition_variable& ports_cv = *new std::condition_variable();
+std::vector<std::shared_ptr<MixerPort>> ports;
+std::atomic<bool> ports_changed = false;
+bool mixer_started = false;
+
+static void mixThread() {
+    Profiler::setThreadName("[Emu] Audio mixer");
+    auto sink = createSink();
+
+    // Realtime sinks play at the host audio device's rate, which drifts from ours.
+    // When more than this is queued the mixer slows down a little.
+    constexpr u32 MAX_QUEUED_FRAMES = MIX_PERIOD * 4;
+    const auto period = std::chrono::duration_cast<Timers::Clock::duration>(std::chrono::nanoseconds(1'000'000'000ull * MIX_PERIOD / MIX_FREQ));
+
+    std::vector<std::shared_ptr<MixerPort>> mixed_ports;
+    std::vector<float> mix(MIX_PERIOD * MIX_CHANNELS);
+    auto deadline = Timers::Clock::now();
+    while (true) {
+        if (ports_changed.exchange(false, std::memory_order_acquire)) {
+            auto lk = std::unique_lock<std::mutex>(ports_mtx);
+            if (ports.empty()) {
+                // Nothing to mix, sleep until a port is opened
+                ports_cv.wait(lk, []() { return !ports.empty(); });
+                deadline = Timers::Clock::now();
+            }
+            ports_changed = false;
+            mixed_ports = ports;
+        }
+
+        {
+            Profiler::Zone zone("Audio mix");
+            std::fill(mix.begin(), mix.end(), 0.0f);
+            for (auto& port : mixed_ports)
+                port->mixInto(mix.data(), MIX_PERIOD);
+            for (auto& sample : mix)
+                sample = std::clamp(sample, -1.0f, 1.0f);
+            sink->write(mix.data(), MIX_PERIOD);
+        }
+
+        deadline += period;
+        if (sink->queuedFrames() > MAX_QUEUED_FRAMES)
+            deadline += period / 4;
+
+        // Don't try to catch up if we fell far behind (i.e. the host was suspended)
+        const auto now = Timers::Clock::now();
+        if (now - deadline > period * 4)
+            deadline = now;
+        Timers::sleepUntil(deadline);
+    }
+}
+
+std::shared_ptr<MixerPort> openPort(SampleFormat format, u32 n_channels, u32 len) {
+    auto port = std::make_shared<MixerPort>(format, n_channels, len);
+    {
+        auto lk = std::unique_lock<std::mutex>(ports_mtx);
+        ports.push_back(port);
+        ports_changed = true;
+        if (!mixer_started) {
+            std::thread(mixThread).detach();
+            mixer_started = true;
+        }
+    }
+    ports_cv.notify_one();
+    return port;
+}
+
+void closePort(const std::shared_ptr<MixerPort>& port) {
+    auto lk = std::unique_lock<std::mutex>(ports_mtx);
+    std::erase(ports, port);
+    ports_changed = true;
+}
+
+}   // End namespace PS4::OS::Libs::SceAudioOut
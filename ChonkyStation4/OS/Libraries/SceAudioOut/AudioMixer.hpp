@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Common.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+namespace PS4::OS::Libs::SceAudioOut {
+
+// Audio ports are mixed by a dedicated thread into a single stereo F32 stream, which is written to an AudioSink.
+// Each port has a lock-free single producer (the guest thread outputting to it), single consumer (the mix thread) ring of frames.
+// The mix thread runs every MIX_PERIOD frames on the timer service's clock, ports that have nothing queued are mixed as silence.
+
+static constexpr u32 MIX_FREQ = 48000;
+static constexpr u32 MIX_CHANNELS = 2;
+static constexpr u32 MIX_PERIOD = 256;  // 5.33ms
+
+enum class SampleFormat {
+    S16,
+    F32
+};
+
+class MixerPort {
+public:
+    MixerPort(SampleFormat format, u32 n_channels, u32 len);
+
+    // Copies len frames to the ring. Like on the console, one buffer can be queued while the previous one is playing,
+    // after that this blocks until the mix thread made room for it.
+    void push(const void* data);
+    // Blocks until every frame that was pushed was mixed
+    void drain();
+    // Adds up to n_frames frames to out, converted to MIX_CHANNELS F32. Only called by the mix thread.
+    void mixInto(float* out, u32 n_frames);
+
+    const SampleFormat format;
+    const u32 n_channels;
+    const u32 len;
+    const u32 frame_size;
+
+private:
+    const u32 capacity;     // In frames
+    std::vector<u8> ring;
+    // Total number of frames written and read, the ring positions are these modulo capacity
+    alignas(64) std::atomic<u64> write_pos = 0;
+    alignas(64) std::atomic<u64> read_pos = 0;
+};
+
+// Where the mixed audio goes
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+    virtual void write(const float* frames, u32 n_frames) = 0;
+    // Frames that were written but not played yet, for sinks that play in real time
+    virtual u32 queuedFrames() { return 0; }
+};
+
+// Creates the sink selected by Configuration::audio_sink: "sdl", "null" or the path to a .wav file
+std::unique_ptr<AudioSink> createSink();
+
+// Adds a port to the mix. The mix thread is started with the first port.
+std::shared_ptr<MixerPort> openPort(SampleFormat format, u32 n_channels, u32 len);
+void closePort(const std::shared_ptr<MixerPort>& port);
+
+}   // End namespace PS4::OS::Libs::SceAudioOut
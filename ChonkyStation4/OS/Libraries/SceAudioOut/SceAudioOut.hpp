@@ -3,6 +3,7 @@
 #include <Common.hpp>
 #include <OS/Libraries/SceUserService/SceUserService.hpp>   // For SceUserServiceUserId
 #include <OS/SceObj.hpp>
+#include <OS/Libraries/SceAudioOut/AudioMixer.hpp>
 
 
 class Module;
@@ -53,11 +54,12 @@ struct SceAudioOutPort : SceObj {
     u32 freq;
     u32 format;
     u32 n_channels;
-    u32 sdl_format;
+    std::shared_ptr<MixerPort> mixer_port;
 };
 
 s32 PS4_FUNC sceAudioOutInit();
 s32 PS4_FUNC sceAudioOutOpen(Libs::SceUserService::SceUserServiceUserId uid, s32 type, s32 idx, u32 len, u32 freq, u32 param);
+s32 PS4_FUNC sceAudioOutClose(s32 handle);
 s32 PS4_FUNC sceAudioOutGetPortState(s32 handle, SceAudioOutPortState* state);
 s32 PS4_FUNC sceAudioOutOutput(s32 handle, const void* ptr);
 s32 PS4_FUNC sceAudioOutOutputs(SceAudioOutOutputParam* param, u32 num);
@@ -170,21 +170,15 @@ s32 PS4_FUNC sceNetEpollWait(SceNetId eid, SceNetEpollEvent* events, s32 max_eve
     }
 
     // Wait for events
-    auto [timed_out, recv_events] = epoll->equeue.wait(true, timeout);
-    if (timed_out) {
-        return 0;
-    }
-
-    if (recv_events.size() > max_events) {
-        Helpers::panic("TODO: sceNetEpollWait recv_events.size() > max_events\n");
-    }
+    if (max_events <= 0) return 0;
+    std::vector<Kernel::SceKernelEvent> recv_events(max_events);
+    const s32 n_events = epoll->equeue.wait(recv_events.data(), max_events, true, timeout);
 
     // For each event:
     // - ident contains the socket/resolver ID
     // - data contains the event (i.e. SCE_NET_EPOLLDESCID)
     // - udata contains the user data (SceNetEpollEvent::data)
-    const auto n_events = std::min<size_t>(recv_events.size(), max_events);
-    for (int i = 0; i < recv_events.size(); i++) {
+    for (int i = 0; i < n_events; i++) {
         events[i].events    = recv_events[i].data;
         events[i].reserved  = 0;
         events[i].ident     = recv_events[i].ident;
@@ -0,0 +1,99 @@
+#include "InflateBenchmark.hpp"
+#include <OS/Libraries/SceZlib/SceZlib.hpp>
+#include <miniz.h>
+#include <chrono>
+#include <fstream>
+#include <vector>
+
+
+namespace PS4::OS::Libs::SceZlib {
+
+static constexpr size_t CHUNK_SIZE = 64_KB;
+
+struct Chunk {
+    std::vector<u8> compressed;
+    u32 size;
+};
+
+static void loadFile(const fs::path& path, std::vector<Chunk>& chunks) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<u8> data(CHUNK_SIZE);
+    while (file.read((char*)data.data(), CHUNK_SIZE) || file.gcount()) {
+        const size_t size = file.gcount();
+        mz_ulong compressed_size = mz_compressBound(size);
+        auto& chunk = chunks.emplace_back(std::vector<u8>(compressed_size), (u32)size);
+        if (mz_compress(chunk.compressed.data(), &compressed_size, data.data(), size) != MZ_OK)
+            Helpers::panic("benchmarkInflate: failed to compress %s\n", path.generic_string().c_str());
+        chunk.compressed.resize(compressed_size);
+    }
+}
+
+static std::vector<Chunk> loadChunks(const fs::path& path) {
+    std::vector<Chunk> chunks;
+    if (fs::is_directory(path)) {
+        for (const auto& entry : fs::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file())
+                loadFile(entry.path(), chunks);
+        }
+    }
+    else loadFile(path, chunks);
+    return chunks;
+}
+
+template <typename F>
+static void measure(const char* name, int iterations, F&& inflate) {
+    u64 n_bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        n_bytes += inflate();
+    const auto end = std::chrono::steady_clock::now();
+
+    const double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-16s %llu bytes in %.3f ms (%.2f MB/s)\n", name, n_bytes, secs * 1000.0, secs > 0 ? n_bytes / secs / 1_MB : 0.0);
+}
+
+void benchmarkInflate(const fs::path& path, int iterations) {
+    const auto chunks = loadChunks(path);
+    if (chunks.empty()) {
+        printf("No data found in %s\n", path.generic_string().c_str());
+        return;
+    }
+
+    size_t compressed_size = 0;
+    for (const auto& chunk : chunks)
+        compressed_size += chunk.compressed.size();
+    printf("Inflating %zu chunks (%zu kb compressed) %d times\n", chunks.size(), compressed_size / 1_KB, iterations);
+
+    std::vector<u8> out(chunks.size() * CHUNK_SIZE);
+    measure("mz_uncompress", iterations, [&]() {
+        u64 n = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            mz_ulong out_len = CHUNK_SIZE;
+            mz_uncompress(&out[i * CHUNK_SIZE], &out_len, chunks[i].compressed.data(), chunks[i].compressed.size());
+            n += out_len;
+        }
+        return n;
+    });
+
+    // Requests are all submitted before waiting for any of them, like a game streaming in a file would
+    sceZlibInitialize(nullptr, 0);
+    std::vector<u64> req_ids(chunks.size());
+    measure("sceZlib", iterations, [&]() {
+        u64 n = 0;
+        for (size_t i = 0; i < chunks.size(); i++)
+            sceZlibInflate(chunks[i].compressed.data(), chunks[i].compressed.size(), &out[i * CHUNK_SIZE], CHUNK_SIZE, &req_ids[i]);
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+            u32 out_len;
+            s32 status;
+            sceZlibWaitForDone(&req_ids[i], nullptr);
+            sceZlibGetResult(req_ids[i], &out_len, &status);
+            if (out_len != chunks[i].size)
+                Helpers::panic("benchmarkInflate: chunk %zu inflated to %d bytes instead of %d\n", i, out_len, chunks[i].size);
+            n += out_len;
+        }
+        return n;
+    });
+}
+
+}   // End namespace PS4::OS::Libs::SceZlib
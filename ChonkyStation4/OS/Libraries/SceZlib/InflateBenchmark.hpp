@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::OS::Libs::SceZlib {
+
+// Splits every file in path (a file or a folder) into 64kb chunks, compresses them, and prints how fast they are inflated
+// on a single thread with mz_uncompress and through the sceZlib inflate service.
+void benchmarkInflate(const fs::path& path, int iterations);
+
+}   // End namespace PS4::OS::Libs::SceZlib
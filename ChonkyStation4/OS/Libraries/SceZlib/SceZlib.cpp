@@ -1,11 +1,13 @@
 #include "SceZlib.hpp"
 #include <Logger.hpp>
 #include <Loaders/Module.hpp>
+#include <Profiler.hpp>
+#include <ThreadPool.hpp>
 #include <miniz.h>
 #include <mutex>
-#include <semaphore>
-#include <deque>
-#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <chrono>
 
 
 namespace PS4::OS::Libs::SceZlib {
@@ -19,22 +21,50 @@ void init(Module& module) {
     module.addSymbolExport("2eDcGHC0YaM", "sceZlibGetResult", "libSceZlib", "libSceZlib", (void*)&sceZlibGetResult);
 }
 
-std::thread inflate_thread;
-std::counting_semaphore queue_sema { 0 };
-std::mutex queue_mtx;
-
 struct InflateTask {
-    u64 req_id;
     const void* src;
     u32 src_len;
     void* dst;
     u32 dst_len;
 
     u32 out_len = 0;
-    std::atomic<bool> completed = false;
-    std::binary_semaphore sema { 0 };
+    bool completed = false;
 };
-std::deque<std::shared_ptr<InflateTask>> queue;
+
+// Requests are inflated by a pool of workers, and stay in the table until the guest calls sceZlibGetResult
+std::unique_ptr<Helpers::ThreadPool> inflate_pool;
+std::unordered_map<u64, InflateTask> requests;
+std::mutex requests_mtx;
+std::condition_variable done_cv;
+
+static void inflate(u64 req_id) {
+    InflateTask* task;
+    {
+        const std::unique_lock<std::mutex> lk(requests_mtx);
+        task = &requests.at(req_id);    // unordered_map never moves its elements, and the request can't be removed before it completes
+    }
+
+    // Inflate straight into the guest's buffer. tinfl_decompress_mem_to_mem keeps the decompressor on the stack,
+    // unlike mz_uncompress which allocates and clears a new inflate state for every request.
+    // The adler32 checksum in the zlib footer is verified like mz_uncompress does.
+    Profiler::Zone zone("Inflate");
+    const size_t out_len = tinfl_decompress_mem_to_mem(task->dst, task->dst_len, task->src, task->src_len, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32);
+    if (out_len == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED) {
+        Helpers::panic("inflate: decompression error (request %lld, src_len=%d, dst_len=%d)\n", req_id, task->src_len, task->dst_len);
+    }
+
+    // Max allowed size after decompression is 64kb
+    if (out_len > 64_KB) {
+        Helpers::panic("inflate: decompressed size is > 64 kb (%d bytes, %d kb)\n", out_len, out_len / 1_KB);
+    }
+
+    {
+        const std::unique_lock<std::mutex> lk(requests_mtx);
+        task->out_len = out_len;
+        task->completed = true;
+    }
+    done_cv.notify_all();
+}
 
 static bool initialized = false;
 s32 PS4_FUNC sceZlibInitialize(const void* buffer, size_t length) {
@@ -50,61 +80,34 @@ s32 PS4_FUNC sceZlibInitialize(const void* buffer, size_t length) {
         return SCE_ZLIB_ERROR_ALREADY_INITIALIZED;
     }
 
-    inflate_thread = std::thread([]() {
-        while (true) {
-            // Wait for a task
-            queue_sema.acquire();
-
-            std::shared_ptr<InflateTask> task;
-            {
-                const std::unique_lock<std::mutex> lk(queue_mtx);
-                
-                // Find a task that was not completed
-                auto it = std::find_if(queue.begin(), queue.end(), [](const std::shared_ptr<InflateTask>& task) {
-                    return !task->completed;
-                });
-
-                if (it == queue.end())
-                    Helpers::panic("inflate_thread: semaphore was signalled but no task was found\n");
-
-                task = *it;
-            }
-
-            // Inflate
-            unsigned long out_len = task->dst_len;
-            auto res = mz_uncompress((u8*)task->dst, &out_len, (u8*)task->src, task->src_len);
-            if (res != Z_OK) {
-                Helpers::panic("inflate_thread: uncompress error %d\n", res);
-            }
-
-            // Max allowed size after decompression is 64kb
-            if (out_len > 64_KB) {
-                Helpers::panic("inflate_thread: decompressed size is > 64 kb (%d bytes, %d kb)\n", out_len, out_len / 1_KB);
-            }
-
-            // Flag task as completed. It will be removed from the queue once the guest calls sceZlibGetResult
-            task->out_len = out_len;
-            task->completed = true;
-            task->sema.release();
-        }
-    });
-
-    inflate_thread.detach();
+    inflate_pool = std::make_unique<Helpers::ThreadPool>("Zlib inflate");
     initialized = true;
     return SCE_OK;
 }
 
-std::atomic<u64> next_req_id = 0x1;
+u64 next_req_id = 0x1;
 s32 PS4_FUNC sceZlibInflate(const void* src, u32 src_len, void* dst, u32 dst_len, u64* req_id) {
     log("sceZlibInflate(src=%p, src_len=%d, dest=%p, dest_len=%d, req_id=*%p)\n", src, src_len, dst, dst_len, req_id);
-    
-    const auto new_req_id = next_req_id++;
-    *req_id = new_req_id;
 
-    const std::unique_lock<std::mutex> lk(queue_mtx);
-    auto task = std::make_shared<InflateTask>(new_req_id, src, src_len, dst, dst_len);
-    queue.push_back(std::move(task));
-    queue_sema.release();
+    if (!initialized) {
+        log("sceZlibInflate: not initialized\n");
+        return SCE_ZLIB_ERROR_NOT_INITIALIZED;
+    }
+
+    if (!src || !src_len || !dst || !dst_len || !req_id) {
+        log("sceZlibInflate: argument error\n");
+        return SCE_ZLIB_ERROR_INVALID;
+    }
+
+    u64 new_req_id;
+    {
+        const std::unique_lock<std::mutex> lk(requests_mtx);
+        new_req_id = next_req_id++;
+        requests.emplace(new_req_id, InflateTask { src, src_len, dst, dst_len });
+    }
+
+    *req_id = new_req_id;
+    inflate_pool->submit([new_req_id]() { inflate(new_req_id); });
     return SCE_OK;
 }
 
@@ -116,53 +119,58 @@ s32 PS4_FUNC sceZlibWaitForDone(u64* req_id, u32* timeout) {
         return SCE_ZLIB_ERROR_INVALID;
     }
 
-    if (timeout)
-        printf("TODO: sceZlibWaitForDone timeout\n");
-
     log("req_id=%lld\n", *req_id);
     
-    // Find task
-    std::shared_ptr<InflateTask> task;
-    {
-        const std::unique_lock<std::mutex> lk(queue_mtx);
-
-        auto it = std::find_if(queue.begin(), queue.end(), [&](const std::shared_ptr<InflateTask>& task) {
-            return task->req_id == *req_id;
-        });
-
-        if (it == queue.end())
-            Helpers::panic("sceZlibWaitForDone: task %lld not found\n", *req_id);
-
-        task = *it;
+    std::unique_lock<std::mutex> lk(requests_mtx);
+    auto it = requests.find(*req_id);
+    if (it == requests.end()) {
+        log("sceZlibWaitForDone: request %lld not found\n", *req_id);
+        return SCE_ZLIB_ERROR_NOT_FOUND;
     }
 
-    if (!task->completed)
-        task->sema.acquire();
+    // The request is looked up again every time, it can be removed by sceZlibGetResult on another thread while we wait.
+    // A request that is gone was completed.
+    const u64 id = *req_id;
+    const auto is_done = [&]() {
+        auto it = requests.find(id);
+        return it == requests.end() || it->second.completed;
+    };
+    // The timeout is in microseconds
+    if (!timeout) {
+        done_cv.wait(lk, is_done);
+    }
+    else if (!done_cv.wait_for(lk, std::chrono::microseconds(*timeout), is_done)) {
+        log("sceZlibWaitForDone: timed out\n");
+        return SCE_ZLIB_ERROR_TIMEDOUT;
+    }
 
     return SCE_OK;
 }
 
 s32 PS4_FUNC sceZlibGetResult(u64 req_id, u32* dst_len, s32* status) {
-    log("sceZlibGetResult(req_id=*%p, dst_len=*%p, status=*%p)\n", req_id, dst_len, status);
-
-    // Find task
-    const std::unique_lock<std::mutex> lk(queue_mtx);
+    log("sceZlibGetResult(req_id=%lld, dst_len=*%p, status=*%p)\n", req_id, dst_len, status);
 
-    auto it = std::find_if(queue.begin(), queue.end(), [&](const std::shared_ptr<InflateTask>& task) {
-        return task->req_id == req_id;
-    });
+    if (!dst_len || !status) {
+        log("sceZlibGetResult: argument error\n");
+        return SCE_ZLIB_ERROR_INVALID;
+    }
 
-    if (it == queue.end())
-        Helpers::panic("sceZlibGetResult: task %lld not found\n", req_id);
+    const std::unique_lock<std::mutex> lk(requests_mtx);
+    auto it = requests.find(req_id);
+    if (it == requests.end()) {
+        log("sceZlibGetResult: request %lld not found\n", req_id);
+        return SCE_ZLIB_ERROR_NOT_FOUND;
+    }
 
-    auto task = *it;
-    if (!task->completed)
-        Helpers::panic("sceZlibGetResult: task was not complete\n");
+    if (!it->second.completed) {
+        log("sceZlibGetResult: request %lld is not done\n", req_id);
+        return SCE_ZLIB_ERROR_BUSY;
+    }
 
-    *dst_len = task->out_len;
+    *dst_len = it->second.out_len;
     *status = 0;
-    queue.erase(it);
+    requests.erase(it);
     return SCE_OK;
 }
 
-}   // End namespace PS4::OS::Libs::SceZlib
\ No newline at end of file
+}   // End namespace PS4::OS::Libs::SceZlib
@@ -9,7 +9,11 @@ namespace PS4::OS::Libs::SceZlib {
 
 void init(Module& module);
 
+static constexpr s32 SCE_ZLIB_ERROR_NOT_FOUND = 0x81120002;
+static constexpr s32 SCE_ZLIB_ERROR_BUSY = 0x8112000B;
 static constexpr s32 SCE_ZLIB_ERROR_INVALID = 0x81120016;
+static constexpr s32 SCE_ZLIB_ERROR_TIMEDOUT = 0x81120027;
+static constexpr s32 SCE_ZLIB_ERROR_NOT_INITIALIZED = 0x81120032;
 static constexpr s32 SCE_ZLIB_ERROR_ALREADY_INITIALIZED = 0x81120033;
 
 s32 PS4_FUNC sceZlibInitialize(const void* buffer, size_t length);
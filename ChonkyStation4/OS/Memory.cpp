@@ -0,0 +1,425 @@
+#include "Memory.hpp"
+#include <IntervalMap.hpp>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace PS4::OS::Memory {
+
+// The guest address space is split in areas (VMAs) and free ranges, which together cover [GUEST_MEMORY_START, GUEST_MEMORY_END).
+// Free ranges are indexed both by address, for searches starting at a given address, and by size, for searches anywhere.
+std::mutex memory_mtx;
+Helpers::IntervalMap<uptr, Vma, true> vmas;
+std::map<uptr, uptr> free_ranges;           // Start -> end
+std::multimap<size_t, uptr> free_by_size;   // Size -> start
+bool free_ranges_initialized = false;
+// Direct memory areas by the range of direct memory they map, to the start of the area. The same memory can be mapped more than once.
+Helpers::IntervalMap<u64, uptr> direct_vmas;
+
+// Allocated direct memory, by start offset
+std::mutex dmem_mtx;
+std::map<u64, DmemBlock> dmem_blocks;
+
+// Host backend
+
+static bool hostCommit(uptr addr, size_t size, bool exec) {
+#ifdef _WIN32
+    return VirtualAlloc((void*)addr, size, MEM_COMMIT, exec ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE) != nullptr;
+#else
+    const s32 prot = PROT_READ | PROT_WRITE | (exec ? PROT_EXEC : 0);
+    return mmap((void*)addr, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+#endif
+}
+
+// Gives the memory back to the host, the range stays reserved
+static void hostDecommit(uptr addr, size_t size) {
+#ifdef _WIN32
+    VirtualFree((void*)addr, size, MEM_DECOMMIT);
+#else
+    mmap((void*)addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+}
+
+bool reserveAddressSpace() {
+#ifdef _WIN32
+    return VirtualAlloc((void*)GUEST_MEMORY_START, 2048_GB, MEM_RESERVE, PAGE_NOACCESS) != nullptr;
+#else
+    void* res = mmap((void*)GUEST_MEMORY_START, 2048_GB, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    return res == (void*)GUEST_MEMORY_START;
+#endif
+}
+
+// Free range bookkeeping, memory_mtx must be held
+
+static void eraseBySize(uptr start, size_t size) {
+    auto [begin, end] = free_by_size.equal_range(size);
+    for (auto it = begin; it != end; it++) {
+        if (it->second == start) {
+            free_by_size.erase(it);
+            return;
+        }
+    }
+}
+
+static void initFreeRanges() {
+    if (free_ranges_initialized) return;
+    free_ranges[GUEST_MEMORY_START] = GUEST_MEMORY_END;
+    free_by_size.emplace(GUEST_MEMORY_END - GUEST_MEMORY_START, GUEST_MEMORY_START);
+    free_ranges_initialized = true;
+}
+
+// Marks [start, end) as free, merging it with the neighbouring free ranges
+static void addFree(uptr start, uptr end) {
+    auto next = free_ranges.lower_bound(start);
+    if (next != free_ranges.end() && next->first == end) {
+        eraseBySize(next->first, next->second - next->first);
+        end = next->second;
+        next = free_ranges.erase(next);
+    }
+    if (next != free_ranges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->second == start) {
+            eraseBySize(prev->first, prev->second - prev->first);
+            start = prev->first;
+            free_ranges.erase(prev);
+        }
+    }
+
+    free_ranges[start] = end;
+    free_by_size.emplace(end - start, start);
+}
+
+// Marks [start, end) as used. The range must be inside a single free range.
+static void takeFree(uptr start, uptr end) {
+    auto it = std::prev(free_ranges.upper_bound(start));
+    const uptr range_start = it->first;
+    const uptr range_end = it->second;
+    eraseBySize(range_start, range_end - range_start);
+    free_ranges.erase(it);
+
+    if (range_start < start) {
+        free_ranges[range_start] = start;
+        free_by_size.emplace(start - range_start, range_start);
+    }
+    if (end < range_end) {
+        free_ranges[end] = range_end;
+        free_by_size.emplace(range_end - end, end);
+    }
+}
+
+static uptr fitIn(uptr range_start, uptr range_end, uptr search_start, size_t size, size_t align) {
+    const uptr start = Helpers::alignUp<uptr>(std::max(range_start, search_start), align);
+    return start + size <= range_end && start >= range_start ? start : 0;
+}
+
+// Returns the start of a free area of size bytes, or 0 if there is none
+static uptr findFree(uptr search_start, size_t size, size_t align) {
+    if (search_start < GUEST_MEMORY_START) {
+        // Smallest free range that fits
+        for (auto it = free_by_size.lower_bound(size); it != free_by_size.end(); it++) {
+            if (const uptr start = fitIn(it->second, it->second + it->first, 0, size, align))
+                return start;
+        }
+        return 0;
+    }
+
+    // First free range at or after search_start that fits
+    auto it = free_ranges.upper_bound(search_start);
+    if (it != free_ranges.begin() && std::prev(it)->second > search_start) it--;
+    for (; it != free_ranges.end(); it++) {
+        if (const uptr start = fitIn(it->first, it->second, search_start, size, align))
+            return start;
+    }
+    return 0;
+}
+
+// VMA bookkeeping, memory_mtx must be held
+
+static void insertVma(const Vma& vma) {
+    vmas.insert(vma.start, vma.end, vma);
+    if (vma.type == VmaType::Direct)
+        direct_vmas.insert(vma.dmem_offset, vma.dmem_offset + (vma.end - vma.start), vma.start);
+}
+
+static void eraseVma(const Vma& vma) {
+    vmas.erase(vma.start, vma);
+    if (vma.type == VmaType::Direct)
+        direct_vmas.erase(vma.dmem_offset, vma.start);
+}
+
+// Splits the area containing addr in two at addr
+static void splitAt(uptr addr) {
+    Vma* vma = vmas.findContaining(addr);
+    if (!vma || vma->start == addr) return;
+
+    const Vma old = *vma;
+    Vma left = old;
+    Vma right = old;
+    left.end = addr;
+    right.start = addr;
+    if (right.type == VmaType::Direct)
+        right.dmem_offset += addr - left.start;
+
+    eraseVma(old);
+    insertVma(left);
+    insertVma(right);
+}
+
+// Calls func(Vma&) for every area inside [start, end), after splitting the areas crossing the boundaries
+template <typename F>
+static void forEachIn(uptr start, uptr end, F&& func) {
+    splitAt(start);
+    splitAt(end);
+
+    std::vector<Vma> in_range;
+    vmas.forEachOverlapping(start, end, [&](const auto& range) { in_range.push_back(range.value); });
+    for (auto& vma : in_range)
+        func(vma);
+}
+
+static void unmapLocked(uptr start, uptr end) {
+    forEachIn(start, end, [](Vma& vma) {
+        eraseVma(vma);
+        if (vma.type != VmaType::Reserved)
+            hostDecommit(vma.start, vma.end - vma.start);
+        addFree(vma.start, vma.end);
+    });
+}
+
+// commit(start, size) backs the area with host memory, it's not called for reservations
+template <typename F>
+static void* mapLocked(uptr addr, size_t size, size_t align, VmaType type, s32 prot, bool fixed, bool no_overwrite, const char* name, u64 dmem_offset, F&& commit) {
+    if (!size || (align & (align - 1))) return nullptr;
+    size = Helpers::alignUp<size_t>(size, GUEST_PAGE_SIZE);
+    align = std::max(align, GUEST_PAGE_SIZE);
+
+    uptr start;
+    if (fixed) {
+        if (addr & (GUEST_PAGE_SIZE - 1)) return nullptr;
+        if (addr < GUEST_MEMORY_START || addr + size > GUEST_MEMORY_END) return nullptr;
+
+        bool overlaps_mapping = false;
+        vmas.forEachOverlapping(addr, addr + size, [&](const auto& range) {
+            if (range.value.type != VmaType::Reserved) overlaps_mapping = true;
+        });
+
+        // Fixed reservations only take the free parts of the range, they don't replace existing mappings
+        if (type == VmaType::Reserved && overlaps_mapping) {
+            if (no_overwrite) return nullptr;
+            std::vector<std::pair<uptr, uptr>> gaps;
+            auto it = free_ranges.upper_bound(addr);
+            if (it != free_ranges.begin()) it--;
+            for (; it != free_ranges.end() && it->first < addr + size; it++) {
+                const uptr gap_start = std::max(it->first, addr);
+                const uptr gap_end = std::min(it->second, addr + size);
+                if (gap_start < gap_end) gaps.push_back({ gap_start, gap_end });
+            }
+            for (auto& [gap_start, gap_end] : gaps) {
+                takeFree(gap_start, gap_end);
+                insertVma({ .start = gap_start, .end = gap_end, .type = VmaType::Reserved });
+            }
+            return (void*)addr;
+        }
+
+        if (overlaps_mapping && no_overwrite) return nullptr;
+        unmapLocked(addr, addr + size);
+        start = addr;
+    }
+    else {
+        start = findFree(addr, size, align);
+        if (!start) return nullptr;
+    }
+
+    if (type != VmaType::Reserved && !commit(start, size))
+        return nullptr;
+    takeFree(start, start + size);
+
+    Vma vma = { .start = start, .end = start + size, .type = type, .prot = prot, .dmem_offset = dmem_offset };
+    if (name) std::strncpy(vma.name, name, sizeof(vma.name) - 1);
+    insertVma(vma);
+    return (void*)start;
+}
+
+void* map(uptr addr, size_t size, size_t align, VmaType type, s32 prot, bool fixed, bool no_overwrite, const char* name, u64 dmem_offset) {
+    auto lk = std::unique_lock<std::mutex>(memory_mtx);
+    initFreeRanges();
+
+    return mapLocked(addr, size, align, type, prot, fixed, no_overwrite, name, dmem_offset, [&](uptr start, size_t size) {
+        return hostCommit(start, size, prot & SCE_KERNEL_PROT_CPU_EXEC);
+    });
+}
+
+void* mapFile(uptr addr, size_t size, s32 prot, bool fixed, s64 host_file, u64 offset, u64 file_size, const char* name) {
+#ifdef _WIN32
+    // Views of file mappings can't be placed in the middle of the reserved guest range without placeholders
+    return nullptr;
+#else
+    const size_t host_page_size = getpagesize();
+    if (offset & (host_page_size - 1)) return nullptr;
+
+    auto lk = std::unique_lock<std::mutex>(memory_mtx);
+    initFreeRanges();
+
+    return mapLocked(addr, size, 0, VmaType::File, prot, fixed, false, name, 0, [&](uptr start, size_t size) {
+        const bool exec = prot & SCE_KERNEL_PROT_CPU_EXEC;
+        if (!hostCommit(start, size, exec)) return false;
+
+        // Pages entirely past the end of the file can't be mapped from it (touching them raises SIGBUS), they stay anonymous
+        const size_t file_bytes = offset < file_size ? std::min<u64>(size, file_size - offset) : 0;
+        const size_t file_pages_size = Helpers::alignUp<size_t>(file_bytes, host_page_size);
+        if (!file_pages_size) return true;
+
+        const s32 host_prot = PROT_READ | PROT_WRITE | (exec ? PROT_EXEC : 0);
+        if (mmap((void*)start, file_pages_size, host_prot, MAP_PRIVATE | MAP_FIXED, host_file, offset) == MAP_FAILED) {
+            hostDecommit(start, size);
+            return false;
+        }
+        return true;
+    });
+#endif
+}
+
+void unmap(uptr addr, size_t size) {
+    auto lk = std::unique_lock<std::mutex>(memory_mtx);
+    initFreeRanges();
+
+    const uptr start = Helpers::alignDown<uptr>(std::max(addr, GUEST_MEMORY_START), GUEST_PAGE_SIZE);
+    const uptr end = Helpers::alignUp<uptr>(std::min(addr + size, GUEST_MEMORY_END), GUEST_PAGE_SIZE);
+    if (start < end)
+        unmapLocked(start, end);
+}
+
+// Guest protection is only tracked, host pages stay read/write so that the emulator can access them
+bool protect(uptr addr, size_t size, s32 prot) {
+    auto lk = std::unique_lock<std::mutex>(memory_mtx);
+    const uptr start = Helpers::alignDown<uptr>(addr, GUEST_PAGE_SIZE);
+    const uptr end = Helpers::alignUp<uptr>(addr + size, GUEST_PAGE_SIZE);
+
+    bool found = false;
+    forEachIn(start, end, [&](Vma& vma) {
+        if (vma.type == VmaType::Reserved) return;
+        eraseVma(vma);
+        vma.prot = prot;
+        insertVma(vma);
+        found = true;
+    });
+    return found;
+}
+
+bool setName(uptr addr, size_t size, const char* name) {
+    auto lk = std::unique_lock<std::mutex>(memory_mtx);
+    const uptr start = Helpers::alignDown<uptr>(addr, GUEST_PAGE_SIZE);
+    const uptr end = Helpers::alignUp<uptr>(addr + size, GUEST_PAGE_SIZE);
+
+    bool found = false;
+    forEachIn(start, end, [&](Vma& vma) {
+        eraseVma(vma);
+        std::memset(vma.name, 0, sizeof(vma.name));
+        std::strncpy(vma.name, name, sizeof(vma.name) - 1);
+        insertVma(vma);
+        found = true;
+    });
+    return found;
+}
+
+bool query(uptr addr, bool find_next, Vma& out) {
+    auto lk = std::unique_lock<std::mutex>(memory_mtx);
+
+    bool found = false;
+    vmas.forEachOverlapping(addr, find_next ? GUEST_MEMORY_END : addr + 1, [&](const auto& range) {
+        out = range.value;
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+bool allocateDirect(u64 search_start, u64 search_end, size_t size, size_t align, s32 mem_type, u64& out) {
+    auto lk = std::unique_lock<std::mutex>(dmem_mtx);
+
+    if (!size || (align & (align - 1))) return false;
+    size = Helpers::alignUp<size_t>(size, GUEST_PAGE_SIZE);
+    align = std::max(align, GUEST_PAGE_SIZE);
+    search_end = std::min<u64>(search_end, DIRECT_MEMORY_SIZE);
+
+    // First fit, direct memory is usually allocated in a few big blocks
+    u64 start = Helpers::alignUp<u64>(search_start, align);
+    auto it = dmem_blocks.upper_bound(start);
+    if (it != dmem_blocks.begin() && std::prev(it)->second.end > start)
+        start = Helpers::alignUp<u64>(std::prev(it)->second.end, align);
+
+    for (; it != dmem_blocks.end() && it->second.start < start + size; it++)
+        start = std::max(start, Helpers::alignUp<u64>(it->second.end, align));
+
+    if (start + size > search_end) return false;
+    dmem_blocks[start] = { .start = start, .end = start + size, .mem_type = mem_type };
+    out = start;
+    return true;
+}
+
+// dmem_mtx must be held
+static bool isDirectAllocated(u64 start, u64 end) {
+    auto it = dmem_blocks.upper_bound(start);
+    if (it == dmem_blocks.begin()) return false;
+    it--;
+    // Adjacent blocks are allowed, the range only has to be covered without holes
+    u64 covered = start;
+    for (; it != dmem_blocks.end() && it->second.start <= covered && covered < end; it++)
+        covered = std::max(covered, it->second.end);
+    return covered >= end;
+}
+
+bool releaseDirect(u64 start, size_t size, bool checked) {
+    const u64 end = start + size;
+
+    // dmem_mtx is held while unmapping so that a checked release can't race with another release of the same range
+    auto dmem_lk = std::unique_lock<std::mutex>(dmem_mtx);
+    if (checked && !isDirectAllocated(start, end)) return false;
+
+    // Unmap the areas mapping this range
+    {
+        auto lk = std::unique_lock<std::mutex>(memory_mtx);
+        std::vector<std::pair<uptr, uptr>> to_unmap;
+        direct_vmas.forEachOverlapping(start, end, [&](const auto& range) {
+            const u64 overlap_start = std::max<u64>(range.start, start);
+            const u64 overlap_end = std::min<u64>(range.end, end);
+            to_unmap.push_back({ range.value + (overlap_start - range.start), range.value + (overlap_end - range.start) });
+        });
+        for (auto& [unmap_start, unmap_end] : to_unmap)
+            unmapLocked(unmap_start, unmap_end);
+    }
+
+    u64 released = 0;
+    auto it = dmem_blocks.upper_bound(start);
+    if (it != dmem_blocks.begin() && std::prev(it)->second.end > start) it--;
+    while (it != dmem_blocks.end() && it->second.start < end) {
+        const DmemBlock block = it->second;
+        it = dmem_blocks.erase(it);
+        if (block.start < start)
+            dmem_blocks[block.start] = { block.start, start, block.mem_type };
+        if (block.end > end)
+            dmem_blocks[end] = { end, block.end, block.mem_type };
+        released += std::min(block.end, end) - std::max(block.start, start);
+    }
+    return released == size;
+}
+
+bool queryDirect(u64 offset, DmemBlock& out) {
+    auto lk = std::unique_lock<std::mutex>(dmem_mtx);
+    auto it = dmem_blocks.upper_bound(offset);
+    if (it == dmem_blocks.begin()) return false;
+    it--;
+    if (it->second.end <= offset) return false;
+    out = it->second;
+    return true;
+}
+
+}   // End namespace PS4::OS::Memory
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::OS::Memory {
+
+// Guest memory is identity mapped: guest addresses are host addresses inside this range, which is reserved at startup.
+static constexpr uptr GUEST_MEMORY_START    = 0x8000'0000;
+static constexpr uptr GUEST_MEMORY_END      = GUEST_MEMORY_START + 2000_GB;
+static constexpr uptr SYSTEM_MAPPING_AREA   = 0x0010'0000'0000;     // Where non-fixed reservations below GUEST_MEMORY_START are placed
+static constexpr size_t GUEST_PAGE_SIZE     = 16_KB;
+
+static constexpr size_t DIRECT_MEMORY_SIZE  = 5_GB - 512_MB;        // Total size - flexible memory size
+
+static constexpr s32 SCE_KERNEL_PROT_CPU_READ   = 0x01;
+static constexpr s32 SCE_KERNEL_PROT_CPU_WRITE  = 0x02;
+static constexpr s32 SCE_KERNEL_PROT_CPU_EXEC   = 0x04;
+static constexpr s32 SCE_KERNEL_PROT_GPU_READ   = 0x10;
+static constexpr s32 SCE_KERNEL_PROT_GPU_WRITE  = 0x20;
+
+static constexpr s32 SCE_KERNEL_MAP_FIXED           = 0x10;
+static constexpr s32 SCE_KERNEL_MAP_NO_OVERWRITE    = 0x80;
+
+enum class VmaType {
+    Reserved,   // Address space only, nothing is committed
+    Direct,
+    Flexible,
+    Code,
+    File        // Copy-on-write mapping of a host file
+};
+
+// A mapped or reserved area of the guest address space
+struct Vma {
+    uptr start = 0;
+    uptr end = 0;
+    VmaType type = VmaType::Reserved;
+    s32 prot = 0;
+    u64 dmem_offset = 0;    // For direct memory, the offset of start in direct memory
+    char name[32] = {};
+
+    bool operator==(const Vma& other) const {
+        return start == other.start && end == other.end && type == other.type;
+    }
+};
+
+// Reserves the guest address range on the host. Called as early as possible, before the host allocates anything there.
+bool reserveAddressSpace();
+
+// Maps size bytes of memory of the given type. Committed memory reads as zero.
+// If fixed is true the area is mapped exactly at addr, replacing whatever was mapped there unless no_overwrite is true.
+// Otherwise the first free area at or after addr is used, or any free area if addr is below GUEST_MEMORY_START.
+// Returns nullptr if there was no space.
+void* map(uptr addr, size_t size, size_t align, VmaType type, s32 prot, bool fixed, bool no_overwrite, const char* name, u64 dmem_offset = 0);
+// Maps size bytes of a host file (a file descriptor) starting at offset, copy-on-write: the guest can write to the pages but the file isn't modified.
+// The part of the area past file_size reads as zero. offset must be aligned to the host page size.
+// Returns nullptr on failure, or if the host can't place file mappings inside the guest range (Windows).
+void* mapFile(uptr addr, size_t size, s32 prot, bool fixed, s64 host_file, u64 offset, u64 file_size, const char* name);
+void unmap(uptr addr, size_t size);
+bool protect(uptr addr, size_t size, s32 prot);
+bool setName(uptr addr, size_t size, const char* name);
+// Returns the area containing addr. If find_next is true and no area contains addr, returns the next area after it instead.
+bool query(uptr addr, bool find_next, Vma& out);
+
+// Direct (physical) memory. Allocations return offsets in direct memory, which are then mapped with map().
+struct DmemBlock {
+    u64 start;
+    u64 end;
+    s32 mem_type;
+};
+
+// Returns false if there's no free range of size bytes in [search_start, search_end)
+bool allocateDirect(u64 search_start, u64 search_end, size_t size, size_t align, s32 mem_type, u64& out);
+// Frees a range of direct memory and unmaps it. Returns false if part of the range wasn't allocated.
+// If checked is true nothing is released unless the whole range is allocated.
+bool releaseDirect(u64 start, size_t size, bool checked = false);
+bool queryDirect(u64 offset, DmemBlock& out);
+
+}   // End namespace PS4::OS::Memory
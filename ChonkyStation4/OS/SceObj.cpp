@@ -4,22 +4,73 @@
 
 namespace PS4::OS {
 
-std::mutex mtx;
-std::atomic<u64> next_handle16   = 0x100;
-std::atomic<u64> next_handle     = UINT16_MAX + 1;
+std::atomic<u64> next_handle = UINT16_MAX + 1;
 
 SceObj::SceObj(bool handle16bit) {
-    const std::lock_guard<std::mutex> lock(mtx);
+    handle = handle_table.allocate(handle16bit);
+}
+
+u64 HandleTable::allocate(bool handle16bit) {
+    auto lk = std::unique_lock<std::mutex>(mtx);
 
-    if (!handle16bit)
-        handle = next_handle++;
-    else {
-        handle = next_handle16++;
+    if (handle16bit) {
+        const u64 handle = next_handle16++;
         if (handle > UINT16_MAX)
             Helpers::panic("SceObj: ran out of 16bit handles");
+        slots16.getOrCreate(handle);
+        return handle;
+    }
+
+    u32 idx;
+    if (next_index < N_SLOTS)
+        idx = next_index++;
+    else if (!free_indices.empty()) {
+        idx = free_indices.front();
+        free_indices.pop_front();
+    }
+    else Helpers::panic("SceObj: ran out of handles");
+
+    // Generation 0 is skipped, so that a handle is never equal to HANDLE_BASE + index
+    if (gens[idx] == 0) gens[idx] = 1;
+    slots32.getOrCreate(idx);
+    return HANDLE_BASE | ((u64)gens[idx] << INDEX_BITS) | idx;
+}
+
+void HandleTable::publish(SceObj* obj) {
+    slots(obj->handle <= UINT16_MAX).get(obj->handle & (N_SLOTS - 1))->store(obj, std::memory_order_release);
+}
+
+bool HandleTable::erase(u64 handle) {
+    auto lk = std::unique_lock<std::mutex>(mtx);
+    return eraseLocked(handle);
+}
+
+bool HandleTable::eraseLocked(u64 handle) {
+    auto* slot = slots(handle <= UINT16_MAX).get(handle & (N_SLOTS - 1));
+    SceObj* obj = slot ? slot->load(std::memory_order_relaxed) : nullptr;
+    if (!obj || obj->handle != handle) return false;
+
+    slot->store(nullptr, std::memory_order_release);
+    if (handle > UINT16_MAX) {
+        const u32 idx = handle & (N_SLOTS - 1);
+        gens[idx] = (gens[idx] + 1) & ((1 << GEN_BITS) - 1);
+        free_indices.push_back(idx);
     }
+    return true;
+}
+
+bool HandleTable::moveToReserved(SceObj* obj, u64 handle) {
+    if (handle == 0 || handle >= FIRST_HANDLE16) return false;
+
+    auto lk = std::unique_lock<std::mutex>(mtx);
+    auto* slot = slots16.getOrCreate(handle);
+    if (slot->load(std::memory_order_relaxed)) return false;
+    if (!eraseLocked(obj->handle)) return false;
 
-    objs.push_back(this);
+    // Lookups of the old handle fail from now on, the object's handle must be updated before it is published in the new slot
+    obj->handle = handle;
+    slot->store(obj, std::memory_order_release);
+    return true;
 }
 
 // Manually request an handle
@@ -27,4 +78,4 @@ u64 requestHandle() {
     return next_handle++;
 }
 
-}   // End namespace PS4::OS
\ No newline at end of file
+}   // End namespace PS4::OS
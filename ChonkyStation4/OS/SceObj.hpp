@@ -2,6 +2,10 @@
 
 #include <Common.hpp>
 #include <mutex>
+#include <atomic>
+#include <array>
+#include <deque>
+#include <typeinfo>
 
 
 namespace PS4::OS {
@@ -11,39 +15,100 @@ inline bool initialized = false;
 struct SceObj {
     SceObj(bool handle16bit);
     u64 handle = 0;
+    const std::type_info* type = nullptr;   // Set by make()
 };
 
-inline std::vector<SceObj*> objs;
-inline std::mutex obj_mtx;
+// Kernel object handle table.
+// A handle maps directly to a slot, so lookups are O(1) and don't take any lock.
+// Regular handles also carry a generation which is bumped every time a slot is freed: a stale handle whose slot was reused
+// doesn't match the handle of the new object in the slot, and fails to resolve.
+// 16bit handles don't have room for a generation, so they are never reused.
+// Objects are never freed, a pointer read from a slot stays valid even if it races with erase().
+class HandleTable {
+public:
+    static constexpr u64 HANDLE_BASE    = 0x40000000;   // Keeps handles positive as s32, and out of the range of requestHandle()
+    static constexpr u32 INDEX_BITS     = 16;
+    static constexpr u32 GEN_BITS       = 14;
+    static constexpr u32 N_SLOTS        = 1 << INDEX_BITS;
+    static constexpr u64 FIRST_HANDLE16 = 0x100;
+
+    u64 allocate(bool handle16bit);
+    void publish(SceObj* obj);
+    bool erase(u64 handle);
+    // Frees the object's handle and installs it at a fixed handle below FIRST_HANDLE16, which are never allocated.
+    // For objects the guest expects at a hardcoded handle. Returns false if the handle is out of range or already taken.
+    bool moveToReserved(SceObj* obj, u64 handle);
+
+    SceObj* find(u64 handle) {
+        auto* slot = slots(handle <= UINT16_MAX).get(handle & (N_SLOTS - 1));
+        if (!slot) return nullptr;
+
+        SceObj* obj = slot->load(std::memory_order_acquire);
+        if (!obj || obj->handle != handle) return nullptr;
+        return obj;
+    }
+
+private:
+    // Slots are allocated in chunks as they are needed, and chunks are never freed
+    class Slots {
+    public:
+        static constexpr u32 CHUNK_SIZE = 1024;
+
+        std::atomic<SceObj*>* get(u32 idx) {
+            auto* chunk = chunks[idx / CHUNK_SIZE].load(std::memory_order_acquire);
+            return chunk ? &chunk[idx % CHUNK_SIZE] : nullptr;
+        }
+
+        // Must be called with the table lock held
+        std::atomic<SceObj*>* getOrCreate(u32 idx) {
+            auto& chunk = chunks[idx / CHUNK_SIZE];
+            if (!chunk.load(std::memory_order_relaxed))
+                chunk.store(new std::atomic<SceObj*>[CHUNK_SIZE](), std::memory_order_release);
+            return get(idx);
+        }
+
+    private:
+        std::array<std::atomic<std::atomic<SceObj*>*>, N_SLOTS / CHUNK_SIZE> chunks = {};
+    };
+
+    bool eraseLocked(u64 handle);
+    Slots& slots(bool handle16bit) { return handle16bit ? slots16 : slots32; }
+
+    Slots slots32;
+    Slots slots16;  // Indexed directly by the handle
+
+    std::mutex mtx;     // Only taken to allocate and free handles
+    std::array<u16, N_SLOTS> gens = {};
+    std::deque<u32> free_indices;   // FIFO, so that freed slots take as long as possible to be reused
+    u32 next_index = 0;
+    u64 next_handle16 = FIRST_HANDLE16;
+};
+
+inline HandleTable handle_table;
 
 template<typename T> requires std::is_base_of_v<SceObj, T>
 T* make(bool handle16bit = false) {
-    auto lk = std::unique_lock<std::mutex>(obj_mtx);
-    auto* obj = (T*)objs.emplace_back(new T(handle16bit));
+    auto* obj = new T(handle16bit);
+    obj->type = &typeid(T);
+    handle_table.publish(obj);
     return obj;
 }
 
 inline bool erase(u64 handle) {
-    auto lk = std::unique_lock<std::mutex>(obj_mtx);
-    for (auto it = objs.begin(); it != objs.end(); it++) {
-        if ((*it)->handle == handle) {
-            objs.erase(it);
-            return true;
-        }
-    }
-    return false;
+    return handle_table.erase(handle);
+}
+
+inline bool moveToReservedHandle(SceObj* obj, u64 handle) {
+    return handle_table.moveToReserved(obj, handle);
 }
 
 template<typename T> requires std::is_base_of_v<SceObj, T>
 T* find(u64 handle) {
-    auto lk = std::unique_lock<std::mutex>(obj_mtx);
-    for (auto& obj : objs) {
-        if (obj->handle == handle)
-            return (T*)obj;
-    }
-    return nullptr;
+    SceObj* obj = handle_table.find(handle);
+    if (!obj || *obj->type != typeid(T)) return nullptr;
+    return (T*)obj;
 }
 
 u64 requestHandle();
 
-}   // End namespace PS4::OS
\ No newline at end of file
+}   // End namespace PS4::OS
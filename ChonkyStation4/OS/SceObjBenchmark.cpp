@@ -0,0 +1,103 @@
+#include "SceObjBenchmark.hpp"
+#include <OS/SceObj.hpp>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+namespace PS4::OS {
+
+struct BenchObj : SceObj {
+    BenchObj(bool handle16bit) : SceObj(handle16bit) {}
+};
+
+template <typename F>
+static void measure(const char* name, u64 n_ops, F&& func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const auto end = std::chrono::steady_clock::now();
+
+    const double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-16s %llu ops in %.3f ms (%.2f ns/op, %.2f M ops/s)\n", name, n_ops, secs * 1000.0, n_ops ? secs * 1e9 / n_ops : 0.0, secs > 0 ? n_ops / secs / 1e6 : 0.0);
+}
+
+void benchmarkHandles(int n_objects, int iterations, int n_threads) {
+    // Handles are 16 bit indices, leave some room for the ones the emulator itself allocated
+    if (n_objects <= 0 || n_objects > (int)HandleTable::N_SLOTS / 2 || iterations <= 0) {
+        printf("The object count must be between 1 and %d\n", HandleTable::N_SLOTS / 2);
+        return;
+    }
+    n_threads = std::max(n_threads, 1);
+    printf("Allocating, finding and freeing %d handles %d times, lookups on %d threads\n", n_objects, iterations, n_threads);
+
+    // Objects are never freed by the handle table, so the same objects are reused for every iteration
+    std::vector<BenchObj*> objs;
+    objs.reserve(n_objects);
+    for (int i = 0; i < n_objects; i++)
+        objs.push_back(make<BenchObj>());
+    for (auto* obj : objs)
+        erase(obj->handle);
+
+    // Lookups are much cheaper than allocations, every handle is looked up several times per iteration for the timing to be meaningful
+    constexpr int FIND_REPS = 16;
+    std::vector<u64> handles(n_objects);
+    const u64 n_ops = (u64)n_objects * FIND_REPS;
+    u64 n_found = 0;
+    for (int it = 0; it < iterations; it++) {
+        // allocate + publish is what make() does, minus the object allocation
+        measure(it == 0 ? "alloc" : "alloc (reused)", n_objects, [&]() {
+            for (int i = 0; i < n_objects; i++) {
+                objs[i]->handle = handle_table.allocate(false);
+                handle_table.publish(objs[i]);
+                handles[i] = objs[i]->handle;
+            }
+        });
+
+        measure("find", n_ops, [&]() {
+            for (int rep = 0; rep < FIND_REPS; rep++)
+                for (int i = 0; i < n_objects; i++)
+                    n_found += find<BenchObj>(handles[i]) != nullptr;
+        });
+
+        if (n_threads > 1) {
+            std::atomic<u64> n_found_mt = 0;
+            measure("find (threads)", n_ops * n_threads, [&]() {
+                std::vector<std::thread> threads;
+                for (int t = 0; t < n_threads; t++) {
+                    threads.emplace_back([&]() {
+                        u64 n = 0;
+                        for (int rep = 0; rep < FIND_REPS; rep++)
+                            for (int i = 0; i < n_objects; i++)
+                                n += find<BenchObj>(handles[i]) != nullptr;
+                        n_found_mt += n;
+                    });
+                }
+                for (auto& thread : threads)
+                    thread.join();
+            });
+            n_found += n_found_mt / n_threads;
+        }
+
+        measure("free", n_objects, [&]() {
+            for (int i = 0; i < n_objects; i++)
+                erase(handles[i]);
+        });
+    }
+
+    // Every freed handle is stale, none of them may resolve to the objects that now reuse their slots
+    u64 n_stale = 0;
+    for (auto* obj : objs) {
+        obj->handle = handle_table.allocate(false);
+        handle_table.publish(obj);
+    }
+    for (int i = 0; i < n_objects; i++)
+        n_stale += find<BenchObj>(handles[i]) != nullptr;
+    for (auto* obj : objs)
+        erase(obj->handle);
+
+    const u64 n_expected = n_ops * iterations * (n_threads > 1 ? 2 : 1);
+    printf("%llu/%llu lookups resolved, %llu stale handles resolved\n", n_found, n_expected, n_stale);
+}
+
+}   // End namespace PS4::OS
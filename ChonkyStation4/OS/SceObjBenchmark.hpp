@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::OS {
+
+// Allocates n_objects handles, looks each of them up and frees them again, iterations times, and prints the cost of each step.
+// The lookups are also run from n_threads threads at once, since find() is meant to scale without taking a lock.
+void benchmarkHandles(int n_objects, int iterations, int n_threads);
+
+}   // End namespace PS4::OS
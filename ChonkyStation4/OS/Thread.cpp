@@ -1,5 +1,6 @@
 #include "Thread.hpp"
 #include <Loaders/App.hpp>
+#include <Profiler.hpp>
 #ifdef _WIN32
 #define NOMINMAX
 #include <codecvt>
@@ -88,6 +89,7 @@ void* threadStart(Thread* thread) {
     const std::string name = "[PS4] " + thread->name;
     SetThreadDescription(GetCurrentThread(), (PCWSTR)converter.from_bytes(name.c_str()).c_str());
 #endif
+    Profiler::setThreadName("[PS4] " + thread->name);
 
 #ifdef _WIN32
     // Get thread stack
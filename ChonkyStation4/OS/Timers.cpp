@@ -0,0 +1,322 @@
+#include "Timers.hpp"
+#include <Profiler.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <bit>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+
+namespace PS4::OS::Timers {
+
+// The wheel has LEVELS levels of SLOTS slots. A slot of level n spans SLOTS^n ticks, and a level spans SLOTS times its slot size.
+// Timers go in the lowest level whose span covers their expiry. When time reaches the start of a slot of level n > 0,
+// the timers in it are moved (cascaded) to the lower levels. Timers in level 0 expire when time reaches their slot.
+// Time only advances to the next tick with something to do, so an idle wheel doesn't wake the timer thread.
+static constexpr u32 TICK_SHIFT = 13;   // 1 tick = 8.192us
+static constexpr u32 SLOT_BITS = 8;
+static constexpr u32 SLOTS = 1 << SLOT_BITS;
+static constexpr u32 LEVELS = 4;        // 2^32 ticks, ~9.7 hours. Later timers are cascaded until they fit.
+static constexpr s8 EXPIRED_LIST = LEVELS;
+static constexpr u64 NO_TICK = ~0ull;
+
+struct TimerList {
+    Timer* head = nullptr;
+    Timer* tail = nullptr;
+
+    void push(Timer* timer) {
+        timer->prev = tail;
+        timer->next = nullptr;
+        if (tail) tail->next = timer;
+        else head = timer;
+        tail = timer;
+    }
+
+    void remove(Timer* timer) {
+        if (timer->prev) timer->prev->next = timer->next;
+        else head = timer->next;
+        if (timer->next) timer->next->prev = timer->prev;
+        else tail = timer->prev;
+        timer->prev = nullptr;
+        timer->next = nullptr;
+    }
+};
+
+struct Level {
+    TimerList slots[SLOTS];
+    u64 occupied[SLOTS / 64] = {};
+};
+
+// The timer thread runs until the process exits, so the objects it waits on are never destroyed
+std::mutex& timers_mtx = *new std::mutex();
+Level levels[LEVELS];
+TimerList expired;                  // Timers waiting for their callback to be called
+u64 current_tick = 0;               // Next tick to process
+const Clock::time_point epoch = Clock::now();
+bool thread_started = false;
+
+// Tick the timer thread sleeps until. 0 while it's awake, NO_TICK when there are no timers.
+u64 wake_tick = 0;
+
+// The timer whose callback is running, cancel() waits for it
+Timer* running = nullptr;
+std::condition_variable& running_cv = *new std::condition_variable();
+
+#ifdef _WIN32
+HANDLE wait_timer;
+HANDLE wake_event;
+#else
+std::condition_variable& wake_cv = *new std::condition_variable();
+#endif
+
+static u64 nowTick() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count() >> TICK_SHIFT;
+}
+
+// Rounded up, so that timers never fire early
+static u64 deadlineTick(Clock::time_point deadline) {
+    if (deadline <= epoch) return 0;
+    const u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - epoch).count();
+    return (ns + (1ull << TICK_SHIFT) - 1) >> TICK_SHIFT;
+}
+
+static Clock::time_point tickTime(u64 tick) {
+    return epoch + std::chrono::nanoseconds(tick << TICK_SHIFT);
+}
+
+// Distance from start to the first occupied slot of the level, going around the wheel. -1 if the level is empty.
+static s32 nextOccupied(const Level& level, u32 start) {
+    constexpr u32 WORDS = SLOTS / 64;
+    for (u32 i = 0; i <= WORDS; i++) {
+        const u32 word = ((start >> 6) + i) % WORDS;
+        u64 bits = level.occupied[word];
+        if (i == 0)     bits &= ~0ull << (start & 63);
+        if (i == WORDS) bits &= (1ull << (start & 63)) - 1;    // Back at the first word, only the slots before start are left
+        if (bits) {
+            const u32 slot = word * 64 + std::countr_zero(bits);
+            return (slot - start) & (SLOTS - 1);
+        }
+    }
+    return -1;
+}
+
+// The next tick at which a timer expires or a slot has to be cascaded
+static u64 nextEventTick() {
+    u64 next = NO_TICK;
+    if (const s32 dist = nextOccupied(levels[0], current_tick & (SLOTS - 1)); dist >= 0)
+        next = current_tick + dist;
+
+    for (u32 l = 1; l < LEVELS; l++) {
+        // First slot starting at or after current_tick
+        const u32 shift = SLOT_BITS * l;
+        const u64 first_slot = (current_tick + (1ull << shift) - 1) >> shift;
+        if (const s32 dist = nextOccupied(levels[l], first_slot & (SLOTS - 1)); dist >= 0)
+            next = std::min(next, (first_slot + dist) << shift);
+    }
+    return next;
+}
+
+static void insert(Timer* timer) {
+    if (timer->expiry_tick < current_tick) {
+        timer->list = EXPIRED_LIST;
+        expired.push(timer);
+        return;
+    }
+
+    // Timers too far in the future are put in the last slot of the wheel and cascaded again from there
+    constexpr u64 MAX_DELTA = (1ull << (SLOT_BITS * LEVELS)) - 1;
+    const u64 tick = std::min(timer->expiry_tick, current_tick + MAX_DELTA);
+    const u64 delta = tick - current_tick;
+
+    u32 l = 0;
+    while (l < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (l + 1))))
+        l++;
+
+    const u32 slot = (tick >> (SLOT_BITS * l)) & (SLOTS - 1);
+    timer->list = l;
+    timer->slot = slot;
+    levels[l].slots[slot].push(timer);
+    levels[l].occupied[slot / 64] |= 1ull << (slot % 64);
+}
+
+static void remove(Timer* timer) {
+    if (timer->list == EXPIRED_LIST) {
+        expired.remove(timer);
+    }
+    else {
+        auto& level = levels[timer->list];
+        auto& list = level.slots[timer->slot];
+        list.remove(timer);
+        if (!list.head) level.occupied[timer->slot / 64] &= ~(1ull << (timer->slot % 64));
+    }
+    timer->list = -1;
+}
+
+// Moves every timer of a slot to the list, or reinserts them in the wheel if list is nullptr
+static void drainSlot(u32 l, u32 slot, TimerList* list) {
+    auto& level = levels[l];
+    Timer* timer = level.slots[slot].head;
+    level.slots[slot] = {};
+    level.occupied[slot / 64] &= ~(1ull << (slot % 64));
+
+    while (timer) {
+        Timer* next = timer->next;
+        if (list) {
+            timer->list = EXPIRED_LIST;
+            list->push(timer);
+        }
+        else insert(timer);
+        timer = next;
+    }
+}
+
+// Processes every tick up to now, moving expired timers to the expired list
+static void advance(u64 now) {
+    while (true) {
+        const u64 tick = nextEventTick();
+        if (tick > now) break;
+
+        current_tick = tick;
+        for (u32 l = LEVELS - 1; l >= 1; l--) {
+            const u32 shift = SLOT_BITS * l;
+            if (tick & ((1ull << shift) - 1)) continue;
+            drainSlot(l, (tick >> shift) & (SLOTS - 1), nullptr);
+        }
+        drainSlot(0, tick & (SLOTS - 1), &expired);
+        current_tick = tick + 1;
+    }
+    // Nothing happens until after now, skip ahead
+    current_tick = std::max(current_tick, now + 1);
+}
+
+static void wakeThread() {
+#ifdef _WIN32
+    SetEvent(wake_event);
+#else
+    wake_cv.notify_one();
+#endif
+}
+
+// Sleeps until wake_tick, or until wakeThread() is called
+static void sleepThread(std::unique_lock<std::mutex>& lk) {
+#ifdef _WIN32
+    // Waitable timers with CREATE_WAITABLE_TIMER_HIGH_RESOLUTION aren't limited by the system timer resolution like condition variables
+    if (wake_tick != NO_TICK) {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tickTime(wake_tick) - Clock::now()).count();
+        if (ns <= 0) return;
+        LARGE_INTEGER due;
+        due.QuadPart = -std::max<LONGLONG>(1, ns / 100);   // Negative = relative, in 100ns units
+        SetWaitableTimer(wait_timer, &due, 0, nullptr, nullptr, FALSE);
+    }
+    else CancelWaitableTimer(wait_timer);
+
+    lk.unlock();
+    const HANDLE handles[] = { wake_event, wait_timer };
+    WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+    lk.lock();
+#else
+    if (wake_tick != NO_TICK)
+        wake_cv.wait_until(lk, tickTime(wake_tick));
+    else
+        wake_cv.wait(lk);
+#endif
+}
+
+static void timerThread() {
+    Profiler::setThreadName("[Emu] Timers");
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+#endif
+
+    auto lk = std::unique_lock<std::mutex>(timers_mtx);
+    while (true) {
+        advance(nowTick());
+
+        while (expired.head) {
+            Timer* timer = expired.head;
+            remove(timer);
+            if (timer->period.count()) {
+                // Periods that were missed entirely are skipped
+                const auto now = Clock::now();
+                timer->deadline += timer->period;
+                if (timer->deadline <= now)
+                    timer->deadline += ((now - timer->deadline) / timer->period + 1) * timer->period;
+                timer->expiry_tick = deadlineTick(timer->deadline);
+                insert(timer);
+            }
+
+            running = timer;
+            lk.unlock();
+            timer->callback();
+            lk.lock();
+            running = nullptr;
+            running_cv.notify_all();
+        }
+
+        wake_tick = nextEventTick();
+        if (wake_tick <= nowTick()) continue;
+        sleepThread(lk);
+        wake_tick = 0;
+    }
+}
+
+void arm(Timer& timer, Clock::time_point deadline, Clock::duration period) {
+    auto lk = std::unique_lock<std::mutex>(timers_mtx);
+    if (!thread_started) {
+#ifdef _WIN32
+        wait_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (!wait_timer) // Not supported before Windows 10 1803
+            wait_timer = CreateWaitableTimerW(nullptr, FALSE, nullptr);
+        wake_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+#endif
+        std::thread(timerThread).detach();
+        thread_started = true;
+    }
+
+    if (timer.list != -1) remove(&timer);
+    timer.deadline = deadline;
+    timer.period = period;
+    timer.expiry_tick = deadlineTick(deadline);
+    insert(&timer);
+
+    if (timer.expiry_tick < wake_tick)
+        wakeThread();
+}
+
+bool cancel(Timer& timer) {
+    auto lk = std::unique_lock<std::mutex>(timers_mtx);
+    const bool was_armed = timer.list != -1;
+    if (was_armed) remove(&timer);
+
+    while (running == &timer)
+        running_cv.wait(lk);
+    return was_armed;
+}
+
+void sleepUntil(Clock::time_point deadline) {
+    if (deadline <= Clock::now()) return;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done = false;
+
+    Timer timer;
+    timer.callback = [&]() {
+        {
+            auto lk = std::unique_lock<std::mutex>(mtx);
+            done = true;
+        }
+        cv.notify_one();
+    };
+    arm(timer, deadline);
+    {
+        auto lk = std::unique_lock<std::mutex>(mtx);
+        cv.wait(lk, [&]() { return done; });
+    }
+    cancel(timer);  // Wait for the callback to be done with cv
+}
+
+}   // End namespace PS4::OS::Timers
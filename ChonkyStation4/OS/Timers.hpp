@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Common.hpp>
+#include <functional>
+#include <chrono>
+
+
+namespace PS4::OS::Timers {
+
+// Timer service for guest timers and timed waits.
+// Every timer is kept in a hierarchical timer wheel serviced by a single thread, so arming and cancelling a timer is O(1)
+// no matter how many timers are pending. The thread sleeps until the next expiry using the most precise wait the host has.
+
+using Clock = std::chrono::steady_clock;
+
+struct Timer {
+    // Called on the timer thread when the timer expires. Callbacks should be short, they delay every other timer.
+    std::function<void()> callback;
+
+    // Internal state, only touched by the timer service
+    Clock::time_point deadline;
+    Clock::duration period = {};
+    u64 expiry_tick = 0;
+    u32 slot = 0;
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    s8 list = -1;   // Wheel level, EXPIRED_LIST, or -1 if not armed
+};
+
+// Arms a timer, or re-arms it if it was already armed. If period isn't zero the timer fires every period after the first deadline.
+void arm(Timer& timer, Clock::time_point deadline, Clock::duration period = {});
+// Disarms a timer. If its callback is running, waits until it returns, so the timer can be destroyed afterwards.
+// Must not be called while holding a lock the callback takes. Returns false if the timer wasn't armed.
+bool cancel(Timer& timer);
+
+// Sleeps on the timer service, which is more precise than std::this_thread::sleep_* on some hosts
+void sleepUntil(Clock::time_point deadline);
+inline void sleepFor(Clock::duration duration) { sleepUntil(Clock::now() + duration); }
+
+}   // End namespace PS4::OS::Timers
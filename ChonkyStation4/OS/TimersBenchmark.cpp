@@ -0,0 +1,73 @@
+#include "TimersBenchmark.hpp"
+#include <OS/Timers.hpp>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+namespace PS4::OS::Timers {
+
+void benchmarkTimers(int n_timers, int n_load_threads) {
+    if (n_timers <= 0) return;
+    printf("Firing %d timers over 1 second with %d load threads\n", n_timers, n_load_threads);
+
+    std::atomic<bool> done = false;
+    std::vector<std::thread> load_threads;
+    for (int i = 0; i < n_load_threads; i++) {
+        load_threads.emplace_back([&done]() {
+            volatile u64 counter = 0;
+            while (!done.load(std::memory_order_relaxed))
+                counter = counter + 1;
+        });
+    }
+
+    // Deadlines are at least 10ms away so that arming every timer doesn't eat into the first deadlines
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<s64> offset_us(10'000, 1'000'000);
+    auto timers = std::make_unique<Timer[]>(n_timers);
+    std::vector<s64> late_ns(n_timers);
+    std::atomic<int> n_fired = 0;
+
+    const auto start = Clock::now();
+    for (int i = 0; i < n_timers; i++) {
+        timers[i].callback = [&, i]() {
+            late_ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - timers[i].deadline).count();
+            n_fired++;
+        };
+        arm(timers[i], start + std::chrono::microseconds(offset_us(rng)));
+    }
+    const auto arm_time = Clock::now() - start;
+
+    sleepUntil(start + std::chrono::milliseconds(1100));
+    while (n_fired < n_timers)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    done = true;
+    for (auto& thread : load_threads)
+        thread.join();
+
+    // Cancelling armed timers
+    const auto far = Clock::now() + std::chrono::seconds(60);
+    for (int i = 0; i < n_timers; i++)
+        arm(timers[i], far);
+    const auto cancel_start = Clock::now();
+    for (int i = 0; i < n_timers; i++)
+        cancel(timers[i]);
+    const auto cancel_time = Clock::now() - cancel_start;
+
+    std::sort(late_ns.begin(), late_ns.end());
+    const auto percentile = [&](double p) { return late_ns[std::min<size_t>(late_ns.size() - 1, late_ns.size() * p)] / 1000.0; };
+    s64 total_ns = 0;
+    for (auto ns : late_ns) total_ns += ns;
+
+    printf("arm:    %.1f ns per timer\n", (double)std::chrono::duration_cast<std::chrono::nanoseconds>(arm_time).count() / n_timers);
+    printf("cancel: %.1f ns per timer\n", (double)std::chrono::duration_cast<std::chrono::nanoseconds>(cancel_time).count() / n_timers);
+    printf("late:   avg %.1f us, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", total_ns / 1000.0 / n_timers, percentile(0.5), percentile(0.99), percentile(0.999), late_ns.back() / 1000.0);
+    if (late_ns.front() < 0)
+        printf("%lld timers fired early\n", (s64)std::count_if(late_ns.begin(), late_ns.end(), [](s64 ns) { return ns < 0; }));
+}
+
+}   // End namespace PS4::OS::Timers
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Common.hpp>
+
+
+namespace PS4::OS::Timers {
+
+// Arms n_timers timers with deadlines spread over the next second and prints how late they fired.
+// n_load_threads threads spin while the timers are pending, to measure the accuracy with every host core busy.
+void benchmarkTimers(int n_timers, int n_load_threads);
+
+}   // End namespace PS4::OS::Timers